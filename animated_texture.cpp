@@ -0,0 +1,127 @@
+#include "animated_texture.h"
+
+#include <iostream>
+
+using namespace std;
+
+AnimatedTexture::AnimatedTexture()
+  : m_stream(NULL), m_current(0), m_width(0), m_height(0), m_delayMs(0), m_queued(false), m_queuedDelayMs(0),
+    m_nextFrameTime(-1.0)
+{
+  for (int i = 0; i < kRingSize; ++i)
+    m_textures[i] = 0;
+}
+
+AnimatedTexture::~AnimatedTexture()
+{
+  close();
+}
+
+bool AnimatedTexture::open(char const* filename)
+{
+  close();
+
+  m_stream = stbi_gif_stream_open(filename, &m_width, &m_height);
+  if (!m_stream)
+    return false;
+
+  // allocate storage once; frames are streamed in with glTexSubImage2D
+  glGenTextures(kRingSize, m_textures);
+  for (int i = 0; i < kRingSize; ++i) {
+    glBindTexture(GL_TEXTURE_2D, m_textures[i]);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, m_width, m_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  }
+
+  m_current = kRingSize - 1;
+  m_queued = false;
+  if (!uploadNextFrame()) {
+    cerr << "Error: no frames in animated image " << filename << endl;
+    close();
+    return false;
+  }
+
+  // peek at the second frame, uploading it into the next slot for update()
+  // to move to. A GIF without one is a still image: the decoder is dropped
+  // and no frame time is ever set, so the render loop has nothing to wake for
+  int delayMs = 0;
+  stbi_uc* frame = stbi_gif_stream_next(m_stream, &delayMs);
+  if (frame) {
+    upload((m_current + 1) % kRingSize, frame);
+    m_queued = true;
+    m_queuedDelayMs = delayMs;
+  } else {
+    stbi_gif_stream_close(m_stream);
+    m_stream = NULL;
+  }
+
+  m_nextFrameTime = -1.0;
+  return true;
+}
+
+void AnimatedTexture::close()
+{
+  if (m_stream) {
+    stbi_gif_stream_close(m_stream);
+    m_stream = NULL;
+  }
+  if (m_textures[0]) {
+    glDeleteTextures(kRingSize, m_textures);
+    for (int i = 0; i < kRingSize; ++i)
+      m_textures[i] = 0;
+  }
+}
+
+GLuint AnimatedTexture::update(double time)
+{
+  if (!m_stream)
+    return m_textures[m_current];
+
+  if (m_nextFrameTime < 0.0) {
+    m_nextFrameTime = time + m_delayMs / 1000.0;
+  } else if (time >= m_nextFrameTime) {
+    if (uploadNextFrame())
+      m_nextFrameTime += m_delayMs / 1000.0;
+    // don't try to catch up after a long stall, just resume from now
+    if (m_nextFrameTime < time)
+      m_nextFrameTime = time + m_delayMs / 1000.0;
+  }
+
+  return m_textures[m_current];
+}
+
+bool AnimatedTexture::uploadNextFrame()
+{
+  int delayMs = 0;
+  if (m_queued) {
+    // open() already uploaded it
+    m_queued = false;
+    delayMs = m_queuedDelayMs;
+  } else {
+    stbi_uc* frame = stbi_gif_stream_next(m_stream, &delayMs);
+    if (!frame) {
+      // loop back to the first frame
+      if (!stbi_gif_stream_rewind(m_stream))
+        return false;
+      frame = stbi_gif_stream_next(m_stream, &delayMs);
+      if (!frame)
+        return false;
+    }
+    upload((m_current + 1) % kRingSize, frame);
+  }
+
+  // browsers treat very short delays as "unspecified" and use 100ms
+  m_delayMs = delayMs > 10 ? delayMs : 100;
+  m_current = (m_current + 1) % kRingSize;
+  return true;
+}
+
+void AnimatedTexture::upload(int slot, stbi_uc const* frame)
+{
+  glBindTexture(GL_TEXTURE_2D, m_textures[slot]);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_width, m_height, GL_RGBA, GL_UNSIGNED_BYTE, frame);
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include "stb-master/stb_image.h"
+
+// Plays an animated GIF by decoding one frame at a time and uploading it into
+// a small ring of textures, so memory stays constant regardless of frame count
+// and a frame upload never touches the texture the GPU may still be sampling.
+// A GIF with a single frame is uploaded once and never advances.
+class AnimatedTexture
+{
+public:
+  static const int kRingSize = 3;
+
+  AnimatedTexture();
+  ~AnimatedTexture();
+
+  bool open(char const* filename);
+  void close();
+  bool isOpen() const { return m_textures[0] != 0; }
+
+  // uploads the next frame once the current frame's delay has elapsed and
+  // returns the texture holding the frame to draw at 'time' (seconds)
+  GLuint update(double time);
+
+  // when update() next moves to a new frame; < 0 before the first call and
+  // for a single-frame GIF, which never does
+  double nextFrameTime() const { return m_nextFrameTime; }
+
+  int width() const { return m_width; }
+  int height() const { return m_height; }
+
+private:
+  bool uploadNextFrame();
+  void upload(int slot, stbi_uc const* frame);
+
+  stbi_gif_stream* m_stream;
+  GLuint m_textures[kRingSize];
+  int m_current;
+  int m_width, m_height;
+  int m_delayMs;
+  bool m_queued;  // the slot after m_current already holds the next frame
+  int m_queuedDelayMs;
+  double m_nextFrameTime;
+};
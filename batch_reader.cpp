@@ -0,0 +1,476 @@
+#include "batch_reader.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+
+using namespace std;
+
+namespace {
+
+typedef chrono::steady_clock Clock;
+
+// the largest single read, well inside what every platform accepts
+const size_t kMaxRead = size_t(1) << 30;
+
+#ifdef _WIN32
+typedef HANDLE FileHandle;
+const FileHandle kNoFile = INVALID_HANDLE_VALUE;
+#else
+typedef int FileHandle;
+const FileHandle kNoFile = -1;
+#endif
+
+FileHandle openFile(string const& path, size_t& size)
+{
+#ifdef _WIN32
+  HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+    FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+  LARGE_INTEGER length;
+  if (file != INVALID_HANDLE_VALUE && !GetFileSizeEx(file, &length)) {
+    CloseHandle(file);
+    return kNoFile;
+  }
+  if (file != INVALID_HANDLE_VALUE)
+    size = size_t(length.QuadPart);
+  return file;
+#else
+  int file = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  struct stat status;
+  if (file >= 0 && fstat(file, &status) != 0) {
+    close(file);
+    return kNoFile;
+  }
+  if (file >= 0)
+    size = size_t(status.st_size);
+  return file;
+#endif
+}
+
+void closeFile(FileHandle file)
+{
+#ifdef _WIN32
+  CloseHandle(file);
+#else
+  close(file);
+#endif
+}
+
+// one positional read; returns the bytes read, 0 at the end of the file or -1
+long long readAt(FileHandle file, unsigned char* buffer, size_t size, size_t offset)
+{
+  size = min(size, kMaxRead);
+#ifdef _WIN32
+  OVERLAPPED position = OVERLAPPED();
+  position.Offset = DWORD(offset);
+  position.OffsetHigh = DWORD(static_cast<unsigned long long>(offset) >> 32);
+  DWORD got = 0;
+  if (!ReadFile(file, buffer, DWORD(size), &got, &position))
+    return GetLastError() == ERROR_HANDLE_EOF ? 0 : -1;
+  return got;
+#else
+  ssize_t got;
+  do
+    got = pread(file, buffer, size, off_t(offset));
+  while (got < 0 && errno == EINTR);
+  return got;
+#endif
+}
+
+#ifdef __linux__
+
+// The bare io_uring interface: a submission and a completion ring shared with
+// the kernel. No liburing, the three system calls are all it takes.
+class Ring
+{
+public:
+  Ring() : m_fd(-1), m_sqRing(MAP_FAILED), m_cqRing(MAP_FAILED), m_sqes(NULL), m_pending(0) {}
+
+  ~Ring()
+  {
+    if (m_sqes)
+      munmap(m_sqes, m_sqesSize);
+    if (m_cqRing != MAP_FAILED && m_cqRing != m_sqRing)
+      munmap(m_cqRing, m_cqRingSize);
+    if (m_sqRing != MAP_FAILED)
+      munmap(m_sqRing, m_sqRingSize);
+    if (m_fd >= 0)
+      close(m_fd);
+  }
+
+  // false if the kernel has no io_uring (or one too old for IORING_OP_READ)
+  bool init(unsigned entries)
+  {
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    m_fd = int(syscall(__NR_io_uring_setup, entries, &params));
+    // IORING_OP_READ came with 5.6, fast poll with 5.7
+    if (m_fd < 0 || !(params.features & IORING_FEAT_FAST_POLL))
+      return false;
+
+    m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    m_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single)
+      m_sqRingSize = m_cqRingSize = max(m_sqRingSize, m_cqRingSize);
+
+    m_sqRing = mmap(NULL, m_sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+    if (m_sqRing == MAP_FAILED)
+      return false;
+    m_cqRing = single ? m_sqRing
+      : mmap(NULL, m_cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+    if (m_cqRing == MAP_FAILED)
+      return false;
+    m_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    void* sqes = mmap(NULL, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED)
+      return false;
+    m_sqes = static_cast<io_uring_sqe*>(sqes);
+
+    char* sq = static_cast<char*>(m_sqRing);
+    m_sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    m_sqMask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    m_sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    m_tail = *m_sqTail;
+
+    char* cq = static_cast<char*>(m_cqRing);
+    m_cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    m_cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    m_cqMask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    m_cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+    return true;
+  }
+
+  int fd() const { return m_fd; }
+
+  // the next submission entry, cleared; the caller never queues more than
+  // the ring holds
+  io_uring_sqe* next()
+  {
+    unsigned slot = m_tail++ & m_sqMask;
+    m_sqArray[slot] = slot;
+    ++m_pending;
+    memset(&m_sqes[slot], 0, sizeof(io_uring_sqe));
+    return &m_sqes[slot];
+  }
+
+  // hands the queued entries to the kernel and waits for 'completions';
+  // returns false with errno set on failure
+  bool submit(unsigned completions)
+  {
+    // the kernel must see the entries before the tail that publishes them
+    __atomic_store_n(m_sqTail, m_tail, __ATOMIC_RELEASE);
+    for (;;) {
+      long submitted = syscall(__NR_io_uring_enter, m_fd, m_pending, completions,
+        completions ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+      if (submitted >= 0) {
+        m_pending -= unsigned(submitted);
+        return true;
+      }
+      if (errno != EINTR)
+        return false;
+    }
+  }
+
+  bool completion(io_uring_cqe& cqe)
+  {
+    unsigned head = *m_cqHead;
+    if (head == __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE))
+      return false;
+    cqe = m_cqes[head & m_cqMask];
+    __atomic_store_n(m_cqHead, head + 1, __ATOMIC_RELEASE);
+    return true;
+  }
+
+private:
+  int m_fd;
+  void* m_sqRing;
+  void* m_cqRing;
+  size_t m_sqRingSize, m_cqRingSize, m_sqesSize;
+  io_uring_sqe* m_sqes;
+  unsigned* m_sqTail;
+  unsigned* m_sqArray;
+  unsigned m_sqMask, m_tail, m_pending;
+  unsigned* m_cqHead;
+  unsigned* m_cqTail;
+  unsigned m_cqMask;
+  io_uring_cqe* m_cqes;
+};
+
+#endif
+
+} // namespace
+
+BatchReader::BatchReader(Options const& options)
+  : m_options(options), m_stats()
+{
+  m_options.depth = max(1, m_options.depth);
+  m_options.bufferSize = max<size_t>(1, m_options.bufferSize);
+}
+
+bool BatchReader::read(vector<string> const& paths, Consumer const& consume)
+{
+  TRACE_ZONE("BatchReader::read");
+  m_stats = Stats();
+  Clock::time_point start = Clock::now();
+
+  if (!m_buffers)
+    m_buffers.reset(new unsigned char[m_options.depth * m_options.bufferSize]);
+
+  bool done = false;
+#ifdef __linux__
+  if (m_options.useUring)
+    done = readUring(paths, consume);
+#endif
+  if (!done)
+    readThreads(paths, consume);
+
+  m_stats.seconds = chrono::duration<double>(Clock::now() - start).count();
+  return m_stats.failed == 0;
+}
+
+void BatchReader::delivered(vector<string> const& paths, size_t index, unsigned char const* data, size_t size,
+  bool ok, Consumer const& consume)
+{
+  if (!ok) {
+    cerr << "Error: can't read " << paths[index] << endl;
+    ++m_stats.failed;
+    return;
+  }
+  ++m_stats.files;
+  m_stats.bytes += size;
+  consume(index, data, size);
+}
+
+#ifdef __linux__
+
+// false only if io_uring isn't available, before anything was read
+bool BatchReader::readUring(vector<string> const& paths, Consumer const& consume)
+{
+  int depth = m_options.depth;
+  size_t bufferSize = m_options.bufferSize;
+  Ring ring;
+  if (!ring.init(unsigned(depth)))
+    return false;
+  m_stats.uring = true;
+
+  // registered buffers stay mapped in the kernel, so READ_FIXED skips
+  // pinning the pages on every request; without them (e.g. a low
+  // RLIMIT_MEMLOCK) plain reads into the same buffers still work
+  vector<iovec> buffers(depth);
+  for (int s = 0; s < depth; ++s) {
+    buffers[s].iov_base = m_buffers.get() + s * bufferSize;
+    buffers[s].iov_len = bufferSize;
+  }
+  m_stats.registeredBuffers = syscall(__NR_io_uring_register, ring.fd(), IORING_REGISTER_BUFFERS, buffers.data(),
+    unsigned(depth)) == 0;
+
+  struct Slot {
+    int fd;
+    size_t index, size, done;
+    unsigned char* data;
+    vector<unsigned char> large;  // files bigger than the buffer
+  };
+  vector<Slot> slots(depth);
+  vector<int> idle;
+  for (int s = depth - 1; s >= 0; --s)
+    idle.push_back(s);
+  int active = 0;
+
+  auto queue = [&](int s) {
+    Slot& slot = slots[s];
+    bool fixed = m_stats.registeredBuffers && slot.data == buffers[s].iov_base;
+    io_uring_sqe* sqe = ring.next();
+    sqe->opcode = fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+    sqe->fd = slot.fd;
+    sqe->addr = reinterpret_cast<unsigned long long>(slot.data + slot.done);
+    sqe->len = unsigned(min(slot.size - slot.done, kMaxRead));
+    sqe->off = slot.done;
+    sqe->buf_index = fixed ? (unsigned short)s : 0;
+    sqe->user_data = unsigned(s);
+    ++m_stats.reads;
+  };
+  auto finish = [&](int s, bool ok) {
+    Slot& slot = slots[s];
+    close(slot.fd);
+    delivered(paths, slot.index, slot.data, slot.done, ok, consume);
+    idle.push_back(s);
+    --active;
+  };
+
+  size_t next = 0;
+  while (next < paths.size() || active > 0) {
+    // opening stays synchronous; it's the reads the drive needs queued
+    while (next < paths.size() && !idle.empty()) {
+      size_t index = next++;
+      size_t size = 0;
+      int fd = openFile(paths[index], size);
+      if (fd == kNoFile) {
+        delivered(paths, index, NULL, 0, false, consume);
+        continue;
+      }
+      int s = idle.back();
+      idle.pop_back();
+      ++active;
+      Slot& slot = slots[s];
+      slot.fd = fd;
+      slot.index = index;
+      slot.size = size;
+      slot.done = 0;
+      if (size <= bufferSize) {
+        slot.data = m_buffers.get() + s * bufferSize;
+      } else {
+        slot.large.resize(size);
+        slot.data = slot.large.data();
+      }
+      if (size == 0)
+        finish(s, true);
+      else
+        queue(s);
+    }
+    if (active == 0)
+      break;
+
+    if (!ring.submit(1)) {
+      cerr << "Error: io_uring_enter failed: " << strerror(errno) << endl;
+      for (int s = 0; s < depth; ++s)
+        if (find(idle.begin(), idle.end(), s) == idle.end())
+          finish(s, false);
+      while (next < paths.size())
+        delivered(paths, next++, NULL, 0, false, consume);
+      break;
+    }
+
+    io_uring_cqe cqe;
+    while (ring.completion(cqe)) {
+      int s = int(cqe.user_data);
+      Slot& slot = slots[s];
+      if (cqe.res == -EINTR || cqe.res == -EAGAIN) {
+        queue(s);
+      } else if (cqe.res < 0) {
+        finish(s, false);
+      } else {
+        // short reads carry on from where they stopped; a file that shrank
+        // since it was opened ends early
+        slot.done += size_t(cqe.res);
+        if (cqe.res > 0 && slot.done < slot.size)
+          queue(s);
+        else
+          finish(s, true);
+      }
+    }
+  }
+  return true;
+}
+
+#endif
+
+void BatchReader::readThreads(vector<string> const& paths, Consumer const& consume)
+{
+  int depth = m_options.depth;
+  size_t bufferSize = m_options.bufferSize;
+
+  struct Done {
+    size_t index;
+    int slot;
+    unsigned char const* data;
+    size_t size;
+    bool ok;
+  };
+  mutex lock;
+  condition_variable changed;
+  vector<int> idle;
+  for (int s = depth - 1; s >= 0; --s)
+    idle.push_back(s);
+  deque<Done> done;
+  vector<vector<unsigned char>> large(depth);
+  atomic<size_t> next(0);
+  atomic<unsigned long long> reads(0);
+
+  // the reads block, so every file in flight needs a thread of its own
+  auto reader = [&] {
+    TRACE_THREAD_NAME("file reader");
+    for (size_t index = next++; index < paths.size(); index = next++) {
+      Done result = { index, -1, NULL, 0, false };
+      {
+        unique_lock<mutex> guard(lock);
+        changed.wait(guard, [&] { return !idle.empty(); });
+        result.slot = idle.back();
+        idle.pop_back();
+      }
+
+      size_t size = 0;
+      FileHandle file = openFile(paths[index], size);
+      if (file != kNoFile) {
+        unsigned char* data = m_buffers.get() + result.slot * bufferSize;
+        if (size > bufferSize) {
+          large[result.slot].resize(size);
+          data = large[result.slot].data();
+        }
+        result.data = data;
+        long long got = 1;
+        while (result.size < size && (got = readAt(file, data + result.size, size - result.size, result.size)) > 0) {
+          result.size += size_t(got);
+          ++reads;
+        }
+        closeFile(file);
+        result.ok = got >= 0;
+      }
+
+      {
+        lock_guard<mutex> guard(lock);
+        done.push_back(result);
+      }
+      changed.notify_all();
+    }
+  };
+
+  vector<thread> readers;
+  for (int t = 0; t < min(depth, int(paths.size())); ++t)
+    readers.push_back(thread(reader));
+
+  for (size_t handled = 0; handled < paths.size(); ++handled) {
+    Done result;
+    {
+      unique_lock<mutex> guard(lock);
+      changed.wait(guard, [&] { return !done.empty(); });
+      result = done.front();
+      done.pop_front();
+    }
+    delivered(paths, result.index, result.data, result.size, result.ok, consume);
+    {
+      lock_guard<mutex> guard(lock);
+      idle.push_back(result.slot);
+    }
+    changed.notify_all();
+  }
+
+  for (size_t t = 0; t < readers.size(); ++t)
+    readers[t].join();
+  m_stats.reads = reads;
+}
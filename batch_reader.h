@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Reads a batch of whole files with many reads in flight at once, so an NVMe
+// drive sees a queue instead of one stdio read after another. On Linux the
+// reads go through io_uring into buffers registered with the kernel; where
+// io_uring is missing (or on other systems) a pool of threads issues
+// positional reads instead. Either way at most 'depth' files are being read
+// or waiting to be consumed at any time.
+//
+// Files are handed to the consumer on the calling thread as they complete,
+// in no particular order, while the other reads carry on. The data is only
+// valid until the consumer returns.
+class BatchReader
+{
+public:
+  struct Options {
+    int depth;              // files in flight
+    std::size_t bufferSize; // per file; bigger files get a buffer of their own
+    bool useUring;          // false forces the thread pool
+
+    Options() : depth(16), bufferSize(2 << 20), useUring(true) {}
+  };
+
+  // of the last read()
+  struct Stats {
+    unsigned long long files, failed;
+    unsigned long long reads;  // I/O requests issued; a file may need more than one
+    unsigned long long bytes;
+    double seconds;
+    bool uring;
+    bool registeredBuffers;
+  };
+
+  typedef std::function<void(std::size_t index, unsigned char const* data, std::size_t size)> Consumer;
+
+  explicit BatchReader(Options const& options = Options());
+
+  // Reads every file and calls consume(index into 'paths', data, size) for
+  // each one read. Returns false if any couldn't be.
+  bool read(std::vector<std::string> const& paths, Consumer const& consume);
+
+  Stats const& stats() const { return m_stats; }
+
+private:
+  bool readUring(std::vector<std::string> const& paths, Consumer const& consume);
+  void readThreads(std::vector<std::string> const& paths, Consumer const& consume);
+  void delivered(std::vector<std::string> const& paths, std::size_t index, unsigned char const* data,
+    std::size_t size, bool ok, Consumer const& consume);
+
+  Options m_options;
+  Stats m_stats;
+  // 'depth' buffers of bufferSize, kept from one read() to the next
+  std::unique_ptr<unsigned char[]> m_buffers;
+};
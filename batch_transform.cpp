@@ -0,0 +1,179 @@
+#include "batch_transform.h"
+
+#include "cpu_features.h"
+
+#ifdef SIMD_X86
+#include <immintrin.h>
+#endif
+
+// Each kernel handles the largest prefix it can and returns its length; the
+// scalar loop finishes the rest. A column-major mat4 makes output component
+// r the sum over columns c of m[c][r] * in[c], so every lane multiplies by
+// the same broadcast matrix element and no shuffles are needed.
+
+static std::size_t transformVec4Scalar(glm::mat4 const& m, ConstVec4Streams in, Vec4Streams out, std::size_t begin, std::size_t count)
+{
+  for (std::size_t i = begin; i < count; ++i) {
+    glm::vec4 v = m * glm::vec4(in.x[i], in.y[i], in.z[i], in.w[i]);
+    out.x[i] = v.x;
+    out.y[i] = v.y;
+    out.z[i] = v.z;
+    out.w[i] = v.w;
+  }
+  return count;
+}
+
+static std::size_t transformPointScalar(glm::mat4 const& m, ConstVec3Streams in, Vec4Streams out, std::size_t begin, std::size_t count)
+{
+  for (std::size_t i = begin; i < count; ++i) {
+    glm::vec4 v = m[0] * in.x[i] + m[1] * in.y[i] + m[2] * in.z[i] + m[3];
+    out.x[i] = v.x;
+    out.y[i] = v.y;
+    out.z[i] = v.z;
+    out.w[i] = v.w;
+  }
+  return count;
+}
+
+#ifdef SIMD_X86
+SIMD_TARGET_SSE2 static std::size_t transformVec4SSE2(glm::mat4 const& m, ConstVec4Streams in, Vec4Streams out, std::size_t count)
+{
+  std::size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    __m128 x = _mm_loadu_ps(in.x + i), y = _mm_loadu_ps(in.y + i), z = _mm_loadu_ps(in.z + i), w = _mm_loadu_ps(in.w + i);
+    float* dst[4] = { out.x + i, out.y + i, out.z + i, out.w + i };
+    for (int r = 0; r < 4; ++r) {
+      __m128 a = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(m[0][r]), x), _mm_mul_ps(_mm_set1_ps(m[1][r]), y));
+      __m128 b = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(m[2][r]), z), _mm_mul_ps(_mm_set1_ps(m[3][r]), w));
+      _mm_storeu_ps(dst[r], _mm_add_ps(a, b));
+    }
+  }
+  return i;
+}
+
+SIMD_TARGET_SSE2 static std::size_t transformPointSSE2(glm::mat4 const& m, ConstVec3Streams in, Vec4Streams out, std::size_t count)
+{
+  std::size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    __m128 x = _mm_loadu_ps(in.x + i), y = _mm_loadu_ps(in.y + i), z = _mm_loadu_ps(in.z + i);
+    float* dst[4] = { out.x + i, out.y + i, out.z + i, out.w + i };
+    for (int r = 0; r < 4; ++r) {
+      __m128 a = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(m[0][r]), x), _mm_set1_ps(m[3][r]));
+      __m128 b = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(m[1][r]), y), _mm_mul_ps(_mm_set1_ps(m[2][r]), z));
+      _mm_storeu_ps(dst[r], _mm_add_ps(a, b));
+    }
+  }
+  return i;
+}
+
+SIMD_TARGET_AVX2 static std::size_t transformVec4AVX2(glm::mat4 const& m, ConstVec4Streams in, Vec4Streams out, std::size_t count)
+{
+  __m256 c[4][4];
+  for (int col = 0; col < 4; ++col)
+    for (int r = 0; r < 4; ++r)
+      c[col][r] = _mm256_set1_ps(m[col][r]);
+
+  std::size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m256 x = _mm256_loadu_ps(in.x + i), y = _mm256_loadu_ps(in.y + i);
+    __m256 z = _mm256_loadu_ps(in.z + i), w = _mm256_loadu_ps(in.w + i);
+    float* dst[4] = { out.x + i, out.y + i, out.z + i, out.w + i };
+    for (int r = 0; r < 4; ++r) {
+      __m256 a = _mm256_fmadd_ps(c[1][r], y, _mm256_mul_ps(c[0][r], x));
+      __m256 b = _mm256_fmadd_ps(c[3][r], w, _mm256_mul_ps(c[2][r], z));
+      _mm256_storeu_ps(dst[r], _mm256_add_ps(a, b));
+    }
+  }
+  return i;
+}
+
+SIMD_TARGET_AVX2 static std::size_t transformPointAVX2(glm::mat4 const& m, ConstVec3Streams in, Vec4Streams out, std::size_t count)
+{
+  __m256 c[4][4];
+  for (int col = 0; col < 4; ++col)
+    for (int r = 0; r < 4; ++r)
+      c[col][r] = _mm256_set1_ps(m[col][r]);
+
+  std::size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m256 x = _mm256_loadu_ps(in.x + i), y = _mm256_loadu_ps(in.y + i), z = _mm256_loadu_ps(in.z + i);
+    float* dst[4] = { out.x + i, out.y + i, out.z + i, out.w + i };
+    for (int r = 0; r < 4; ++r) {
+      __m256 a = _mm256_fmadd_ps(c[0][r], x, c[3][r]);
+      __m256 b = _mm256_fmadd_ps(c[2][r], z, _mm256_mul_ps(c[1][r], y));
+      _mm256_storeu_ps(dst[r], _mm256_add_ps(a, b));
+    }
+  }
+  return i;
+}
+
+// the tail goes through masked loads and stores, so this covers every element
+SIMD_TARGET_AVX512 static std::size_t transformVec4AVX512(glm::mat4 const& m, ConstVec4Streams in, Vec4Streams out, std::size_t count)
+{
+  __m512 c[4][4];
+  for (int col = 0; col < 4; ++col)
+    for (int r = 0; r < 4; ++r)
+      c[col][r] = _mm512_set1_ps(m[col][r]);
+
+  for (std::size_t i = 0; i < count; i += 16) {
+    __mmask16 k = count - i >= 16 ? __mmask16(0xffff) : __mmask16((1u << (count - i)) - 1);
+    __m512 x = _mm512_maskz_loadu_ps(k, in.x + i), y = _mm512_maskz_loadu_ps(k, in.y + i);
+    __m512 z = _mm512_maskz_loadu_ps(k, in.z + i), w = _mm512_maskz_loadu_ps(k, in.w + i);
+    float* dst[4] = { out.x + i, out.y + i, out.z + i, out.w + i };
+    for (int r = 0; r < 4; ++r) {
+      __m512 a = _mm512_fmadd_ps(c[1][r], y, _mm512_mul_ps(c[0][r], x));
+      __m512 b = _mm512_fmadd_ps(c[3][r], w, _mm512_mul_ps(c[2][r], z));
+      _mm512_mask_storeu_ps(dst[r], k, _mm512_add_ps(a, b));
+    }
+  }
+  return count;
+}
+
+SIMD_TARGET_AVX512 static std::size_t transformPointAVX512(glm::mat4 const& m, ConstVec3Streams in, Vec4Streams out, std::size_t count)
+{
+  __m512 c[4][4];
+  for (int col = 0; col < 4; ++col)
+    for (int r = 0; r < 4; ++r)
+      c[col][r] = _mm512_set1_ps(m[col][r]);
+
+  for (std::size_t i = 0; i < count; i += 16) {
+    __mmask16 k = count - i >= 16 ? __mmask16(0xffff) : __mmask16((1u << (count - i)) - 1);
+    __m512 x = _mm512_maskz_loadu_ps(k, in.x + i), y = _mm512_maskz_loadu_ps(k, in.y + i), z = _mm512_maskz_loadu_ps(k, in.z + i);
+    float* dst[4] = { out.x + i, out.y + i, out.z + i, out.w + i };
+    for (int r = 0; r < 4; ++r) {
+      __m512 a = _mm512_fmadd_ps(c[0][r], x, c[3][r]);
+      __m512 b = _mm512_fmadd_ps(c[2][r], z, _mm512_mul_ps(c[1][r], y));
+      _mm512_mask_storeu_ps(dst[r], k, _mm512_add_ps(a, b));
+    }
+  }
+  return count;
+}
+#endif
+
+void transformVec4Batch(glm::mat4 const& m, ConstVec4Streams in, Vec4Streams out, std::size_t count)
+{
+  std::size_t done = 0;
+#ifdef SIMD_X86
+  switch (activeSimdLevel()) {
+  case SIMD_AVX512: done = transformVec4AVX512(m, in, out, count); break;
+  case SIMD_AVX2: done = transformVec4AVX2(m, in, out, count); break;
+  case SIMD_SSE2: done = transformVec4SSE2(m, in, out, count); break;
+  default: break;
+  }
+#endif
+  transformVec4Scalar(m, in, out, done, count);
+}
+
+void transformPointBatch(glm::mat4 const& m, ConstVec3Streams in, Vec4Streams out, std::size_t count)
+{
+  std::size_t done = 0;
+#ifdef SIMD_X86
+  switch (activeSimdLevel()) {
+  case SIMD_AVX512: done = transformPointAVX512(m, in, out, count); break;
+  case SIMD_AVX2: done = transformPointAVX2(m, in, out, count); break;
+  case SIMD_SSE2: done = transformPointSSE2(m, in, out, count); break;
+  default: break;
+  }
+#endif
+  transformPointScalar(m, in, out, done, count);
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+
+#include <glm/glm.hpp>
+
+// Component streams of an array of vectors stored structure-of-arrays, so
+// element i is (x[i], y[i], z[i]) or (x[i], y[i], z[i], w[i]). Any alignment
+// works; 64-byte aligned streams are fastest.
+struct Vec3Streams {
+  float* x;
+  float* y;
+  float* z;
+};
+
+struct Vec4Streams {
+  float* x;
+  float* y;
+  float* z;
+  float* w;
+};
+
+struct ConstVec3Streams {
+  float const* x;
+  float const* y;
+  float const* z;
+};
+
+struct ConstVec4Streams {
+  float const* x;
+  float const* y;
+  float const* z;
+  float const* w;
+};
+
+// out[i] = m * in[i] for 'count' elements, 8 or 16 at a time with AVX2 or
+// AVX-512 where the CPU has them (see cpu_features.h). 'out' may alias 'in'.
+void transformVec4Batch(glm::mat4 const& m, ConstVec4Streams in, Vec4Streams out, std::size_t count);
+
+// out[i] = m * vec4(in[i], 1), e.g. grid positions straight to clip space
+void transformPointBatch(glm::mat4 const& m, ConstVec3Streams in, Vec4Streams out, std::size_t count);
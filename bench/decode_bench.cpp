@@ -0,0 +1,508 @@
+// Throughput benchmark for the stb_image paths the viewer depends on: whole
+// image decodes over the generated corpus (see make_corpus.py), the hot
+// decoder kernels in isolation, and texture upload.
+//
+//   decode_bench [--corpus DIR] [--out FILE] [--baseline FILE] [--threshold PCT]
+//                [--min-time SECONDS] [--filter TEXT] [--no-upload]
+//
+// Results are written as JSON, one case per line: "mb_per_s" is decoded
+// output bytes per second (input bits for the zlib kernel) and "items_per_s"
+// counts images, blocks, rows or symbols depending on the case. With
+// --baseline, any case slower than the baseline by more than --threshold
+// percent (default 10) is reported and the exit code is 1, so a build step
+// can fail on regressions.
+//
+// Build with DECODE_BENCH_NO_UPLOAD to drop the GL dependency on machines
+// without a display.
+
+// this TU carries its own copy of the implementation so the kernels, which
+// are static, can be called directly
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb-master/stb_image.h"
+
+#ifndef DECODE_BENCH_NO_UPLOAD
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+struct BenchResult {
+  string name;
+  double mbPerSec;
+  double itemsPerSec;
+};
+
+static double g_minTime = 0.5;
+static string g_filter;
+static vector<BenchResult> g_results;
+static volatile unsigned g_sink;
+
+// Best of five batches, each running for at least a fifth of the minimum
+// time. Returns seconds per call.
+static double measure(function<void()> const& body)
+{
+  typedef chrono::steady_clock Clock;
+  double best = 1e30;
+  body(); // warm caches and lazily initialised tables
+
+  for (int batch = 0; batch < 5; ++batch) {
+    long iterations = 0;
+    Clock::time_point start = Clock::now();
+    double elapsed = 0.0;
+    do {
+      body();
+      ++iterations;
+      elapsed = chrono::duration<double>(Clock::now() - start).count();
+    } while (elapsed < g_minTime / 5);
+    best = min(best, elapsed / iterations);
+  }
+  return best;
+}
+
+static bool selected(string const& name)
+{
+  return g_filter.empty() || name.find(g_filter) != string::npos;
+}
+
+static void report(string const& name, double secondsPerCall, double bytesPerCall, double itemsPerCall)
+{
+  BenchResult result = { name, bytesPerCall / secondsPerCall / 1e6, itemsPerCall / secondsPerCall };
+  g_results.push_back(result);
+  printf("%-40s %10.1f MB/s %12.1f /s\n", name.c_str(), result.mbPerSec, result.itemsPerSec);
+  fflush(stdout);
+}
+
+static bool readFile(string const& path, vector<stbi_uc>& data)
+{
+  ifstream file(path.c_str(), ios::binary);
+  if (!file)
+    return false;
+  data.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+  return true;
+}
+
+// decodes one corpus file the way the viewer would; returns decoded bytes
+static size_t decodeImage(string const& name, vector<stbi_uc> const& data)
+{
+  int x = 0, y = 0, n = 0;
+  int len = int(data.size());
+
+  if (name.compare(0, 4, "gif/") == 0) {
+    int z = 0;
+    int* delays = NULL;
+    stbi_uc* frames = stbi_load_gif_from_memory(data.data(), len, &delays, &x, &y, &z, &n, 4);
+    stbi_image_free(frames);
+    stbi_image_free(delays);
+    return frames ? size_t(x) * y * z * 4 : 0;
+  }
+  if (name.compare(0, 4, "hdr/") == 0) {
+    float* pixels = stbi_loadf_from_memory(data.data(), len, &x, &y, &n, 0);
+    stbi_image_free(pixels);
+    return pixels ? size_t(x) * y * n * sizeof(float) : 0;
+  }
+  if (stbi_is_16_bit_from_memory(data.data(), len)) {
+    stbi_us* pixels = stbi_load_16_from_memory(data.data(), len, &x, &y, &n, 0);
+    stbi_image_free(pixels);
+    return pixels ? size_t(x) * y * n * 2 : 0;
+  }
+
+  stbi_uc* pixels = stbi_load_from_memory(data.data(), len, &x, &y, &n, 0);
+  stbi_image_free(pixels);
+  return pixels ? size_t(x) * y * n : 0;
+}
+
+static void benchCorpus(string const& corpus)
+{
+  ifstream manifest((corpus + "/manifest.txt").c_str());
+  if (!manifest) {
+    cerr << "Error: no manifest.txt in " << corpus << " (run make_corpus.py)" << endl;
+    exit(EXIT_FAILURE);
+  }
+
+  // per-format totals, e.g. "jpeg" over every jpeg case
+  map<string, double> formatSeconds, formatBytes, formatImages;
+
+  string name, file;
+  while (manifest >> name >> file) {
+    if (!selected(name))
+      continue;
+
+    vector<stbi_uc> data;
+    if (!readFile(corpus + "/" + file, data)) {
+      cerr << "Error: can't read " << file << endl;
+      exit(EXIT_FAILURE);
+    }
+
+    size_t bytes = decodeImage(name, data);
+    if (!bytes) {
+      cerr << "Error: can't decode " << file << ": " << stbi_failure_reason() << endl;
+      exit(EXIT_FAILURE);
+    }
+
+    double seconds = measure([&] { g_sink += unsigned(decodeImage(name, data)); });
+    report(name, seconds, double(bytes), 1.0);
+
+    string format = name.substr(0, name.find('/'));
+    formatSeconds[format] += seconds;
+    formatBytes[format] += double(bytes);
+    formatImages[format] += 1.0;
+  }
+
+  for (map<string, double>::iterator it = formatSeconds.begin(); it != formatSeconds.end(); ++it)
+    report("format/" + it->first, it->second, formatBytes[it->first], formatImages[it->first]);
+}
+
+static void benchKernels()
+{
+  unsigned seed = 12345;
+  auto random = [&seed]() { seed = seed * 1664525u + 1013904223u; return seed >> 8; };
+
+  // dequantized coefficient blocks with energy falling off towards high
+  // frequencies, like real JPEG data
+  const int kBlocks = 1024;
+  vector<short> coefficients(kBlocks * 64);
+  for (int b = 0; b < kBlocks; ++b)
+    for (int i = 0; i < 64; ++i) {
+      int zig = stbi__jpeg_dezigzag[i];
+      int range = zig < 6 ? 512 : zig < 20 ? 64 : zig < 40 ? 8 : 0;
+      coefficients[b * 64 + zig] = short(range ? int(random() % (2 * range)) - range : 0);
+    }
+  vector<stbi_uc> pixels(kBlocks * 64);
+
+  if (selected("kernel/idct_block")) {
+    double seconds = measure([&] {
+      for (int b = 0; b < kBlocks; ++b)
+        stbi__idct_block(&pixels[b * 64], 8, &coefficients[b * 64]);
+    });
+    report("kernel/idct_block", seconds, kBlocks * 64.0, kBlocks);
+  }
+#if defined(STBI_SSE2) || defined(STBI_NEON)
+  if (selected("kernel/idct_simd")) {
+    double seconds = measure([&] {
+      for (int b = 0; b < kBlocks; ++b)
+        stbi__idct_simd(&pixels[b * 64], 8, &coefficients[b * 64]);
+    });
+    report("kernel/idct_simd", seconds, kBlocks * 64.0, kBlocks);
+  }
+#endif
+
+  const int kRow = 4096;
+  vector<stbi_uc> y(kRow), cb(kRow), cr(kRow), rgba(kRow * 4);
+  for (int i = 0; i < kRow; ++i) {
+    y[i] = stbi_uc(random());
+    cb[i] = stbi_uc(random());
+    cr[i] = stbi_uc(random());
+  }
+  if (selected("kernel/YCbCr_to_RGB_row")) {
+    double seconds = measure([&] { stbi__YCbCr_to_RGB_row(rgba.data(), y.data(), cb.data(), cr.data(), kRow, 4); });
+    report("kernel/YCbCr_to_RGB_row", seconds, kRow * 4.0, 1.0);
+  }
+#if defined(STBI_SSE2) || defined(STBI_NEON)
+  if (selected("kernel/YCbCr_to_RGB_simd")) {
+    double seconds = measure([&] { stbi__YCbCr_to_RGB_simd(rgba.data(), y.data(), cb.data(), cr.data(), kRow, 4); });
+    report("kernel/YCbCr_to_RGB_simd", seconds, kRow * 4.0, 1.0);
+  }
+#endif
+
+  if (selected("kernel/zhuffman_decode_slowpath")) {
+    // a complete code: the 8-bit codes resolve in the fast table, the 10- and
+    // 11-bit ones take the slow path
+    stbi_uc sizes[288];
+    for (int i = 0; i < 288; ++i)
+      sizes[i] = i < 252 ? 8 : i < 260 ? 10 : i < 276 ? 11 : 0;
+    stbi__zhuffman huffman;
+    stbi__zbuild_huffman(&huffman, sizes, 288);
+
+    // only keep bit patterns that miss the fast table
+    vector<stbi__uint32> patterns;
+    double bits = 0.0;
+    while (patterns.size() < 4096) {
+      stbi__zbuf z;
+      z.code_buffer = random() | (random() << 24);
+      z.num_bits = 32;
+      if (huffman.fast[z.code_buffer & STBI__ZFAST_MASK] != 0)
+        continue;
+      patterns.push_back(z.code_buffer);
+      stbi__zhuffman_decode_slowpath(&z, &huffman);
+      bits += 32 - z.num_bits;
+    }
+
+    double seconds = measure([&] {
+      stbi__zbuf z;
+      for (size_t i = 0; i < patterns.size(); ++i) {
+        z.code_buffer = patterns[i];
+        z.num_bits = 32;
+        g_sink += unsigned(stbi__zhuffman_decode_slowpath(&z, &huffman));
+      }
+    });
+    report("kernel/zhuffman_decode_slowpath", seconds, bits / 8.0, double(patterns.size()));
+  }
+
+  for (int depth = 8; depth <= 16; depth += 8) {
+    char name[64];
+    snprintf(name, sizeof(name), "kernel/create_png_image_raw-rgb%d", depth);
+    if (!selected(name))
+      continue;
+
+    // filtered scanlines cycling through all five filter types
+    const int w = 1024, h = 768, bytesPerRow = w * 3 * depth / 8;
+    vector<stbi_uc> raw(size_t(bytesPerRow + 1) * h);
+    for (int row = 0; row < h; ++row) {
+      raw[size_t(row) * (bytesPerRow + 1)] = stbi_uc(row % 5);
+      for (int i = 1; i <= bytesPerRow; ++i)
+        raw[size_t(row) * (bytesPerRow + 1) + i] = stbi_uc(random());
+    }
+
+    stbi__context s;
+    memset(&s, 0, sizeof(s));
+    s.img_x = w;
+    s.img_y = h;
+    s.img_n = 3;
+    stbi__png png;
+    memset(&png, 0, sizeof(png));
+    png.s = &s;
+
+    double seconds = measure([&] {
+      stbi__create_png_image_raw(&png, raw.data(), stbi__uint32(raw.size()), 3, w, h, depth, 2);
+      STBI_FREE(png.out);
+      png.out = NULL;
+    });
+    report(name, seconds, double(bytesPerRow) * h, 1.0);
+  }
+
+  // every channel-count pair of stbi__convert_format over a 1024x768 image,
+  // and the in-place form used when channels are dropped
+  const int cw = 1024, ch = 768;
+  vector<stbi_uc> source(size_t(cw) * ch * 4), converted(size_t(cw) * ch * 4);
+  for (size_t i = 0; i < source.size(); ++i)
+    source[i] = stbi_uc(random());
+  for (int from = 1; from <= 4; ++from)
+    for (int to = 1; to <= 4; ++to) {
+      if (from == to)
+        continue;
+      stbi__convert_row_func convert = stbi__get_convert_row(from, to);
+      char name[64];
+      snprintf(name, sizeof(name), "kernel/convert_format-%d-%d", from, to);
+      if (selected(name)) {
+        double seconds = measure([&] {
+          for (int row = 0; row < ch; ++row)
+            convert(&converted[size_t(row) * cw * to], &source[size_t(row) * cw * from], cw);
+        });
+        report(name, seconds, double(cw) * ch * to, 1.0);
+      }
+
+      snprintf(name, sizeof(name), "kernel/convert_format-%d-%d-inplace", from, to);
+      if (to < from && selected(name)) {
+        // the buffer degrades after the first pass, which doesn't matter for timing
+        double seconds = measure([&] {
+          for (int row = 0; row < ch; ++row)
+            convert(&converted[size_t(row) * cw * to], &converted[size_t(row) * cw * from], cw);
+        });
+        report(name, seconds, double(cw) * ch * to, 1.0);
+      }
+    }
+
+  // the single post-process pass the loaders hand their output to; each call
+  // starts from a fresh copy because stbi__postprocess may free its input
+  struct PostprocessCase {
+    char const* name;
+    int from, bits, to, reqBits, flip;
+  };
+  const PostprocessCase postprocessCases[] = {
+    { "kernel/postprocess-flip-rgb8", 3, 8, 3, 8, 1 },
+    { "kernel/postprocess-flip-rgb8-to-rgba8", 3, 8, 4, 8, 1 },
+    { "kernel/postprocess-rgb16-to-rgb8", 3, 16, 3, 8, 0 },
+    { "kernel/postprocess-flip-rgb16-to-rgb8", 3, 16, 3, 8, 1 },
+    { "kernel/postprocess-flip-rgba16-to-rgb8", 4, 16, 3, 8, 1 },
+    { "kernel/postprocess-flip-rgb8-to-rgba16", 3, 8, 4, 16, 1 },
+  };
+  for (size_t c = 0; c < sizeof(postprocessCases) / sizeof(postprocessCases[0]); ++c) {
+    PostprocessCase const& pp = postprocessCases[c];
+    if (!selected(pp.name))
+      continue;
+    size_t inBytes = size_t(cw) * ch * pp.from * (pp.bits / 8);
+    vector<stbi_uc> image(inBytes);
+    for (size_t i = 0; i < inBytes; ++i)
+      image[i] = stbi_uc(random());
+    double seconds = measure([&] {
+      void* copy = STBI_MALLOC(inBytes);
+      memcpy(copy, image.data(), inBytes);
+      STBI_FREE(stbi__postprocess(copy, cw, ch, pp.from, pp.bits, pp.to, pp.reqBits, pp.flip));
+    });
+    report(pp.name, seconds, double(cw) * ch * pp.to * (pp.reqBits / 8), 1.0);
+  }
+}
+
+#ifndef DECODE_BENCH_NO_UPLOAD
+static void benchUpload()
+{
+  if (!glfwInit()) {
+    cerr << "Warning: GLFW init failed, skipping upload benchmarks" << endl;
+    return;
+  }
+
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+  glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+  glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+  glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+  GLFWwindow* window = glfwCreateWindow(64, 64, "decode_bench", NULL, NULL);
+  if (!window) {
+    cerr << "Warning: no GL context, skipping upload benchmarks" << endl;
+    glfwTerminate();
+    return;
+  }
+  glfwMakeContextCurrent(window);
+  glewExperimental = GL_TRUE;
+  glewInit();
+
+  struct UploadCase {
+    char const* name;
+    GLint internalFormat;
+    GLenum format, type;
+    int bytesPerPixel;
+  };
+  const UploadCase cases[] = {
+    { "upload/rgb8", GL_RGB8, GL_RGB, GL_UNSIGNED_BYTE, 3 },
+    { "upload/rgba8", GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, 4 },
+    { "upload/rgb16", GL_RGB16, GL_RGB, GL_UNSIGNED_SHORT, 6 },
+    { "upload/rgb16f", GL_RGB16F, GL_RGB, GL_HALF_FLOAT, 6 },
+  };
+
+  const int w = 2048, h = 1536;
+  vector<unsigned char> pixels(size_t(w) * h * 8, 0x5a);
+  GLuint texture;
+  glGenTextures(1, &texture);
+  glBindTexture(GL_TEXTURE_2D, texture);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+  for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); ++c) {
+    UploadCase const& upload = cases[c];
+    if (!selected(upload.name))
+      continue;
+    glTexImage2D(GL_TEXTURE_2D, 0, upload.internalFormat, w, h, 0, upload.format, upload.type, NULL);
+    double seconds = measure([&] {
+      glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, w, h, upload.format, upload.type, pixels.data());
+      glFinish();
+    });
+    report(upload.name, seconds, double(w) * h * upload.bytesPerPixel, 1.0);
+  }
+
+  glDeleteTextures(1, &texture);
+  glfwDestroyWindow(window);
+  glfwTerminate();
+}
+#endif
+
+static bool writeResults(char const* path)
+{
+  FILE* file = fopen(path, "w");
+  if (!file) {
+    cerr << "Error: can't write " << path << endl;
+    return false;
+  }
+  fputs("{\n  \"results\": {\n", file);
+  for (size_t i = 0; i < g_results.size(); ++i)
+    fprintf(file, "    \"%s\": {\"mb_per_s\": %.3f, \"items_per_s\": %.3f}%s\n", g_results[i].name.c_str(),
+      g_results[i].mbPerSec, g_results[i].itemsPerSec, i + 1 < g_results.size() ? "," : "");
+  fputs("  }\n}\n", file);
+  fclose(file);
+  return true;
+}
+
+// reads back the one-case-per-line layout written by writeResults
+static map<string, double> readBaseline(char const* path)
+{
+  map<string, double> baseline;
+  ifstream file(path);
+  string line;
+  while (getline(file, line)) {
+    size_t open = line.find('"'), close = line.find('"', open + 1), value = line.find("\"mb_per_s\":");
+    if (open == string::npos || close == string::npos || value == string::npos)
+      continue;
+    baseline[line.substr(open + 1, close - open - 1)] = atof(line.c_str() + value + 11);
+  }
+  return baseline;
+}
+
+int main(int argc, char** argv)
+{
+  string corpus = "corpus";
+  char const* outPath = "decode_bench.json";
+  char const* baselinePath = NULL;
+  double threshold = 10.0;
+  bool upload = true;
+
+  for (int i = 1; i < argc; ++i) {
+    string arg = argv[i];
+    if (arg == "--corpus" && i + 1 < argc)
+      corpus = argv[++i];
+    else if (arg == "--out" && i + 1 < argc)
+      outPath = argv[++i];
+    else if (arg == "--baseline" && i + 1 < argc)
+      baselinePath = argv[++i];
+    else if (arg == "--threshold" && i + 1 < argc)
+      threshold = atof(argv[++i]);
+    else if (arg == "--min-time" && i + 1 < argc)
+      g_minTime = atof(argv[++i]);
+    else if (arg == "--filter" && i + 1 < argc)
+      g_filter = argv[++i];
+    else if (arg == "--no-upload")
+      upload = false;
+    else {
+      cerr << "usage: decode_bench [--corpus DIR] [--out FILE] [--baseline FILE] [--threshold PCT]"
+              " [--min-time SECONDS] [--filter TEXT] [--no-upload]" << endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  benchCorpus(corpus);
+  benchKernels();
+#ifndef DECODE_BENCH_NO_UPLOAD
+  if (upload)
+    benchUpload();
+#else
+  (void)upload;
+#endif
+
+  if (!writeResults(outPath))
+    return EXIT_FAILURE;
+
+  if (!baselinePath)
+    return EXIT_SUCCESS;
+
+  map<string, double> baseline = readBaseline(baselinePath);
+  int regressions = 0;
+  for (size_t i = 0; i < g_results.size(); ++i) {
+    map<string, double>::const_iterator it = baseline.find(g_results[i].name);
+    if (it == baseline.end() || it->second <= 0.0)
+      continue;
+    double change = (g_results[i].mbPerSec / it->second - 1.0) * 100.0;
+    if (change < -threshold) {
+      printf("REGRESSION %-40s %10.1f MB/s vs %10.1f baseline (%+.1f%%)\n", g_results[i].name.c_str(),
+        g_results[i].mbPerSec, it->second, change);
+      ++regressions;
+    }
+  }
+
+  if (regressions) {
+    printf("%d case(s) regressed by more than %.1f%%\n", regressions, threshold);
+    return EXIT_FAILURE;
+  }
+  printf("no regressions beyond %.1f%% against %s\n", threshold, baselinePath);
+  return EXIT_SUCCESS;
+}
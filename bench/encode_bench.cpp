@@ -0,0 +1,298 @@
+// Frame encoders: PNG, JPEG and QOI from image_writer.h.
+//
+//   encode_bench [--image FILE] [--width W] [--height H] [--min-time SECONDS]
+//
+// Encodes --image (any format stb_image reads) or a generated RGBA frame of
+// W x H (default 1920 x 1080) with smooth gradients, edges and some noise,
+// roughly what a warped render looks like. Every PNG and QOI file is decoded
+// again and must match the input exactly (PNG with stb_image, QOI with the
+// small decoder below); every JPEG must decode to within 30 dB PSNR. A
+// failure makes the exit code 1.
+//
+// Then prints megapixels per second and file size for PNG at deflate levels
+// 1 and 6, compressed as one strip (serial, like a plain zlib stream) and in
+// strips on the shared job system, JPEG at quality 90 with 4:2:0 and 4:4:4,
+// for every SIMD level, QOI, and SPF spill frames with and without the row
+// predictor. SPF files must also load back exactly, whole and a band of rows
+// at a time.
+//
+// Last, decode speed in MB/s of pixels: stb_image reading the PNG and the SPF
+// file on one core, and the SPF file as bands decoded on the job system.
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb-master/stb_image.h"
+
+#include "../cpu_features.h"
+#include "../image_writer.h"
+#include "../job_system.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+static double g_minTime = 0.5;
+
+// best of five batches; returns seconds per call
+static double measure(function<void()> const& body)
+{
+  typedef chrono::steady_clock Clock;
+  double best = 1e30;
+  body();
+  for (int batch = 0; batch < 5; ++batch) {
+    long iterations = 0;
+    Clock::time_point start = Clock::now();
+    double elapsed = 0.0;
+    do {
+      body();
+      ++iterations;
+      elapsed = chrono::duration<double>(Clock::now() - start).count();
+    } while (elapsed < g_minTime / 5);
+    best = min(best, elapsed / iterations);
+  }
+  return best;
+}
+
+static vector<unsigned char> makeFrame(int width, int height)
+{
+  vector<unsigned char> pixels(size_t(width) * height * 4);
+  unsigned seed = 12345;
+  for (int y = 0; y < height; ++y)
+    for (int x = 0; x < width; ++x) {
+      unsigned char* p = &pixels[(size_t(y) * width + x) * 4];
+      seed = seed * 1664525u + 1013904223u;
+      int noise = int(seed >> 29) - 4;
+      double u = double(x) / width, v = double(y) / height;
+      bool stripe = (int(u * 24 + v * 9) & 1) != 0;
+      p[0] = (unsigned char)min(255, max(0, int(255 * u) + noise));
+      p[1] = (unsigned char)min(255, max(0, int(128 + 100 * sin(u * 13 + v * 7)) + noise));
+      p[2] = (unsigned char)(stripe ? 200 : 40);
+      p[3] = 255;
+    }
+  return pixels;
+}
+
+// the QOI reference decoder, enough to check the encoder; returns RGBA
+static bool decodeQoi(vector<unsigned char> const& data, int& width, int& height, vector<unsigned char>& pixels)
+{
+  if (data.size() < 22 || memcmp(data.data(), "qoif", 4))
+    return false;
+  width = data[4] << 24 | data[5] << 16 | data[6] << 8 | data[7];
+  height = data[8] << 24 | data[9] << 16 | data[10] << 8 | data[11];
+  size_t count = size_t(width) * height, p = 14, end = data.size() - 8;
+  pixels.assign(count * 4, 0);
+  unsigned char seen[64][4] = {}, px[4] = { 0, 0, 0, 255 };
+  for (size_t i = 0; i < count;) {
+    if (p >= end)
+      return false;
+    int op = data[p++];
+    int run = 0;
+    if (op == 0xFE) {
+      memcpy(px, &data[p], 3);
+      p += 3;
+    } else if (op == 0xFF) {
+      memcpy(px, &data[p], 4);
+      p += 4;
+    } else if (op >> 6 == 0) {
+      memcpy(px, seen[op], 4);
+    } else if (op >> 6 == 1) {
+      px[0] = (unsigned char)(px[0] + ((op >> 4) & 3) - 2);
+      px[1] = (unsigned char)(px[1] + ((op >> 2) & 3) - 2);
+      px[2] = (unsigned char)(px[2] + (op & 3) - 2);
+    } else if (op >> 6 == 2) {
+      int dg = (op & 63) - 32, next = data[p++];
+      px[0] = (unsigned char)(px[0] + dg + (next >> 4) - 8);
+      px[1] = (unsigned char)(px[1] + dg);
+      px[2] = (unsigned char)(px[2] + dg + (next & 15) - 8);
+    } else {
+      run = op & 63;
+    }
+    memcpy(seen[(px[0] * 3 + px[1] * 5 + px[2] * 7 + px[3] * 11) % 64], px, 4);
+    for (int r = 0; r <= run && i < count; ++r, ++i)
+      memcpy(&pixels[i * 4], px, 4);
+  }
+  static const unsigned char kEnd[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+  return p == end && !memcmp(&data[end], kEnd, 8);
+}
+
+static void report(char const* name, char const* variant, double seconds, size_t bytes, int width, int height)
+{
+  printf("  %-6s %-24s %8.1f MP/s  %9.2f MB\n", name, variant, width * double(height) / seconds / 1e6,
+    bytes / 1048576.0);
+}
+
+int main(int argc, char** argv)
+{
+  string imagePath;
+  int width = 1920, height = 1080;
+  for (int i = 1; i < argc; ++i) {
+    string arg = argv[i];
+    if (arg == "--image" && i + 1 < argc)
+      imagePath = argv[++i];
+    else if (arg == "--width" && i + 1 < argc)
+      width = max(1, atoi(argv[++i]));
+    else if (arg == "--height" && i + 1 < argc)
+      height = max(1, atoi(argv[++i]));
+    else if (arg == "--min-time" && i + 1 < argc)
+      g_minTime = atof(argv[++i]);
+    else {
+      fprintf(stderr, "usage: encode_bench [--image FILE] [--width W] [--height H] [--min-time SECONDS]\n");
+      return EXIT_FAILURE;
+    }
+  }
+
+  vector<unsigned char> pixels;
+  int channels = 4;
+  if (!imagePath.empty()) {
+    stbi_uc* image = stbi_load(imagePath.c_str(), &width, &height, &channels, 0);
+    if (!image) {
+      fprintf(stderr, "Error: can't load %s: %s\n", imagePath.c_str(), stbi_failure_reason());
+      return EXIT_FAILURE;
+    }
+    pixels.assign(image, image + size_t(width) * height * channels);
+    stbi_image_free(image);
+  } else {
+    pixels = makeFrame(width, height);
+  }
+  size_t size = pixels.size();
+  printf("%dx%d, %d channels, %d workers\n", width, height, channels, jobSystem().workerCount());
+
+  int failures = 0;
+  SimdLevel detected = detectSimdLevel();
+  for (int level = SIMD_SCALAR; level <= detected; ++level) {
+    setSimdLevelLimit(SimdLevel(level));
+    printf("%s\n", simdLevelName(SimdLevel(level)));
+
+    for (int deflateLevel = 1; deflateLevel <= 6; deflateLevel += 5) {
+      for (int strips = 0; strips < 2; ++strips) {
+        PngOptions options;
+        options.level = deflateLevel;
+        options.stripRows = strips ? 0 : height;
+        vector<unsigned char> png;
+        double seconds = measure([&]() {
+          png.clear();
+          writePng(png, pixels.data(), width, height, channels, options);
+        });
+        int x, y, n;
+        stbi_uc* decoded = stbi_load_from_memory(png.data(), int(png.size()), &x, &y, &n, 0);
+        if (!decoded || x != width || y != height || n != channels || memcmp(decoded, pixels.data(), size)) {
+          fprintf(stderr, "Error: PNG level %d doesn't decode to the input\n", deflateLevel);
+          ++failures;
+        }
+        stbi_image_free(decoded);
+        char variant[64];
+        snprintf(variant, sizeof(variant), "level %d, %s", deflateLevel, strips ? "strips" : "one strip");
+        report("png", variant, seconds, png.size(), width, height);
+      }
+    }
+
+    for (int subsample = 1; subsample >= 0; --subsample) {
+      vector<unsigned char> jpeg;
+      double seconds = measure([&]() {
+        jpeg.clear();
+        writeJpeg(jpeg, pixels.data(), width, height, channels, 90, subsample != 0);
+      });
+      int x, y, n;
+      stbi_uc* decoded = stbi_load_from_memory(jpeg.data(), int(jpeg.size()), &x, &y, &n, channels);
+      double error = 0.0;
+      int colors = channels >= 3 ? 3 : 1;
+      for (size_t i = 0; decoded && i < size_t(width) * height; ++i)
+        for (int c = 0; c < colors; ++c) {
+          double d = double(decoded[i * channels + c]) - pixels[i * channels + c];
+          error += d * d;
+        }
+      double psnr = 10.0 * log10(255.0 * 255.0 / max(1e-9, error / (double(width) * height * colors)));
+      if (!decoded || x != width || y != height || psnr < 30.0) {
+        fprintf(stderr, "Error: JPEG doesn't decode close to the input (%.1f dB)\n", psnr);
+        ++failures;
+      }
+      stbi_image_free(decoded);
+      char variant[64];
+      snprintf(variant, sizeof(variant), "q90 %s, %.1f dB", subsample ? "4:2:0" : "4:4:4", psnr);
+      report("jpeg", variant, seconds, jpeg.size(), width, height);
+    }
+  }
+
+  vector<unsigned char> qoi;
+  double seconds = measure([&]() {
+    qoi.clear();
+    writeQoi(qoi, pixels.data(), width, height, channels);
+  });
+  int x, y;
+  vector<unsigned char> decoded;
+  bool same = decodeQoi(qoi, x, y, decoded) && x == width && y == height;
+  for (size_t i = 0; same && i < size_t(width) * height; ++i) {
+    unsigned char const* p = &pixels[i * channels];
+    unsigned char expected[4] = { p[0], p[channels < 3 ? 0 : 1], p[channels < 3 ? 0 : 2],
+      channels == 2 || channels == 4 ? p[channels - 1] : (unsigned char)255 };
+    same = !memcmp(expected, &decoded[i * 4], 4);
+  }
+  if (!same) {
+    fprintf(stderr, "Error: QOI doesn't decode to the input\n");
+    ++failures;
+  }
+  printf("serial\n");
+  report("qoi", "", seconds, qoi.size(), width, height);
+
+  printf("jobs\n");
+  vector<unsigned char> spf;
+  for (int predict = 1; predict >= 0; --predict) {
+    SpillOptions options;
+    options.predict = predict != 0;
+    seconds = measure([&]() {
+      spf.clear();
+      writeSpill(spf, pixels.data(), width, height, channels, 8, options);
+    });
+    int n, bits;
+    stbi_uc* whole = stbi_load_from_memory(spf.data(), int(spf.size()), &x, &y, &n, 0);
+    int first = height / 3, count = max(1, height / 3);
+    stbi_uc* band = static_cast<stbi_uc*>(
+      stbi_spf_load_rows_from_memory(spf.data(), int(spf.size()), first, count, &x, &n, &bits));
+    size_t rowSize = size_t(width) * channels;
+    if (!whole || memcmp(whole, pixels.data(), size) || !band
+      || memcmp(band, pixels.data() + first * rowSize, count * rowSize)) {
+      fprintf(stderr, "Error: SPF doesn't decode to the input\n");
+      ++failures;
+    }
+    stbi_image_free(whole);
+    stbi_image_free(band);
+    report("spf", predict ? "predicted" : "plain", seconds, spf.size(), width, height);
+  }
+
+  // spf now holds the plain file; the predicted one is the default
+  writeSpill(spf, pixels.data(), width, height, channels);
+  vector<unsigned char> png;
+  writePng(png, pixels.data(), width, height, channels);
+  printf("decode\n");
+  char const* names[2] = { "png", "spf" };
+  vector<unsigned char> const* files[2] = { &png, &spf };
+  for (int f = 0; f < 2; ++f) {
+    seconds = measure([&]() {
+      int n;
+      stbi_image_free(stbi_load_from_memory(files[f]->data(), int(files[f]->size()), &x, &y, &n, 0));
+    });
+    printf("  %-6s %-24s %8.0f MB/s\n", names[f], "one core", size / seconds / 1e6);
+  }
+  int bands = max(1, jobSystem().workerCount() + 1) * 4;
+  seconds = measure([&]() {
+    jobSystem().parallelFor(0, bands, 1, [&](int first, int last) {
+      int rows = (height + bands - 1) / bands, n, bits;
+      for (int b = first; b < last; ++b)
+        if (b * rows < height)
+          stbi_image_free(stbi_spf_load_rows_from_memory(spf.data(), int(spf.size()), b * rows,
+            min(rows, height - b * rows), &x, &n, &bits));
+    });
+  });
+  printf("  %-6s %-24s %8.0f MB/s\n", "spf", "bands on jobs", size / seconds / 1e6);
+
+  if (failures)
+    return EXIT_FAILURE;
+  return EXIT_SUCCESS;
+}
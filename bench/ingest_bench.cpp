@@ -0,0 +1,205 @@
+// Batch file ingest: stdio against BatchReader.
+//
+//   ingest_bench [--corpus DIR] [--repeat N] [--depth N] [--buffer KB] [--no-uring]
+//
+// Reads the decode_bench corpus (see make_corpus.py) --repeat times over
+// (default 20, so a few hundred files), first just reading and then reading
+// and decoding:
+//
+//   read    fopen/fread one file after another, as stbi_load does, against
+//           BatchReader with the thread pool and with io_uring at 1, 4, 16 ...
+//           --depth (default 64) files in flight
+//   decode  stbi_load per file against BatchReader feeding
+//           stbi_load_from_memory as files arrive
+//
+// Prints files, IOPS and MB/s for each. Every file's contents and every
+// decoded image are hashed and compared with the stdio result; a difference
+// makes the exit code 1.
+//
+// Files read a second time come from the page cache, which hides the device.
+// For numbers that mean anything about the drive, point --corpus at a large
+// set of files and drop the cache before each run (as root:
+// sync; echo 3 > /proc/sys/vm/drop_caches) with --repeat 1.
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb-master/stb_image.h"
+
+#include "../batch_reader.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+typedef chrono::steady_clock Clock;
+
+unsigned long long fnv1a(void const* data, size_t size)
+{
+  unsigned long long hash = 14695981039346656037ull;
+  unsigned char const* bytes = static_cast<unsigned char const*>(data);
+  for (size_t i = 0; i < size; ++i) {
+    hash ^= bytes[i];
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+bool readStdio(string const& path, vector<unsigned char>& data)
+{
+  FILE* file = fopen(path.c_str(), "rb");
+  if (!file)
+    return false;
+  fseek(file, 0, SEEK_END);
+  data.resize(size_t(ftell(file)));
+  fseek(file, 0, SEEK_SET);
+  bool ok = fread(data.data(), 1, data.size(), file) == data.size();
+  fclose(file);
+  return ok;
+}
+
+unsigned long long hashPixels(stbi_uc* pixels, int x, int y, int n)
+{
+  if (!pixels)
+    return 0;
+  unsigned long long hash = fnv1a(pixels, size_t(x) * y * n) | 1;
+  stbi_image_free(pixels);
+  return hash;
+}
+
+void report(char const* name, int depth, size_t files, unsigned long long reads, unsigned long long bytes,
+  double seconds)
+{
+  printf("  %-24s", name);
+  if (depth)
+    printf(" %4d", depth);
+  else
+    printf("     ");
+  printf("  %7zu files  %10.0f IOPS  %9.1f MB/s  %8.1f files/s\n", files, reads / seconds,
+    bytes / 1048576.0 / seconds, files / seconds);
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+  string corpus = "corpus";
+  int repeat = 20, maxDepth = 64;
+  size_t bufferKb = 2048;
+  bool uring = true;
+  for (int i = 1; i < argc; ++i) {
+    string arg = argv[i];
+    if (arg == "--corpus" && i + 1 < argc)
+      corpus = argv[++i];
+    else if (arg == "--repeat" && i + 1 < argc)
+      repeat = max(1, atoi(argv[++i]));
+    else if (arg == "--depth" && i + 1 < argc)
+      maxDepth = max(1, atoi(argv[++i]));
+    else if (arg == "--buffer" && i + 1 < argc)
+      bufferKb = size_t(max(1, atoi(argv[++i])));
+    else if (arg == "--no-uring")
+      uring = false;
+    else {
+      cerr << "usage: ingest_bench [--corpus DIR] [--repeat N] [--depth N] [--buffer KB] [--no-uring]" << endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  ifstream manifest((corpus + "/manifest.txt").c_str());
+  if (!manifest) {
+    cerr << "Error: no manifest.txt in " << corpus << " (run make_corpus.py)" << endl;
+    return EXIT_FAILURE;
+  }
+  vector<string> corpusFiles;
+  string name, file;
+  while (manifest >> name >> file)
+    corpusFiles.push_back(corpus + "/" + file);
+  vector<string> paths;
+  for (int r = 0; r < repeat; ++r)
+    paths.insert(paths.end(), corpusFiles.begin(), corpusFiles.end());
+  if (paths.empty()) {
+    cerr << "Error: no files in " << corpus << endl;
+    return EXIT_FAILURE;
+  }
+
+  // stdio, which is also where the reference hashes come from
+  vector<unsigned long long> contents(paths.size()), pixels(paths.size());
+  unsigned long long bytes = 0;
+  vector<unsigned char> data;
+  Clock::time_point start = Clock::now();
+  for (size_t i = 0; i < paths.size(); ++i) {
+    if (!readStdio(paths[i], data)) {
+      cerr << "Error: can't read " << paths[i] << endl;
+      return EXIT_FAILURE;
+    }
+    contents[i] = fnv1a(data.data(), data.size());
+    bytes += data.size();
+  }
+  double stdioSeconds = chrono::duration<double>(Clock::now() - start).count();
+
+  printf("%zu files, %.1f MB\nread                      depth\n", paths.size(), bytes / 1048576.0);
+  report("stdio", 0, paths.size(), paths.size(), bytes, stdioSeconds);
+
+  int failures = 0;
+  for (int pass = 0; pass < 2; ++pass) {
+    if (pass == 1 && !uring)
+      break;
+    for (int depth = 1; depth <= maxDepth; depth *= 4) {
+      BatchReader::Options options;
+      options.depth = depth;
+      options.bufferSize = bufferKb * 1024;
+      options.useUring = pass == 1;
+      BatchReader reader(options);
+      bool ok = reader.read(paths, [&](size_t index, unsigned char const* file, size_t size) {
+        if (fnv1a(file, size) != contents[index])
+          ++failures;
+      });
+      failures += ok ? 0 : 1;
+      BatchReader::Stats const& stats = reader.stats();
+      if (pass == 1 && !stats.uring) {
+        printf("  io_uring unavailable, skipped\n");
+        break;
+      }
+      report(!stats.uring ? "thread pool" : stats.registeredBuffers ? "io_uring, fixed buffers" : "io_uring", depth,
+        size_t(stats.files), stats.reads, stats.bytes, stats.seconds);
+    }
+  }
+
+  printf("decode\n");
+  start = Clock::now();
+  for (size_t i = 0; i < paths.size(); ++i) {
+    int x, y, n;
+    stbi_uc* image = stbi_load(paths[i].c_str(), &x, &y, &n, 0);
+    pixels[i] = hashPixels(image, x, y, n);
+  }
+  report("stbi_load", 0, paths.size(), paths.size(), bytes, chrono::duration<double>(Clock::now() - start).count());
+
+  BatchReader::Options options;
+  options.depth = maxDepth;
+  options.bufferSize = bufferKb * 1024;
+  options.useUring = uring;
+  BatchReader reader(options);
+  bool ok = reader.read(paths, [&](size_t index, unsigned char const* file, size_t size) {
+    int x, y, n;
+    stbi_uc* image = stbi_load_from_memory(file, int(size), &x, &y, &n, 0);
+    if (hashPixels(image, x, y, n) != pixels[index])
+      ++failures;
+  });
+  failures += ok ? 0 : 1;
+  BatchReader::Stats const& stats = reader.stats();
+  report(stats.uring ? "reader + from_memory" : "pool + from_memory", maxDepth, size_t(stats.files), stats.reads,
+    stats.bytes, stats.seconds);
+
+  if (failures) {
+    fprintf(stderr, "Error: %d file(s) read or decoded differently from stdio\n", failures);
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
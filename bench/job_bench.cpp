@@ -0,0 +1,184 @@
+// Overhead and balance of the shared job system.
+//
+//   job_bench [--workers N] [--min-time SECONDS] [--no-pin]
+//
+// Runs a row-parallel image kernel (a 5-tap horizontal blur) at several image
+// sizes three ways: serially, with a fresh std::thread per band on every
+// call (what srgb_convert used to do) and with JobSystem::parallelFor. Then
+// times a dependency graph of small jobs (a fan-out, per-item chains and a
+// fan-in continuation), checks every job ran after its dependencies, and
+// prints the scheduler's steal, idle and queue depth counters. Exits 1 if a
+// result differs from the serial one or a dependency ran out of order.
+
+#include "../job_system.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+static double g_minTime = 0.5;
+
+// best of five batches; returns seconds per call
+static double measure(function<void()> const& body)
+{
+  typedef chrono::steady_clock Clock;
+  double best = 1e30;
+  body();
+  for (int batch = 0; batch < 5; ++batch) {
+    long iterations = 0;
+    Clock::time_point start = Clock::now();
+    double elapsed = 0.0;
+    do {
+      body();
+      ++iterations;
+      elapsed = chrono::duration<double>(Clock::now() - start).count();
+    } while (elapsed < g_minTime / 5);
+    best = min(best, elapsed / iterations);
+  }
+  return best;
+}
+
+static void blurRows(float const* src, float* dst, int width, int first, int last)
+{
+  for (int y = first; y < last; ++y) {
+    float const* in = src + size_t(y) * width;
+    float* out = dst + size_t(y) * width;
+    for (int x = 0; x < width; ++x) {
+      float sum = 0.0f;
+      for (int k = -2; k <= 2; ++k)
+        sum += in[min(width - 1, max(0, x + k))];
+      out[x] = sum * 0.2f;
+    }
+  }
+}
+
+static void threadPerBand(int height, int threads, function<void(int, int)> const& body)
+{
+  vector<thread> workers;
+  for (int t = 1; t < threads; ++t)
+    workers.push_back(thread(body, int(long(height) * t / threads), int(long(height) * (t + 1) / threads)));
+  body(0, height / threads);
+  for (size_t t = 0; t < workers.size(); ++t)
+    workers[t].join();
+}
+
+static bool benchRows(JobSystem& jobs)
+{
+  static const int kSizes[][2] = { { 256, 64 }, { 1024, 256 }, { 1920, 1080 }, { 4096, 3072 } };
+  int threads = jobs.workerCount() + 1;
+  bool ok = true;
+
+  printf("row kernel (ms per image)           serial  thread/band  parallelFor\n");
+  for (size_t s = 0; s < sizeof(kSizes) / sizeof(kSizes[0]); ++s) {
+    int width = kSizes[s][0], height = kSizes[s][1];
+    vector<float> src(size_t(width) * height), expected(src.size()), dst(src.size());
+    for (size_t i = 0; i < src.size(); ++i)
+      src[i] = float((i * 2654435761u) % 1000) / 1000.0f;
+    blurRows(src.data(), expected.data(), width, 0, height);
+
+    function<void(int, int)> body = [&](int first, int last) { blurRows(src.data(), dst.data(), width, first, last); };
+    double serial = measure([&] { body(0, height); });
+    double spawned = measure([&] { threadPerBand(height, threads, body); });
+    // around 64K pixels per chunk keeps the per-job cost in the noise
+    int grain = max(1, (1 << 16) / width);
+    double pooled = measure([&] { jobs.parallelFor(0, height, grain, body); });
+    ok = ok && memcmp(dst.data(), expected.data(), dst.size() * sizeof(float)) == 0;
+
+    printf("  %4dx%-4d                      %9.3f  %11.3f  %11.3f\n", width, height, serial * 1e3, spawned * 1e3,
+      pooled * 1e3);
+  }
+  if (!ok)
+    fprintf(stderr, "Error: parallel rows differ from the serial result\n");
+  return ok;
+}
+
+// 'items' independent chains of 'depth' jobs hanging off one root, all
+// joined by a single continuation
+static bool benchGraph(JobSystem& jobs, int items, int depth)
+{
+  vector<atomic<int>> progress(items);
+  atomic<int> outOfOrder(0);
+  atomic<bool> rootDone(false), joined(false);
+
+  double seconds = measure([&] {
+    for (int i = 0; i < items; ++i)
+      progress[i] = 0;
+    rootDone = false;
+    joined = false;
+
+    JobHandle root = jobs.submit([&] { rootDone = true; });
+    vector<JobHandle> tails;
+    for (int i = 0; i < items; ++i) {
+      JobHandle previous = root;
+      for (int d = 0; d < depth; ++d)
+        previous = jobs.then(previous, [&, i, d] {
+          if (!rootDone || progress[i].exchange(d + 1) != d)
+            ++outOfOrder;
+        });
+      tails.push_back(previous);
+    }
+    JobHandle join = jobs.submitAfter(tails, [&] {
+      for (int i = 0; i < items; ++i)
+        if (progress[i] != depth)
+          ++outOfOrder;
+      joined = true;
+    });
+    jobs.wait(join);
+    if (!joined)
+      ++outOfOrder;
+  });
+
+  int count = items * depth + 2;
+  printf("dependency graph: %d chains of %d, %d jobs  %8.3f ms  %6.2f us/job\n", items, depth, count, seconds * 1e3,
+    seconds * 1e6 / count);
+  if (outOfOrder)
+    fprintf(stderr, "Error: %d job(s) ran before their dependencies\n", int(outOfOrder));
+  return outOfOrder == 0;
+}
+
+int main(int argc, char** argv)
+{
+  int workers = -1;
+  bool pin = true;
+  for (int i = 1; i < argc; ++i) {
+    string arg = argv[i];
+    if (arg == "--workers" && i + 1 < argc)
+      workers = atoi(argv[++i]);
+    else if (arg == "--min-time" && i + 1 < argc)
+      g_minTime = atof(argv[++i]);
+    else if (arg == "--no-pin")
+      pin = false;
+    else {
+      fprintf(stderr, "usage: job_bench [--workers N] [--min-time SECONDS] [--no-pin]\n");
+      return EXIT_FAILURE;
+    }
+  }
+
+  JobSystem& jobs = jobSystem();
+  jobs.start(workers, pin);
+  printf("%d workers + calling thread, %u hardware threads\n", jobs.workerCount(), thread::hardware_concurrency());
+
+  bool ok = benchRows(jobs);
+  ok = benchGraph(jobs, 64, 16) && ok;
+
+  JobSystem::WorkerStats total = jobs.totals();
+  printf("executed %llu (%llu stolen, %llu by waiting threads), %llu empty steal passes, idle %.1f ms, "
+    "deepest queue %u\n", total.executed, total.stolen, total.helped, total.failedSteals, total.idleMs,
+    total.maxQueueDepth);
+  vector<JobSystem::WorkerStats> perWorker = jobs.stats();
+  for (size_t i = 0; i < perWorker.size(); ++i)
+    printf("  worker %2zu  executed %8llu  stolen %7llu  idle %9.1f ms  deepest %4u\n", i, perWorker[i].executed,
+      perWorker[i].stolen, perWorker[i].idleMs, perWorker[i].maxQueueDepth);
+
+  jobs.stop();
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
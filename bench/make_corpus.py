@@ -0,0 +1,175 @@
+#!/usr/bin/env python3
+"""Generates the decode benchmark corpus.
+
+The output is deterministic for a given Pillow/numpy version, so results from
+different machines (or before/after a change) measure the same bytes.
+
+    python make_corpus.py [output_dir]      (default: ./corpus)
+
+Writes the images plus manifest.txt, one "<case name> <file name>" per line,
+which decode_bench reads.
+"""
+
+import os
+import struct
+import sys
+import zlib
+
+import numpy as np
+from PIL import Image
+
+SIZES = [(256, 256), (1024, 768), (2048, 1536)]
+SEED = 20201019
+
+
+def natural_image(w, h, channels, rng, depth=8):
+    """Smooth gradients, some edges and a little noise, roughly photo-like."""
+    y, x = np.mgrid[0:h, 0:w].astype(np.float64)
+    planes = []
+    for c in range(channels):
+        fx, fy = rng.uniform(2, 9, size=2)
+        plane = 0.5 + 0.25 * np.sin(x / w * fx * np.pi + c) * np.cos(y / h * fy * np.pi)
+        plane += 0.2 * ((x // (w / 8) + y // (h / 6)) % 2)          # blocky edges
+        plane += rng.normal(0, 0.03, size=(h, w))                    # sensor noise
+        planes.append(plane)
+    img = np.clip(np.stack(planes, axis=-1), 0, 1)
+    top = 65535 if depth == 16 else 255
+    return (img * top + 0.5).astype(np.uint16 if depth == 16 else np.uint8)
+
+
+def png_chunk(kind, data):
+    return struct.pack(">I", len(data)) + kind + data + struct.pack(">I", zlib.crc32(kind + data) & 0xffffffff)
+
+
+def filter_rows(rows, bpp):
+    """Cycles through all five PNG filters so every unfilter path is exercised."""
+    out = bytearray()
+    prior = np.zeros_like(rows[0], dtype=np.int32)
+    for index, row in enumerate(rows):
+        cur = row.astype(np.int32)
+        left = np.concatenate([np.zeros(bpp, np.int32), cur[:-bpp]])
+        upleft = np.concatenate([np.zeros(bpp, np.int32), prior[:-bpp]])
+        kind = index % 5
+        if kind == 0:
+            res = cur
+        elif kind == 1:
+            res = cur - left
+        elif kind == 2:
+            res = cur - prior
+        elif kind == 3:
+            res = cur - (left + prior) // 2
+        else:
+            p = left + prior - upleft
+            pa, pb, pc = abs(p - left), abs(p - prior), abs(p - upleft)
+            pred = np.where((pa <= pb) & (pa <= pc), left, np.where(pb <= pc, prior, upleft))
+            res = cur - pred
+        out.append(kind)
+        out += (res & 0xff).astype(np.uint8).tobytes()
+        prior = cur
+    return bytes(out)
+
+
+ADAM7 = [(0, 0, 8, 8), (4, 0, 8, 8), (0, 4, 4, 8), (2, 0, 4, 4), (0, 2, 2, 4), (1, 0, 2, 2), (0, 1, 1, 2)]
+
+
+def write_png(path, img, depth, interlaced):
+    h, w = img.shape[:2]
+    channels = img.shape[2]
+    color = {1: 0, 2: 4, 3: 2, 4: 6}[channels]
+    bpp = channels * depth // 8
+
+    def raw_rows(sub):
+        data = sub.astype(">u2").tobytes() if depth == 16 else sub.tobytes()
+        return np.frombuffer(data, np.uint8).reshape(sub.shape[0], -1)
+
+    if interlaced:
+        raw = b""
+        for x0, y0, dx, dy in ADAM7:
+            sub = img[y0::dy, x0::dx]
+            if sub.size:
+                raw += filter_rows(raw_rows(sub), bpp)
+    else:
+        raw = filter_rows(raw_rows(img), bpp)
+
+    ihdr = struct.pack(">IIBBBBB", w, h, depth, color, 0, 0, 1 if interlaced else 0)
+    with open(path, "wb") as f:
+        f.write(b"\x89PNG\r\n\x1a\n" + png_chunk(b"IHDR", ihdr) + png_chunk(b"IDAT", zlib.compress(raw, 6)) + png_chunk(b"IEND", b""))
+
+
+def write_hdr(path, img):
+    """Radiance RGBE with new-style RLE scanlines (literal runs only)."""
+    h, w = img.shape[:2]
+    mantissa, exponent = np.frexp(img.max(axis=2))
+    scale = np.where(img.max(axis=2) > 1e-32, mantissa * 256.0 / np.maximum(img.max(axis=2), 1e-32), 0)
+    rgbe = np.zeros((h, w, 4), np.uint8)
+    rgbe[..., :3] = np.clip(img * scale[..., None], 0, 255).astype(np.uint8)
+    rgbe[..., 3] = np.where(scale > 0, exponent + 128, 0).astype(np.uint8)
+
+    with open(path, "wb") as f:
+        f.write(b"#?RADIANCE\nFORMAT=32-bit_rle_rgbe\n\n-Y %d +X %d\n" % (h, w))
+        for row in rgbe:
+            f.write(bytes([2, 2, w >> 8, w & 0xff]))
+            for c in range(4):
+                channel = row[:, c].tobytes()
+                for start in range(0, w, 128):
+                    run = channel[start:start + 128]
+                    f.write(bytes([len(run)]) + run)
+
+
+def main():
+    out_dir = sys.argv[1] if len(sys.argv) > 1 else os.path.join(os.path.dirname(os.path.abspath(__file__)), "corpus")
+    os.makedirs(out_dir, exist_ok=True)
+    rng = np.random.RandomState(SEED)
+    manifest = []
+
+    def add(case, name):
+        manifest.append("%s %s" % (case, name))
+
+    for w, h in SIZES:
+        size = "%dx%d" % (w, h)
+        rgb = natural_image(w, h, 3, rng)
+        im = Image.fromarray(rgb, "RGB")
+
+        for mode in ("baseline", "progressive"):
+            for sub_name, sub in (("444", 0), ("422", 1), ("420", 2)):
+                name = "jpeg_%s_%s_%s.jpg" % (mode, sub_name, size)
+                im.save(os.path.join(out_dir, name), quality=90, subsampling=sub, progressive=(mode == "progressive"))
+                add("jpeg/%s-%s/%s" % (mode, sub_name, size), name)
+        name = "jpeg_grey_%s.jpg" % size
+        im.convert("L").save(os.path.join(out_dir, name), quality=90)
+        add("jpeg/grey/%s" % size, name)
+
+        for interlaced in (False, True):
+            tag = "adam7" if interlaced else "plain"
+            name = "png_rgb8_%s_%s.png" % (tag, size)
+            write_png(os.path.join(out_dir, name), rgb, 8, interlaced)
+            add("png/rgb8-%s/%s" % (tag, size), name)
+
+            name = "png_rgb16_%s_%s.png" % (tag, size)
+            write_png(os.path.join(out_dir, name), natural_image(w, h, 3, rng, 16), 16, interlaced)
+            add("png/rgb16-%s/%s" % (tag, size), name)
+
+        name = "png_rgba8_%s.png" % size
+        write_png(os.path.join(out_dir, name), natural_image(w, h, 4, rng), 8, False)
+        add("png/rgba8/%s" % size, name)
+
+        name = "png_palette_%s.png" % size
+        im.quantize(256, dither=Image.NONE).save(os.path.join(out_dir, name))
+        add("png/palette/%s" % size, name)
+
+        name = "gif_anim8_%s.gif" % size
+        frames = [Image.fromarray(np.roll(rgb, i * w // 16, axis=1), "RGB").quantize(256, dither=Image.NONE) for i in range(8)]
+        frames[0].save(os.path.join(out_dir, name), save_all=True, append_images=frames[1:], duration=40, loop=0)
+        add("gif/anim8/%s" % size, name)
+
+        name = "hdr_rle_%s.hdr" % size
+        write_hdr(os.path.join(out_dir, name), rgb.astype(np.float32) / 255.0 * 4.0)
+        add("hdr/rle/%s" % size, name)
+
+    with open(os.path.join(out_dir, "manifest.txt"), "w") as f:
+        f.write("\n".join(manifest) + "\n")
+    print("wrote %d images to %s" % (len(manifest), out_dir))
+
+
+if __name__ == "__main__":
+    main()
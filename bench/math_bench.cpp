@@ -0,0 +1,249 @@
+// Accuracy and throughput of the simd_math approximations.
+//
+//   math_bench [--count N] [--min-time SECONDS] [--step N]
+//
+// Accuracy: walks float bit patterns over each function's documented range
+// (every --step'th pattern, default 64; 1 is exhaustive) and reports the
+// worst error in ulp against the double precision libm result, for the
+// scalar and every SIMD level the CPU supports. Throughput: million results
+// per second against the float libm call and glm's vec4 overloads.
+
+#include "../cpu_features.h"
+#include "../simd_math.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+static double g_minTime = 0.5;
+
+// best of five batches; returns seconds per call
+static double measure(function<void()> const& body)
+{
+  typedef chrono::steady_clock Clock;
+  double best = 1e30;
+  body();
+  for (int batch = 0; batch < 5; ++batch) {
+    long iterations = 0;
+    Clock::time_point start = Clock::now();
+    double elapsed = 0.0;
+    do {
+      body();
+      ++iterations;
+      elapsed = chrono::duration<double>(Clock::now() - start).count();
+    } while (elapsed < g_minTime / 5);
+    best = min(best, elapsed / iterations);
+  }
+  return best;
+}
+
+static float fromBits(unsigned bits)
+{
+  float f;
+  memcpy(&f, &bits, sizeof(f));
+  return f;
+}
+
+static unsigned toBits(float f)
+{
+  unsigned bits;
+  memcpy(&bits, &f, sizeof(bits));
+  return bits;
+}
+
+// error of 'result' in units of the last place of the exact value
+static double ulpError(float result, double exact)
+{
+  if (std::isnan(exact))
+    return std::isnan(result) ? 0.0 : INFINITY;
+  if (std::isinf(float(exact)) || std::isinf(result))
+    return result == float(exact) ? 0.0 : INFINITY;
+  int exponent;
+  frexp(exact, &exponent);
+  double ulp = ldexp(1.0, max(exponent - 24, -149));
+  return fabs(result - exact) / ulp;
+}
+
+// every step'th float in [lo, hi], both signs folded in by the caller
+static vector<float> sweep(float lo, float hi, unsigned step)
+{
+  vector<float> values;
+  if (lo < 0.0f) {
+    for (unsigned bits = toBits(-0.0f); bits <= toBits(lo); bits += step)
+      values.push_back(fromBits(bits));
+    lo = 0.0f;
+  }
+  for (unsigned bits = toBits(lo); bits <= toBits(hi); bits += step)
+    values.push_back(fromBits(bits));
+  return values;
+}
+
+struct Function {
+  char const* name;
+  char const* range;
+  vector<float> x, y;
+  function<void(float const*, float const*, float*, size_t)> approx;
+  function<double(double, double)> exact;
+  function<void(float const*, float const*, float*, size_t)> libm;
+  function<void(float const*, float const*, float*, size_t)> glmVec4;
+};
+
+int main(int argc, char** argv)
+{
+  size_t count = 1 << 16;
+  unsigned step = 64;
+  for (int i = 1; i < argc; ++i) {
+    string arg = argv[i];
+    if (arg == "--count" && i + 1 < argc)
+      count = size_t(atol(argv[++i]));
+    else if (arg == "--min-time" && i + 1 < argc)
+      g_minTime = atof(argv[++i]);
+    else if (arg == "--step" && i + 1 < argc)
+      step = unsigned(max(1, atoi(argv[++i])));
+    else {
+      fprintf(stderr, "usage: math_bench [--count N] [--min-time SECONDS] [--step N]\n");
+      return EXIT_FAILURE;
+    }
+  }
+
+  typedef float const* In;
+  Function functions[5];
+  functions[0].name = "sin";
+  functions[0].range = "|x| <= 8192";
+  functions[0].x = sweep(-8192.0f, 8192.0f, step);
+  functions[0].approx = [](In x, In, float* o, size_t n) { approxSin(x, o, n); };
+  functions[0].exact = [](double x, double) { return sin(x); };
+  functions[0].libm = [](In x, In, float* o, size_t n) { for (size_t i = 0; i < n; ++i) o[i] = sinf(x[i]); };
+  functions[0].glmVec4 = [](In x, In, float* o, size_t n) {
+    for (size_t i = 0; i + 4 <= n; i += 4) *reinterpret_cast<glm::vec4*>(o + i) = glm::sin(*reinterpret_cast<glm::vec4 const*>(x + i)); };
+
+  functions[1].name = "cos";
+  functions[1].range = "|x| <= 8192";
+  functions[1].x = functions[0].x;
+  functions[1].approx = [](In x, In, float* o, size_t n) { approxCos(x, o, n); };
+  functions[1].exact = [](double x, double) { return cos(x); };
+  functions[1].libm = [](In x, In, float* o, size_t n) { for (size_t i = 0; i < n; ++i) o[i] = cosf(x[i]); };
+  functions[1].glmVec4 = [](In x, In, float* o, size_t n) {
+    for (size_t i = 0; i + 4 <= n; i += 4) *reinterpret_cast<glm::vec4*>(o + i) = glm::cos(*reinterpret_cast<glm::vec4 const*>(x + i)); };
+
+  functions[2].name = "exp";
+  functions[2].range = "all finite x";
+  functions[2].x = sweep(-FLT_MAX, FLT_MAX, step);
+  functions[2].approx = [](In x, In, float* o, size_t n) { approxExp(x, o, n); };
+  functions[2].exact = [](double x, double) { return exp(x); };
+  functions[2].libm = [](In x, In, float* o, size_t n) { for (size_t i = 0; i < n; ++i) o[i] = expf(x[i]); };
+  functions[2].glmVec4 = [](In x, In, float* o, size_t n) {
+    for (size_t i = 0; i + 4 <= n; i += 4) *reinterpret_cast<glm::vec4*>(o + i) = glm::exp(*reinterpret_cast<glm::vec4 const*>(x + i)); };
+
+  functions[3].name = "log";
+  functions[3].range = "x > 0";
+  functions[3].x = sweep(fromBits(1), FLT_MAX, step);
+  functions[3].approx = [](In x, In, float* o, size_t n) { approxLog(x, o, n); };
+  functions[3].exact = [](double x, double) { return log(x); };
+  functions[3].libm = [](In x, In, float* o, size_t n) { for (size_t i = 0; i < n; ++i) o[i] = logf(x[i]); };
+  functions[3].glmVec4 = [](In x, In, float* o, size_t n) {
+    for (size_t i = 0; i + 4 <= n; i += 4) *reinterpret_cast<glm::vec4*>(o + i) = glm::log(*reinterpret_cast<glm::vec4 const*>(x + i)); };
+
+  // log-uniform x, uniform y
+  functions[4].name = "pow";
+  functions[4].range = "x in [1e-4, 1e4], |y| <= 4";
+  srand(1);
+  for (size_t i = 0; i < (1u << 30) / step / 16; ++i) {
+    functions[4].x.push_back(float(pow(10.0, rand() / double(RAND_MAX) * 8.0 - 4.0)));
+    functions[4].y.push_back(float(rand() / double(RAND_MAX) * 8.0 - 4.0));
+  }
+  functions[4].approx = [](In x, In y, float* o, size_t n) { approxPow(x, y, o, n); };
+  functions[4].exact = [](double x, double y) { return pow(x, y); };
+  functions[4].libm = [](In x, In y, float* o, size_t n) { for (size_t i = 0; i < n; ++i) o[i] = powf(x[i], y[i]); };
+  functions[4].glmVec4 = [](In x, In y, float* o, size_t n) {
+    for (size_t i = 0; i + 4 <= n; i += 4)
+      *reinterpret_cast<glm::vec4*>(o + i) = glm::pow(*reinterpret_cast<glm::vec4 const*>(x + i), *reinterpret_cast<glm::vec4 const*>(y + i)); };
+
+  SimdLevel top = detectSimdLevel();
+  printf("CPU supports %s, accuracy sampled every %u floats\n\n", simdLevelName(top), step);
+
+  printf("%-5s %-28s", "", "range");
+  for (int level = SIMD_SCALAR; level <= top; ++level)
+    printf(" %10s", simdLevelName(SimdLevel(level)));
+  printf("   (max ulp)\n");
+
+  for (int f = 0; f < 5; ++f) {
+    Function& fn = functions[f];
+    vector<float> out(fn.x.size());
+    printf("%-5s %-28s", fn.name, fn.range);
+    for (int level = SIMD_SCALAR; level <= top; ++level) {
+      setSimdLevelLimit(SimdLevel(level));
+      fn.approx(fn.x.data(), fn.y.empty() ? NULL : fn.y.data(), out.data(), out.size());
+      double worst = 0.0;
+      for (size_t i = 0; i < out.size(); ++i)
+        worst = max(worst, ulpError(out[i], fn.exact(fn.x[i], fn.y.empty() ? 0.0 : fn.y[i])));
+      printf(" %10.2f", worst);
+    }
+    printf("\n");
+  }
+
+  printf("\n%-5s %10s %10s", "", "libm", "glm vec4");
+  for (int level = SIMD_SCALAR; level <= top; ++level)
+    printf(" %10s", simdLevelName(SimdLevel(level)));
+  printf("   (M/s)\n");
+
+  // typical arguments rather than the sweeps, which are mostly tiny values
+  vector<float> x(count), y(count), out(count);
+  for (int f = 0; f < 5; ++f) {
+    Function& fn = functions[f];
+    for (size_t i = 0; i < count; ++i) {
+      float u = rand() / float(RAND_MAX);
+      if (f < 2)
+        x[i] = u * 200.0f - 100.0f;
+      else if (f == 2)
+        x[i] = u * 40.0f - 20.0f;
+      else if (f == 3)
+        x[i] = pow(10.0f, u * 12.0f - 6.0f);
+      else {
+        x[i] = fn.x[i % fn.x.size()];
+        y[i] = fn.y[i % fn.y.size()];
+      }
+    }
+
+    printf("%-5s", fn.name);
+    printf(" %10.1f", count / measure([&] { fn.libm(x.data(), y.data(), out.data(), count); }) / 1e6);
+    printf(" %10.1f", count / measure([&] { fn.glmVec4(x.data(), y.data(), out.data(), count); }) / 1e6);
+    for (int level = SIMD_SCALAR; level <= top; ++level) {
+      setSimdLevelLimit(SimdLevel(level));
+      printf(" %10.1f", count / measure([&] { fn.approx(x.data(), fn.y.empty() ? NULL : y.data(), out.data(), count); }) / 1e6);
+    }
+    printf("\n");
+  }
+
+  // special values, at every level
+  static const float kSpecial[] = { 0.0f, -0.0f, -1.0f, INFINITY, -INFINITY, NAN, 1000.0f, -1000.0f };
+  const size_t kSpecialCount = sizeof(kSpecial) / sizeof(kSpecial[0]);
+  bool failed = false;
+  for (int level = SIMD_SCALAR; level <= top; ++level) {
+    setSimdLevelLimit(SimdLevel(level));
+    float e[kSpecialCount], l[kSpecialCount];
+    approxExp(kSpecial, e, kSpecialCount);
+    approxLog(kSpecial, l, kSpecialCount);
+    for (size_t i = 0; i < kSpecialCount; ++i) {
+      float wantExp = expf(kSpecial[i]), wantLog = logf(kSpecial[i]);
+      bool expOk = std::isnan(wantExp) ? std::isnan(e[i]) : e[i] == wantExp;
+      bool logOk = std::isnan(wantLog) ? std::isnan(l[i]) : l[i] == wantLog;
+      if (!expOk || !logOk) {
+        fprintf(stderr, "Error: %s special value %g: exp %g (want %g), log %g (want %g)\n",
+          simdLevelName(SimdLevel(level)), kSpecial[i], e[i], wantExp, l[i], wantLog);
+        failed = true;
+      }
+    }
+  }
+
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
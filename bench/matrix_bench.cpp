@@ -0,0 +1,161 @@
+// Batch mat4 inverse and determinant against glm, one matrix at a time.
+//
+//   matrix_bench [--count N] [--min-time SECONDS]
+//
+// Prints million matrices per second and the worst residual |M * inv(M) - I|
+// over the batch for every kernel level the CPU supports, highp and lowp.
+
+#include "../cpu_features.h"
+#include "../mat4_soa.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+void inverseAoSIntrinsics(float const* in, float* out, size_t count, bool lowp);
+
+static double g_minTime = 0.5;
+
+// best of five batches; returns seconds per call
+static double measure(function<void()> const& body)
+{
+  typedef chrono::steady_clock Clock;
+  double best = 1e30;
+  body();
+  for (int batch = 0; batch < 5; ++batch) {
+    long iterations = 0;
+    Clock::time_point start = Clock::now();
+    double elapsed = 0.0;
+    do {
+      body();
+      ++iterations;
+      elapsed = chrono::duration<double>(Clock::now() - start).count();
+    } while (elapsed < g_minTime / 5);
+    best = min(best, elapsed / iterations);
+  }
+  return best;
+}
+
+static float residual(glm::mat4 const& m, glm::mat4 const& inverse)
+{
+  glm::mat4 p = m * inverse;
+  float worst = 0.0f;
+  for (int c = 0; c < 4; ++c)
+    for (int r = 0; r < 4; ++r)
+      worst = max(worst, fabs(p[c][r] - (c == r ? 1.0f : 0.0f)));
+  return worst;
+}
+
+int main(int argc, char** argv)
+{
+  size_t count = 4096;
+  for (int i = 1; i < argc; ++i) {
+    string arg = argv[i];
+    if (arg == "--count" && i + 1 < argc)
+      count = size_t(atol(argv[++i]));
+    else if (arg == "--min-time" && i + 1 < argc)
+      g_minTime = atof(argv[++i]);
+    else {
+      fprintf(stderr, "usage: matrix_bench [--count N] [--min-time SECONDS]\n");
+      return EXIT_FAILURE;
+    }
+  }
+
+  // camera-like matrices: rotation, translation and scale, plus some with a
+  // projection so every element is in play
+  vector<glm::mat4> aos(count), aosOut(count);
+  mat4_soa soa(count), soaOut;
+  float_soa det;
+  srand(1);
+  for (size_t i = 0; i < count; ++i) {
+    float r[8];
+    for (int k = 0; k < 8; ++k)
+      r[k] = rand() / float(RAND_MAX);
+    glm::mat4 m = glm::translate(glm::mat4(1.0f), glm::vec3(r[0], r[1], r[2]) * 10.0f - 5.0f);
+    m = glm::rotate(m, r[3] * 6.28f, glm::normalize(glm::vec3(r[4], r[5], r[6]) + 0.1f));
+    m = glm::scale(m, glm::vec3(0.5f + r[7]));
+    if (i % 2)
+      m = glm::perspective(0.5f + r[0], 1.0f + r[1], 0.1f, 100.0f) * m;
+    aos[i] = m;
+    soa.set(i, m);
+  }
+
+  vector<float> aligned(count * 16 + 4), alignedOut(count * 16 + 4);
+  float* in16 = reinterpret_cast<float*>((reinterpret_cast<size_t>(aligned.data()) + 15) & ~size_t(15));
+  float* out16 = reinterpret_cast<float*>((reinterpret_cast<size_t>(alignedOut.data()) + 15) & ~size_t(15));
+  for (size_t i = 0; i < count; ++i)
+    for (int c = 0; c < 4; ++c)
+      for (int r = 0; r < 4; ++r)
+        in16[i * 16 + c * 4 + r] = aos[i][c][r];
+
+  printf("%zu matrices, CPU supports %s\n", count, simdLevelName(detectSimdLevel()));
+  printf("%-26s %10s %12s\n", "", "Mmat/s", "residual");
+
+  double seconds = measure([&] {
+    for (size_t i = 0; i < count; ++i)
+      aosOut[i] = glm::inverse(aos[i]);
+  });
+  float worst = 0.0f;
+  for (size_t i = 0; i < count; ++i)
+    worst = max(worst, residual(aos[i], aosOut[i]));
+  printf("%-26s %10.2f %12.3g\n", "glm::inverse", count / seconds / 1e6, worst);
+
+  for (int lowp = 0; lowp < 2; ++lowp) {
+    seconds = measure([&] { inverseAoSIntrinsics(in16, out16, count, lowp != 0); });
+    worst = 0.0f;
+    for (size_t i = 0; i < count; ++i) {
+      glm::mat4 inverse;
+      for (int c = 0; c < 4; ++c)
+        for (int r = 0; r < 4; ++r)
+          inverse[c][r] = out16[i * 16 + c * 4 + r];
+      worst = max(worst, residual(aos[i], inverse));
+    }
+    printf("%-26s %10.2f %12.3g\n", lowp ? "glm_mat4_inverse_lowp" : "glm_mat4_inverse", count / seconds / 1e6, worst);
+  }
+
+  seconds = measure([&] {
+    for (size_t i = 0; i < count; ++i)
+      aosOut[i][0][0] = glm::determinant(aos[i]);
+  });
+  printf("%-26s %10.2f\n", "glm::determinant", count / seconds / 1e6);
+
+  int failures = 0;
+  for (int level = SIMD_SCALAR; level <= detectSimdLevel(); ++level) {
+    setSimdLevelLimit(SimdLevel(level));
+    char name[64];
+
+    for (int lowp = 0; lowp < 2; ++lowp) {
+      glm::qualifier precision = lowp ? glm::lowp : glm::highp;
+      seconds = measure([&] { soaInverse(soa, soaOut, precision); });
+      worst = 0.0f;
+      for (size_t i = 0; i < count; ++i)
+        worst = max(worst, residual(aos[i], soaOut.get(i)));
+      snprintf(name, sizeof(name), "soaInverse %s %s", simdLevelName(SimdLevel(level)), lowp ? "lowp" : "highp");
+      printf("%-26s %10.2f %12.3g\n", name, count / seconds / 1e6, worst);
+      if (worst > (lowp ? 1e-2f : 1e-4f))
+        ++failures;
+    }
+
+    seconds = measure([&] { soaDeterminant(soa, det); });
+    float detError = 0.0f;
+    for (size_t i = 0; i < count; ++i) {
+      float expected = glm::determinant(aos[i]);
+      detError = max(detError, fabs(det[0][i] - expected) / max(fabs(expected), 1e-6f));
+    }
+    snprintf(name, sizeof(name), "soaDeterminant %s", simdLevelName(SimdLevel(level)));
+    printf("%-26s %10.2f %12.3g (relative)\n", name, count / seconds / 1e6, detError);
+    if (detError > 1e-4f)
+      ++failures;
+  }
+
+  return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,27 @@
+// glm's SSE mat4 inverse (glm_mat4_inverse, glm_mat4_inverse_lowp), one
+// matrix at a time. Own TU for the same reason as transform_bench_intrinsics.
+#define GLM_FORCE_INTRINSICS
+#include <glm/glm.hpp>
+#include <glm/gtc/type_aligned.hpp>
+
+#include <cstddef>
+
+void inverseAoSIntrinsics(float const* in, float* out, std::size_t count, bool lowp)
+{
+#if GLM_ARCH & GLM_ARCH_SSE2_BIT
+  glm_vec4 const* src = reinterpret_cast<glm_vec4 const*>(in);
+  glm_vec4* dst = reinterpret_cast<glm_vec4*>(out);
+  if (lowp)
+    for (std::size_t i = 0; i < count; ++i)
+      glm_mat4_inverse_lowp(src + i * 4, dst + i * 4);
+  else
+    for (std::size_t i = 0; i < count; ++i)
+      glm_mat4_inverse(src + i * 4, dst + i * 4);
+#else
+  glm::aligned_mat4 const* src = reinterpret_cast<glm::aligned_mat4 const*>(in);
+  glm::aligned_mat4* dst = reinterpret_cast<glm::aligned_mat4*>(out);
+  for (std::size_t i = 0; i < count; ++i)
+    dst[i] = glm::inverse(src[i]);
+  (void)lowp;
+#endif
+}
@@ -0,0 +1,152 @@
+// RGB to NV12 on the CPU (rgbToNv12), the reference Nv12Readback's shader is
+// checked against.
+//
+//   nv12_bench [--width W] [--height H] [--min-time SECONDS]
+//
+// Compares every SIMD level with the conversion done in doubles, on RGBA and
+// RGB images of random pixels, including odd sizes whose last chroma row and
+// column cover a single pixel; any sample more than one code away makes the
+// exit code 1. Then prints million pixels per second converting a W x H
+// (default 1920 x 1080) RGBA frame: the double reference per pixel on one
+// thread, and rgbToNv12 at each level on the shared job system.
+
+#include "../cpu_features.h"
+#include "../job_system.h"
+#include "../nv12_convert.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+static double g_minTime = 0.5;
+
+// best of five batches; returns seconds per call
+static double measure(function<void()> const& body)
+{
+  typedef chrono::steady_clock Clock;
+  double best = 1e30;
+  body();
+  for (int batch = 0; batch < 5; ++batch) {
+    long iterations = 0;
+    Clock::time_point start = Clock::now();
+    double elapsed = 0.0;
+    do {
+      body();
+      ++iterations;
+      elapsed = chrono::duration<double>(Clock::now() - start).count();
+    } while (elapsed < g_minTime / 5);
+    best = min(best, elapsed / iterations);
+  }
+  return best;
+}
+
+static void referenceNv12(unsigned char const* src, int width, int height, int channels, unsigned char* dst)
+{
+  unsigned char* chroma = dst + size_t(width) * height;
+  int chromaWidth = (width + 1) / 2;
+  for (int y = 0; y < height; ++y)
+    for (int x = 0; x < width; ++x) {
+      unsigned char const* p = src + (size_t(y) * width + x) * channels;
+      double luma = 0.2126 * p[0] + 0.7152 * p[1] + 0.0722 * p[2];
+      dst[size_t(y) * width + x] = (unsigned char)floor(16 + luma * 219 / 255 + 0.5);
+    }
+  for (int j = 0; j < (height + 1) / 2; ++j)
+    for (int i = 0; i < chromaWidth; ++i) {
+      double rgb[3] = { 0, 0, 0 };
+      for (int dy = 0; dy < 2; ++dy)
+        for (int dx = 0; dx < 2; ++dx) {
+          int x = min(2 * i + dx, width - 1), y = min(2 * j + dy, height - 1);
+          for (int k = 0; k < 3; ++k)
+            rgb[k] += src[(size_t(y) * width + x) * channels + k] / 4.0;
+        }
+      double luma = 0.2126 * rgb[0] + 0.7152 * rgb[1] + 0.0722 * rgb[2];
+      unsigned char* uv = chroma + (size_t(j) * chromaWidth + i) * 2;
+      uv[0] = (unsigned char)floor(128 + (rgb[2] - luma) / 1.8556 * 224 / 255 + 0.5);
+      uv[1] = (unsigned char)floor(128 + (rgb[0] - luma) / 1.5748 * 224 / 255 + 0.5);
+    }
+}
+
+int main(int argc, char** argv)
+{
+  int width = 1920, height = 1080;
+  for (int i = 1; i < argc; ++i) {
+    string arg = argv[i];
+    if (arg == "--width" && i + 1 < argc)
+      width = atoi(argv[++i]);
+    else if (arg == "--height" && i + 1 < argc)
+      height = atoi(argv[++i]);
+    else if (arg == "--min-time" && i + 1 < argc)
+      g_minTime = atof(argv[++i]);
+    else {
+      fprintf(stderr, "usage: nv12_bench [--width W] [--height H] [--min-time SECONDS]\n");
+      return EXIT_FAILURE;
+    }
+  }
+
+  jobSystem().start(-1, false);
+  SimdLevel top = detectSimdLevel();
+  bool failed = false;
+  srand(1);
+
+  printf("CPU supports %s\n\n", simdLevelName(top));
+  static const int kSizes[][2] = { { 64, 32 }, { 37, 23 }, { 1, 1 }, { 17, 2 }, { 250, 141 } };
+  for (int level = SIMD_SCALAR; level <= top; ++level) {
+    setSimdLevelLimit(SimdLevel(level));
+    size_t samples = 0, mismatches = 0;
+    int worst = 0;
+    for (size_t s = 0; s < sizeof(kSizes) / sizeof(kSizes[0]); ++s)
+      for (int channels = 3; channels <= 4; ++channels) {
+        int w = kSizes[s][0], h = kSizes[s][1];
+        vector<unsigned char> image(size_t(w) * h * channels);
+        for (size_t i = 0; i < image.size(); ++i)
+          image[i] = (unsigned char)(rand() & 255);
+        vector<unsigned char> expected(nv12FrameSize(w, h)), actual(expected.size());
+        referenceNv12(image.data(), w, h, channels, expected.data());
+        rgbToNv12(image.data(), ptrdiff_t(w) * channels, w, h, channels, actual.data());
+        for (size_t i = 0; i < expected.size(); ++i) {
+          int diff = abs(int(actual[i]) - int(expected[i]));
+          mismatches += diff != 0;
+          worst = max(worst, diff);
+        }
+        samples += expected.size();
+
+        // the same image bottom up, as glReadPixels returns it
+        vector<unsigned char> flipped(image.size()), again(expected.size());
+        size_t rowSize = size_t(w) * channels;
+        for (int y = 0; y < h; ++y)
+          copy(image.begin() + y * rowSize, image.begin() + (y + 1) * rowSize, flipped.begin() + (h - 1 - y) * rowSize);
+        rgbToNv12(flipped.data() + (h - 1) * rowSize, -ptrdiff_t(rowSize), w, h, channels, again.data());
+        if (again != actual) {
+          printf("%-7s bottom-up %dx%d x%d differs from top-down\n", simdLevelName(SimdLevel(level)), w, h, channels);
+          failed = true;
+        }
+      }
+    printf("%-7s %zu of %zu samples off by up to %d\n", simdLevelName(SimdLevel(level)), mismatches, samples, worst);
+    failed |= worst > 1;
+  }
+
+  size_t pixels = size_t(width) * height;
+  vector<unsigned char> image(pixels * 4), out(nv12FrameSize(width, height));
+  for (size_t i = 0; i < image.size(); ++i)
+    image[i] = (unsigned char)(rand() & 255);
+
+  printf("\n%dx%d RGBA to NV12, million pixels per second\n\n", width, height);
+  printf("%-22s %10.1f\n", "double reference",
+    pixels / measure([&] { referenceNv12(image.data(), width, height, 4, out.data()); }) / 1e6);
+  for (int level = SIMD_SCALAR; level <= top; ++level) {
+    setSimdLevelLimit(SimdLevel(level));
+    string name = string("rgbToNv12 ") + simdLevelName(SimdLevel(level));
+    printf("%-22s %10.1f\n", name.c_str(),
+      pixels / measure([&] { rgbToNv12(image.data(), ptrdiff_t(width) * 4, width, height, 4, out.data()); }) / 1e6);
+  }
+
+  jobSystem().stop();
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
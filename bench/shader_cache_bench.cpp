@@ -0,0 +1,205 @@
+// Startup cost of building many shader programs, cold versus warm.
+//
+//   shader_cache_bench [--programs N] [--dir DIRECTORY] [--runs N]
+//
+// Generates N (default 48) distinct warp/colour programs of the kind the
+// viewer is growing, then times, in a hidden 3.3 core context:
+//   source  compile and link with no cache at all
+//   cold    empty cache: compile, link and store each binary
+//   warm    every program loaded back with glProgramBinary
+// Each is the best of --runs (default 3) passes. Drivers with their own
+// shader cache (most desktop ones) make "source" optimistic after the first
+// pass; the warm path skips GLSL parsing regardless. Exits 1 if any program
+// fails to build or warm loads don't come from the cache.
+
+#include "../shader_cache.h"
+
+#include <GLFW/glfw3.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+static const char* const kVertexSource = R"glsl(
+    #version 330 core
+    in vec3 aPos;
+    in vec3 aColor;
+    in vec2 aTexCoord;
+    out vec3 Color;
+    out vec2 TexCoord;
+    void main()
+    {
+      gl_Position = vec4(aPos, 1.0F);
+      Color = aColor;
+      TexCoord = aTexCoord;
+    }
+)glsl";
+
+// a radial warp followed by a colour matrix and tone curve; each variant gets
+// its own constants so every program is a distinct cache entry
+static string fragmentSource(int variant)
+{
+  char constants[256];
+  snprintf(constants, sizeof(constants),
+    "    const float kWarp = %.4f;\n"
+    "    const float kGamma = %.4f;\n"
+    "    const mat3 kColor = mat3(%.4f, 0.02, 0.01, 0.03, %.4f, 0.02, 0.01, 0.04, %.4f);\n",
+    0.05 + 0.01 * variant, 1.8 + 0.02 * variant, 0.9 + 0.001 * variant, 0.95 - 0.001 * variant,
+    1.0 + 0.002 * variant);
+
+  return string(R"glsl(
+    #version 330 core
+    in vec3 Color;
+    in vec2 TexCoord;
+    out vec4 outColor;
+    uniform sampler2D ourTexture;
+)glsl") + constants + R"glsl(
+    vec2 warp(vec2 uv)
+    {
+      vec2 centered = uv * 2.0 - 1.0;
+      float r2 = dot(centered, centered);
+      centered *= 1.0 + kWarp * r2 + kWarp * kWarp * r2 * r2;
+      return centered * 0.5 + 0.5;
+    }
+    vec3 tone(vec3 c)
+    {
+      c = kColor * c;
+      c = c / (1.0 + c);
+      return pow(max(c, vec3(0.0)), vec3(1.0 / kGamma));
+    }
+    void main()
+    {
+      vec2 uv = warp(TexCoord);
+      vec3 sum = vec3(0.0);
+      for (int i = -2; i <= 2; ++i)
+        for (int j = -2; j <= 2; ++j)
+          sum += texture(ourTexture, uv + vec2(i, j) / 1024.0).rgb;
+      outColor = vec4(tone(sum / 25.0) * Color, 1.0);
+    }
+)glsl";
+}
+
+static void bindOutputs(GLuint program)
+{
+  glBindFragDataLocation(program, 0, "outColor");
+}
+
+// builds every program once; returns milliseconds, or -1 if one fails
+static double buildAll(ShaderCache& cache, vector<string> const& fragments)
+{
+  typedef chrono::steady_clock Clock;
+  Clock::time_point start = Clock::now();
+  vector<GLuint> programs;
+  for (size_t i = 0; i < fragments.size(); ++i) {
+    GLuint program = cache.buildProgram(kVertexSource, fragments[i].c_str(), bindOutputs);
+    if (!program)
+      return -1.0;
+    programs.push_back(program);
+  }
+  // make sure the driver has really finished, not just queued the work
+  glFinish();
+  double ms = chrono::duration<double, milli>(Clock::now() - start).count();
+
+  for (size_t i = 0; i < programs.size(); ++i)
+    glDeleteProgram(programs[i]);
+  return ms;
+}
+
+int main(int argc, char** argv)
+{
+  int count = 48, runs = 3;
+  char const* directory = "shader_cache_bench";
+  for (int i = 1; i < argc; ++i) {
+    string arg = argv[i];
+    if (arg == "--programs" && i + 1 < argc)
+      count = atoi(argv[++i]);
+    else if (arg == "--dir" && i + 1 < argc)
+      directory = argv[++i];
+    else if (arg == "--runs" && i + 1 < argc)
+      runs = max(1, atoi(argv[++i]));
+    else {
+      fprintf(stderr, "usage: shader_cache_bench [--programs N] [--dir DIRECTORY] [--runs N]\n");
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (!glfwInit()) {
+    fprintf(stderr, "Error: GLFW init failed\n");
+    return EXIT_FAILURE;
+  }
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+  glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+  glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+  glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+  GLFWwindow* window = glfwCreateWindow(64, 64, "shader_cache_bench", NULL, NULL);
+  if (!window) {
+    fprintf(stderr, "Error: no GL context\n");
+    glfwTerminate();
+    return EXIT_FAILURE;
+  }
+  glfwMakeContextCurrent(window);
+  glewExperimental = GL_TRUE;
+  glewInit();
+
+  printf("%s / %s / %s\n", glGetString(GL_VENDOR), glGetString(GL_RENDERER), glGetString(GL_VERSION));
+
+  vector<string> fragments;
+  for (int i = 0; i < count; ++i)
+    fragments.push_back(fragmentSource(i));
+
+  double sourceMs = 1e30, coldMs = 1e30, warmMs = 1e30;
+  bool failed = false, cached = true;
+  for (int run = 0; run < runs && !failed; ++run) {
+    ShaderCache none;
+    none.init(NULL);
+    double ms = buildAll(none, fragments);
+    failed = failed || ms < 0.0;
+    sourceMs = min(sourceMs, ms);
+
+    ShaderCache cold;
+    if (!cold.init(directory)) {
+      failed = true;
+      break;
+    }
+    if (!cold.enabled()) {
+      printf("no program binary formats, nothing to cache\n");
+      break;
+    }
+    for (int i = 0; i < count; ++i)
+      cold.erase(kVertexSource, fragments[i].c_str());
+    ms = buildAll(cold, fragments);
+    failed = failed || ms < 0.0;
+    coldMs = min(coldMs, ms);
+
+    ShaderCache warm;
+    warm.init(directory);
+    ms = buildAll(warm, fragments);
+    failed = failed || ms < 0.0;
+    cached = cached && warm.stats().hits == unsigned(count);
+    warmMs = min(warmMs, ms);
+  }
+
+  if (!failed) {
+    printf("%d programs, best of %d\n", count, runs);
+    printf("  source %9.2f ms  %7.3f ms/program\n", sourceMs, sourceMs / count);
+    if (coldMs < 1e30) {
+      printf("  cold   %9.2f ms  %7.3f ms/program\n", coldMs, coldMs / count);
+      printf("  warm   %9.2f ms  %7.3f ms/program  (%.1fx faster than cold)\n", warmMs, warmMs / count,
+        coldMs / warmMs);
+    }
+  }
+  if (!cached) {
+    fprintf(stderr, "Error: warm pass compiled programs instead of loading them\n");
+    failed = true;
+  }
+
+  glfwDestroyWindow(window);
+  glfwTerminate();
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
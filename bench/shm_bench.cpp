@@ -0,0 +1,200 @@
+// Shared-memory frame transport (SharedFrameRing).
+//
+//   shm_bench [--size WxH] [--nv12] [--slots N] [--frames N] [--rate FPS]
+//   shm_bench --serve NAME [--size WxH] [--nv12] [--slots N] [--rate FPS] [--frames N]
+//
+// Without --serve, a producer thread and the main thread (the consumer) map
+// the same named ring independently, as two processes would, and run it
+// twice:
+//
+//   throughput  the producer fills and publishes --frames frames (default
+//               600) as fast as it can; the consumer checks each frame's
+//               stamp and releases it at once
+//   latency     the producer publishes at --rate (default 60) frames per
+//               second and the consumer sleeps in acquire() between frames;
+//               reports publish-to-acquire latency percentiles
+//
+// Both print how often each side had to sleep, which is also how many wake
+// up system calls the other side made. Frames are --size (default
+// 1920x1080) RGBA, or NV12 with --nv12. Exits 1 if a frame arrives out of
+// order or with the wrong contents.
+//
+// --serve runs just the producer, at --rate, under NAME, for the renderer to
+// show with "opengl_test --shm NAME"; forever unless --frames is given.
+
+#include "../shared_frame_ring.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+typedef chrono::steady_clock Clock;
+
+struct Config {
+  int width, height, slots;
+  SharedFrameFormat format;
+  long frames;
+  double rate;
+};
+
+long long nowNs()
+{
+  return chrono::duration_cast<chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+}
+
+// a diagonal gradient that moves a pixel per frame, with the sequence number
+// stamped over the first 8 bytes
+void fillFrame(unsigned char* data, Config const& config, unsigned long long sequence)
+{
+  int bytesPerPixel = config.format == SHARED_FRAME_NV12 ? 1 : 4;
+  size_t rowSize = size_t(config.width) * bytesPerPixel;
+  for (int y = 0; y < config.height; ++y)
+    memset(data + y * rowSize, int((y + sequence) & 255), rowSize);
+  if (config.format == SHARED_FRAME_NV12) {
+    size_t chromaSize = size_t((config.width + 1) / 2) * ((config.height + 1) / 2) * 2;
+    memset(data + size_t(config.width) * config.height, 128, chromaSize);
+  }
+  memcpy(data, &sequence, sizeof(sequence));
+}
+
+bool checkFrame(SharedFrameRing::Frame const& frame, Config const& config, unsigned long long expected)
+{
+  unsigned long long stamp;
+  memcpy(&stamp, frame.data, sizeof(stamp));
+  int bytesPerPixel = config.format == SHARED_FRAME_NV12 ? 1 : 4;
+  size_t last = size_t(config.width) * config.height * bytesPerPixel - 1;
+  return stamp == expected && frame.sequence == expected
+    && frame.data[last] == ((config.height - 1 + expected) & 255);
+}
+
+void produce(SharedFrameRing& ring, Config const& config, bool paced)
+{
+  Clock::time_point next = Clock::now();
+  for (long i = 0; config.frames < 0 || i < config.frames; ++i) {
+    if (paced) {
+      next += chrono::nanoseconds((long long)(1e9 / config.rate));
+      this_thread::sleep_until(next);
+    }
+    // a consumer that has gone away leaves the ring full
+    unsigned char* data = ring.beginWrite(5000);
+    if (!data) {
+      printf("  no free slot within 5 s\n");
+      return;
+    }
+    fillFrame(data, config, (unsigned long long)i);
+    ring.publish();
+  }
+}
+
+bool consume(char const* name, Config const& config, bool paced)
+{
+  SharedFrameRing ring;
+  if (!ring.open(name))
+    return false;
+
+  Clock::time_point start = Clock::now();
+  vector<double> latencies;
+  bool ok = true;
+  for (long i = 0; i < config.frames; ++i) {
+    SharedFrameRing::Frame frame;
+    if (!ring.acquire(frame, 5000)) {
+      printf("  no frame %ld within 5 s\n", i);
+      return false;
+    }
+    latencies.push_back((nowNs() - frame.timestampNs) / 1000.0);
+    if (!checkFrame(frame, config, (unsigned long long)i)) {
+      printf("  frame %ld arrived as %llu or damaged\n", i, frame.sequence);
+      ok = false;
+    }
+    ring.release();
+  }
+  double seconds = chrono::duration<double>(Clock::now() - start).count();
+
+  sort(latencies.begin(), latencies.end());
+  double frameMB = ring.frameSize() / 1048576.0;
+  if (!paced)
+    printf("  %ld frames of %.1f MB in %.3f s: %.0f frames/s, %.0f MB/s\n", config.frames, frameMB, seconds,
+      config.frames / seconds, config.frames * frameMB / seconds);
+  printf("  latency us: p50 %.1f  p99 %.1f  max %.1f\n", latencies[latencies.size() / 2],
+    latencies[latencies.size() * 99 / 100], latencies.back());
+  printf("  consumer slept %llu times\n", ring.stats().waits);
+  return ok;
+}
+
+bool run(char const* title, Config const& config, bool paced)
+{
+  printf("%s\n", title);
+  char name[64];
+  snprintf(name, sizeof(name), "shm_bench_%ld", (long)chrono::system_clock::now().time_since_epoch().count() % 100000);
+  SharedFrameRing ring;
+  if (!ring.create(name, config.width, config.height, config.format, config.slots))
+    return false;
+  thread producer(produce, ref(ring), config, paced);
+  bool ok = consume(name, config, paced);
+  producer.join();
+  printf("  producer slept %llu times\n", ring.stats().waits);
+  return ok;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+  Config config;
+  config.width = 1920;
+  config.height = 1080;
+  config.slots = 4;
+  config.format = SHARED_FRAME_RGBA8;
+  config.frames = -1;
+  config.rate = 60.0;
+  char const* serveName = NULL;
+
+  for (int i = 1; i < argc; ++i) {
+    string arg = argv[i];
+    if (arg == "--size" && i + 1 < argc)
+      sscanf(argv[++i], "%dx%d", &config.width, &config.height);
+    else if (arg == "--nv12")
+      config.format = SHARED_FRAME_NV12;
+    else if (arg == "--slots" && i + 1 < argc)
+      config.slots = atoi(argv[++i]);
+    else if (arg == "--frames" && i + 1 < argc)
+      config.frames = atol(argv[++i]);
+    else if (arg == "--rate" && i + 1 < argc)
+      config.rate = atof(argv[++i]);
+    else if (arg == "--serve" && i + 1 < argc)
+      serveName = argv[++i];
+    else {
+      fprintf(stderr, "usage: shm_bench [--serve NAME] [--size WxH] [--nv12] [--slots N] [--frames N] [--rate FPS]\n");
+      return 2;
+    }
+  }
+
+  if (serveName) {
+    printf("serving %dx%d %s frames at %g fps as %s\n", config.width, config.height,
+      config.format == SHARED_FRAME_NV12 ? "NV12" : "RGBA", config.rate, serveName);
+    SharedFrameRing ring;
+    if (!ring.create(serveName, config.width, config.height, config.format, config.slots))
+      return 1;
+    produce(ring, config, true);
+    return 0;
+  }
+
+  printf("%dx%d %s, %d slots\n", config.width, config.height, config.format == SHARED_FRAME_NV12 ? "NV12" : "RGBA",
+    config.slots);
+  Config throughput = config, latency = config;
+  throughput.frames = config.frames > 0 ? config.frames : 600;
+  latency.frames = config.frames > 0 ? config.frames : long(config.rate * 3);
+  bool ok = run("throughput", throughput, false);
+  ok = run("latency", latency, true) && ok;
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,146 @@
+// SoA vector kernels against the same operations on AoS glm::vec3 arrays.
+//
+//   soa_bench [--count N] [--min-time SECONDS]
+//
+// Prints million elements per second for the AoS loop and for every kernel
+// level the CPU supports, with the largest difference from the AoS result.
+
+#include "../cpu_features.h"
+#include "../vec_soa.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+static double g_minTime = 0.5;
+
+// best of five batches; returns seconds per call
+static double measure(function<void()> const& body)
+{
+  typedef chrono::steady_clock Clock;
+  double best = 1e30;
+  body();
+  for (int batch = 0; batch < 5; ++batch) {
+    long iterations = 0;
+    Clock::time_point start = Clock::now();
+    double elapsed = 0.0;
+    do {
+      body();
+      ++iterations;
+      elapsed = chrono::duration<double>(Clock::now() - start).count();
+    } while (elapsed < g_minTime / 5);
+    best = min(best, elapsed / iterations);
+  }
+  return best;
+}
+
+static float maxError(vec3_soa const& soa, vector<glm::vec3> const& aos)
+{
+  float error = 0.0f;
+  for (size_t i = 0; i < aos.size(); ++i)
+    error = max(error, glm::length(soa.get(i) - aos[i]));
+  return error;
+}
+
+static float maxError(float_soa const& soa, vector<float> const& aos)
+{
+  float error = 0.0f;
+  for (size_t i = 0; i < aos.size(); ++i)
+    error = max(error, fabs(soa[0][i] - aos[i]));
+  return error;
+}
+
+int main(int argc, char** argv)
+{
+  size_t count = 1 << 20;
+  for (int i = 1; i < argc; ++i) {
+    string arg = argv[i];
+    if (arg == "--count" && i + 1 < argc)
+      count = size_t(atol(argv[++i]));
+    else if (arg == "--min-time" && i + 1 < argc)
+      g_minTime = atof(argv[++i]);
+    else {
+      fprintf(stderr, "usage: soa_bench [--count N] [--min-time SECONDS]\n");
+      return EXIT_FAILURE;
+    }
+  }
+
+  vector<glm::vec3> a(count), b(count), c(count), out3(count);
+  vector<float> out1(count);
+  vec3_soa sa(count), sb(count), sc(count), sout3;
+  float_soa sout1;
+
+  srand(1);
+  for (size_t i = 0; i < count; ++i) {
+    a[i] = glm::vec3(rand(), rand(), rand()) / float(RAND_MAX) * 4.0f - 2.0f;
+    b[i] = glm::vec3(rand(), rand(), rand()) / float(RAND_MAX) * 4.0f - 2.0f;
+    c[i] = glm::vec3(rand(), rand(), rand()) / float(RAND_MAX) * 4.0f - 2.0f;
+    sa.set(i, a[i]);
+    sb.set(i, b[i]);
+    sc.set(i, c[i]);
+  }
+
+  struct Kernel {
+    char const* name;
+    function<void()> aos;
+    function<void()> soa;
+    function<float()> error;
+  };
+  const Kernel kernels[] = {
+    { "dot",
+      [&] { for (size_t i = 0; i < count; ++i) out1[i] = glm::dot(a[i], b[i]); },
+      [&] { soaDot(sa, sb, sout1); },
+      [&] { return maxError(sout1, out1); } },
+    { "cross",
+      [&] { for (size_t i = 0; i < count; ++i) out3[i] = glm::cross(a[i], b[i]); },
+      [&] { soaCross(sa, sb, sout3); },
+      [&] { return maxError(sout3, out3); } },
+    { "normalize",
+      [&] { for (size_t i = 0; i < count; ++i) out3[i] = glm::normalize(a[i]); },
+      [&] { soaNormalize(sa, sout3); },
+      [&] { return maxError(sout3, out3); } },
+    { "mix",
+      [&] { for (size_t i = 0; i < count; ++i) out3[i] = glm::mix(a[i], b[i], 0.3f); },
+      [&] { soaMix(sa, sb, 0.3f, sout3); },
+      [&] { return maxError(sout3, out3); } },
+    { "clamp",
+      [&] { for (size_t i = 0; i < count; ++i) out3[i] = glm::clamp(a[i], -1.0f, 1.0f); },
+      [&] { soaClamp(sa, -1.0f, 1.0f, sout3); },
+      [&] { return maxError(sout3, out3); } },
+    { "fma",
+      [&] { for (size_t i = 0; i < count; ++i) out3[i] = a[i] * b[i] + c[i]; },
+      [&] { soaFma(sa, sb, sc, sout3); },
+      [&] { return maxError(sout3, out3); } },
+  };
+
+  printf("%zu elements, CPU supports %s\n", count, simdLevelName(detectSimdLevel()));
+  printf("%-10s %10s", "kernel", "AoS glm");
+  for (int level = SIMD_SCALAR; level <= detectSimdLevel(); ++level)
+    printf(" %10s", simdLevelName(SimdLevel(level)));
+  printf("   (Melem/s)  max error\n");
+
+  int failures = 0;
+  for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); ++k) {
+    Kernel const& kernel = kernels[k];
+    printf("%-10s %10.1f", kernel.name, count / measure(kernel.aos) / 1e6);
+
+    float worst = 0.0f;
+    for (int level = SIMD_SCALAR; level <= detectSimdLevel(); ++level) {
+      setSimdLevelLimit(SimdLevel(level));
+      printf(" %10.1f", count / measure(kernel.soa) / 1e6);
+      worst = max(worst, kernel.error());
+    }
+    printf("   %g\n", worst);
+    if (worst > 1e-5f)
+      ++failures;
+  }
+
+  return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
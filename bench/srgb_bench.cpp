@@ -0,0 +1,175 @@
+// Whole-image sRGB conversion against glm's per-pixel color_space functions.
+//
+//   srgb_bench [--width W] [--height H] [--threads N] [--min-time SECONDS]
+//
+// Checks every 8-bit code round trips through linear float, and counts
+// linear -> 8-bit results that differ from the correctly rounded curve over
+// a sweep of floats in [0, 1], for every SIMD level. Then prints million
+// RGBA pixels per second for each direction, single threaded per level and
+// with --threads (default: one per hardware thread) on the shared job system.
+
+#include "../cpu_features.h"
+#include "../job_system.h"
+#include "../srgb_convert.h"
+
+#include <glm/gtc/color_space.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+static double g_minTime = 0.5;
+
+// best of five batches; returns seconds per call
+static double measure(function<void()> const& body)
+{
+  typedef chrono::steady_clock Clock;
+  double best = 1e30;
+  body();
+  for (int batch = 0; batch < 5; ++batch) {
+    long iterations = 0;
+    Clock::time_point start = Clock::now();
+    double elapsed = 0.0;
+    do {
+      body();
+      ++iterations;
+      elapsed = chrono::duration<double>(Clock::now() - start).count();
+    } while (elapsed < g_minTime / 5);
+    best = min(best, elapsed / iterations);
+  }
+  return best;
+}
+
+static int referenceEncode(double x)
+{
+  x = min(max(x, 0.0), 1.0);
+  double s = x <= 0.0031308 ? x * 12.92 : 1.055 * pow(x, 1.0 / 2.4) - 0.055;
+  return int(floor(s * 255.0 + 0.5));
+}
+
+int main(int argc, char** argv)
+{
+  int width = 1920, height = 1080;
+  int threads = max(1, int(thread::hardware_concurrency()));
+  for (int i = 1; i < argc; ++i) {
+    string arg = argv[i];
+    if (arg == "--width" && i + 1 < argc)
+      width = atoi(argv[++i]);
+    else if (arg == "--height" && i + 1 < argc)
+      height = atoi(argv[++i]);
+    else if (arg == "--threads" && i + 1 < argc)
+      threads = atoi(argv[++i]);
+    else if (arg == "--min-time" && i + 1 < argc)
+      g_minTime = atof(argv[++i]);
+    else {
+      fprintf(stderr, "usage: srgb_bench [--width W] [--height H] [--threads N] [--min-time SECONDS]\n");
+      return EXIT_FAILURE;
+    }
+  }
+
+  // the calling thread works alongside the workers, so --threads N is N - 1 of them
+  jobSystem().start(max(0, threads - 1), false);
+
+  SimdLevel top = detectSimdLevel();
+  bool failed = false;
+
+  // every code, as a one-row RGB image, must survive the round trip
+  unsigned char codes[256 * 3], back[256 * 3];
+  float linear[256 * 3];
+  for (int i = 0; i < 256 * 3; ++i)
+    codes[i] = (unsigned char)(i / 3);
+  srgbToLinear(codes, linear, 256, 1, 3, 1);
+
+  // floats in [0, 1], every 16th bit pattern, as a single-channel image
+  vector<float> sweep;
+  for (unsigned bits = 0; bits <= 0x3f800000u; bits += 16) {
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    sweep.push_back(f);
+  }
+  vector<unsigned char> encoded(sweep.size());
+
+  printf("CPU supports %s\n\n", simdLevelName(top));
+  for (int level = SIMD_SCALAR; level <= top; ++level) {
+    setSimdLevelLimit(SimdLevel(level));
+    linearToSrgb(linear, back, 256, 1, 3, 1);
+    int roundTripErrors = 0;
+    for (int i = 0; i < 256 * 3; ++i)
+      roundTripErrors += back[i] != codes[i];
+
+    linearToSrgb(sweep.data(), encoded.data(), int(sweep.size()), 1, 1, 1);
+    size_t mismatches = 0;
+    int worst = 0;
+    for (size_t i = 0; i < sweep.size(); ++i) {
+      int diff = abs(int(encoded[i]) - referenceEncode(sweep[i]));
+      mismatches += diff != 0;
+      worst = max(worst, diff);
+    }
+    printf("%-7s round trip errors %d, %zu of %zu sweep values off by up to %d\n", simdLevelName(SimdLevel(level)),
+      roundTripErrors, mismatches, sweep.size(), worst);
+    failed |= roundTripErrors != 0 || worst > 1;
+  }
+
+  size_t pixels = size_t(width) * height;
+  vector<unsigned char> image(pixels * 4);
+  vector<float> linearImage(pixels * 4);
+  vector<glm::uint16> halfImage(pixels * 4);
+  vector<unsigned char> out(pixels * 4);
+  srand(1);
+  for (size_t i = 0; i < image.size(); ++i)
+    image[i] = (unsigned char)(rand() & 255);
+  srgbToLinear(image.data(), linearImage.data(), width, height, 4, threads);
+
+  printf("\n%dx%d RGBA, million pixels per second\n\n", width, height);
+  printf("%-22s %10s %10s\n", "", "1 thread", "threads");
+
+  double glmDecode = measure([&] {
+    for (size_t i = 0; i < pixels; ++i) {
+      glm::vec4 c = glm::convertSRGBToLinear(glm::vec4(image[i * 4], image[i * 4 + 1], image[i * 4 + 2],
+        image[i * 4 + 3]) / 255.0f);
+      memcpy(&linearImage[i * 4], &c, sizeof(c));
+    }
+  });
+  printf("%-22s %10.1f\n", "glm decode", pixels / glmDecode / 1e6);
+  printf("%-22s %10.1f %10.1f\n", "lut decode float",
+    pixels / measure([&] { srgbToLinear(image.data(), linearImage.data(), width, height, 4, 1); }) / 1e6,
+    pixels / measure([&] { srgbToLinear(image.data(), linearImage.data(), width, height, 4, threads); }) / 1e6);
+  printf("%-22s %10.1f %10.1f\n", "lut decode half",
+    pixels / measure([&] { srgbToLinearHalf(image.data(), halfImage.data(), width, height, 4, 1); }) / 1e6,
+    pixels / measure([&] { srgbToLinearHalf(image.data(), halfImage.data(), width, height, 4, threads); }) / 1e6);
+
+  double glmEncode = measure([&] {
+    for (size_t i = 0; i < pixels; ++i) {
+      glm::vec4 c = glm::convertLinearToSRGB(glm::vec4(linearImage[i * 4], linearImage[i * 4 + 1],
+        linearImage[i * 4 + 2], linearImage[i * 4 + 3]));
+      for (int k = 0; k < 4; ++k)
+        out[i * 4 + k] = (unsigned char)(glm::clamp(c[k], 0.0f, 1.0f) * 255.0f + 0.5f);
+    }
+  });
+  printf("%-22s %10.1f\n", "glm encode", pixels / glmEncode / 1e6);
+  for (int level = SIMD_SCALAR; level <= top; ++level) {
+    setSimdLevelLimit(SimdLevel(level));
+    string name = string("encode ") + simdLevelName(SimdLevel(level));
+    printf("%-22s %10.1f %10.1f\n", name.c_str(),
+      pixels / measure([&] { linearToSrgb(linearImage.data(), out.data(), width, height, 4, 1); }) / 1e6,
+      pixels / measure([&] { linearToSrgb(linearImage.data(), out.data(), width, height, 4, threads); }) / 1e6);
+  }
+
+  for (size_t i = 0; i < image.size(); ++i)
+    if (out[i] != image[i]) {
+      fprintf(stderr, "Error: image round trip differs at component %zu: %d -> %d\n", i, image[i], out[i]);
+      failed = true;
+      break;
+    }
+
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
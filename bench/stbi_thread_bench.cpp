@@ -0,0 +1,253 @@
+// Concurrent stb_image decoding with per-call options.
+//
+//   stbi_thread_bench [--corpus DIR] [--passes N] [--max-threads N] [--filter TEXT]
+//
+// Decodes the decode_bench corpus (see make_corpus.py) --passes times (default
+// 4) with 1, 2, 4, ... --max-threads (default 32) threads pulling jobs from a
+// shared counter. Every job gets its own stbi_load_options: flip, channel
+// request, unpremultiply, iPhone conversion and, for half of them, a
+// per-thread counting allocator all vary from job to job, so threads running
+// side by side always disagree. Each result is hashed and checked against a
+// single-threaded reference decode of the same job; any difference, or a
+// custom allocation left unfreed, makes the exit code 1.
+//
+// Prints images per second and the speedup over one thread. Scaling is only
+// expected to be linear up to the number of hardware threads, which is shown
+// alongside.
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb-master/stb_image.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+struct Image {
+  string name;
+  vector<stbi_uc> data;
+};
+
+struct Job {
+  size_t image;
+  unsigned mix;
+  unsigned long long reference;
+};
+
+// Allocator state owned by one thread: blocks still come from malloc, but the
+// bookkeeping is the thread's own, so a leak or a block released through the
+// wrong allocator shows up as a nonzero count once the job is done.
+struct Tally {
+  long live;
+};
+
+void* tallyMalloc(void* user, size_t size)
+{
+  ++static_cast<Tally*>(user)->live;
+  return malloc(size);
+}
+
+void* tallyRealloc(void* user, void* block, size_t size)
+{
+  if (!block)
+    ++static_cast<Tally*>(user)->live;
+  return realloc(block, size);
+}
+
+void tallyFree(void* user, void* block)
+{
+  if (block)
+    --static_cast<Tally*>(user)->live;
+  free(block);
+}
+
+bool readFile(string const& path, vector<stbi_uc>& data)
+{
+  ifstream file(path.c_str(), ios::binary);
+  if (!file)
+    return false;
+  data.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+  return true;
+}
+
+// the options for one job: bits of 'mix' pick each setting, so neighbouring
+// jobs (which run on different threads) never share a combination
+stbi_load_options jobOptions(unsigned mix, Tally* tally)
+{
+  stbi_load_options options;
+  memset(&options, 0, sizeof(options));
+  options.flip_vertically = mix & 1;
+  options.unpremultiply = (mix >> 1) & 1;
+  options.convert_iphone_png = (mix >> 2) & 1;
+  options.req_comp = (mix >> 3) % 5;
+  if (tally && (mix & 64)) {
+    options.malloc_fn = tallyMalloc;
+    options.realloc_fn = tallyRealloc;
+    options.free_fn = tallyFree;
+    options.alloc_user = tally;
+  }
+  return options;
+}
+
+unsigned long long fnv1a(void const* data, size_t size)
+{
+  unsigned long long hash = 14695981039346656037ull;
+  unsigned char const* bytes = static_cast<unsigned char const*>(data);
+  for (size_t i = 0; i < size; ++i) {
+    hash ^= bytes[i];
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+// decodes one job the way its format is normally loaded; returns the hash of
+// the pixels, or 0 on failure
+unsigned long long decode(Image const& image, stbi_load_options const& options)
+{
+  stbi_uc const* data = image.data.data();
+  int len = int(image.data.size());
+  int x = 0, y = 0, n = 0;
+  void* pixels;
+  size_t bytes;
+
+  if (image.name.compare(0, 4, "gif/") == 0) {
+    int z = 0;
+    int* delays = NULL;
+    pixels = stbi_load_gif_from_memory_ex(data, len, &delays, &x, &y, &z, &n, &options);
+    bytes = size_t(x) * y * z * (options.req_comp ? options.req_comp : n);
+    if (delays)
+      options.free_fn ? options.free_fn(options.alloc_user, delays) : stbi_image_free(delays);
+  } else if (image.name.compare(0, 4, "hdr/") == 0) {
+    pixels = stbi_loadf_from_memory_ex(data, len, &x, &y, &n, &options);
+    bytes = size_t(x) * y * (options.req_comp ? options.req_comp : n) * sizeof(float);
+  } else if (stbi_is_16_bit_from_memory(data, len)) {
+    pixels = stbi_load_16_from_memory_ex(data, len, &x, &y, &n, &options);
+    bytes = size_t(x) * y * (options.req_comp ? options.req_comp : n) * 2;
+  } else {
+    pixels = stbi_load_from_memory_ex(data, len, &x, &y, &n, &options);
+    bytes = size_t(x) * y * (options.req_comp ? options.req_comp : n);
+  }
+  if (!pixels)
+    return 0;
+
+  unsigned long long hash = fnv1a(pixels, bytes) | 1;
+  options.free_fn ? options.free_fn(options.alloc_user, pixels) : stbi_image_free(pixels);
+  return hash;
+}
+
+// runs every job on 'threads' threads; returns seconds, counting mismatches
+double run(vector<Image> const& images, vector<Job> const& jobs, int threads, int& failures)
+{
+  atomic<size_t> next(0);
+  atomic<int> failed(0);
+
+  typedef chrono::steady_clock Clock;
+  Clock::time_point start = Clock::now();
+  vector<thread> workers;
+  for (int t = 0; t < threads; ++t)
+    workers.push_back(thread([&] {
+      Tally tally = { 0 };
+      for (size_t i = next++; i < jobs.size(); i = next++) {
+        stbi_load_options options = jobOptions(jobs[i].mix, &tally);
+        if (decode(images[jobs[i].image], options) != jobs[i].reference || tally.live != 0)
+          ++failed;
+        tally.live = 0;
+      }
+    }));
+  for (size_t t = 0; t < workers.size(); ++t)
+    workers[t].join();
+  double seconds = chrono::duration<double>(Clock::now() - start).count();
+
+  failures += failed;
+  return seconds;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+  string corpus = "corpus", filter;
+  int passes = 4, maxThreads = 32;
+  for (int i = 1; i < argc; ++i) {
+    string arg = argv[i];
+    if (arg == "--corpus" && i + 1 < argc)
+      corpus = argv[++i];
+    else if (arg == "--passes" && i + 1 < argc)
+      passes = max(1, atoi(argv[++i]));
+    else if (arg == "--max-threads" && i + 1 < argc)
+      maxThreads = max(1, atoi(argv[++i]));
+    else if (arg == "--filter" && i + 1 < argc)
+      filter = argv[++i];
+    else {
+      cerr << "usage: stbi_thread_bench [--corpus DIR] [--passes N] [--max-threads N] [--filter TEXT]" << endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  ifstream manifest((corpus + "/manifest.txt").c_str());
+  if (!manifest) {
+    cerr << "Error: no manifest.txt in " << corpus << " (run make_corpus.py)" << endl;
+    return EXIT_FAILURE;
+  }
+  vector<Image> images;
+  string name, file;
+  while (manifest >> name >> file) {
+    if (!filter.empty() && name.find(filter) == string::npos)
+      continue;
+    Image image;
+    image.name = name;
+    if (!readFile(corpus + "/" + file, image.data)) {
+      cerr << "Error: can't read " << file << endl;
+      return EXIT_FAILURE;
+    }
+    images.push_back(image);
+  }
+  if (images.empty()) {
+    cerr << "Error: no images selected" << endl;
+    return EXIT_FAILURE;
+  }
+
+  // references are decoded here, one at a time, with the default allocator
+  vector<Job> jobs;
+  for (int pass = 0; pass < passes; ++pass)
+    for (size_t i = 0; i < images.size(); ++i) {
+      Job job;
+      job.image = i;
+      job.mix = unsigned(jobs.size() * 37 + pass);
+      job.reference = decode(images[i], jobOptions(job.mix, NULL));
+      if (!job.reference) {
+        cerr << "Error: can't decode " << images[i].name << ": " << stbi_failure_reason() << endl;
+        return EXIT_FAILURE;
+      }
+      jobs.push_back(job);
+    }
+
+  printf("%zu images, %zu jobs, %u hardware threads\n", images.size(), jobs.size(), thread::hardware_concurrency());
+  int failures = 0;
+  double single = 0.0;
+  for (int threads = 1; threads <= maxThreads; threads *= 2) {
+    double seconds = run(images, jobs, threads, failures);
+    double rate = jobs.size() / seconds;
+    if (threads == 1)
+      single = rate;
+    printf("  %2d threads %9.1f images/s  %5.2fx\n", threads, rate, rate / single);
+    fflush(stdout);
+  }
+
+  if (failures) {
+    fprintf(stderr, "Error: %d decode(s) differed from the single-threaded reference or leaked\n", failures);
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
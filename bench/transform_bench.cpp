@@ -0,0 +1,143 @@
+// Batch SoA mat4 transform against glm's per-element mat4 * vec4, with
+// glm's intrinsics off (this TU) and on (transform_bench_intrinsics.cpp).
+//
+//   transform_bench [--count N] [--min-time SECONDS]
+//
+// Prints vertices per second for every kernel level the CPU supports and
+// checks each batch result against glm.
+
+#include "../batch_transform.h"
+#include "../cpu_features.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+void transformAoSIntrinsics(float const* matrix, float const* in, float* out, size_t count);
+bool glmIntrinsicsEnabled();
+
+static double g_minTime = 0.5;
+
+// 64-byte aligned float buffer
+class AlignedFloats
+{
+public:
+  explicit AlignedFloats(size_t count) : m_storage(count + 16) {}
+  float* data() { return reinterpret_cast<float*>((reinterpret_cast<size_t>(m_storage.data()) + 63) & ~size_t(63)); }
+
+private:
+  vector<float> m_storage;
+};
+
+// best of five batches; returns seconds per call
+static double measure(function<void()> const& body)
+{
+  typedef chrono::steady_clock Clock;
+  double best = 1e30;
+  body();
+  for (int batch = 0; batch < 5; ++batch) {
+    long iterations = 0;
+    Clock::time_point start = Clock::now();
+    double elapsed = 0.0;
+    do {
+      body();
+      ++iterations;
+      elapsed = chrono::duration<double>(Clock::now() - start).count();
+    } while (elapsed < g_minTime / 5);
+    best = min(best, elapsed / iterations);
+  }
+  return best;
+}
+
+static void report(char const* name, double seconds, size_t count, double maxError)
+{
+  if (maxError >= 0.0)
+    printf("%-28s %9.1f Mvert/s   max error %.2g\n", name, count / seconds / 1e6, maxError);
+  else
+    printf("%-28s %9.1f Mvert/s\n", name, count / seconds / 1e6);
+}
+
+int main(int argc, char** argv)
+{
+  size_t count = 1 << 16;
+  for (int i = 1; i < argc; ++i) {
+    string arg = argv[i];
+    if (arg == "--count" && i + 1 < argc)
+      count = size_t(atol(argv[++i]));
+    else if (arg == "--min-time" && i + 1 < argc)
+      g_minTime = atof(argv[++i]);
+    else {
+      fprintf(stderr, "usage: transform_bench [--count N] [--min-time SECONDS]\n");
+      return EXIT_FAILURE;
+    }
+  }
+
+  glm::mat4 m = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 100.0f)
+    * glm::lookAt(glm::vec3(1.0f, 2.0f, 3.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f))
+    * glm::rotate(glm::mat4(1.0f), 0.3f, glm::vec3(0.0f, 0.0f, 1.0f));
+
+  vector<glm::vec4> aos(count), aosOut(count), reference(count);
+  AlignedFloats aosAligned(count * 4), aosAlignedOut(count * 4);
+  AlignedFloats soa[4] = { AlignedFloats(count), AlignedFloats(count), AlignedFloats(count), AlignedFloats(count) };
+  AlignedFloats soaOut[4] = { AlignedFloats(count), AlignedFloats(count), AlignedFloats(count), AlignedFloats(count) };
+
+  srand(1);
+  for (size_t i = 0; i < count; ++i) {
+    glm::vec4 v(rand() / float(RAND_MAX) * 2 - 1, rand() / float(RAND_MAX) * 2 - 1, rand() / float(RAND_MAX) * 2 - 1, 1.0f);
+    aos[i] = v;
+    for (int c = 0; c < 4; ++c) {
+      aosAligned.data()[i * 4 + c] = v[c];
+      soa[c].data()[i] = v[c];
+    }
+    reference[i] = m * v;
+  }
+
+  printf("%zu vertices, CPU supports %s, glm intrinsics TU %s\n", count, simdLevelName(detectSimdLevel()),
+    glmIntrinsicsEnabled() ? "enabled" : "DISABLED");
+
+  double seconds = measure([&] {
+    for (size_t i = 0; i < count; ++i)
+      aosOut[i] = m * aos[i];
+  });
+  report("glm AoS mat4*vec4", seconds, count, -1.0);
+
+  seconds = measure([&] { transformAoSIntrinsics(&m[0][0], aosAligned.data(), aosAlignedOut.data(), count); });
+  report("glm AoS mat4*vec4 intrinsics", seconds, count, -1.0);
+
+  ConstVec4Streams in = { soa[0].data(), soa[1].data(), soa[2].data(), soa[3].data() };
+  ConstVec3Streams points = { soa[0].data(), soa[1].data(), soa[2].data() };
+  Vec4Streams out = { soaOut[0].data(), soaOut[1].data(), soaOut[2].data(), soaOut[3].data() };
+
+  int failures = 0;
+  for (int level = SIMD_SCALAR; level <= detectSimdLevel(); ++level) {
+    setSimdLevelLimit(SimdLevel(level));
+
+    for (int points3 = 0; points3 < 2; ++points3) {
+      char name[64];
+      snprintf(name, sizeof(name), "batch %s %s", points3 ? "point" : "vec4", simdLevelName(SimdLevel(level)));
+      if (points3)
+        seconds = measure([&] { transformPointBatch(m, points, out, count); });
+      else
+        seconds = measure([&] { transformVec4Batch(m, in, out, count); });
+
+      double maxError = 0.0;
+      for (size_t i = 0; i < count; ++i)
+        for (int c = 0; c < 4; ++c)
+          maxError = max(maxError, double(fabs(soaOut[c].data()[i] - reference[i][c])));
+      if (maxError > 1e-4)
+        ++failures;
+      report(name, seconds, count, maxError);
+    }
+  }
+
+  return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,25 @@
+// glm's per-element mat4 * vec4 with GLM_FORCE_INTRINSICS. Kept in its own
+// TU, and on the aligned types only, so the SSE specialisations cannot leak
+// into the packed instantiations the rest of the benchmark uses.
+#define GLM_FORCE_INTRINSICS
+#include <glm/glm.hpp>
+#include <glm/gtc/type_aligned.hpp>
+
+#include <cstddef>
+
+void transformAoSIntrinsics(float const* matrix, float const* in, float* out, std::size_t count)
+{
+  glm::aligned_mat4 m;
+  for (int c = 0; c < 4; ++c)
+    m[c] = glm::aligned_vec4(matrix[c * 4], matrix[c * 4 + 1], matrix[c * 4 + 2], matrix[c * 4 + 3]);
+
+  glm::aligned_vec4 const* src = reinterpret_cast<glm::aligned_vec4 const*>(in);
+  glm::aligned_vec4* dst = reinterpret_cast<glm::aligned_vec4*>(out);
+  for (std::size_t i = 0; i < count; ++i)
+    dst[i] = m * src[i];
+}
+
+bool glmIntrinsicsEnabled()
+{
+  return GLM_CONFIG_SIMD == GLM_ENABLE;
+}
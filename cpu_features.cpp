@@ -0,0 +1,103 @@
+#include "cpu_features.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(_MSC_VER) && defined(SIMD_X86)
+#include <intrin.h>
+#elif defined(SIMD_X86)
+#include <cpuid.h>
+#endif
+
+static const char* const kLevelNames[SIMD_LEVEL_COUNT] = { "scalar", "sse2", "avx2", "avx512" };
+
+static std::atomic<int> g_activeLevel(-1);
+
+#ifdef SIMD_X86
+static void cpuid(int leaf, int subleaf, unsigned regs[4])
+{
+#ifdef _MSC_VER
+  int r[4];
+  __cpuidex(r, leaf, subleaf);
+  for (int i = 0; i < 4; ++i)
+    regs[i] = unsigned(r[i]);
+#else
+  __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+static unsigned long long xgetbv0()
+{
+#ifdef _MSC_VER
+  return _xgetbv(0);
+#else
+  unsigned lo, hi;
+  __asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+  return (static_cast<unsigned long long>(hi) << 32) | lo;
+#endif
+}
+#endif
+
+SimdLevel detectSimdLevel()
+{
+#ifdef SIMD_X86
+  unsigned regs[4];
+  cpuid(0, 0, regs);
+  unsigned maxLeaf = regs[0];
+
+  cpuid(1, 0, regs);
+  bool sse2 = (regs[3] >> 26) & 1;
+  bool fma = (regs[2] >> 12) & 1;
+  bool osxsave = (regs[2] >> 27) & 1;
+  if (!sse2)
+    return SIMD_SCALAR;
+  if (!osxsave || maxLeaf < 7)
+    return SIMD_SSE2;
+
+  // XCR0: SSE and AVX state (bits 1-2), then opmask and upper ZMM (bits 5-7)
+  unsigned long long xcr0 = xgetbv0();
+  bool avxState = (xcr0 & 0x6) == 0x6;
+  bool avx512State = (xcr0 & 0xe6) == 0xe6;
+
+  cpuid(7, 0, regs);
+  bool avx2 = (regs[1] >> 5) & 1;
+  bool avx512f = (regs[1] >> 16) & 1;
+
+  if (avx512f && avx2 && fma && avx512State)
+    return SIMD_AVX512;
+  if (avx2 && fma && avxState)
+    return SIMD_AVX2;
+  return SIMD_SSE2;
+#else
+  return SIMD_SCALAR;
+#endif
+}
+
+SimdLevel activeSimdLevel()
+{
+  int level = g_activeLevel.load(std::memory_order_relaxed);
+  if (level >= 0)
+    return SimdLevel(level);
+
+  // racing first calls compute the same answer
+  level = detectSimdLevel();
+  if (char const* limit = std::getenv("SIMD_LEVEL")) {
+    for (int i = 0; i < SIMD_LEVEL_COUNT; ++i)
+      if (std::strcmp(limit, kLevelNames[i]) == 0 && i < level)
+        level = i;
+  }
+  g_activeLevel.store(level, std::memory_order_relaxed);
+  return SimdLevel(level);
+}
+
+void setSimdLevelLimit(SimdLevel limit)
+{
+  int detected = detectSimdLevel();
+  g_activeLevel.store(limit < detected ? int(limit) : detected, std::memory_order_relaxed);
+}
+
+char const* simdLevelName(SimdLevel level)
+{
+  return level >= 0 && level < SIMD_LEVEL_COUNT ? kLevelNames[level] : "unknown";
+}
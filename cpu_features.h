@@ -0,0 +1,66 @@
+#pragma once
+
+// Runtime instruction set detection for the batch math kernels. Kernels for
+// every level are compiled into the same binary (see SIMD_TARGET_*) and the
+// dispatcher picks one per call from activeSimdLevel().
+
+enum SimdLevel {
+  SIMD_SCALAR,
+  SIMD_SSE2,
+  SIMD_AVX2,    // AVX2 + FMA
+  SIMD_AVX512,  // AVX-512F
+  SIMD_LEVEL_COUNT
+};
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define SIMD_X86
+#endif
+
+// GCC and Clang only emit instructions a function is compiled for, so the
+// wider kernels are tagged; MSVC allows any intrinsic anywhere.
+#if defined(SIMD_X86) && (defined(__GNUC__) || defined(__clang__))
+#define SIMD_TARGET_SSE2 __attribute__((target("sse2")))
+#define SIMD_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#define SIMD_TARGET_AVX512 __attribute__((target("avx512f")))
+#else
+#define SIMD_TARGET_SSE2
+#define SIMD_TARGET_AVX2
+#define SIMD_TARGET_AVX512
+#endif
+
+// The same, for a whole region of code: everything defined between
+// SIMD_BEGIN_TARGET_* and SIMD_END_TARGET is compiled for that level. Lets
+// one kernel source be included once per level (see simd_lane.h).
+#if defined(SIMD_X86) && defined(__clang__)
+#define SIMD_BEGIN_TARGET_SSE2 _Pragma("clang attribute push(__attribute__((target(\"sse2\"))), apply_to = function)")
+#define SIMD_BEGIN_TARGET_AVX2 _Pragma("clang attribute push(__attribute__((target(\"avx2,fma\"))), apply_to = function)")
+#define SIMD_BEGIN_TARGET_AVX512 _Pragma("clang attribute push(__attribute__((target(\"avx512f\"))), apply_to = function)")
+#define SIMD_END_TARGET _Pragma("clang attribute pop")
+#elif defined(SIMD_X86) && defined(__GNUC__)
+// GCC's AVX-512 headers pass _mm512_undefined_ps() to masked builtins, which
+// trips the uninitialized warnings once inlined
+#define SIMD_BEGIN_TARGET_(target) _Pragma("GCC push_options") _Pragma(target) _Pragma("GCC diagnostic push")
+#define SIMD_BEGIN_TARGET_SSE2 SIMD_BEGIN_TARGET_("GCC target(\"sse2\")")
+#define SIMD_BEGIN_TARGET_AVX2 SIMD_BEGIN_TARGET_("GCC target(\"avx2,fma\")")
+#define SIMD_BEGIN_TARGET_AVX512 SIMD_BEGIN_TARGET_("GCC target(\"avx512f\")") \
+  _Pragma("GCC diagnostic ignored \"-Wuninitialized\"") _Pragma("GCC diagnostic ignored \"-Wmaybe-uninitialized\"")
+#define SIMD_END_TARGET _Pragma("GCC diagnostic pop") _Pragma("GCC pop_options")
+#else
+#define SIMD_BEGIN_TARGET_SSE2
+#define SIMD_BEGIN_TARGET_AVX2
+#define SIMD_BEGIN_TARGET_AVX512
+#define SIMD_END_TARGET
+#endif
+
+// highest level supported by both the CPU and the OS (which has to save the
+// wider registers on context switches)
+SimdLevel detectSimdLevel();
+
+// detected level, capped by setSimdLevelLimit() or the SIMD_LEVEL environment
+// variable ("scalar", "sse2", "avx2" or "avx512")
+SimdLevel activeSimdLevel();
+
+// caps dispatch below the detected level, e.g. to compare kernels
+void setSimdLevelLimit(SimdLevel limit);
+
+char const* simdLevelName(SimdLevel level);
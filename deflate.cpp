@@ -0,0 +1,582 @@
+#include "deflate.h"
+
+#include <algorithm>
+#include <cstring>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+using namespace std;
+
+namespace {
+
+const int kWindow = 32768;
+const int kMinMatch = 3;
+const int kMaxMatch = 258;
+const int kHashBits = 15;
+// symbols per block; small enough that the code lengths follow the data
+const size_t kBlockSymbols = 1 << 14;
+const size_t kMaxStored = 65535;
+
+const int kLengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99,
+  115, 131, 163, 195, 227, 258 };
+const int kLengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+const int kDistanceBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025,
+  1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+const int kDistanceExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12,
+  12, 13, 13 };
+// order the code length code lengths are sent in
+const int kCodeLengthOrder[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+// search effort per level, roughly zlib's
+struct Level {
+  int maxChain;     // candidates tried per position
+  int niceLength;   // stop searching once a match is this long
+  bool lazy;        // look one byte ahead for a longer match before taking one
+};
+const Level kLevels[10] = { { 0, 0, false }, { 4, 8, false }, { 8, 16, false }, { 16, 32, false }, { 16, 32, true },
+  { 32, 64, true }, { 128, 128, true }, { 256, 258, true }, { 1024, 258, true }, { 4096, 258, true } };
+
+struct Tables {
+  unsigned char lengthCode[kMaxMatch + 1];
+  unsigned char distanceCode[512];  // distance - 1 below 256, then (distance - 1) >> 7
+  unsigned char fixedLiteralLengths[288], fixedDistanceLengths[30];
+  unsigned crc[256];
+
+  Tables()
+  {
+    for (int code = 0; code < 29; ++code) {
+      int end = code == 28 ? kMaxMatch + 1 : kLengthBase[code + 1];
+      for (int length = kLengthBase[code]; length < end; ++length)
+        lengthCode[length] = (unsigned char)code;
+    }
+    for (int code = 0; code < 30; ++code) {
+      int end = code == 29 ? kWindow + 1 : kDistanceBase[code + 1];
+      for (int distance = kDistanceBase[code]; distance < end; ++distance) {
+        if (distance <= 256)
+          distanceCode[distance - 1] = (unsigned char)code;
+        else
+          distanceCode[256 + ((distance - 1) >> 7)] = (unsigned char)code;
+      }
+    }
+    for (int i = 0; i < 288; ++i)
+      fixedLiteralLengths[i] = i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8;
+    for (int i = 0; i < 30; ++i)
+      fixedDistanceLengths[i] = 5;
+    for (unsigned i = 0; i < 256; ++i) {
+      unsigned c = i;
+      for (int k = 0; k < 8; ++k)
+        c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+      crc[i] = c;
+    }
+  }
+
+  int distance(int d) const { return d <= 256 ? distanceCode[d - 1] : distanceCode[256 + ((d - 1) >> 7)]; }
+};
+
+// built on first use; C++11 makes the initialisation thread safe
+Tables const& tables()
+{
+  static Tables t;
+  return t;
+}
+
+// deflate packs bits starting from the least significant
+class BitWriter
+{
+public:
+  explicit BitWriter(vector<unsigned char>& out) : m_out(out), m_bits(0), m_count(0) {}
+
+  void put(unsigned value, int count)
+  {
+    m_bits |= (unsigned long long)value << m_count;
+    m_count += count;
+    while (m_count >= 8) {
+      m_out.push_back((unsigned char)m_bits);
+      m_bits >>= 8;
+      m_count -= 8;
+    }
+  }
+
+  void align()
+  {
+    if (m_count > 0)
+      m_out.push_back((unsigned char)m_bits);
+    m_bits = 0;
+    m_count = 0;
+  }
+
+  vector<unsigned char>& out() { return m_out; }
+
+private:
+  vector<unsigned char>& m_out;
+  unsigned long long m_bits;
+  int m_count;
+};
+
+// a literal when distance is 0, else a match
+struct Symbol {
+  unsigned short value;
+  unsigned short distance;
+};
+
+// Huffman code lengths no longer than 'maxBits' for 'count' symbols; unused
+// symbols get 0. A lone symbol gets a partner so the code stays complete.
+void huffmanLengths(unsigned const* freq, int count, int maxBits, unsigned char* lengths)
+{
+  memset(lengths, 0, count);
+  vector<int> used;
+  for (int i = 0; i < count; ++i)
+    if (freq[i])
+      used.push_back(i);
+  if (used.empty())
+    return;
+  if (used.size() == 1) {
+    lengths[used[0]] = 1;
+    lengths[used[0] == 0 ? 1 : 0] = 1;
+    return;
+  }
+
+  // least frequent first; the tree comes from merging the two cheapest of
+  // the sorted leaves and the (already sorted) internal nodes
+  sort(used.begin(), used.end(), [&](int a, int b) { return freq[a] != freq[b] ? freq[a] < freq[b] : a < b; });
+  int n = int(used.size());
+  vector<unsigned long long> weight(2 * n - 1);
+  vector<int> parent(2 * n - 1), depth(2 * n - 1);
+  for (int i = 0; i < n; ++i)
+    weight[i] = freq[used[i]];
+  int leaf = 0, inner = n;
+  for (int next = n; next < 2 * n - 1; ++next) {
+    int pair[2];
+    for (int k = 0; k < 2; ++k)
+      pair[k] = leaf < n && (inner >= next || weight[leaf] <= weight[inner]) ? leaf++ : inner++;
+    weight[next] = weight[pair[0]] + weight[pair[1]];
+    parent[pair[0]] = parent[pair[1]] = next;
+  }
+  depth[2 * n - 2] = 0;
+  for (int i = 2 * n - 3; i >= 0; --i)
+    depth[i] = depth[parent[i]] + 1;
+
+  // fold anything too deep into maxBits, then take codes away from the
+  // longest lengths until the code fits again
+  vector<int> perLength(maxBits + 1, 0);
+  for (int i = 0; i < n; ++i)
+    ++perLength[min(depth[i], maxBits)];
+  unsigned long long total = 0;
+  for (int bits = 1; bits <= maxBits; ++bits)
+    total += (unsigned long long)perLength[bits] << (maxBits - bits);
+  while (total > (1ull << maxBits)) {
+    --perLength[maxBits];
+    for (int bits = maxBits - 1; bits > 0; --bits)
+      if (perLength[bits]) {
+        --perLength[bits];
+        perLength[bits + 1] += 2;
+        break;
+      }
+    --total;
+  }
+
+  // longest codes to the rarest symbols
+  int i = 0;
+  for (int bits = maxBits; bits > 0; --bits)
+    for (int k = 0; k < perLength[bits]; ++k)
+      lengths[used[i++]] = (unsigned char)bits;
+}
+
+// canonical codes, bit reversed for BitWriter
+void huffmanCodes(unsigned char const* lengths, int count, unsigned short* codes)
+{
+  int perLength[16] = {};
+  for (int i = 0; i < count; ++i)
+    ++perLength[lengths[i]];
+  perLength[0] = 0;
+  unsigned next[16];
+  unsigned code = 0;
+  for (int bits = 1; bits < 16; ++bits) {
+    code = (code + perLength[bits - 1]) << 1;
+    next[bits] = code;
+  }
+  for (int i = 0; i < count; ++i) {
+    int length = lengths[i];
+    if (!length)
+      continue;
+    unsigned c = next[length]++, reversed = 0;
+    for (int b = 0; b < length; ++b)
+      reversed |= ((c >> b) & 1) << (length - 1 - b);
+    codes[i] = (unsigned short)reversed;
+  }
+}
+
+void writeStored(BitWriter& bits, unsigned char const* raw, size_t size, bool final)
+{
+  do {
+    size_t chunk = min(size, kMaxStored);
+    size -= chunk;
+    bits.put(final && size == 0 ? 1 : 0, 3);
+    bits.align();
+    unsigned char header[4] = { (unsigned char)chunk, (unsigned char)(chunk >> 8), (unsigned char)~chunk,
+      (unsigned char)(~chunk >> 8) };
+    bits.out().insert(bits.out().end(), header, header + 4);
+    bits.out().insert(bits.out().end(), raw, raw + chunk);
+    raw += chunk;
+  } while (size > 0);
+}
+
+// the symbols of one block, as whichever of dynamic codes, fixed codes or a
+// stored copy of 'raw' comes out smallest
+void writeBlock(BitWriter& bits, vector<Symbol> const& symbols, unsigned char const* raw, size_t rawSize, bool final)
+{
+  Tables const& t = tables();
+  unsigned literalFreq[286] = {}, distanceFreq[30] = {};
+  for (size_t i = 0; i < symbols.size(); ++i) {
+    if (!symbols[i].distance) {
+      ++literalFreq[symbols[i].value];
+    } else {
+      ++literalFreq[257 + t.lengthCode[symbols[i].value]];
+      ++distanceFreq[t.distance(symbols[i].distance)];
+    }
+  }
+  literalFreq[256] = 1;
+
+  // 288 so the fixed code can be built from its lengths; 286 and 287 never occur
+  unsigned char literalLengths[288], distanceLengths[30];
+  huffmanLengths(literalFreq, 286, 15, literalLengths);
+  huffmanLengths(distanceFreq, 30, 15, distanceLengths);
+  int literalCount = 286, distanceCount = 30;
+  while (literalCount > 257 && !literalLengths[literalCount - 1])
+    --literalCount;
+  while (distanceCount > 1 && !distanceLengths[distanceCount - 1])
+    --distanceCount;
+
+  // both length lists as one run-length coded sequence: 16 repeats the
+  // previous length 3-6 times, 17 and 18 are runs of 3-10 and 11-138 zeros
+  unsigned char all[286 + 30];
+  memcpy(all, literalLengths, literalCount);
+  memcpy(all + literalCount, distanceLengths, distanceCount);
+  int allCount = literalCount + distanceCount;
+  vector<unsigned char> runs, runExtra;
+  unsigned runFreq[19] = {};
+  for (int i = 0; i < allCount;) {
+    int length = all[i], run = 1;
+    while (i + run < allCount && all[i + run] == length)
+      ++run;
+    i += run;
+    if (length == 0) {
+      for (; run >= 11; run -= min(run, 138)) {
+        runs.push_back(18);
+        runExtra.push_back((unsigned char)(min(run, 138) - 11));
+      }
+      if (run >= 3) {
+        runs.push_back(17);
+        runExtra.push_back((unsigned char)(run - 3));
+        run = 0;
+      }
+    } else {
+      runs.push_back((unsigned char)length);
+      runExtra.push_back(0);
+      for (--run; run >= 3; run -= min(run, 6)) {
+        runs.push_back(16);
+        runExtra.push_back((unsigned char)(min(run, 6) - 3));
+      }
+    }
+    for (; run > 0; --run) {
+      runs.push_back((unsigned char)length);
+      runExtra.push_back(0);
+    }
+  }
+  for (size_t i = 0; i < runs.size(); ++i)
+    ++runFreq[runs[i]];
+  unsigned char runLengths[19];
+  huffmanLengths(runFreq, 19, 7, runLengths);
+  int runCodeCount = 19;
+  while (runCodeCount > 4 && !runLengths[kCodeLengthOrder[runCodeCount - 1]])
+    --runCodeCount;
+
+  // sizes in bits
+  unsigned long long dynamicBits = 3 + 14 + 3 * runCodeCount, fixedBits = 3;
+  for (size_t i = 0; i < runs.size(); ++i)
+    dynamicBits += runLengths[runs[i]] + (runs[i] == 16 ? 2 : runs[i] == 17 ? 3 : runs[i] == 18 ? 7 : 0);
+  for (int s = 0; s < 286; ++s) {
+    int extra = s > 256 ? kLengthExtra[s - 257] : 0;
+    dynamicBits += (unsigned long long)literalFreq[s] * (literalLengths[s] + extra);
+    fixedBits += (unsigned long long)literalFreq[s] * (t.fixedLiteralLengths[s] + extra);
+  }
+  for (int s = 0; s < 30; ++s) {
+    dynamicBits += (unsigned long long)distanceFreq[s] * (distanceLengths[s] + kDistanceExtra[s]);
+    fixedBits += (unsigned long long)distanceFreq[s] * (5 + kDistanceExtra[s]);
+  }
+  unsigned long long storedBits = (rawSize + 5 * (rawSize / kMaxStored + 1)) * 8 + 7;
+  if (storedBits <= min(dynamicBits, fixedBits)) {
+    writeStored(bits, raw, rawSize, final);
+    return;
+  }
+
+  unsigned short literalCodes[288], distanceCodes[30];
+  int literalCodeCount = 286;
+  if (fixedBits <= dynamicBits) {
+    bits.put(final ? 1 : 0, 1);
+    bits.put(1, 2);
+    literalCodeCount = 288;
+    memcpy(literalLengths, t.fixedLiteralLengths, 288);
+    memcpy(distanceLengths, t.fixedDistanceLengths, 30);
+  } else {
+    bits.put(final ? 1 : 0, 1);
+    bits.put(2, 2);
+    bits.put(literalCount - 257, 5);
+    bits.put(distanceCount - 1, 5);
+    bits.put(runCodeCount - 4, 4);
+    for (int i = 0; i < runCodeCount; ++i)
+      bits.put(runLengths[kCodeLengthOrder[i]], 3);
+    unsigned short runCodes[19];
+    huffmanCodes(runLengths, 19, runCodes);
+    for (size_t i = 0; i < runs.size(); ++i) {
+      bits.put(runCodes[runs[i]], runLengths[runs[i]]);
+      if (runs[i] >= 16)
+        bits.put(runExtra[i], runs[i] == 16 ? 2 : runs[i] == 17 ? 3 : 7);
+    }
+  }
+  huffmanCodes(literalLengths, literalCodeCount, literalCodes);
+  huffmanCodes(distanceLengths, 30, distanceCodes);
+
+  for (size_t i = 0; i < symbols.size(); ++i) {
+    Symbol s = symbols[i];
+    if (!s.distance) {
+      bits.put(literalCodes[s.value], literalLengths[s.value]);
+      continue;
+    }
+    int lengthCode = t.lengthCode[s.value];
+    bits.put(literalCodes[257 + lengthCode], literalLengths[257 + lengthCode]);
+    if (kLengthExtra[lengthCode])
+      bits.put(s.value - kLengthBase[lengthCode], kLengthExtra[lengthCode]);
+    int distanceCode = t.distance(s.distance);
+    bits.put(distanceCodes[distanceCode], distanceLengths[distanceCode]);
+    if (kDistanceExtra[distanceCode])
+      bits.put(s.distance - kDistanceBase[distanceCode], kDistanceExtra[distanceCode]);
+  }
+  bits.put(literalCodes[256], literalLengths[256]);
+}
+
+int trailingZeros(unsigned long long x)
+{
+#ifdef _MSC_VER
+  unsigned long index;
+  _BitScanForward64(&index, x);
+  return int(index);
+#else
+  return __builtin_ctzll(x);
+#endif
+}
+
+// common prefix of a and b, up to 'limit' bytes, eight at a time
+int matchLength(unsigned char const* a, unsigned char const* b, int limit)
+{
+  int length = 0;
+  while (length + 8 <= limit) {
+    unsigned long long x, y;
+    memcpy(&x, a + length, 8);
+    memcpy(&y, b + length, 8);
+    if (x != y)
+      return length + trailingZeros(x ^ y) / 8;
+    length += 8;
+  }
+  while (length < limit && a[length] == b[length])
+    ++length;
+  return length;
+}
+
+// LZ77 over a window of hash chains: head holds the latest position for each
+// hash of three bytes, prev the one before each position
+class Matcher
+{
+public:
+  Matcher(unsigned char const* data, int end, Level const& level)
+    : m_data(data), m_end(end), m_level(level), m_head(size_t(1) << kHashBits, -1), m_prev(kWindow, -1)
+  {
+  }
+
+  void insert(int pos)
+  {
+    if (pos + kMinMatch > m_end)
+      return;
+    unsigned h = hash(pos);
+    m_prev[pos & (kWindow - 1)] = m_head[h];
+    m_head[h] = pos;
+  }
+
+  // longest match for 'pos' (already inserted) beating 'atLeast'; 0 if none
+  int find(int pos, int atLeast, int& distance) const
+  {
+    int limit = min(kMaxMatch, m_end - pos);
+    if (limit < kMinMatch || limit <= atLeast)
+      return 0;
+    int best = max(atLeast, kMinMatch - 1), chain = m_level.maxChain;
+    // past a window behind 'pos', a slot of m_prev has been reused
+    int oldest = pos - (kWindow - 1);
+    for (int candidate = m_prev[pos & (kWindow - 1)]; candidate >= 0 && candidate >= oldest && chain-- > 0;) {
+      // the byte that would make this candidate longer than 'best' must match
+      if (m_data[candidate + best] == m_data[pos + best]) {
+        int length = matchLength(m_data + candidate, m_data + pos, limit);
+        if (length > best) {
+          best = length;
+          distance = pos - candidate;
+          if (length >= m_level.niceLength || length == limit)
+            break;
+        }
+      }
+      int next = m_prev[candidate & (kWindow - 1)];
+      if (next >= candidate)
+        break;
+      candidate = next;
+    }
+    if (best < kMinMatch || best <= atLeast)
+      return 0;
+    // a short match far back codes bigger than its literals
+    if (best == kMinMatch && distance > 4096)
+      return 0;
+    return best;
+  }
+
+private:
+  unsigned hash(int pos) const
+  {
+    unsigned v = m_data[pos] | m_data[pos + 1] << 8 | m_data[pos + 2] << 16;
+    return (v * 2654435761u) >> (32 - kHashBits);
+  }
+
+  unsigned char const* m_data;
+  int m_end;
+  Level m_level;
+  vector<int> m_head, m_prev;
+};
+
+} // namespace
+
+void deflateCompress(unsigned char const* data, size_t dictionary, size_t size, int level, bool last,
+  vector<unsigned char>& out)
+{
+  level = max(0, min(9, level));
+  BitWriter bits(out);
+
+  if (level == 0) {
+    if (size > 0 || last)
+      writeStored(bits, data + dictionary, size, last);
+  } else {
+    // only the last window of the dictionary can be referenced
+    size_t skip = dictionary > size_t(kWindow) ? dictionary - kWindow : 0;
+    unsigned char const* base = data + skip;
+    int start = int(dictionary - skip), end = int(dictionary - skip + size);
+
+    Matcher matcher(base, end, kLevels[level]);
+    for (int pos = 0; pos < start; ++pos)
+      matcher.insert(pos);
+
+    vector<Symbol> symbols;
+    symbols.reserve(kBlockSymbols + 1);
+    int blockStart = start, emitted = start;
+    auto literal = [&](int pos) {
+      Symbol s = { base[pos], 0 };
+      symbols.push_back(s);
+      emitted = pos + 1;
+    };
+    auto match = [&](int length, int distance) {
+      Symbol s = { (unsigned short)length, (unsigned short)distance };
+      symbols.push_back(s);
+      emitted += length;
+    };
+    auto flush = [&](bool final) {
+      writeBlock(bits, symbols, base + blockStart, size_t(emitted - blockStart), final);
+      symbols.clear();
+      blockStart = emitted;
+    };
+
+    bool lazy = kLevels[level].lazy;
+    int pending = 0, pendingDistance = 0;  // lazy: the match found at pos - 1
+    for (int pos = start; pos < end;) {
+      matcher.insert(pos);
+      int distance = 0;
+      int length = pending >= kLevels[level].niceLength ? 0 : matcher.find(pos, pending, distance);
+
+      if (!lazy) {
+        if (length) {
+          match(length, distance);
+          for (int k = 1; k < length; ++k)
+            matcher.insert(pos + k);
+          pos += length;
+        } else {
+          literal(pos);
+          ++pos;
+        }
+      } else if (pending && !length) {
+        // the match at pos - 1 wins; pos itself is already inserted
+        match(pending, pendingDistance);
+        for (int k = 1; k < pending - 1; ++k)
+          matcher.insert(pos + k);
+        pos += pending - 1;
+        pending = 0;
+      } else {
+        if (pending || pos > emitted)
+          literal(pos - 1);
+        pending = length;
+        pendingDistance = distance;
+        ++pos;
+      }
+
+      if (symbols.size() >= kBlockSymbols)
+        flush(false);
+    }
+    if (lazy && emitted < end) {
+      if (pending)
+        match(pending, pendingDistance);
+      else
+        literal(end - 1);
+    }
+    flush(last);
+  }
+
+  // sync flush: an empty stored block ends the piece on a byte boundary
+  if (!last)
+    writeStored(bits, NULL, 0, false);
+  bits.align();
+}
+
+unsigned adler32(unsigned adler, unsigned char const* data, size_t size)
+{
+  const unsigned kBase = 65521;
+  unsigned a = adler & 0xFFFF, b = adler >> 16;
+  while (size > 0) {
+    // the most bytes before b can overflow 32 bits
+    size_t chunk = min(size, size_t(5552));
+    size -= chunk;
+    for (size_t i = 0; i < chunk; ++i) {
+      a += data[i];
+      b += a;
+    }
+    data += chunk;
+    a %= kBase;
+    b %= kBase;
+  }
+  return b << 16 | a;
+}
+
+unsigned adler32Combine(unsigned first, unsigned second, size_t secondSize)
+{
+  const unsigned kBase = 65521;
+  unsigned remainder = unsigned(secondSize % kBase);
+  unsigned long long a = first & 0xFFFF;
+  unsigned long long b = (remainder * a) % kBase;
+  a += (second & 0xFFFF) + kBase - 1;
+  b += (first >> 16) + (second >> 16) + kBase - remainder;
+  a %= kBase;
+  b %= kBase;
+  return unsigned(b << 16 | a);
+}
+
+unsigned crc32(unsigned crc, unsigned char const* data, size_t size)
+{
+  unsigned const* table = tables().crc;
+  crc = ~crc;
+  for (size_t i = 0; i < size; ++i)
+    crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+  return ~crc;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+// Raw deflate (RFC 1951) for one piece of a stream that may be compressed
+// in several pieces at once. data[0, dictionary) is history only: it is
+// searched for matches (the last 32 KB of it) but not emitted, so a piece
+// given the end of the piece before it as its dictionary continues the same
+// stream. The compressed data is appended to 'out' in whole bytes: with
+// 'last' its final block is marked final, otherwise it ends with an empty
+// stored block (a sync flush) so the next piece starts on a byte boundary
+// and the pieces can simply be concatenated.
+//
+// 'level' trades speed for size like zlib's: 1 is fastest, 9 smallest and
+// 0 only stores.
+void deflateCompress(unsigned char const* data, std::size_t dictionary, std::size_t size, int level, bool last,
+  std::vector<unsigned char>& out);
+
+// Running checksums with zlib's conventions: start from adler32(1, ...) and
+// crc32(0, ...) and pass the previous result back in to continue.
+unsigned adler32(unsigned adler, unsigned char const* data, std::size_t size);
+unsigned crc32(unsigned crc, unsigned char const* data, std::size_t size);
+
+// adler32 of two pieces back to back, given the checksum of each and the
+// length of the second
+unsigned adler32Combine(unsigned first, unsigned second, std::size_t secondSize);
@@ -0,0 +1,249 @@
+#include "frame_profiler.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+using namespace std;
+
+static char const* const kStageNames[STAGE_COUNT] = { "poll", "upload", "draw", "swap" };
+
+RollingSamples::RollingSamples(size_t capacity)
+  : m_values(capacity), m_next(0), m_filled(0)
+{
+}
+
+void RollingSamples::add(float value)
+{
+  m_values[m_next] = value;
+  m_next = (m_next + 1) % m_values.size();
+  if (m_filled < m_values.size())
+    ++m_filled;
+}
+
+float RollingSamples::percentile(float p) const
+{
+  if (m_filled == 0)
+    return 0.0f;
+
+  vector<float> sorted(m_values.begin(), m_values.begin() + m_filled);
+  size_t rank = min(m_filled - 1, size_t(p / 100.0f * m_filled));
+  nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+  return sorted[rank];
+}
+
+FrameProfiler::FrameProfiler()
+  : m_gpuTimers(false), m_frame(0), m_oldestPending(0), m_droppedGpuFrames(0),
+    m_trace(NULL), m_traceJson(false), m_traceFirstRecord(true)
+{
+  memset(m_queries, 0, sizeof(m_queries));
+  memset(m_records, 0, sizeof(m_records));
+}
+
+FrameProfiler::~FrameProfiler()
+{
+  shutdown();
+}
+
+bool FrameProfiler::init(bool gpuTimers, char const* tracePath)
+{
+  m_gpuTimers = gpuTimers;
+  if (m_gpuTimers)
+    glGenQueries(kQueryLatency * STAGE_COUNT, &m_queries[0][0]);
+
+  if (tracePath) {
+    m_trace = fopen(tracePath, "w");
+    if (!m_trace) {
+      cerr << "Error: can't open trace file " << tracePath << endl;
+      return false;
+    }
+
+    size_t length = strlen(tracePath);
+    m_traceJson = length >= 5 && strcmp(tracePath + length - 5, ".json") == 0;
+    if (m_traceJson) {
+      fputs("[\n", m_trace);
+    } else {
+      fputs("frame,frame_ms", m_trace);
+      for (int s = 0; s < STAGE_COUNT; ++s)
+        fprintf(m_trace, ",%s_ms", kStageNames[s]);
+      for (int s = 0; s < STAGE_COUNT; ++s)
+        if (isGpuStage(FrameStage(s)))
+          fprintf(m_trace, ",gpu_%s_ms", kStageNames[s]);
+      fputs("\n", m_trace);
+    }
+  }
+
+  m_lastReport = Clock::now();
+  return true;
+}
+
+void FrameProfiler::shutdown()
+{
+  if (m_gpuTimers) {
+    resolve(m_frame, true);
+    glDeleteQueries(kQueryLatency * STAGE_COUNT, &m_queries[0][0]);
+    m_gpuTimers = false;
+  }
+
+  if (m_trace) {
+    if (m_traceJson)
+      fputs("\n]\n", m_trace);
+    fclose(m_trace);
+    m_trace = NULL;
+  }
+}
+
+void FrameProfiler::beginFrame()
+{
+  FrameRecord& record = m_records[m_frame % kQueryLatency];
+
+  // the slot still holds a frame whose queries haven't come back; drop its
+  // GPU times rather than waiting on them. It is the oldest frame pending,
+  // and the newer ones keep their chance to resolve.
+  if (record.pending)
+    resolve(m_frame - kQueryLatency + 1, true);
+
+  memset(&record, 0, sizeof(record));
+  record.frame = m_frame;
+  m_frameStart = Clock::now();
+}
+
+void FrameProfiler::beginStage(FrameStage stage)
+{
+  if (m_gpuTimers && isGpuStage(stage)) {
+    glBeginQuery(GL_TIME_ELAPSED, m_queries[m_frame % kQueryLatency][stage]);
+    m_records[m_frame % kQueryLatency].gpuIssued[stage] = true;
+  }
+  m_stageStart[stage] = Clock::now();
+}
+
+void FrameProfiler::endStage(FrameStage stage)
+{
+  chrono::duration<float, milli> elapsed = Clock::now() - m_stageStart[stage];
+  m_records[m_frame % kQueryLatency].cpuMs[stage] += elapsed.count();
+
+  if (m_gpuTimers && isGpuStage(stage))
+    glEndQuery(GL_TIME_ELAPSED);
+}
+
+void FrameProfiler::endFrame()
+{
+  FrameRecord& record = m_records[m_frame % kQueryLatency];
+  chrono::duration<float, milli> elapsed = Clock::now() - m_frameStart;
+  record.frameMs = elapsed.count();
+  record.pending = true;
+  ++m_frame;
+
+  resolve(m_frame, false);
+}
+
+void FrameProfiler::resolve(unsigned long long end, bool dropUnavailable)
+{
+  for (; m_oldestPending < end; ++m_oldestPending) {
+    FrameRecord& record = m_records[m_oldestPending % kQueryLatency];
+    GLuint* queries = m_queries[m_oldestPending % kQueryLatency];
+
+    bool available = true;
+    for (int s = 0; s < STAGE_COUNT && available; ++s) {
+      if (record.gpuIssued[s]) {
+        GLint ready = 0;
+        glGetQueryObjectiv(queries[s], GL_QUERY_RESULT_AVAILABLE, &ready);
+        available = ready != 0;
+      }
+    }
+
+    if (available) {
+      for (int s = 0; s < STAGE_COUNT; ++s) {
+        if (record.gpuIssued[s]) {
+          GLuint64 ns = 0;
+          glGetQueryObjectui64v(queries[s], GL_QUERY_RESULT, &ns);
+          record.gpuMs[s] = ns / 1.0e6f;
+        }
+      }
+    } else if (dropUnavailable) {
+      memset(record.gpuIssued, 0, sizeof(record.gpuIssued));
+      ++m_droppedGpuFrames;
+    } else {
+      // results arrive in order, so nothing newer is ready either
+      break;
+    }
+
+    finish(record);
+  }
+}
+
+void FrameProfiler::finish(FrameRecord& record)
+{
+  for (int s = 0; s < STAGE_COUNT; ++s) {
+    m_cpu[s].add(record.cpuMs[s]);
+    if (record.gpuIssued[s])
+      m_gpu[s].add(record.gpuMs[s]);
+  }
+  m_total.add(record.frameMs);
+
+  if (m_trace)
+    writeTrace(record);
+
+  record.pending = false;
+}
+
+void FrameProfiler::writeTrace(FrameRecord const& record)
+{
+  if (m_traceJson) {
+    fprintf(m_trace, "%s  {\"frame\": %llu, \"frame_ms\": %.4f", m_traceFirstRecord ? "" : ",\n", record.frame, record.frameMs);
+    for (int s = 0; s < STAGE_COUNT; ++s)
+      fprintf(m_trace, ", \"%s_ms\": %.4f", kStageNames[s], record.cpuMs[s]);
+    for (int s = 0; s < STAGE_COUNT; ++s)
+      if (record.gpuIssued[s])
+        fprintf(m_trace, ", \"gpu_%s_ms\": %.4f", kStageNames[s], record.gpuMs[s]);
+    fputs("}", m_trace);
+  } else {
+    fprintf(m_trace, "%llu,%.4f", record.frame, record.frameMs);
+    for (int s = 0; s < STAGE_COUNT; ++s)
+      fprintf(m_trace, ",%.4f", record.cpuMs[s]);
+    for (int s = 0; s < STAGE_COUNT; ++s) {
+      if (!isGpuStage(FrameStage(s)))
+        continue;
+      if (record.gpuIssued[s])
+        fprintf(m_trace, ",%.4f", record.gpuMs[s]);
+      else
+        fputs(",", m_trace);
+    }
+    fputs("\n", m_trace);
+  }
+  m_traceFirstRecord = false;
+}
+
+void FrameProfiler::report()
+{
+  if (m_total.size() == 0)
+    return;
+
+  printf("frame timings over the last %zu frames (ms):\n", m_total.size());
+  printf("  %-12s %8s %8s %8s\n", "stage", "p50", "p95", "p99");
+  printf("  %-12s %8.3f %8.3f %8.3f\n", "frame",
+    m_total.percentile(50), m_total.percentile(95), m_total.percentile(99));
+  for (int s = 0; s < STAGE_COUNT; ++s)
+    printf("  %-12s %8.3f %8.3f %8.3f\n", kStageNames[s],
+      m_cpu[s].percentile(50), m_cpu[s].percentile(95), m_cpu[s].percentile(99));
+  for (int s = 0; s < STAGE_COUNT; ++s) {
+    if (m_gpu[s].size() == 0)
+      continue;
+    char name[32];
+    snprintf(name, sizeof(name), "gpu %s", kStageNames[s]);
+    printf("  %-12s %8.3f %8.3f %8.3f\n", name,
+      m_gpu[s].percentile(50), m_gpu[s].percentile(95), m_gpu[s].percentile(99));
+  }
+  if (m_droppedGpuFrames)
+    printf("  (%llu frames had GPU timings dropped)\n", m_droppedGpuFrames);
+}
+
+void FrameProfiler::reportEvery(double intervalSeconds)
+{
+  Clock::time_point now = Clock::now();
+  if (chrono::duration<double>(now - m_lastReport).count() < intervalSeconds)
+    return;
+
+  m_lastReport = now;
+  report();
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+enum FrameStage {
+  STAGE_POLL,
+  STAGE_UPLOAD,
+  STAGE_DRAW,
+  STAGE_SWAP,
+  STAGE_COUNT
+};
+
+// Fixed-size window of the most recent samples of one timing series.
+class RollingSamples
+{
+public:
+  explicit RollingSamples(size_t capacity = 300);
+
+  void add(float value);
+  size_t size() const { return m_filled; }
+  float percentile(float p) const;
+
+private:
+  std::vector<float> m_values;
+  size_t m_next, m_filled;
+};
+
+// Per-stage CPU timestamps plus GL_TIME_ELAPSED queries for the stages that
+// do GPU work. Queries go into a ring a few frames deep and are only read
+// once GL reports them available, so measuring never stalls the pipeline;
+// results that are still pending when their slot comes round are dropped.
+// Works without GPU timers too (headless runs, drivers without the query).
+class FrameProfiler
+{
+public:
+  static const int kQueryLatency = 4;
+
+  FrameProfiler();
+  ~FrameProfiler();
+
+  // tracePath may be NULL; a ".json" suffix selects JSON, anything else CSV
+  bool init(bool gpuTimers, char const* tracePath);
+  void shutdown();
+
+  void beginFrame();
+  void beginStage(FrameStage stage);
+  void endStage(FrameStage stage);
+  void endFrame();
+
+  // prints p50/p95/p99 of the rolling window to stdout
+  void report();
+
+  // prints at most every 'intervalSeconds', call once per frame
+  void reportEvery(double intervalSeconds);
+
+private:
+  typedef std::chrono::steady_clock Clock;
+
+  struct FrameRecord {
+    unsigned long long frame;
+    float cpuMs[STAGE_COUNT];
+    float frameMs;
+    float gpuMs[STAGE_COUNT];
+    bool gpuIssued[STAGE_COUNT];
+    bool pending;
+  };
+
+  static bool isGpuStage(FrameStage stage) { return stage == STAGE_UPLOAD || stage == STAGE_DRAW; }
+
+  // finishes frames before 'end' whose results are in, stopping at the
+  // first that isn't unless 'dropUnavailable'
+  void resolve(unsigned long long end, bool dropUnavailable);
+  void finish(FrameRecord& record);
+  void writeTrace(FrameRecord const& record);
+
+  bool m_gpuTimers;
+  GLuint m_queries[kQueryLatency][STAGE_COUNT];
+  FrameRecord m_records[kQueryLatency];
+  unsigned long long m_frame, m_oldestPending;
+  Clock::time_point m_frameStart, m_stageStart[STAGE_COUNT], m_lastReport;
+
+  RollingSamples m_cpu[STAGE_COUNT], m_gpu[STAGE_COUNT], m_total;
+  unsigned long long m_droppedGpuFrames;
+
+  FILE* m_trace;
+  bool m_traceJson, m_traceFirstRecord;
+};
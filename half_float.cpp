@@ -0,0 +1,75 @@
+#include "half_float.h"
+
+#include <cstring>
+
+#include <glm/gtc/packing.hpp>
+
+#if defined(__F16C__) || defined(__AVX2__)
+#define HALF_FLOAT_F16C
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define HALF_FLOAT_SSE2
+#include <emmintrin.h>
+#endif
+
+#ifdef HALF_FLOAT_SSE2
+// Branchless float -> half with round to nearest even, one result per 32-bit
+// lane (sign-extended so _mm_packs_epi32 narrows it without saturating).
+// After F. Giesen, "float->half variants".
+static __m128i floatToHalfSSE2(__m128 f)
+{
+  const __m128i f16max = _mm_set1_epi32((127 + 16) << 23);        // >= this rounds to inf
+  const __m128i minNormal = _mm_set1_epi32((127 - 14) << 23);     // smallest value giving a normal half
+  const __m128i subnormMagic = _mm_set1_epi32(((127 - 15) + (23 - 10) + 1) << 23);
+  const __m128i normalBias = _mm_set1_epi32(0xfff - ((127 - 15) << 23));
+
+  __m128 justSign = _mm_and_ps(_mm_set1_ps(-0.0f), f);
+  __m128 absf = _mm_xor_ps(f, justSign);
+  __m128i absi = _mm_castps_si128(absf);
+
+  __m128i isNan = _mm_castps_si128(_mm_cmpunord_ps(absf, absf));
+  __m128i isRegular = _mm_cmpgt_epi32(f16max, absi);
+  __m128i infOrNan = _mm_or_si128(_mm_and_si128(isNan, _mm_set1_epi32(0x200)), _mm_set1_epi32(0x7c00));
+
+  // subnormal result: let the FPU round the mantissa by adding a magic number
+  __m128i isSubnormal = _mm_cmpgt_epi32(minNormal, absi);
+  __m128i subnormal = _mm_sub_epi32(_mm_castps_si128(_mm_add_ps(absf, _mm_castsi128_ps(subnormMagic))), subnormMagic);
+
+  // normal result: rebias the exponent and round, ties to the even mantissa
+  __m128i mantissaOdd = _mm_srai_epi32(_mm_slli_epi32(absi, 31 - 13), 31);
+  __m128i normal = _mm_srli_epi32(_mm_sub_epi32(_mm_add_epi32(absi, normalBias), mantissaOdd), 13);
+
+  __m128i finite = _mm_or_si128(_mm_and_si128(isSubnormal, subnormal), _mm_andnot_si128(isSubnormal, normal));
+  __m128i joined = _mm_or_si128(_mm_and_si128(isRegular, finite), _mm_andnot_si128(isRegular, infOrNan));
+
+  return _mm_or_si128(joined, _mm_srai_epi32(_mm_castps_si128(justSign), 16));
+}
+#endif
+
+void packHalfArray(float const* src, glm::uint16* dst, std::size_t count)
+{
+  std::size_t i = 0;
+
+  // every block is loaded before it is stored and the output is half the size
+  // of the input, so writes never overtake unread input when dst == src
+#if defined(HALF_FLOAT_F16C)
+  for (; i + 8 <= count; i += 8) {
+    __m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), h);
+  }
+#elif defined(HALF_FLOAT_SSE2)
+  for (; i + 8 <= count; i += 8) {
+    __m128i lo = floatToHalfSSE2(_mm_loadu_ps(src + i));
+    __m128i hi = floatToHalfSSE2(_mm_loadu_ps(src + i + 4));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packs_epi32(lo, hi));
+  }
+#endif
+
+  for (; i + 4 <= count; i += 4) {
+    glm::uint64 packed = glm::packHalf4x16(glm::vec4(src[i], src[i + 1], src[i + 2], src[i + 3]));
+    std::memcpy(dst + i, &packed, sizeof(packed));
+  }
+
+  for (; i < count; ++i)
+    dst[i] = glm::packHalf1x16(src[i]);
+}
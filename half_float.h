@@ -0,0 +1,10 @@
+#pragma once
+
+#include <cstddef>
+
+#include <glm/glm.hpp>
+
+// Converts 'count' floats to IEEE 754 half floats (round to nearest even),
+// the layout GL_HALF_FLOAT textures expect. 'dst' may alias 'src', which
+// narrows a float image in place without a second allocation.
+void packHalfArray(float const* src, glm::uint16* dst, std::size_t count);
@@ -0,0 +1,470 @@
+#include "image_writer.h"
+
+#include "cpu_features.h"
+#include "deflate.h"
+#include "job_system.h"
+#include "lz4_block.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#ifdef SIMD_X86
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+namespace {
+
+const int kPngFilters = 5;  // none, sub, up, average, paeth
+
+void putBigEndian(vector<unsigned char>& out, unsigned value)
+{
+  for (int shift = 24; shift >= 0; shift -= 8)
+    out.push_back((unsigned char)(value >> shift));
+}
+
+// length, type and data of a PNG chunk; returns the running CRC over type
+// and data, which the caller appends (or extends first)
+unsigned beginChunk(vector<unsigned char>& out, char const* type, unsigned char const* data, size_t size)
+{
+  putBigEndian(out, unsigned(size));
+  size_t start = out.size();
+  out.insert(out.end(), type, type + 4);
+  out.insert(out.end(), data, data + size);
+  return crc32(0, out.data() + start, out.size() - start);
+}
+
+void appendChunk(vector<unsigned char>& out, char const* type, unsigned char const* data, size_t size)
+{
+  putBigEndian(out, beginChunk(out, type, data, size));
+}
+
+int paeth(int a, int b, int c)
+{
+  int pa = abs(b - c), pb = abs(a - c), pc = abs(a + b - 2 * c);
+  return pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+}
+
+// Every filter of bytes [begin, end) of a row into filtered[type], adding
+// the magnitude of each result (as a signed byte) to sums[type]. 'prior' is
+// the row above, all zeros for the first.
+//
+// The kernels below handle the largest prefix they can past the first pixel
+// and return where they stopped; this finishes the rest. Filtering only
+// reads the original rows, so every byte is independent and the whole row
+// vectorises.
+void filterBytes(unsigned char const* row, unsigned char const* prior, int begin, int end, int bpp,
+  unsigned char* const* filtered, unsigned long long* sums)
+{
+  for (int i = begin; i < end; ++i) {
+    int x = row[i], b = prior[i];
+    int a = i >= bpp ? row[i - bpp] : 0, c = i >= bpp ? prior[i - bpp] : 0;
+    unsigned char values[kPngFilters] = { (unsigned char)x, (unsigned char)(x - a), (unsigned char)(x - b),
+      (unsigned char)(x - ((a + b) >> 1)), (unsigned char)(x - paeth(a, b, c)) };
+    for (int f = 0; f < kPngFilters; ++f) {
+      filtered[f][i] = values[f];
+      sums[f] += values[f] < 128 ? values[f] : 256 - values[f];
+    }
+  }
+}
+
+#ifdef SIMD_X86
+// |v| of each byte taken as signed, summed into the 64-bit halves
+SIMD_TARGET_SSE2 __m128i magnitudeSSE2(__m128i v)
+{
+  __m128i magnitude = _mm_min_epu8(v, _mm_sub_epi8(_mm_setzero_si128(), v));
+  return _mm_sad_epu8(magnitude, _mm_setzero_si128());
+}
+
+// paeth predictor on eight 16-bit lanes
+SIMD_TARGET_SSE2 __m128i paethSSE2(__m128i a, __m128i b, __m128i c)
+{
+  __m128i zero = _mm_setzero_si128();
+  __m128i bc = _mm_sub_epi16(b, c), ac = _mm_sub_epi16(a, c), abc = _mm_add_epi16(bc, ac);
+  __m128i pa = _mm_max_epi16(bc, _mm_sub_epi16(zero, bc));
+  __m128i pb = _mm_max_epi16(ac, _mm_sub_epi16(zero, ac));
+  __m128i pc = _mm_max_epi16(abc, _mm_sub_epi16(zero, abc));
+  __m128i notA = _mm_or_si128(_mm_cmpgt_epi16(pa, pb), _mm_cmpgt_epi16(pa, pc));
+  __m128i notB = _mm_cmpgt_epi16(pb, pc);
+  __m128i bOrC = _mm_or_si128(_mm_and_si128(notB, c), _mm_andnot_si128(notB, b));
+  return _mm_or_si128(_mm_and_si128(notA, bOrC), _mm_andnot_si128(notA, a));
+}
+
+SIMD_TARGET_SSE2 int filterBytesSSE2(unsigned char const* row, unsigned char const* prior, int size, int bpp,
+  unsigned char* const* filtered, unsigned long long* sums)
+{
+  __m128i zero = _mm_setzero_si128(), one = _mm_set1_epi8(1);
+  __m128i total[kPngFilters] = { zero, zero, zero, zero, zero };
+  int i = bpp;
+  for (; i + 16 <= size; i += 16) {
+    __m128i x = _mm_loadu_si128(reinterpret_cast<__m128i const*>(row + i));
+    __m128i a = _mm_loadu_si128(reinterpret_cast<__m128i const*>(row + i - bpp));
+    __m128i b = _mm_loadu_si128(reinterpret_cast<__m128i const*>(prior + i));
+    __m128i c = _mm_loadu_si128(reinterpret_cast<__m128i const*>(prior + i - bpp));
+    // pavgb rounds up; take the carry back off where a + b is odd
+    __m128i average = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one));
+    __m128i low = paethSSE2(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero), _mm_unpacklo_epi8(c, zero));
+    __m128i high = paethSSE2(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero), _mm_unpackhi_epi8(c, zero));
+    __m128i values[kPngFilters] = { x, _mm_sub_epi8(x, a), _mm_sub_epi8(x, b), _mm_sub_epi8(x, average),
+      _mm_sub_epi8(x, _mm_packus_epi16(low, high)) };
+    for (int f = 0; f < kPngFilters; ++f) {
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(filtered[f] + i), values[f]);
+      total[f] = _mm_add_epi64(total[f], magnitudeSSE2(values[f]));
+    }
+  }
+  for (int f = 0; f < kPngFilters; ++f) {
+    unsigned long long halves[2];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(halves), total[f]);
+    sums[f] += halves[0] + halves[1];
+  }
+  return i;
+}
+
+SIMD_TARGET_AVX2 __m256i paethAVX2(__m256i a, __m256i b, __m256i c)
+{
+  __m256i bc = _mm256_sub_epi16(b, c), ac = _mm256_sub_epi16(a, c);
+  __m256i pa = _mm256_abs_epi16(bc), pb = _mm256_abs_epi16(ac), pc = _mm256_abs_epi16(_mm256_add_epi16(bc, ac));
+  __m256i notA = _mm256_or_si256(_mm256_cmpgt_epi16(pa, pb), _mm256_cmpgt_epi16(pa, pc));
+  __m256i bOrC = _mm256_blendv_epi8(b, c, _mm256_cmpgt_epi16(pb, pc));
+  return _mm256_blendv_epi8(a, bOrC, notA);
+}
+
+// the SSE2 kernel at twice the width; unpack and pack both work within
+// 128-bit halves, so the bytes come back in order
+SIMD_TARGET_AVX2 int filterBytesAVX2(unsigned char const* row, unsigned char const* prior, int size, int bpp,
+  unsigned char* const* filtered, unsigned long long* sums)
+{
+  __m256i zero = _mm256_setzero_si256(), one = _mm256_set1_epi8(1);
+  __m256i total[kPngFilters] = { zero, zero, zero, zero, zero };
+  int i = bpp;
+  for (; i + 32 <= size; i += 32) {
+    __m256i x = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(row + i));
+    __m256i a = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(row + i - bpp));
+    __m256i b = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(prior + i));
+    __m256i c = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(prior + i - bpp));
+    __m256i average = _mm256_sub_epi8(_mm256_avg_epu8(a, b), _mm256_and_si256(_mm256_xor_si256(a, b), one));
+    __m256i low = paethAVX2(_mm256_unpacklo_epi8(a, zero), _mm256_unpacklo_epi8(b, zero),
+      _mm256_unpacklo_epi8(c, zero));
+    __m256i high = paethAVX2(_mm256_unpackhi_epi8(a, zero), _mm256_unpackhi_epi8(b, zero),
+      _mm256_unpackhi_epi8(c, zero));
+    __m256i values[kPngFilters] = { x, _mm256_sub_epi8(x, a), _mm256_sub_epi8(x, b), _mm256_sub_epi8(x, average),
+      _mm256_sub_epi8(x, _mm256_packus_epi16(low, high)) };
+    for (int f = 0; f < kPngFilters; ++f) {
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(filtered[f] + i), values[f]);
+      __m256i magnitude = _mm256_min_epu8(values[f], _mm256_sub_epi8(zero, values[f]));
+      total[f] = _mm256_add_epi64(total[f], _mm256_sad_epu8(magnitude, zero));
+    }
+  }
+  for (int f = 0; f < kPngFilters; ++f) {
+    unsigned long long quarters[4];
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(quarters), total[f]);
+    sums[f] += quarters[0] + quarters[1] + quarters[2] + quarters[3];
+  }
+  return i;
+}
+#endif
+
+// Filters one row into out (type byte first) with the filter whose output
+// has the smallest sum of magnitudes, the usual predictor of what deflates
+// best. 'scratch' holds kPngFilters rows.
+void filterRow(unsigned char const* row, unsigned char const* prior, int size, int bpp, SimdLevel level,
+  unsigned char* scratch, unsigned char* out)
+{
+  unsigned char* filtered[kPngFilters];
+  for (int f = 0; f < kPngFilters; ++f)
+    filtered[f] = scratch + size_t(f) * size;
+  unsigned long long sums[kPngFilters] = {};
+
+  int first = min(bpp, size);
+  filterBytes(row, prior, 0, first, bpp, filtered, sums);
+  int done = first;
+  switch (level) {
+#ifdef SIMD_X86
+  case SIMD_AVX512:
+  case SIMD_AVX2: done = filterBytesAVX2(row, prior, size, bpp, filtered, sums); break;
+  case SIMD_SSE2: done = filterBytesSSE2(row, prior, size, bpp, filtered, sums); break;
+#endif
+  default: break;
+  }
+  filterBytes(row, prior, max(done, first), size, bpp, filtered, sums);
+
+  int best = 0;
+  for (int f = 1; f < kPngFilters; ++f)
+    if (sums[f] < sums[best])
+      best = f;
+  out[0] = (unsigned char)best;
+  memcpy(out + 1, filtered[best], size);
+}
+
+bool checkImage(char const* format, unsigned char const* pixels, int width, int height, int channels)
+{
+  if (pixels && width > 0 && height > 0 && channels >= 1 && channels <= 4)
+    return true;
+  cerr << "Error: can't write " << format << ": " << width << "x" << height << " image with " << channels
+    << " channels" << endl;
+  return false;
+}
+
+bool hasExtension(string const& path, char const* extension)
+{
+  size_t length = strlen(extension);
+  if (path.size() < length)
+    return false;
+  for (size_t i = 0; i < length; ++i)
+    if (tolower((unsigned char)path[path.size() - length + i]) != extension[i])
+      return false;
+  return true;
+}
+
+} // namespace
+
+bool writePng(vector<unsigned char>& out, unsigned char const* pixels, int width, int height, int channels,
+  PngOptions const& options)
+{
+  TRACE_ZONE("writePng");
+  if (!checkImage("PNG", pixels, width, height, channels))
+    return false;
+
+  // the rows with their filter bytes, as deflate sees them
+  size_t rowSize = size_t(width) * channels, stride = rowSize + 1;
+  vector<unsigned char> filtered(stride * height);
+  vector<unsigned char> zeros(rowSize, 0);
+  SimdLevel level = activeSimdLevel();
+  jobSystem().parallelFor(0, height, max(1, int((1 << 16) / stride)), [&](int first, int last) {
+    vector<unsigned char> scratch(rowSize * kPngFilters);
+    for (int y = first; y < last; ++y)
+      filterRow(pixels + y * rowSize, y ? pixels + (y - 1) * rowSize : zeros.data(), int(rowSize), channels, level,
+        scratch.data(), filtered.data() + y * stride);
+  });
+
+  int stripRows = options.stripRows > 0 ? options.stripRows : max(1, int((256 << 10) / stride));
+  int strips = (height + stripRows - 1) / stripRows;
+  struct Strip {
+    vector<unsigned char> chunk;  // a whole IDAT chunk but for its CRC
+    unsigned crc, adler;
+    size_t size;
+  };
+  vector<Strip> done(strips);
+  jobSystem().parallelFor(0, strips, 1, [&](int first, int last) {
+    for (int s = first; s < last; ++s) {
+      size_t begin = size_t(s) * stripRows * stride;
+      size_t size = min(size_t(height), size_t(s + 1) * stripRows) * stride - begin;
+      // the zlib header goes in front of the first strip; FLEVEL only
+      // advertises the effort
+      static const unsigned char kHeaders[4][2] = { { 0x78, 0x01 }, { 0x78, 0x5E }, { 0x78, 0x9C }, { 0x78, 0xDA } };
+      int header = options.level < 2 ? 0 : options.level < 6 ? 1 : options.level == 6 ? 2 : 3;
+      vector<unsigned char> data;
+      if (s == 0)
+        data.assign(kHeaders[header], kHeaders[header] + 2);
+      size_t dictionary = min(begin, size_t(32768));
+      deflateCompress(filtered.data() + begin - dictionary, dictionary, size, options.level, s == strips - 1, data);
+
+      Strip& strip = done[s];
+      strip.crc = beginChunk(strip.chunk, "IDAT", data.data(), data.size());
+      strip.adler = adler32(1, filtered.data() + begin, size);
+      strip.size = size;
+    }
+  });
+
+  static const unsigned char kSignature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+  static const unsigned char kColorTypes[5] = { 0, 0, 4, 2, 6 };
+  out.insert(out.end(), kSignature, kSignature + 8);
+  unsigned char header[13];
+  for (int k = 0; k < 4; ++k) {
+    header[k] = (unsigned char)(unsigned(width) >> (24 - 8 * k));
+    header[4 + k] = (unsigned char)(unsigned(height) >> (24 - 8 * k));
+  }
+  header[8] = 8;
+  header[9] = kColorTypes[channels];
+  header[10] = header[11] = header[12] = 0;
+  appendChunk(out, "IHDR", header, sizeof(header));
+
+  // the checksum of the whole stream ends the last strip's chunk, so that
+  // one chunk's length and CRC are only settled here
+  unsigned adler = 1;
+  for (int s = 0; s < strips; ++s)
+    adler = adler32Combine(adler, done[s].adler, done[s].size);
+  for (int s = 0; s < strips; ++s) {
+    Strip& strip = done[s];
+    if (s == strips - 1) {
+      unsigned char trailer[4] = { (unsigned char)(adler >> 24), (unsigned char)(adler >> 16),
+        (unsigned char)(adler >> 8), (unsigned char)adler };
+      strip.chunk.insert(strip.chunk.end(), trailer, trailer + 4);
+      strip.crc = crc32(strip.crc, trailer, 4);
+      unsigned length = unsigned(strip.chunk.size() - 8);
+      for (int k = 0; k < 4; ++k)
+        strip.chunk[k] = (unsigned char)(length >> (24 - 8 * k));
+    }
+    out.insert(out.end(), strip.chunk.begin(), strip.chunk.end());
+    putBigEndian(out, strip.crc);
+  }
+  appendChunk(out, "IEND", NULL, 0);
+  return true;
+}
+
+bool writeQoi(vector<unsigned char>& out, unsigned char const* pixels, int width, int height, int channels)
+{
+  TRACE_ZONE("writeQoi");
+  if (!checkImage("QOI", pixels, width, height, channels))
+    return false;
+
+  bool alpha = channels == 2 || channels == 4;
+  out.insert(out.end(), { 'q', 'o', 'i', 'f' });
+  putBigEndian(out, unsigned(width));
+  putBigEndian(out, unsigned(height));
+  out.push_back(alpha ? 4 : 3);
+  out.push_back(0);  // sRGB with linear alpha
+
+  struct Pixel {
+    unsigned char r, g, b, a;
+    bool operator==(Pixel const& o) const { return r == o.r && g == o.g && b == o.b && a == o.a; }
+  };
+  Pixel seen[64] = {};
+  Pixel previous = { 0, 0, 0, 255 };
+  int run = 0;
+  size_t count = size_t(width) * height;
+  for (size_t i = 0; i < count; ++i) {
+    unsigned char const* p = pixels + i * channels;
+    Pixel pixel;
+    if (channels < 3) {
+      pixel.r = pixel.g = pixel.b = p[0];
+      pixel.a = channels == 2 ? p[1] : 255;
+    } else {
+      pixel.r = p[0];
+      pixel.g = p[1];
+      pixel.b = p[2];
+      pixel.a = channels == 4 ? p[3] : 255;
+    }
+
+    if (pixel == previous) {
+      if (++run == 62 || i + 1 == count) {
+        out.push_back((unsigned char)(0xC0 | (run - 1)));
+        run = 0;
+      }
+      continue;
+    }
+    if (run) {
+      out.push_back((unsigned char)(0xC0 | (run - 1)));
+      run = 0;
+    }
+
+    int slot = (pixel.r * 3 + pixel.g * 5 + pixel.b * 7 + pixel.a * 11) % 64;
+    if (seen[slot] == pixel) {
+      out.push_back((unsigned char)slot);
+    } else if (pixel.a != previous.a) {
+      seen[slot] = pixel;
+      out.insert(out.end(), { 0xFF, pixel.r, pixel.g, pixel.b, pixel.a });
+    } else {
+      seen[slot] = pixel;
+      signed char dr = (signed char)(pixel.r - previous.r), dg = (signed char)(pixel.g - previous.g);
+      signed char db = (signed char)(pixel.b - previous.b);
+      int drg = dr - dg, dbg = db - dg;
+      if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1)
+        out.push_back((unsigned char)(0x40 | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2)));
+      else if (dg >= -32 && dg <= 31 && drg >= -8 && drg <= 7 && dbg >= -8 && dbg <= 7)
+        out.insert(out.end(), { (unsigned char)(0x80 | (dg + 32)), (unsigned char)((drg + 8) << 4 | (dbg + 8)) });
+      else
+        out.insert(out.end(), { 0xFE, pixel.r, pixel.g, pixel.b });
+    }
+    previous = pixel;
+  }
+  out.insert(out.end(), { 0, 0, 0, 0, 0, 0, 0, 1 });
+  return true;
+}
+
+bool writeSpill(vector<unsigned char>& out, void const* pixels, int width, int height, int channels,
+  int bitsPerChannel, SpillOptions const& options)
+{
+  TRACE_ZONE("writeSpill");
+  if (bitsPerChannel != 8 && bitsPerChannel != 16) {
+    cerr << "Error: can't write SPF with " << bitsPerChannel << " bits per channel" << endl;
+    return false;
+  }
+  if (!checkImage("SPF", static_cast<unsigned char const*>(pixels), width, height, channels))
+    return false;
+
+  size_t rowSize = size_t(width) * channels * (bitsPerChannel / 8);
+  int rowsPerBlock = options.rowsPerBlock > 0 ? min(options.rowsPerBlock, height)
+    : max(1, min(height, int((128 << 10) / rowSize)));
+  int blocks = (height + rowsPerBlock - 1) / rowsPerBlock;
+  vector<vector<unsigned char> > coded(blocks);
+  unsigned char const* bytes = static_cast<unsigned char const*>(pixels);
+  jobSystem().parallelFor(0, blocks, 1, [&](int first, int last) {
+    vector<unsigned char> delta;
+    for (int b = first; b < last; ++b) {
+      size_t begin = size_t(b) * rowsPerBlock * rowSize;
+      size_t size = min(size_t(height), size_t(b + 1) * rowsPerBlock) * rowSize - begin;
+      unsigned char const* block = bytes + begin;
+      if (options.predict) {
+        // the first row stays as it is so every block decodes on its own
+        delta.resize(size);
+        memcpy(delta.data(), block, min(size, rowSize));
+        for (size_t i = rowSize; i < size; ++i)
+          delta[i] = (unsigned char)(block[i] - block[i - rowSize]);
+        block = delta.data();
+      }
+
+      vector<unsigned char>& data = coded[b];
+      data.push_back(options.predict ? 2 : 1);
+      lz4Compress(block, size, data);
+      if (data.size() > size + 1) {
+        data.assign(1, 0);
+        data.insert(data.end(), bytes + begin, bytes + begin + size);
+      }
+    }
+  });
+
+  // header, then the offset of every block and of the end
+  size_t start = out.size();
+  out.insert(out.end(), { 'S', 'P', 'F', 'R', 1, (unsigned char)channels, (unsigned char)bitsPerChannel, 0 });
+  unsigned fields[3] = { unsigned(width), unsigned(height), unsigned(rowsPerBlock) };
+  for (int f = 0; f < 3; ++f)
+    for (int k = 0; k < 4; ++k)
+      out.push_back((unsigned char)(fields[f] >> (8 * k)));
+  out.insert(out.end(), 4, 0);
+  unsigned long long offset = 24 + (blocks + 1) * 8ull;
+  for (int b = 0; b <= blocks; ++b) {
+    for (int k = 0; k < 8; ++k)
+      out.push_back((unsigned char)(offset >> (8 * k)));
+    if (b < blocks)
+      offset += coded[b].size();
+  }
+  for (int b = 0; b < blocks; ++b)
+    out.insert(out.end(), coded[b].begin(), coded[b].end());
+  if (out.size() - start > 0xFFFFFFFFull)
+    cerr << "Warning: SPF over 4 GB, which stb_image can't read" << endl;
+  return true;
+}
+
+bool writeImage(string const& path, unsigned char const* pixels, int width, int height, int channels, int jpegQuality)
+{
+  vector<unsigned char> encoded;
+  bool ok;
+  if (hasExtension(path, ".png")) {
+    ok = writePng(encoded, pixels, width, height, channels);
+  } else if (hasExtension(path, ".jpg") || hasExtension(path, ".jpeg")) {
+    ok = writeJpeg(encoded, pixels, width, height, channels, jpegQuality);
+  } else if (hasExtension(path, ".qoi")) {
+    ok = writeQoi(encoded, pixels, width, height, channels);
+  } else if (hasExtension(path, ".spf")) {
+    ok = writeSpill(encoded, pixels, width, height, channels);
+  } else {
+    cerr << "Error: don't know how to write " << path << " (use .png, .jpg, .qoi or .spf)" << endl;
+    return false;
+  }
+  if (!ok)
+    return false;
+
+  ofstream file(path.c_str(), ios::binary);
+  file.write(reinterpret_cast<char const*>(encoded.data()), encoded.size());
+  if (!file) {
+    cerr << "Error: can't write " << path << endl;
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Encoders for saving rendered and warped frames. Pixels are tightly packed
+// 8-bit rows, top row first, with 1 (grey), 2 (grey + alpha), 3 (RGB) or 4
+// (RGBA) channels. Each encoder appends a complete file to 'out' and spreads
+// its work over the shared JobSystem; the output does not depend on the
+// number of workers.
+
+struct PngOptions {
+  int level;      // deflate effort, 1 (fastest) to 9 (smallest); 0 stores
+  int stripRows;  // rows compressed per job; 0 picks about 256 KB of pixels
+
+  PngOptions() : level(6), stripRows(0) {}
+};
+
+// Every row gets the filter with the smallest sum of absolute differences,
+// computed with SSE2 where available. Strips of rows are then compressed on
+// separate jobs, pigz-style: each strip is its own run of deflate blocks,
+// primed with the last 32 KB of the strip above as its dictionary and ended
+// with a sync flush, so the strips join into one ordinary zlib stream (and
+// one IDAT chunk each) that any decoder reads.
+bool writePng(std::vector<unsigned char>& out, unsigned char const* pixels, int width, int height, int channels,
+  PngOptions const& options = PngOptions());
+
+// Baseline JPEG. 'quality' 1 to 100 scales the Annex K tables as libjpeg
+// does; colour is subsampled 2x2 unless 'subsample' is false. Colour
+// conversion and the forward DCT run at activeSimdLevel(). Strips of MCU rows
+// are encoded on separate jobs and joined with restart markers. Alpha is
+// dropped.
+bool writeJpeg(std::vector<unsigned char>& out, unsigned char const* pixels, int width, int height, int channels,
+  int quality = 90, bool subsample = true);
+
+// QOI (qoiformat.org): lossless, several times faster than PNG for a
+// somewhat larger file. The format is one serial stream, so this runs on the
+// calling thread. Grey is written as RGB(A).
+bool writeQoi(std::vector<unsigned char>& out, unsigned char const* pixels, int width, int height, int channels);
+
+struct SpillOptions {
+  int rowsPerBlock;  // rows coded and indexed together; 0 picks about 128 KB
+  bool predict;      // code each row as its difference from the one above
+
+  SpillOptions() : rowsPerBlock(0), predict(true) {}
+};
+
+// SPF "spill frame": a lossless format for parking frames between pipeline
+// stages, read back by stbi_load (or stbi_spf_load_rows_from_memory for
+// random access, see stb_image.h for the layout). Blocks of rows are LZ4
+// compressed on separate jobs, stored when that doesn't pay, and indexed by
+// offset. Decoding runs at a few GB/s per core, an order of magnitude faster
+// than PNG. Unlike the other writers this also takes 16-bit samples
+// ('bitsPerChannel' 16, native little-endian shorts).
+bool writeSpill(std::vector<unsigned char>& out, void const* pixels, int width, int height, int channels,
+  int bitsPerChannel = 8, SpillOptions const& options = SpillOptions());
+
+// Encodes by the extension of 'path' (.png, .jpg/.jpeg, .qoi or .spf) and
+// writes the file; errors go to cerr.
+bool writeImage(std::string const& path, unsigned char const* pixels, int width, int height, int channels,
+  int jpegQuality = 90);
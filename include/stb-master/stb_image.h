@@ -14,6 +14,9 @@
 
    You can #define STBI_ASSERT(x) before the #include to avoid using assert.h.
    And #define STBI_MALLOC, STBI_REALLOC, and STBI_FREE to avoid using malloc,realloc,free
+   And #define STBI_TRACE_ZONE(name) to profile the main decode stages; it is
+   expanded at the top of a block and must end the zone when the block exits
+   (e.g. a C++ scoped timer object), so it does nothing by default.
 
 
    QUICK NOTES:
@@ -31,6 +34,7 @@
       HDR (radiance rgbE format)
       PIC (Softimage PIC)
       PNM (PPM and PGM binary only)
+      SPF (8/16 bit-per-channel "spill frames", see stbi_spf_load_rows_from_memory)
 
       Animated GIF still needs a proper API, but here's one way to do it:
           http://gist.github.com/urraka/685d9a6340b26b830d49
@@ -300,6 +304,7 @@ RECENT REVISION HISTORY:
 //        STBI_NO_HDR
 //        STBI_NO_PIC
 //        STBI_NO_PNM   (.ppm and .pgm)
+//        STBI_NO_SPF
 //
 //  - You can request *only* certain decoders and suppress all other ones
 //    (this will be more forward-compatible, as addition of new decoders
@@ -314,6 +319,7 @@ RECENT REVISION HISTORY:
 //        STBI_ONLY_HDR
 //        STBI_ONLY_PIC
 //        STBI_ONLY_PNM   (.ppm and .pgm)
+//        STBI_ONLY_SPF
 //
 //   - If you use STBI_NO_PNG (or _ONLY_ without PNG), and you still
 //     want the zlib decoder to be available, #define STBI_SUPPORT_ZLIB
@@ -384,6 +390,30 @@ STBIDEF stbi_uc *stbi_load_from_file  (FILE *f, int *x, int *y, int *channels_in
 
 #ifndef STBI_NO_GIF
 STBIDEF stbi_uc *stbi_load_gif_from_memory(stbi_uc const *buffer, int len, int **delays, int *x, int *y, int *z, int *comp, int req_comp);
+
+// animated GIF frame iterator: decodes one frame per call into a small pool of
+// recycled RGBA buffers, so memory use doesn't grow with the number of frames.
+// the returned frame is owned by the stream and stays valid for the next two
+// calls to stbi_gif_stream_next (or until rewind/close). vertical flip is not
+// applied to streamed frames.
+typedef struct stbi_gif_stream stbi_gif_stream;
+
+STBIDEF stbi_gif_stream *stbi_gif_stream_open_memory(stbi_uc const *buffer, int len, int *x, int *y);
+#ifndef STBI_NO_STDIO
+STBIDEF stbi_gif_stream *stbi_gif_stream_open(char const *filename, int *x, int *y);
+#endif
+STBIDEF stbi_uc         *stbi_gif_stream_next  (stbi_gif_stream *gs, int *delay_ms); // NULL at end of stream or on error
+STBIDEF int              stbi_gif_stream_rewind(stbi_gif_stream *gs);
+STBIDEF void             stbi_gif_stream_close (stbi_gif_stream *gs);
+#endif
+
+#ifndef STBI_NO_SPF
+// SPF "spill frames" keep the offset of every block of rows, so part of a
+// frame held in memory decodes without the rest, e.g. one band per thread.
+// returns rows [first_row, first_row + row_count) as stored: *channels_in_file
+// channels of *bits_per_channel (8 or 16) bits, no flip, for stbi_image_free.
+STBIDEF void *stbi_spf_load_rows_from_memory(stbi_uc const *buffer, int len, int first_row, int row_count,
+                                             int *x, int *channels_in_file, int *bits_per_channel);
 #endif
 
 #ifdef STBI_WINDOWS_UTF8
@@ -475,6 +505,55 @@ STBIDEF void stbi_set_flip_vertically_on_load(int flag_true_if_should_flip);
 // calling it will fail to link if your compiler doesn't
 STBIDEF void stbi_set_flip_vertically_on_load_thread(int flag_true_if_should_flip);
 
+// per-call options: everything the setters above control, plus the channel
+// request and an allocator, passed to one load instead of living in globals,
+// so decoders running on many threads at once can each use their own.
+typedef struct
+{
+   int flip_vertically;     // as stbi_set_flip_vertically_on_load
+   int unpremultiply;       // as stbi_set_unpremultiply_on_load
+   int convert_iphone_png;  // as stbi_convert_iphone_png_to_rgb
+   int req_comp;            // desired_channels of the plain loaders; 0 keeps the file's
+
+   // optional allocator for every allocation the call makes, the result
+   // included, which must then be released with free_fn rather than
+   // stbi_image_free. set all three or none. needs thread-local support and
+   // is unavailable when STBI_MALLOC is overridden; loads asking for it then fail
+   void *(*malloc_fn) (void *user, size_t size);
+   void *(*realloc_fn)(void *user, void *p, size_t newsize);
+   void  (*free_fn)   (void *user, void *p);
+   void *alloc_user;
+} stbi_load_options;
+
+// fills 'options' from the current global (and thread) settings, with no
+// channel request and the default allocator
+STBIDEF void stbi_load_options_init(stbi_load_options *options);
+
+// the loaders with their desired_channels replaced by 'options' (NULL means
+// stbi_load_options_init's defaults)
+STBIDEF stbi_uc *stbi_load_from_memory_ex      (stbi_uc const *buffer, int len, int *x, int *y, int *channels_in_file, stbi_load_options const *options);
+STBIDEF stbi_uc *stbi_load_from_callbacks_ex   (stbi_io_callbacks const *clbk, void *user, int *x, int *y, int *channels_in_file, stbi_load_options const *options);
+STBIDEF stbi_us *stbi_load_16_from_memory_ex   (stbi_uc const *buffer, int len, int *x, int *y, int *channels_in_file, stbi_load_options const *options);
+STBIDEF stbi_us *stbi_load_16_from_callbacks_ex(stbi_io_callbacks const *clbk, void *user, int *x, int *y, int *channels_in_file, stbi_load_options const *options);
+#ifndef STBI_NO_STDIO
+STBIDEF stbi_uc *stbi_load_ex                  (char const *filename, int *x, int *y, int *channels_in_file, stbi_load_options const *options);
+STBIDEF stbi_uc *stbi_load_from_file_ex        (FILE *f, int *x, int *y, int *channels_in_file, stbi_load_options const *options);
+STBIDEF stbi_us *stbi_load_16_ex               (char const *filename, int *x, int *y, int *channels_in_file, stbi_load_options const *options);
+STBIDEF stbi_us *stbi_load_from_file_16_ex     (FILE *f, int *x, int *y, int *channels_in_file, stbi_load_options const *options);
+#endif
+#ifndef STBI_NO_LINEAR
+STBIDEF float   *stbi_loadf_from_memory_ex     (stbi_uc const *buffer, int len, int *x, int *y, int *channels_in_file, stbi_load_options const *options);
+STBIDEF float   *stbi_loadf_from_callbacks_ex  (stbi_io_callbacks const *clbk, void *user, int *x, int *y, int *channels_in_file, stbi_load_options const *options);
+#ifndef STBI_NO_STDIO
+STBIDEF float   *stbi_loadf_ex                 (char const *filename, int *x, int *y, int *channels_in_file, stbi_load_options const *options);
+STBIDEF float   *stbi_loadf_from_file_ex       (FILE *f, int *x, int *y, int *channels_in_file, stbi_load_options const *options);
+#endif
+#endif
+#ifndef STBI_NO_GIF
+// the delays array comes from the same allocator as the frames
+STBIDEF stbi_uc *stbi_load_gif_from_memory_ex  (stbi_uc const *buffer, int len, int **delays, int *x, int *y, int *z, int *comp, stbi_load_options const *options);
+#endif
+
 // ZLIB client - used by PNG, available for other purposes
 
 STBIDEF char *stbi_zlib_decode_malloc_guesssize(const char *buffer, int len, int initial_size, int *outlen);
@@ -500,7 +579,7 @@ STBIDEF int   stbi_zlib_decode_noheader_buffer(char *obuffer, int olen, const ch
 #if defined(STBI_ONLY_JPEG) || defined(STBI_ONLY_PNG) || defined(STBI_ONLY_BMP) \
   || defined(STBI_ONLY_TGA) || defined(STBI_ONLY_GIF) || defined(STBI_ONLY_PSD) \
   || defined(STBI_ONLY_HDR) || defined(STBI_ONLY_PIC) || defined(STBI_ONLY_PNM) \
-  || defined(STBI_ONLY_ZLIB)
+  || defined(STBI_ONLY_SPF) || defined(STBI_ONLY_ZLIB)
    #ifndef STBI_ONLY_JPEG
    #define STBI_NO_JPEG
    #endif
@@ -528,6 +607,9 @@ STBIDEF int   stbi_zlib_decode_noheader_buffer(char *obuffer, int olen, const ch
    #ifndef STBI_ONLY_PNM
    #define STBI_NO_PNM
    #endif
+   #ifndef STBI_ONLY_SPF
+   #define STBI_NO_SPF
+   #endif
 #endif
 
 #if defined(STBI_NO_PNG) && !defined(STBI_SUPPORT_ZLIB) && !defined(STBI_NO_ZLIB)
@@ -554,6 +636,10 @@ STBIDEF int   stbi_zlib_decode_noheader_buffer(char *obuffer, int olen, const ch
 #define STBI_ASSERT(x) assert(x)
 #endif
 
+#ifndef STBI_TRACE_ZONE
+#define STBI_TRACE_ZONE(name)
+#endif
+
 #ifdef __cplusplus
 #define STBI_EXTERN extern "C"
 #else
@@ -623,6 +709,18 @@ typedef unsigned char validate_uint32[sizeof(stbi__uint32)==4 ? 1 : -1];
 #error "Must define all or none of STBI_MALLOC, STBI_FREE, and STBI_REALLOC (or STBI_REALLOC_SIZED)."
 #endif
 
+#if !defined(STBI_MALLOC) && defined(STBI_THREAD_LOCAL)
+// the default allocator defers to the one passed in stbi_load_options for the
+// duration of that call. it is per thread rather than per context because it
+// has to reach every allocation, and most of the decoders never see a context
+#define STBI__CALL_ALLOCATOR
+static STBI_THREAD_LOCAL stbi_load_options const *stbi__call_allocator;
+
+#define STBI_MALLOC(sz)           (stbi__call_allocator ? stbi__call_allocator->malloc_fn(stbi__call_allocator->alloc_user,sz) : malloc(sz))
+#define STBI_REALLOC(p,newsz)     (stbi__call_allocator ? stbi__call_allocator->realloc_fn(stbi__call_allocator->alloc_user,p,newsz) : realloc(p,newsz))
+#define STBI_FREE(p)              (stbi__call_allocator ? stbi__call_allocator->free_fn(stbi__call_allocator->alloc_user,p) : free(p))
+#endif
+
 #ifndef STBI_MALLOC
 #define STBI_MALLOC(sz)           malloc(sz)
 #define STBI_REALLOC(p,newsz)     realloc(p,newsz)
@@ -666,6 +764,12 @@ typedef unsigned char validate_uint32[sizeof(stbi__uint32)==4 ? 1 : -1];
 #define STBI_NO_SIMD
 #endif
 
+// the generic channel converter (stbi__convert_format) is compiled in, and
+// has SSE2 paths, unless every format that uses it is disabled
+#if !(defined(STBI_NO_PNG) && defined(STBI_NO_BMP) && defined(STBI_NO_PSD) && defined(STBI_NO_TGA) && defined(STBI_NO_GIF) && defined(STBI_NO_PIC) && defined(STBI_NO_PNM) && defined(STBI_NO_SPF))
+#define STBI__CONVERT_FORMAT
+#endif
+
 #if !defined(STBI_NO_SIMD) && (defined(STBI__X86_TARGET) || defined(STBI__X64_TARGET))
 #define STBI_SSE2
 #include <emmintrin.h>
@@ -695,7 +799,7 @@ static int stbi__cpuid3(void)
 
 #define STBI_SIMD_ALIGN(type, name) __declspec(align(16)) type name
 
-#if !defined(STBI_NO_JPEG) && defined(STBI_SSE2)
+#if (!defined(STBI_NO_JPEG) || defined(STBI__CONVERT_FORMAT)) && defined(STBI_SSE2)
 static int stbi__sse2_available(void)
 {
    int info3 = stbi__cpuid3();
@@ -706,7 +810,7 @@ static int stbi__sse2_available(void)
 #else // assume GCC-style if not VC++
 #define STBI_SIMD_ALIGN(type, name) type name __attribute__((aligned(16)))
 
-#if !defined(STBI_NO_JPEG) && defined(STBI_SSE2)
+#if (!defined(STBI_NO_JPEG) || defined(STBI__CONVERT_FORMAT)) && defined(STBI_SSE2)
 static int stbi__sse2_available(void)
 {
    // If we're even attempting to compile this on GCC/Clang, that means
@@ -754,6 +858,9 @@ typedef struct
 
    stbi_uc *img_buffer, *img_buffer_end;
    stbi_uc *img_buffer_original, *img_buffer_original_end;
+
+   // decode flags from stbi_load_options; all off unless a loader sets them
+   int flip_vertically, unpremultiply, convert_iphone_png;
 } stbi__context;
 
 
@@ -766,6 +873,7 @@ static void stbi__start_mem(stbi__context *s, stbi_uc const *buffer, int len)
    s->read_from_callbacks = 0;
    s->img_buffer = s->img_buffer_original = (stbi_uc *) buffer;
    s->img_buffer_end = s->img_buffer_original_end = (stbi_uc *) buffer+len;
+   s->flip_vertically = s->unpremultiply = s->convert_iphone_png = 0;
 }
 
 // initialize a callback-based context
@@ -776,6 +884,7 @@ static void stbi__start_callbacks(stbi__context *s, stbi_io_callbacks *c, void *
    s->buflen = sizeof(s->buffer_start);
    s->read_from_callbacks = 1;
    s->img_buffer_original = s->buffer_start;
+   s->flip_vertically = s->unpremultiply = s->convert_iphone_png = 0;
    stbi__refill_buffer(s);
    s->img_buffer_original_end = s->img_buffer_end;
 }
@@ -831,7 +940,7 @@ enum
 typedef struct
 {
    int bits_per_channel;
-   int num_channels;
+   int num_channels;    // if nonzero, the loader left conversion to req_comp to stbi__postprocess
    int channel_order;
 } stbi__result_info;
 
@@ -892,6 +1001,13 @@ static void    *stbi__pnm_load(stbi__context *s, int *x, int *y, int *comp, int
 static int      stbi__pnm_info(stbi__context *s, int *x, int *y, int *comp);
 #endif
 
+#ifndef STBI_NO_SPF
+static int      stbi__spf_test(stbi__context *s);
+static void    *stbi__spf_load(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri);
+static int      stbi__spf_info(stbi__context *s, int *x, int *y, int *comp);
+static int      stbi__spf_is16(stbi__context *s);
+#endif
+
 static
 #ifdef STBI_THREAD_LOCAL
 STBI_THREAD_LOCAL
@@ -1046,8 +1162,71 @@ STBIDEF void stbi_set_flip_vertically_on_load_thread(int flag_true_if_should_fli
                                          : stbi__vertically_flip_on_load_global)
 #endif // STBI_THREAD_LOCAL
 
+static int stbi__unpremultiply_on_load = 0;
+static int stbi__de_iphone_flag = 0;
+
+STBIDEF void stbi_set_unpremultiply_on_load(int flag_true_if_should_unpremultiply)
+{
+   stbi__unpremultiply_on_load = flag_true_if_should_unpremultiply;
+}
+
+STBIDEF void stbi_convert_iphone_png_to_rgb(int flag_true_if_should_convert)
+{
+   stbi__de_iphone_flag = flag_true_if_should_convert;
+}
+
+STBIDEF void stbi_load_options_init(stbi_load_options *options)
+{
+   memset(options, 0, sizeof(*options));
+   options->flip_vertically = stbi__vertically_flip_on_load;
+   options->unpremultiply = stbi__unpremultiply_on_load;
+   options->convert_iphone_png = stbi__de_iphone_flag;
+}
+
+// the options the plain loaders pass on: the global settings as they are now
+static stbi_load_options stbi__global_options(int req_comp)
+{
+   stbi_load_options options;
+   stbi_load_options_init(&options);
+   options.req_comp = req_comp;
+   return options;
+}
+
+// copies the decode flags into the context and makes the options' allocator
+// (if any) current on this thread; returns the allocator to hand back to
+// stbi__end_call, or 0 if the options can't be honoured
+static int stbi__begin_call(stbi__context *s, stbi_load_options const *options, stbi_load_options const **saved)
+{
+   int custom = options->malloc_fn != NULL;
+   if (custom != (options->realloc_fn != NULL) || custom != (options->free_fn != NULL))
+      return stbi__err("bad allocator", "Set all of malloc_fn, realloc_fn and free_fn, or none");
+
+   s->flip_vertically = options->flip_vertically;
+   s->unpremultiply = options->unpremultiply;
+   s->convert_iphone_png = options->convert_iphone_png;
+
+   #ifdef STBI__CALL_ALLOCATOR
+   *saved = stbi__call_allocator;
+   if (custom) stbi__call_allocator = options;
+   #else
+   *saved = NULL;
+   if (custom) return stbi__err("no custom allocator", "Per-call allocators need thread-local storage and the default STBI_MALLOC");
+   #endif
+   return 1;
+}
+
+static void stbi__end_call(stbi_load_options const *saved)
+{
+   #ifdef STBI__CALL_ALLOCATOR
+   stbi__call_allocator = saved;
+   #else
+   STBI_NOTUSED(saved);
+   #endif
+}
+
 static void *stbi__load_main(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri, int bpc)
 {
+   STBI_TRACE_ZONE("stbi__load_main");
    memset(ri, 0, sizeof(*ri)); // make sure it's initialized if we add new fields
    ri->bits_per_channel = 8; // default is 8 so most paths don't have to be changed
    ri->channel_order = STBI_ORDER_RGB; // all current input & output are this, but this is here so we can add BGR order
@@ -1076,6 +1255,9 @@ static void *stbi__load_main(stbi__context *s, int *x, int *y, int *comp, int re
    #ifndef STBI_NO_PNM
    if (stbi__pnm_test(s))  return stbi__pnm_load(s,x,y,comp,req_comp, ri);
    #endif
+   #ifndef STBI_NO_SPF
+   if (stbi__spf_test(s))  return stbi__spf_load(s,x,y,comp,req_comp, ri);
+   #endif
 
    #ifndef STBI_NO_HDR
    if (stbi__hdr_test(s)) {
@@ -1093,38 +1275,6 @@ static void *stbi__load_main(stbi__context *s, int *x, int *y, int *comp, int re
    return stbi__errpuc("unknown image type", "Image not of any known type, or corrupt");
 }
 
-static stbi_uc *stbi__convert_16_to_8(stbi__uint16 *orig, int w, int h, int channels)
-{
-   int i;
-   int img_len = w * h * channels;
-   stbi_uc *reduced;
-
-   reduced = (stbi_uc *) stbi__malloc(img_len);
-   if (reduced == NULL) return stbi__errpuc("outofmem", "Out of memory");
-
-   for (i = 0; i < img_len; ++i)
-      reduced[i] = (stbi_uc)((orig[i] >> 8) & 0xFF); // top half of each byte is sufficient approx of 16->8 bit scaling
-
-   STBI_FREE(orig);
-   return reduced;
-}
-
-static stbi__uint16 *stbi__convert_8_to_16(stbi_uc *orig, int w, int h, int channels)
-{
-   int i;
-   int img_len = w * h * channels;
-   stbi__uint16 *enlarged;
-
-   enlarged = (stbi__uint16 *) stbi__malloc(img_len*2);
-   if (enlarged == NULL) return (stbi__uint16 *) stbi__errpuc("outofmem", "Out of memory");
-
-   for (i = 0; i < img_len; ++i)
-      enlarged[i] = (stbi__uint16)((orig[i] << 8) + orig[i]); // replicate to high and low byte, maps 0->0, 255->0xffff
-
-   STBI_FREE(orig);
-   return enlarged;
-}
-
 static void stbi__vertical_flip(void *image, int w, int h, int bytes_per_pixel)
 {
    int row;
@@ -1163,65 +1313,187 @@ static void stbi__vertical_flip_slices(void *image, int w, int h, int z, int byt
 }
 #endif
 
-static unsigned char *stbi__load_and_postprocess_8bit(stbi__context *s, int *x, int *y, int *comp, int req_comp)
+#ifdef STBI__CONVERT_FORMAT
+typedef void (*stbi__convert_row_func)(stbi_uc *dest, stbi_uc const *src, int x);
+static stbi__convert_row_func stbi__get_convert_row(int img_n, int req_comp);
+static void stbi__convert_row16(stbi__uint16 *dest, stbi__uint16 const *src, int img_n, int req_comp, int x);
+static unsigned char *stbi__convert_format(unsigned char *data, int img_n, int req_comp, unsigned int x, unsigned int y);
+static stbi__uint16 *stbi__convert_format16(stbi__uint16 *data, int img_n, int req_comp, unsigned int x, unsigned int y);
+#endif
+
+static void stbi__narrow_16_to_8(stbi_uc *dest, stbi__uint16 const *src, int n)
 {
-   stbi__result_info ri;
-   void *result = stbi__load_main(s, x, y, comp, req_comp, &ri, 8);
+   int i;
+   // byte i is written only after 16-bit element i was read, so dest may alias src
+   for (i = 0; i < n; ++i)
+      dest[i] = (stbi_uc)((src[i] >> 8) & 0xFF); // top half of each byte is sufficient approx of 16->8 bit scaling
+}
 
-   if (result == NULL)
-      return NULL;
+static void stbi__widen_8_to_16(stbi__uint16 *dest, stbi_uc const *src, int n)
+{
+   int i;
+   for (i = 0; i < n; ++i)
+      dest[i] = (stbi__uint16)((src[i] << 8) + src[i]); // replicate to high and low byte, maps 0->0, 255->0xffff
+}
+
+// The whole post-process in one pass over the image: converts img_n channels
+// to req_comp, changes the bit depth and flips row order, reading each source
+// row once and writing each output row once. When the output rows are no
+// larger it works in place instead and flips the (smaller) result afterwards,
+// which beats touching a freshly allocated image. Frees 'data' if it returns
+// a different buffer or fails.
+static void *stbi__postprocess(void *data, int w, int h, int img_n, int bits, int req_comp, int req_bits, int flip)
+{
+   int j, in_place;
+   size_t in_row, out_row;
+   stbi_uc *out, *temp = NULL;
 
-   if (ri.bits_per_channel != 8) {
-      STBI_ASSERT(ri.bits_per_channel == 16);
-      result = stbi__convert_16_to_8((stbi__uint16 *) result, *x, *y, req_comp == 0 ? *comp : req_comp);
-      ri.bits_per_channel = 8;
+   STBI_ASSERT(bits == 8 || bits == 16);
+   if (img_n == req_comp && bits == req_bits) {
+      if (flip)
+         stbi__vertical_flip(data, w, h, img_n * (bits / 8));
+      return data;
    }
 
-   // @TODO: move stbi__convert_format to here
+   #ifdef STBI__CONVERT_FORMAT
+   // channels only: the converters already work in place when shrinking
+   if (bits == req_bits && !flip) {
+      if (bits == 8)
+         return stbi__convert_format((unsigned char *) data, img_n, req_comp, w, h);
+      return stbi__convert_format16((stbi__uint16 *) data, img_n, req_comp, w, h);
+   }
+   #else
+   STBI_ASSERT(img_n == req_comp);
+   #endif
 
-   if (stbi__vertically_flip_on_load) {
-      int channels = req_comp ? req_comp : *comp;
-      stbi__vertical_flip(result, *x, *y, channels * sizeof(stbi_uc));
+   in_row  = (size_t) w * img_n * (bits / 8);
+   out_row = (size_t) w * req_comp * (req_bits / 8);
+   in_place = out_row <= in_row;
+   if (in_place) {
+      out = (stbi_uc *) data;
+   } else {
+      out = (stbi_uc *) stbi__malloc_mad3(w, req_comp * (req_bits / 8), h, 0);
+      if (out == NULL) {
+         STBI_FREE(data);
+         return stbi__errpuc("outofmem", "Out of memory");
+      }
+   }
+
+   // changing both depth and channels converts channels at the source depth
+   // into a staging row first, as the loaders themselves used to, so luma
+   // results do not depend on which depth the caller asked for
+   if (img_n != req_comp && bits != req_bits) {
+      temp = (stbi_uc *) stbi__malloc_mad3(w, (img_n > req_comp ? img_n : req_comp) * 2, 1, 0);
+      if (temp == NULL) {
+         if (out != data) STBI_FREE(out);
+         STBI_FREE(data);
+         return stbi__errpuc("outofmem", "Out of memory");
+      }
    }
 
-   return (unsigned char *) result;
+   for (j = 0; j < h; ++j) {
+      stbi_uc const *src = (stbi_uc const *) data + (flip && !in_place ? h - 1 - j : j) * in_row;
+      stbi_uc *dest = out + j * out_row;
+      #ifdef STBI__CONVERT_FORMAT
+      if (bits == req_bits) {
+         if (bits == 8)
+            stbi__get_convert_row(img_n, req_comp)(dest, src, w);
+         else
+            stbi__convert_row16((stbi__uint16 *) dest, (stbi__uint16 const *) src, img_n, req_comp, w);
+      } else if (img_n != req_comp) {
+         if (bits == 16) {
+            stbi__convert_row16((stbi__uint16 *) temp, (stbi__uint16 const *) src, img_n, req_comp, w);
+            stbi__narrow_16_to_8(dest, (stbi__uint16 const *) temp, w * req_comp);
+         } else {
+            stbi__get_convert_row(img_n, req_comp)(temp, src, w);
+            stbi__widen_8_to_16((stbi__uint16 *) dest, temp, w * req_comp);
+         }
+      } else
+      #endif
+      if (bits == 16)
+         stbi__narrow_16_to_8(dest, (stbi__uint16 const *) src, w * img_n);
+      else
+         stbi__widen_8_to_16((stbi__uint16 *) dest, src, w * img_n);
+   }
+
+   if (temp) STBI_FREE(temp);
+   if (out != data) STBI_FREE(data);
+   if (flip && in_place)
+      stbi__vertical_flip(out, w, h, req_comp * (req_bits / 8));
+   return out;
 }
 
-static stbi__uint16 *stbi__load_and_postprocess_16bit(stbi__context *s, int *x, int *y, int *comp, int req_comp)
+static unsigned char *stbi__load_and_postprocess_8bit(stbi__context *s, int *x, int *y, int *comp, int req_comp)
 {
    stbi__result_info ri;
-   void *result = stbi__load_main(s, x, y, comp, req_comp, &ri, 16);
+   void *result = stbi__load_main(s, x, y, comp, req_comp, &ri, 8);
+   int channels;
 
    if (result == NULL)
       return NULL;
 
-   if (ri.bits_per_channel != 16) {
-      STBI_ASSERT(ri.bits_per_channel == 8);
-      result = stbi__convert_8_to_16((stbi_uc *) result, *x, *y, req_comp == 0 ? *comp : req_comp);
-      ri.bits_per_channel = 16;
-   }
+   // flip, finish any channel conversion the loader left and narrow 16-bit
+   // results in a single pass
+   channels = req_comp ? req_comp : *comp;
+   return (unsigned char *) stbi__postprocess(result, *x, *y, ri.num_channels ? ri.num_channels : channels,
+                                              ri.bits_per_channel, channels, 8, s->flip_vertically);
+}
 
-   // @TODO: move stbi__convert_format16 to here
-   // @TODO: special case RGB-to-Y (and RGBA-to-YA) for 8-bit-to-16-bit case to keep more precision
+static stbi__uint16 *stbi__load_and_postprocess_16bit(stbi__context *s, int *x, int *y, int *comp, int req_comp)
+{
+   stbi__result_info ri;
+   void *result = stbi__load_main(s, x, y, comp, req_comp, &ri, 16);
+   int channels;
 
-   if (stbi__vertically_flip_on_load) {
-      int channels = req_comp ? req_comp : *comp;
-      stbi__vertical_flip(result, *x, *y, channels * sizeof(stbi__uint16));
-   }
+   if (result == NULL)
+      return NULL;
 
-   return (stbi__uint16 *) result;
+   // @TODO: special case RGB-to-Y (and RGBA-to-YA) for 8-bit-to-16-bit case to keep more precision
+   channels = req_comp ? req_comp : *comp;
+   return (stbi__uint16 *) stbi__postprocess(result, *x, *y, ri.num_channels ? ri.num_channels : channels,
+                                             ri.bits_per_channel, channels, 16, s->flip_vertically);
 }
 
 #if !defined(STBI_NO_HDR) && !defined(STBI_NO_LINEAR)
-static void stbi__float_postprocess(float *result, int *x, int *y, int *comp, int req_comp)
+static void stbi__float_postprocess(stbi__context *s, float *result, int *x, int *y, int *comp, int req_comp)
 {
-   if (stbi__vertically_flip_on_load && result != NULL) {
+   if (s->flip_vertically && result != NULL) {
       int channels = req_comp ? req_comp : *comp;
       stbi__vertical_flip(result, *x, *y, channels * sizeof(float));
    }
 }
 #endif
 
+#ifndef STBI_NO_LINEAR
+static float *stbi__loadf_main(stbi__context *s, int *x, int *y, int *comp, int req_comp);
+#endif
+
+// the common path of every loader but the gif one: 'bpc' is 8, 16, or 32
+// for float results
+static void *stbi__load_with_options(stbi__context *s, int *x, int *y, int *comp, stbi_load_options const *options, int bpc)
+{
+   stbi_load_options defaults;
+   stbi_load_options const *saved;
+   void *result = NULL;
+
+   if (options == NULL) {
+      stbi_load_options_init(&defaults);
+      options = &defaults;
+   }
+   if (!stbi__begin_call(s, options, &saved))
+      return NULL;
+   if (bpc == 8)
+      result = stbi__load_and_postprocess_8bit(s, x, y, comp, options->req_comp);
+   else if (bpc == 16)
+      result = stbi__load_and_postprocess_16bit(s, x, y, comp, options->req_comp);
+   #ifndef STBI_NO_LINEAR
+   else
+      result = stbi__loadf_main(s, x, y, comp, options->req_comp);
+   #endif
+   stbi__end_call(saved);
+   return result;
+}
+
 #ifndef STBI_NO_STDIO
 
 #if defined(_MSC_VER) && defined(STBI_WINDOWS_UTF8)
@@ -1266,21 +1538,34 @@ static FILE *stbi__fopen(char const *filename, char const *mode)
 
 
 STBIDEF stbi_uc *stbi_load(char const *filename, int *x, int *y, int *comp, int req_comp)
+{
+   stbi_load_options options = stbi__global_options(req_comp);
+   return stbi_load_ex(filename,x,y,comp,&options);
+}
+
+STBIDEF stbi_uc *stbi_load_ex(char const *filename, int *x, int *y, int *comp, stbi_load_options const *options)
 {
    FILE *f = stbi__fopen(filename, "rb");
    unsigned char *result;
+   STBI_TRACE_ZONE("stbi_load");
    if (!f) return stbi__errpuc("can't fopen", "Unable to open file");
-   result = stbi_load_from_file(f,x,y,comp,req_comp);
+   result = stbi_load_from_file_ex(f,x,y,comp,options);
    fclose(f);
    return result;
 }
 
 STBIDEF stbi_uc *stbi_load_from_file(FILE *f, int *x, int *y, int *comp, int req_comp)
+{
+   stbi_load_options options = stbi__global_options(req_comp);
+   return stbi_load_from_file_ex(f,x,y,comp,&options);
+}
+
+STBIDEF stbi_uc *stbi_load_from_file_ex(FILE *f, int *x, int *y, int *comp, stbi_load_options const *options)
 {
    unsigned char *result;
    stbi__context s;
    stbi__start_file(&s,f);
-   result = stbi__load_and_postprocess_8bit(&s,x,y,comp,req_comp);
+   result = (unsigned char *) stbi__load_with_options(&s,x,y,comp,options,8);
    if (result) {
       // need to 'unget' all the characters in the IO buffer
       fseek(f, - (int) (s.img_buffer_end - s.img_buffer), SEEK_CUR);
@@ -1289,11 +1574,17 @@ STBIDEF stbi_uc *stbi_load_from_file(FILE *f, int *x, int *y, int *comp, int req
 }
 
 STBIDEF stbi__uint16 *stbi_load_from_file_16(FILE *f, int *x, int *y, int *comp, int req_comp)
+{
+   stbi_load_options options = stbi__global_options(req_comp);
+   return stbi_load_from_file_16_ex(f,x,y,comp,&options);
+}
+
+STBIDEF stbi__uint16 *stbi_load_from_file_16_ex(FILE *f, int *x, int *y, int *comp, stbi_load_options const *options)
 {
    stbi__uint16 *result;
    stbi__context s;
    stbi__start_file(&s,f);
-   result = stbi__load_and_postprocess_16bit(&s,x,y,comp,req_comp);
+   result = (stbi__uint16 *) stbi__load_with_options(&s,x,y,comp,options,16);
    if (result) {
       // need to 'unget' all the characters in the IO buffer
       fseek(f, - (int) (s.img_buffer_end - s.img_buffer), SEEK_CUR);
@@ -1302,11 +1593,18 @@ STBIDEF stbi__uint16 *stbi_load_from_file_16(FILE *f, int *x, int *y, int *comp,
 }
 
 STBIDEF stbi_us *stbi_load_16(char const *filename, int *x, int *y, int *comp, int req_comp)
+{
+   stbi_load_options options = stbi__global_options(req_comp);
+   return stbi_load_16_ex(filename,x,y,comp,&options);
+}
+
+STBIDEF stbi_us *stbi_load_16_ex(char const *filename, int *x, int *y, int *comp, stbi_load_options const *options)
 {
    FILE *f = stbi__fopen(filename, "rb");
    stbi__uint16 *result;
+   STBI_TRACE_ZONE("stbi_load_16");
    if (!f) return (stbi_us *) stbi__errpuc("can't fopen", "Unable to open file");
-   result = stbi_load_from_file_16(f,x,y,comp,req_comp);
+   result = stbi_load_from_file_16_ex(f,x,y,comp,options);
    fclose(f);
    return result;
 }
@@ -1315,44 +1613,83 @@ STBIDEF stbi_us *stbi_load_16(char const *filename, int *x, int *y, int *comp, i
 #endif //!STBI_NO_STDIO
 
 STBIDEF stbi_us *stbi_load_16_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *channels_in_file, int desired_channels)
+{
+   stbi_load_options options = stbi__global_options(desired_channels);
+   return stbi_load_16_from_memory_ex(buffer,len,x,y,channels_in_file,&options);
+}
+
+STBIDEF stbi_us *stbi_load_16_from_memory_ex(stbi_uc const *buffer, int len, int *x, int *y, int *channels_in_file, stbi_load_options const *options)
 {
    stbi__context s;
    stbi__start_mem(&s,buffer,len);
-   return stbi__load_and_postprocess_16bit(&s,x,y,channels_in_file,desired_channels);
+   return (stbi_us *) stbi__load_with_options(&s,x,y,channels_in_file,options,16);
 }
 
 STBIDEF stbi_us *stbi_load_16_from_callbacks(stbi_io_callbacks const *clbk, void *user, int *x, int *y, int *channels_in_file, int desired_channels)
+{
+   stbi_load_options options = stbi__global_options(desired_channels);
+   return stbi_load_16_from_callbacks_ex(clbk,user,x,y,channels_in_file,&options);
+}
+
+STBIDEF stbi_us *stbi_load_16_from_callbacks_ex(stbi_io_callbacks const *clbk, void *user, int *x, int *y, int *channels_in_file, stbi_load_options const *options)
 {
    stbi__context s;
    stbi__start_callbacks(&s, (stbi_io_callbacks *)clbk, user);
-   return stbi__load_and_postprocess_16bit(&s,x,y,channels_in_file,desired_channels);
+   return (stbi_us *) stbi__load_with_options(&s,x,y,channels_in_file,options,16);
 }
 
 STBIDEF stbi_uc *stbi_load_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp)
+{
+   stbi_load_options options = stbi__global_options(req_comp);
+   return stbi_load_from_memory_ex(buffer,len,x,y,comp,&options);
+}
+
+STBIDEF stbi_uc *stbi_load_from_memory_ex(stbi_uc const *buffer, int len, int *x, int *y, int *comp, stbi_load_options const *options)
 {
    stbi__context s;
    stbi__start_mem(&s,buffer,len);
-   return stbi__load_and_postprocess_8bit(&s,x,y,comp,req_comp);
+   return (stbi_uc *) stbi__load_with_options(&s,x,y,comp,options,8);
 }
 
 STBIDEF stbi_uc *stbi_load_from_callbacks(stbi_io_callbacks const *clbk, void *user, int *x, int *y, int *comp, int req_comp)
+{
+   stbi_load_options options = stbi__global_options(req_comp);
+   return stbi_load_from_callbacks_ex(clbk,user,x,y,comp,&options);
+}
+
+STBIDEF stbi_uc *stbi_load_from_callbacks_ex(stbi_io_callbacks const *clbk, void *user, int *x, int *y, int *comp, stbi_load_options const *options)
 {
    stbi__context s;
    stbi__start_callbacks(&s, (stbi_io_callbacks *) clbk, user);
-   return stbi__load_and_postprocess_8bit(&s,x,y,comp,req_comp);
+   return (stbi_uc *) stbi__load_with_options(&s,x,y,comp,options,8);
 }
 
 #ifndef STBI_NO_GIF
 STBIDEF stbi_uc *stbi_load_gif_from_memory(stbi_uc const *buffer, int len, int **delays, int *x, int *y, int *z, int *comp, int req_comp)
+{
+   stbi_load_options options = stbi__global_options(req_comp);
+   return stbi_load_gif_from_memory_ex(buffer,len,delays,x,y,z,comp,&options);
+}
+
+STBIDEF stbi_uc *stbi_load_gif_from_memory_ex(stbi_uc const *buffer, int len, int **delays, int *x, int *y, int *z, int *comp, stbi_load_options const *options)
 {
    unsigned char *result;
    stbi__context s;
+   stbi_load_options defaults;
+   stbi_load_options const *saved;
    stbi__start_mem(&s,buffer,len);
 
-   result = (unsigned char*) stbi__load_gif_main(&s, delays, x, y, z, comp, req_comp);
-   if (stbi__vertically_flip_on_load) {
+   if (options == NULL) {
+      stbi_load_options_init(&defaults);
+      options = &defaults;
+   }
+   if (!stbi__begin_call(&s, options, &saved))
+      return NULL;
+   result = (unsigned char*) stbi__load_gif_main(&s, delays, x, y, z, comp, options->req_comp);
+   if (s.flip_vertically && result) {
       stbi__vertical_flip_slices( result, *x, *y, *z, *comp );
    }
+   stbi__end_call(saved);
 
    return result;
 }
@@ -1367,7 +1704,7 @@ static float *stbi__loadf_main(stbi__context *s, int *x, int *y, int *comp, int
       stbi__result_info ri;
       float *hdr_data = stbi__hdr_load(s,x,y,comp,req_comp, &ri);
       if (hdr_data)
-         stbi__float_postprocess(hdr_data,x,y,comp,req_comp);
+         stbi__float_postprocess(s,hdr_data,x,y,comp,req_comp);
       return hdr_data;
    }
    #endif
@@ -1378,35 +1715,60 @@ static float *stbi__loadf_main(stbi__context *s, int *x, int *y, int *comp, int
 }
 
 STBIDEF float *stbi_loadf_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp)
+{
+   stbi_load_options options = stbi__global_options(req_comp);
+   return stbi_loadf_from_memory_ex(buffer,len,x,y,comp,&options);
+}
+
+STBIDEF float *stbi_loadf_from_memory_ex(stbi_uc const *buffer, int len, int *x, int *y, int *comp, stbi_load_options const *options)
 {
    stbi__context s;
    stbi__start_mem(&s,buffer,len);
-   return stbi__loadf_main(&s,x,y,comp,req_comp);
+   return (float *) stbi__load_with_options(&s,x,y,comp,options,32);
 }
 
 STBIDEF float *stbi_loadf_from_callbacks(stbi_io_callbacks const *clbk, void *user, int *x, int *y, int *comp, int req_comp)
+{
+   stbi_load_options options = stbi__global_options(req_comp);
+   return stbi_loadf_from_callbacks_ex(clbk,user,x,y,comp,&options);
+}
+
+STBIDEF float *stbi_loadf_from_callbacks_ex(stbi_io_callbacks const *clbk, void *user, int *x, int *y, int *comp, stbi_load_options const *options)
 {
    stbi__context s;
    stbi__start_callbacks(&s, (stbi_io_callbacks *) clbk, user);
-   return stbi__loadf_main(&s,x,y,comp,req_comp);
+   return (float *) stbi__load_with_options(&s,x,y,comp,options,32);
 }
 
 #ifndef STBI_NO_STDIO
 STBIDEF float *stbi_loadf(char const *filename, int *x, int *y, int *comp, int req_comp)
+{
+   stbi_load_options options = stbi__global_options(req_comp);
+   return stbi_loadf_ex(filename,x,y,comp,&options);
+}
+
+STBIDEF float *stbi_loadf_ex(char const *filename, int *x, int *y, int *comp, stbi_load_options const *options)
 {
    float *result;
    FILE *f = stbi__fopen(filename, "rb");
+   STBI_TRACE_ZONE("stbi_loadf");
    if (!f) return stbi__errpf("can't fopen", "Unable to open file");
-   result = stbi_loadf_from_file(f,x,y,comp,req_comp);
+   result = stbi_loadf_from_file_ex(f,x,y,comp,options);
    fclose(f);
    return result;
 }
 
 STBIDEF float *stbi_loadf_from_file(FILE *f, int *x, int *y, int *comp, int req_comp)
+{
+   stbi_load_options options = stbi__global_options(req_comp);
+   return stbi_loadf_from_file_ex(f,x,y,comp,&options);
+}
+
+STBIDEF float *stbi_loadf_from_file_ex(FILE *f, int *x, int *y, int *comp, stbi_load_options const *options)
 {
    stbi__context s;
    stbi__start_file(&s,f);
-   return stbi__loadf_main(&s,x,y,comp,req_comp);
+   return (float *) stbi__load_with_options(&s,x,y,comp,options,32);
 }
 #endif // !STBI_NO_STDIO
 
@@ -1560,7 +1922,7 @@ static void stbi__skip(stbi__context *s, int n)
 }
 #endif
 
-#if defined(STBI_NO_PNG) && defined(STBI_NO_TGA) && defined(STBI_NO_HDR) && defined(STBI_NO_PNM)
+#if defined(STBI_NO_PNG) && defined(STBI_NO_TGA) && defined(STBI_NO_HDR) && defined(STBI_NO_PNM) && defined(STBI_NO_SPF)
 // nothing
 #else
 static int stbi__getn(stbi__context *s, stbi_uc *buffer, int n)
@@ -1628,7 +1990,7 @@ static stbi__uint32 stbi__get32le(stbi__context *s)
 
 #define STBI__BYTECAST(x)  ((stbi_uc) ((x) & 255))  // truncate int to byte without warnings
 
-#if defined(STBI_NO_JPEG) && defined(STBI_NO_PNG) && defined(STBI_NO_BMP) && defined(STBI_NO_PSD) && defined(STBI_NO_TGA) && defined(STBI_NO_GIF) && defined(STBI_NO_PIC) && defined(STBI_NO_PNM)
+#if defined(STBI_NO_JPEG) && defined(STBI_NO_PNG) && defined(STBI_NO_BMP) && defined(STBI_NO_PSD) && defined(STBI_NO_TGA) && defined(STBI_NO_GIF) && defined(STBI_NO_PIC) && defined(STBI_NO_PNM) && defined(STBI_NO_SPF)
 // nothing
 #else
 //////////////////////////////////////////////////////////////////////////////
@@ -1648,107 +2010,307 @@ static stbi_uc stbi__compute_y(int r, int g, int b)
 }
 #endif
 
-#if defined(STBI_NO_PNG) && defined(STBI_NO_BMP) && defined(STBI_NO_PSD) && defined(STBI_NO_TGA) && defined(STBI_NO_GIF) && defined(STBI_NO_PIC) && defined(STBI_NO_PNM)
+#if defined(STBI_NO_PNG) && defined(STBI_NO_BMP) && defined(STBI_NO_PSD) && defined(STBI_NO_TGA) && defined(STBI_NO_GIF) && defined(STBI_NO_PIC) && defined(STBI_NO_PNM) && defined(STBI_NO_SPF)
 // nothing
 #else
+// One row converter per (img_n, req_comp) pair, so the channel counts are
+// constants in every loop. A converter may be called with dest == src when
+// req_comp < img_n: each pixel (or SIMD block) is read before it is written
+// and the output never gets ahead of the input. (stbi__convert_row_func is
+// declared ahead of stbi__postprocess.)
+
+#define STBI__CONVERT_LOOP(a,b)  for (; x > 0; --x, src += a, dest += b)
+static void stbi__convert_row_1_2(stbi_uc *dest, stbi_uc const *src, int x) { STBI__CONVERT_LOOP(1,2) { dest[0]=src[0]; dest[1]=255;                                     } }
+static void stbi__convert_row_1_3(stbi_uc *dest, stbi_uc const *src, int x) { STBI__CONVERT_LOOP(1,3) { dest[0]=dest[1]=dest[2]=src[0];                                  } }
+static void stbi__convert_row_1_4(stbi_uc *dest, stbi_uc const *src, int x) { STBI__CONVERT_LOOP(1,4) { dest[0]=dest[1]=dest[2]=src[0]; dest[3]=255;                     } }
+static void stbi__convert_row_2_1(stbi_uc *dest, stbi_uc const *src, int x) { STBI__CONVERT_LOOP(2,1) { dest[0]=src[0];                                                  } }
+static void stbi__convert_row_2_3(stbi_uc *dest, stbi_uc const *src, int x) { STBI__CONVERT_LOOP(2,3) { dest[0]=dest[1]=dest[2]=src[0];                                  } }
+static void stbi__convert_row_2_4(stbi_uc *dest, stbi_uc const *src, int x) { STBI__CONVERT_LOOP(2,4) { dest[0]=dest[1]=dest[2]=src[0]; dest[3]=src[1];                  } }
+static void stbi__convert_row_3_4(stbi_uc *dest, stbi_uc const *src, int x) { STBI__CONVERT_LOOP(3,4) { dest[0]=src[0];dest[1]=src[1];dest[2]=src[2];dest[3]=255;        } }
+static void stbi__convert_row_3_1(stbi_uc *dest, stbi_uc const *src, int x) { STBI__CONVERT_LOOP(3,1) { dest[0]=stbi__compute_y(src[0],src[1],src[2]);                   } }
+static void stbi__convert_row_3_2(stbi_uc *dest, stbi_uc const *src, int x) { STBI__CONVERT_LOOP(3,2) { dest[0]=stbi__compute_y(src[0],src[1],src[2]); dest[1] = 255;    } }
+static void stbi__convert_row_4_1(stbi_uc *dest, stbi_uc const *src, int x) { STBI__CONVERT_LOOP(4,1) { dest[0]=stbi__compute_y(src[0],src[1],src[2]);                   } }
+static void stbi__convert_row_4_2(stbi_uc *dest, stbi_uc const *src, int x) { STBI__CONVERT_LOOP(4,2) { dest[0]=stbi__compute_y(src[0],src[1],src[2]); dest[1] = src[3]; } }
+static void stbi__convert_row_4_3(stbi_uc *dest, stbi_uc const *src, int x) { STBI__CONVERT_LOOP(4,3) { dest[0]=src[0];dest[1]=src[1];dest[2]=src[2];                    } }
+#undef STBI__CONVERT_LOOP
+
+#ifdef STBI_SSE2
+// The SSE2 converters go through RGBA: 16 pixels of any layout are expanded
+// to four registers of RGBA, then narrowed to the requested layout. Gray
+// expands to r=g=b, whose luma is exactly the gray value again, so every
+// pair gives the same bytes as the scalar table above.
+static void stbi__load16_1(__m128i p[4], stbi_uc const *src)
+{
+   __m128i g = _mm_loadu_si128((__m128i const *) src);
+   __m128i ff = _mm_set1_epi8((char) 255);
+   __m128i gg_lo = _mm_unpacklo_epi8(g, g), gg_hi = _mm_unpackhi_epi8(g, g);
+   __m128i ga_lo = _mm_unpacklo_epi8(g, ff), ga_hi = _mm_unpackhi_epi8(g, ff);
+   p[0] = _mm_unpacklo_epi16(gg_lo, ga_lo);
+   p[1] = _mm_unpackhi_epi16(gg_lo, ga_lo);
+   p[2] = _mm_unpacklo_epi16(gg_hi, ga_hi);
+   p[3] = _mm_unpackhi_epi16(gg_hi, ga_hi);
+}
+
+static void stbi__load16_2(__m128i p[4], stbi_uc const *src)
+{
+   int k;
+   for (k=0; k < 2; ++k) {
+      __m128i ga = _mm_loadu_si128((__m128i const *) (src + 16*k));
+      __m128i g = _mm_and_si128(ga, _mm_set1_epi16(0xff));
+      __m128i gg = _mm_or_si128(g, _mm_slli_epi16(g, 8));
+      p[2*k  ] = _mm_unpacklo_epi16(gg, ga);
+      p[2*k+1] = _mm_unpackhi_epi16(gg, ga);
+   }
+}
+
+// 12 bytes (4 RGB pixels) in the low end of 'c' to 4 RGBA pixels
+static __m128i stbi__expand4_rgb(__m128i c)
+{
+   // 6 bytes into each 64-bit half, then 3 bytes into each 32-bit lane
+   __m128i t = _mm_or_si128(_mm_and_si128(c, _mm_set_epi32(0, 0, 0xffff, -1)),
+                            _mm_and_si128(_mm_slli_si128(c, 2), _mm_set_epi32(0xffff, -1, 0, 0)));
+   __m128i rgb = _mm_or_si128(_mm_and_si128(t, _mm_set_epi32(0, 0xffffff, 0, 0xffffff)),
+                              _mm_and_si128(_mm_slli_epi64(t, 8), _mm_set_epi32(0xffffff, 0, 0xffffff, 0)));
+   return _mm_or_si128(rgb, _mm_set1_epi32((int) 0xff000000));
+}
+
+static void stbi__load16_3(__m128i p[4], stbi_uc const *src)
+{
+   __m128i i0 = _mm_loadu_si128((__m128i const *) (src     ));
+   __m128i i1 = _mm_loadu_si128((__m128i const *) (src + 16));
+   __m128i i2 = _mm_loadu_si128((__m128i const *) (src + 32));
+   p[0] = stbi__expand4_rgb(i0);
+   p[1] = stbi__expand4_rgb(_mm_or_si128(_mm_srli_si128(i0, 12), _mm_slli_si128(i1, 4)));
+   p[2] = stbi__expand4_rgb(_mm_or_si128(_mm_srli_si128(i1,  8), _mm_slli_si128(i2, 8)));
+   p[3] = stbi__expand4_rgb(_mm_srli_si128(i2, 4));
+}
+
+static void stbi__load16_4(__m128i p[4], stbi_uc const *src)
+{
+   int k;
+   for (k=0; k < 4; ++k)
+      p[k] = _mm_loadu_si128((__m128i const *) (src + 16*k));
+}
+
+// stbi__compute_y of 4 RGBA pixels, one per 32-bit lane
+static __m128i stbi__luma4(__m128i p)
+{
+   // r,b and g,a as 16-bit pairs, weighted and summed per pixel by madd
+   __m128i rb = _mm_and_si128(p, _mm_set1_epi16(0xff));
+   __m128i ga = _mm_srli_epi16(p, 8);
+   __m128i y = _mm_add_epi32(_mm_madd_epi16(rb, _mm_set1_epi32((29 << 16) | 77)),
+                             _mm_madd_epi16(ga, _mm_set1_epi32(150)));
+   return _mm_srli_epi32(y, 8);
+}
+
+static void stbi__store16_1(stbi_uc *dest, __m128i const p[4])
+{
+   __m128i w0 = _mm_packs_epi32(stbi__luma4(p[0]), stbi__luma4(p[1]));
+   __m128i w1 = _mm_packs_epi32(stbi__luma4(p[2]), stbi__luma4(p[3]));
+   _mm_storeu_si128((__m128i *) dest, _mm_packus_epi16(w0, w1));
+}
+
+static void stbi__store16_2(stbi_uc *dest, __m128i const p[4])
+{
+   int k;
+   __m128i ya[4];
+   for (k=0; k < 4; ++k) {
+      ya[k] = _mm_or_si128(stbi__luma4(p[k]), _mm_slli_epi32(_mm_srli_epi32(p[k], 24), 8));
+      // sign-extend the 16-bit value so the signed pack keeps its bits
+      ya[k] = _mm_srai_epi32(_mm_slli_epi32(ya[k], 16), 16);
+   }
+   _mm_storeu_si128((__m128i *) (dest     ), _mm_packs_epi32(ya[0], ya[1]));
+   _mm_storeu_si128((__m128i *) (dest + 16), _mm_packs_epi32(ya[2], ya[3]));
+}
+
+// 4 RGBA pixels to 12 bytes of RGB in the low end of the result
+static __m128i stbi__compact4_rgb(__m128i p)
+{
+   // drop alpha: 3 bytes per 32-bit lane into 6 per 64-bit half, then close the gap
+   __m128i t = _mm_or_si128(_mm_and_si128(p, _mm_set_epi32(0, 0xffffff, 0, 0xffffff)),
+                            _mm_and_si128(_mm_srli_epi64(p, 8), _mm_set_epi32(0xffff, (int) 0xff000000, 0xffff, (int) 0xff000000)));
+   return _mm_or_si128(_mm_and_si128(t, _mm_set_epi32(0, 0, 0xffff, -1)),
+                       _mm_srli_si128(_mm_and_si128(t, _mm_set_epi32(0xffff, -1, 0, 0)), 2));
+}
+
+static void stbi__store16_3(stbi_uc *dest, __m128i const p[4])
+{
+   __m128i c0 = stbi__compact4_rgb(p[0]);
+   __m128i c1 = stbi__compact4_rgb(p[1]);
+   __m128i c2 = stbi__compact4_rgb(p[2]);
+   __m128i c3 = stbi__compact4_rgb(p[3]);
+   _mm_storeu_si128((__m128i *) (dest     ), _mm_or_si128(c0, _mm_slli_si128(c1, 12)));
+   _mm_storeu_si128((__m128i *) (dest + 16), _mm_or_si128(_mm_srli_si128(c1, 4), _mm_slli_si128(c2, 8)));
+   _mm_storeu_si128((__m128i *) (dest + 32), _mm_or_si128(_mm_srli_si128(c2, 8), _mm_slli_si128(c3, 4)));
+}
+
+static void stbi__store16_4(stbi_uc *dest, __m128i const p[4])
+{
+   int k;
+   for (k=0; k < 4; ++k)
+      _mm_storeu_si128((__m128i *) (dest + 16*k), p[k]);
+}
+
+// whole 16-pixel blocks, then the scalar converter for the rest of the row
+#define STBI__CONVERT_ROW_SSE2(a,b) \
+   static void stbi__convert_row_##a##_##b##_sse2(stbi_uc *dest, stbi_uc const *src, int x) \
+   { \
+      __m128i p[4]; \
+      for (; x >= 16; x -= 16, src += 16*a, dest += 16*b) { \
+         stbi__load16_##a(p, src); \
+         stbi__store16_##b(dest, p); \
+      } \
+      stbi__convert_row_##a##_##b(dest, src, x); \
+   }
+STBI__CONVERT_ROW_SSE2(1,3)
+STBI__CONVERT_ROW_SSE2(1,4)
+STBI__CONVERT_ROW_SSE2(2,3)
+STBI__CONVERT_ROW_SSE2(2,4)
+STBI__CONVERT_ROW_SSE2(3,1)
+STBI__CONVERT_ROW_SSE2(3,2)
+STBI__CONVERT_ROW_SSE2(3,4)
+STBI__CONVERT_ROW_SSE2(4,1)
+STBI__CONVERT_ROW_SSE2(4,2)
+STBI__CONVERT_ROW_SSE2(4,3)
+#undef STBI__CONVERT_ROW_SSE2
+
+// gray to gray+alpha and back never need a luma, so skip the RGBA round trip
+static void stbi__convert_row_1_2_sse2(stbi_uc *dest, stbi_uc const *src, int x)
+{
+   __m128i ff = _mm_set1_epi8((char) 255);
+   for (; x >= 16; x -= 16, src += 16, dest += 32) {
+      __m128i g = _mm_loadu_si128((__m128i const *) src);
+      _mm_storeu_si128((__m128i *) (dest     ), _mm_unpacklo_epi8(g, ff));
+      _mm_storeu_si128((__m128i *) (dest + 16), _mm_unpackhi_epi8(g, ff));
+   }
+   stbi__convert_row_1_2(dest, src, x);
+}
+
+static void stbi__convert_row_2_1_sse2(stbi_uc *dest, stbi_uc const *src, int x)
+{
+   __m128i mask = _mm_set1_epi16(0xff);
+   for (; x >= 16; x -= 16, src += 32, dest += 16) {
+      __m128i lo = _mm_and_si128(_mm_loadu_si128((__m128i const *) (src     )), mask);
+      __m128i hi = _mm_and_si128(_mm_loadu_si128((__m128i const *) (src + 16)), mask);
+      _mm_storeu_si128((__m128i *) dest, _mm_packus_epi16(lo, hi));
+   }
+   stbi__convert_row_2_1(dest, src, x);
+}
+#endif
+
+static stbi__convert_row_func stbi__get_convert_row(int img_n, int req_comp)
+{
+   static stbi__convert_row_func const scalar[4][4] = {
+      { NULL,                  stbi__convert_row_1_2, stbi__convert_row_1_3, stbi__convert_row_1_4 },
+      { stbi__convert_row_2_1, NULL,                  stbi__convert_row_2_3, stbi__convert_row_2_4 },
+      { stbi__convert_row_3_1, stbi__convert_row_3_2, NULL,                  stbi__convert_row_3_4 },
+      { stbi__convert_row_4_1, stbi__convert_row_4_2, stbi__convert_row_4_3, NULL                  },
+   };
+#ifdef STBI_SSE2
+   static stbi__convert_row_func const sse2[4][4] = {
+      { NULL,                       stbi__convert_row_1_2_sse2, stbi__convert_row_1_3_sse2, stbi__convert_row_1_4_sse2 },
+      { stbi__convert_row_2_1_sse2, NULL,                       stbi__convert_row_2_3_sse2, stbi__convert_row_2_4_sse2 },
+      { stbi__convert_row_3_1_sse2, stbi__convert_row_3_2_sse2, NULL,                       stbi__convert_row_3_4_sse2 },
+      { stbi__convert_row_4_1_sse2, stbi__convert_row_4_2_sse2, stbi__convert_row_4_3_sse2, NULL                       },
+   };
+   if (stbi__sse2_available())
+      return sse2[img_n-1][req_comp-1];
+#endif
+   return scalar[img_n-1][req_comp-1];
+}
+
 static unsigned char *stbi__convert_format(unsigned char *data, int img_n, int req_comp, unsigned int x, unsigned int y)
 {
-   int i,j;
+   int j;
    unsigned char *good;
+   stbi__convert_row_func convert;
 
    if (req_comp == img_n) return data;
    STBI_ASSERT(req_comp >= 1 && req_comp <= 4);
+   STBI_ASSERT(img_n >= 1 && img_n <= 4);
 
-   good = (unsigned char *) stbi__malloc_mad3(req_comp, x, y, 0);
-   if (good == NULL) {
-      STBI_FREE(data);
-      return stbi__errpuc("outofmem", "Out of memory");
-   }
+   // pick the converter once per image rather than once per scanline
+   convert = stbi__get_convert_row(img_n, req_comp);
 
-   for (j=0; j < (int) y; ++j) {
-      unsigned char *src  = data + j * x * img_n   ;
-      unsigned char *dest = good + j * x * req_comp;
-
-      #define STBI__COMBO(a,b)  ((a)*8+(b))
-      #define STBI__CASE(a,b)   case STBI__COMBO(a,b): for(i=x-1; i >= 0; --i, src += a, dest += b)
-      // convert source image with img_n components to one with req_comp components;
-      // avoid switch per pixel, so use switch per scanline and massive macros
-      switch (STBI__COMBO(img_n, req_comp)) {
-         STBI__CASE(1,2) { dest[0]=src[0]; dest[1]=255;                                     } break;
-         STBI__CASE(1,3) { dest[0]=dest[1]=dest[2]=src[0];                                  } break;
-         STBI__CASE(1,4) { dest[0]=dest[1]=dest[2]=src[0]; dest[3]=255;                     } break;
-         STBI__CASE(2,1) { dest[0]=src[0];                                                  } break;
-         STBI__CASE(2,3) { dest[0]=dest[1]=dest[2]=src[0];                                  } break;
-         STBI__CASE(2,4) { dest[0]=dest[1]=dest[2]=src[0]; dest[3]=src[1];                  } break;
-         STBI__CASE(3,4) { dest[0]=src[0];dest[1]=src[1];dest[2]=src[2];dest[3]=255;        } break;
-         STBI__CASE(3,1) { dest[0]=stbi__compute_y(src[0],src[1],src[2]);                   } break;
-         STBI__CASE(3,2) { dest[0]=stbi__compute_y(src[0],src[1],src[2]); dest[1] = 255;    } break;
-         STBI__CASE(4,1) { dest[0]=stbi__compute_y(src[0],src[1],src[2]);                   } break;
-         STBI__CASE(4,2) { dest[0]=stbi__compute_y(src[0],src[1],src[2]); dest[1] = src[3]; } break;
-         STBI__CASE(4,3) { dest[0]=src[0];dest[1]=src[1];dest[2]=src[2];                    } break;
-         default: STBI_ASSERT(0);
+   // as in stbi__convert_format16, dropping channels converts in place
+   if (req_comp < img_n) {
+      good = data;
+   } else {
+      good = (unsigned char *) stbi__malloc_mad3(req_comp, x, y, 0);
+      if (good == NULL) {
+         STBI_FREE(data);
+         return stbi__errpuc("outofmem", "Out of memory");
       }
-      #undef STBI__CASE
    }
 
-   STBI_FREE(data);
+   for (j=0; j < (int) y; ++j)
+      convert(good + j * x * req_comp, data + j * x * img_n, (int) x);
+
+   if (good != data)
+      STBI_FREE(data);
    return good;
 }
 #endif
 
-#if defined(STBI_NO_PNG) && defined(STBI_NO_PSD)
-// nothing
-#else
+#ifdef STBI__CONVERT_FORMAT
 static stbi__uint16 stbi__compute_y_16(int r, int g, int b)
 {
    return (stbi__uint16) (((r*77) + (g*150) +  (29*b)) >> 8);
 }
 #endif
 
-#if defined(STBI_NO_PNG) && defined(STBI_NO_PSD)
-// nothing
-#else
+#ifdef STBI__CONVERT_FORMAT
+static void stbi__convert_row16(stbi__uint16 *dest, stbi__uint16 const *src, int img_n, int req_comp, int x)
+{
+   int i;
+
+   #define STBI__COMBO(a,b)  ((a)*8+(b))
+   #define STBI__CASE(a,b)   case STBI__COMBO(a,b): for(i=x-1; i >= 0; --i, src += a, dest += b)
+   // convert source row with img_n components to one with req_comp components;
+   // avoid switch per pixel, so use switch per scanline and massive macros
+   switch (STBI__COMBO(img_n, req_comp)) {
+      STBI__CASE(1,2) { dest[0]=src[0]; dest[1]=0xffff;                                     } break;
+      STBI__CASE(1,3) { dest[0]=dest[1]=dest[2]=src[0];                                     } break;
+      STBI__CASE(1,4) { dest[0]=dest[1]=dest[2]=src[0]; dest[3]=0xffff;                     } break;
+      STBI__CASE(2,1) { dest[0]=src[0];                                                     } break;
+      STBI__CASE(2,3) { dest[0]=dest[1]=dest[2]=src[0];                                     } break;
+      STBI__CASE(2,4) { dest[0]=dest[1]=dest[2]=src[0]; dest[3]=src[1];                     } break;
+      STBI__CASE(3,4) { dest[0]=src[0];dest[1]=src[1];dest[2]=src[2];dest[3]=0xffff;        } break;
+      STBI__CASE(3,1) { dest[0]=stbi__compute_y_16(src[0],src[1],src[2]);                   } break;
+      STBI__CASE(3,2) { dest[0]=stbi__compute_y_16(src[0],src[1],src[2]); dest[1] = 0xffff; } break;
+      STBI__CASE(4,1) { dest[0]=stbi__compute_y_16(src[0],src[1],src[2]);                   } break;
+      STBI__CASE(4,2) { dest[0]=stbi__compute_y_16(src[0],src[1],src[2]); dest[1] = src[3]; } break;
+      STBI__CASE(4,3) { dest[0]=src[0];dest[1]=src[1];dest[2]=src[2];                       } break;
+      default: STBI_ASSERT(0);
+   }
+   #undef STBI__CASE
+}
+
 static stbi__uint16 *stbi__convert_format16(stbi__uint16 *data, int img_n, int req_comp, unsigned int x, unsigned int y)
 {
-   int i,j;
+   int j;
    stbi__uint16 *good;
 
    if (req_comp == img_n) return data;
    STBI_ASSERT(req_comp >= 1 && req_comp <= 4);
 
-   good = (stbi__uint16 *) stbi__malloc(req_comp * x * y * 2);
-   if (good == NULL) {
-      STBI_FREE(data);
-      return (stbi__uint16 *) stbi__errpuc("outofmem", "Out of memory");
-   }
-
-   for (j=0; j < (int) y; ++j) {
-      stbi__uint16 *src  = data + j * x * img_n   ;
-      stbi__uint16 *dest = good + j * x * req_comp;
-
-      #define STBI__COMBO(a,b)  ((a)*8+(b))
-      #define STBI__CASE(a,b)   case STBI__COMBO(a,b): for(i=x-1; i >= 0; --i, src += a, dest += b)
-      // convert source image with img_n components to one with req_comp components;
-      // avoid switch per pixel, so use switch per scanline and massive macros
-      switch (STBI__COMBO(img_n, req_comp)) {
-         STBI__CASE(1,2) { dest[0]=src[0]; dest[1]=0xffff;                                     } break;
-         STBI__CASE(1,3) { dest[0]=dest[1]=dest[2]=src[0];                                     } break;
-         STBI__CASE(1,4) { dest[0]=dest[1]=dest[2]=src[0]; dest[3]=0xffff;                     } break;
-         STBI__CASE(2,1) { dest[0]=src[0];                                                     } break;
-         STBI__CASE(2,3) { dest[0]=dest[1]=dest[2]=src[0];                                     } break;
-         STBI__CASE(2,4) { dest[0]=dest[1]=dest[2]=src[0]; dest[3]=src[1];                     } break;
-         STBI__CASE(3,4) { dest[0]=src[0];dest[1]=src[1];dest[2]=src[2];dest[3]=0xffff;        } break;
-         STBI__CASE(3,1) { dest[0]=stbi__compute_y_16(src[0],src[1],src[2]);                   } break;
-         STBI__CASE(3,2) { dest[0]=stbi__compute_y_16(src[0],src[1],src[2]); dest[1] = 0xffff; } break;
-         STBI__CASE(4,1) { dest[0]=stbi__compute_y_16(src[0],src[1],src[2]);                   } break;
-         STBI__CASE(4,2) { dest[0]=stbi__compute_y_16(src[0],src[1],src[2]); dest[1] = src[3]; } break;
-         STBI__CASE(4,3) { dest[0]=src[0];dest[1]=src[1];dest[2]=src[2];                       } break;
-         default: STBI_ASSERT(0);
+   // dropping channels never moves a write ahead of an unread source element,
+   // so convert in the source buffer instead of allocating a second image
+   if (req_comp < img_n) {
+      good = data;
+   } else {
+      good = (stbi__uint16 *) stbi__malloc(req_comp * x * y * 2);
+      if (good == NULL) {
+         STBI_FREE(data);
+         return (stbi__uint16 *) stbi__errpuc("outofmem", "Out of memory");
       }
-      #undef STBI__CASE
    }
 
-   STBI_FREE(data);
+   for (j=0; j < (int) y; ++j)
+      stbi__convert_row16(good + j * x * req_comp, data + j * x * img_n, img_n, req_comp, (int) x);
+
+   if (good != data)
+      STBI_FREE(data);
    return good;
 }
 #endif
@@ -1758,14 +2320,18 @@ static float   *stbi__ldr_to_hdr(stbi_uc *data, int x, int y, int comp)
 {
    int i,k,n;
    float *output;
+   float lut[256];
    if (!data) return NULL;
    output = (float *) stbi__malloc_mad4(x, y, comp, sizeof(float), 0);
    if (output == NULL) { STBI_FREE(data); return stbi__errpf("outofmem", "Out of memory"); }
+   // only 256 possible inputs, so evaluate the gamma curve once per code
+   for (i=0; i < 256; ++i)
+      lut[i] = (float) (pow(i/255.0f, stbi__l2h_gamma) * stbi__l2h_scale);
    // compute number of non-alpha components
    if (comp & 1) n = comp; else n = comp-1;
    for (i=0; i < x*y; ++i) {
       for (k=0; k < n; ++k) {
-         output[i*comp + k] = (float) (pow(data[i*comp+k]/255.0f, stbi__l2h_gamma) * stbi__l2h_scale);
+         output[i*comp + k] = lut[data[i*comp+k]];
       }
    }
    if (n < comp) {
@@ -1784,17 +2350,31 @@ static stbi_uc *stbi__hdr_to_ldr(float   *data, int x, int y, int comp)
 {
    int i,k,n;
    stbi_uc *output;
+   float lut[256];
    if (!data) return NULL;
    output = (stbi_uc *) stbi__malloc_mad3(x, y, comp, 0);
    if (output == NULL) { STBI_FREE(data); return stbi__errpuc("outofmem", "Out of memory"); }
+   // instead of a pow per component, precompute the smallest input that rounds
+   // to each output code, then binary-search the monotonic table: output v is
+   // produced when pow(x*scale_i, gamma_i)*255 + 0.5 >= v, i.e. x >= lut[v]
+   lut[0] = 0;
+   for (i=1; i < 256; ++i)
+      lut[i] = (float) pow((i - 0.5f) / 255.0f, 1.0f / stbi__h2l_gamma_i) / stbi__h2l_scale_i;
    // compute number of non-alpha components
    if (comp & 1) n = comp; else n = comp-1;
    for (i=0; i < x*y; ++i) {
       for (k=0; k < n; ++k) {
-         float z = (float) pow(data[i*comp+k]*stbi__h2l_scale_i, stbi__h2l_gamma_i) * 255 + 0.5f;
-         if (z < 0) z = 0;
-         if (z > 255) z = 255;
-         output[i*comp + k] = (stbi_uc) stbi__float2int(z);
+         float z = data[i*comp+k];
+         int v = 0;
+         if (z >= lut[v + 128]) v += 128;
+         if (z >= lut[v +  64]) v +=  64;
+         if (z >= lut[v +  32]) v +=  32;
+         if (z >= lut[v +  16]) v +=  16;
+         if (z >= lut[v +   8]) v +=   8;
+         if (z >= lut[v +   4]) v +=   4;
+         if (z >= lut[v +   2]) v +=   2;
+         if (z >= lut[v +   1]) v +=   1;
+         output[i*comp + k] = (stbi_uc) v;
       }
       if (k < comp) {
          float z = data[i*comp+k] * 255 + 0.5f;
@@ -3265,6 +3845,7 @@ static int stbi__decode_jpeg_header(stbi__jpeg *z, int scan)
 static int stbi__decode_jpeg_image(stbi__jpeg *j)
 {
    int m;
+   STBI_TRACE_ZONE("stbi__decode_jpeg_image");
    for (m = 0; m < 4; m++) {
       j->img_comp[m].raw_data = NULL;
       j->img_comp[m].raw_coeff = NULL;
@@ -4315,6 +4896,7 @@ static int stbi__parse_zlib(stbi__zbuf *a, int parse_header)
 
 static int stbi__do_zlib(stbi__zbuf *a, char *obuf, int olen, int exp, int parse_header)
 {
+   STBI_TRACE_ZONE("stbi__do_zlib");
    a->zout_start = obuf;
    a->zout       = obuf;
    a->zout_end   = obuf + olen;
@@ -4487,6 +5069,7 @@ static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 r
    int output_bytes = out_n*bytes;
    int filter_bytes = img_n*bytes;
    int width = x;
+   STBI_TRACE_ZONE("stbi__create_png_image_raw");
 
    STBI_ASSERT(out_n == s->img_n || out_n == s->img_n+1);
    a->out = (stbi_uc *) stbi__malloc_mad3(x, y, output_bytes, 0); // extra bytes to write off the end into
@@ -4818,19 +5401,6 @@ static int stbi__expand_png_palette(stbi__png *a, stbi_uc *palette, int len, int
    return 1;
 }
 
-static int stbi__unpremultiply_on_load = 0;
-static int stbi__de_iphone_flag = 0;
-
-STBIDEF void stbi_set_unpremultiply_on_load(int flag_true_if_should_unpremultiply)
-{
-   stbi__unpremultiply_on_load = flag_true_if_should_unpremultiply;
-}
-
-STBIDEF void stbi_convert_iphone_png_to_rgb(int flag_true_if_should_convert)
-{
-   stbi__de_iphone_flag = flag_true_if_should_convert;
-}
-
 static void stbi__de_iphone(stbi__png *z)
 {
    stbi__context *s = z->s;
@@ -4846,7 +5416,7 @@ static void stbi__de_iphone(stbi__png *z)
       }
    } else {
       STBI_ASSERT(s->img_out_n == 4);
-      if (stbi__unpremultiply_on_load) {
+      if (s->unpremultiply) {
          // convert bgr to rgb and unpremultiply
          for (i=0; i < pixel_count; ++i) {
             stbi_uc a = p[3];
@@ -5009,7 +5579,7 @@ static int stbi__parse_png_file(stbi__png *z, int scan, int req_comp)
                   if (!stbi__compute_transparency(z, tc, s->img_out_n)) return 0;
                }
             }
-            if (is_iphone && stbi__de_iphone_flag && s->img_out_n > 2)
+            if (is_iphone && s->convert_iphone_png && s->img_out_n > 2)
                stbi__de_iphone(z);
             if (pal_img_n) {
                // pal_img_n == 3 or 4
@@ -5033,8 +5603,12 @@ static int stbi__parse_png_file(stbi__png *z, int scan, int req_comp)
             if (first) return stbi__err("first not IHDR", "Corrupt PNG");
             if ((c.type & (1 << 29)) == 0) {
                #ifndef STBI_NO_FAILURE_STRINGS
-               // not threadsafe
+               // threadsafe only with thread-local storage
+               #ifdef STBI_THREAD_LOCAL
+               static STBI_THREAD_LOCAL char invalid_chunk[] = "XXXX PNG chunk not known";
+               #else
                static char invalid_chunk[] = "XXXX PNG chunk not known";
+               #endif
                invalid_chunk[0] = STBI__BYTECAST(c.type >> 24);
                invalid_chunk[1] = STBI__BYTECAST(c.type >> 16);
                invalid_chunk[2] = STBI__BYTECAST(c.type >>  8);
@@ -5062,12 +5636,9 @@ static void *stbi__do_png(stbi__png *p, int *x, int *y, int *n, int req_comp, st
       result = p->out;
       p->out = NULL;
       if (req_comp && req_comp != p->s->img_out_n) {
-         if (ri->bits_per_channel == 8)
-            result = stbi__convert_format((unsigned char *) result, p->s->img_out_n, req_comp, p->s->img_x, p->s->img_y);
-         else
-            result = stbi__convert_format16((stbi__uint16 *) result, p->s->img_out_n, req_comp, p->s->img_x, p->s->img_y);
+         // converted together with any flip or depth change in stbi__postprocess
+         ri->num_channels = p->s->img_out_n;
          p->s->img_out_n = req_comp;
-         if (result == NULL) return result;
       }
       *x = p->s->img_x;
       *y = p->s->img_y;
@@ -5301,7 +5872,6 @@ static void *stbi__bmp_load(stbi__context *s, int *x, int *y, int *comp, int req
    int psize=0,i,j,width;
    int flip_vertically, pad, target;
    stbi__bmp_data info;
-   STBI_NOTUSED(ri);
 
    info.all_a = 255;
    if (stbi__bmp_parse_header(s, &info) == NULL)
@@ -5465,10 +6035,8 @@ static void *stbi__bmp_load(stbi__context *s, int *x, int *y, int *comp, int req
       }
    }
 
-   if (req_comp && req_comp != target) {
-      out = stbi__convert_format(out, target, req_comp, s->img_x, s->img_y);
-      if (out == NULL) return out; // stbi__convert_format frees input on failure
-   }
+   if (req_comp && req_comp != target)
+      ri->num_channels = target; // converted in stbi__postprocess
 
    *x = s->img_x;
    *y = s->img_y;
@@ -5639,7 +6207,6 @@ static void *stbi__tga_load(stbi__context *s, int *x, int *y, int *comp, int req
    int RLE_count = 0;
    int RLE_repeating = 0;
    int read_next_pixel = 1;
-   STBI_NOTUSED(ri);
    STBI_NOTUSED(tga_x_origin); // @TODO
    STBI_NOTUSED(tga_y_origin); // @TODO
 
@@ -5799,7 +6366,7 @@ static void *stbi__tga_load(stbi__context *s, int *x, int *y, int *comp, int req
 
    // convert to target component count
    if (req_comp && req_comp != tga_comp)
-      tga_data = stbi__convert_format(tga_data, tga_comp, req_comp, tga_width, tga_height);
+      ri->num_channels = tga_comp; // converted in stbi__postprocess
 
    //   the things I do to get rid of an error message, and yet keep
    //   Microsoft's C compilers happy... [8^(
@@ -6719,7 +7286,7 @@ static void *stbi__load_gif_main(stbi__context *s, int **delays, int *x, int *y,
             }
             memcpy( out + ((layers - 1) * stride), u, stride );
             if (layers >= 2) {
-               two_back = out - 2 * stride;
+               two_back = out + (layers - 2) * stride;
             }
 
             if (delays) {
@@ -6777,6 +7344,137 @@ static int stbi__gif_info(stbi__context *s, int *x, int *y, int *comp)
 {
    return stbi__gif_info_raw(s,x,y,comp);
 }
+
+// the canvas of frame N is the pool slot N%3; each new frame starts as a copy
+// of the previous canvas, and slot (N+1)%3 still holds frame N-2 for the
+// "restore to previous" disposal mode, so no other history buffer is needed
+#define STBI__GIF_STREAM_POOL  3
+
+struct stbi_gif_stream
+{
+   stbi__context s;
+   stbi__gif g;
+   stbi_uc *pool[STBI__GIF_STREAM_POOL];
+   int cur;      // pool slot of the most recently returned frame
+   int frames;   // frames decoded since open/rewind
+   stbi_uc const *buffer;
+   int len;
+#ifndef STBI_NO_STDIO
+   FILE *f;
+#endif
+};
+
+static void stbi__gif_stream_reset(stbi_gif_stream *gs)
+{
+   int i;
+   for (i=0; i < STBI__GIF_STREAM_POOL; ++i)
+      STBI_FREE(gs->pool[i]);
+   STBI_FREE(gs->g.background);
+   STBI_FREE(gs->g.history);
+   memset(&gs->g, 0, sizeof(gs->g));
+   memset(gs->pool, 0, sizeof(gs->pool));
+   gs->cur = 0;
+   gs->frames = 0;
+
+#ifndef STBI_NO_STDIO
+   if (gs->f) {
+      fseek(gs->f, 0, SEEK_SET);
+      stbi__start_file(&gs->s, gs->f);
+      return;
+   }
+#endif
+   stbi__start_mem(&gs->s, gs->buffer, gs->len);
+}
+
+static stbi_gif_stream *stbi__gif_stream_open_main(stbi_gif_stream *gs, int *x, int *y)
+{
+   int w, h;
+   stbi__gif_stream_reset(gs);
+   if (!stbi__gif_test(&gs->s) || !stbi__gif_info_raw(&gs->s, &w, &h, NULL)) {
+      stbi_gif_stream_close(gs);
+      return (stbi_gif_stream *) stbi__errpuc("not GIF", "Image was not as a gif type.");
+   }
+   stbi__gif_stream_reset(gs);
+   if (x) *x = w;
+   if (y) *y = h;
+   return gs;
+}
+
+STBIDEF stbi_gif_stream *stbi_gif_stream_open_memory(stbi_uc const *buffer, int len, int *x, int *y)
+{
+   stbi_gif_stream *gs = (stbi_gif_stream *) stbi__malloc(sizeof(*gs));
+   if (!gs) return (stbi_gif_stream *) stbi__errpuc("outofmem", "Out of memory");
+   memset(gs, 0, sizeof(*gs));
+   gs->buffer = buffer;
+   gs->len = len;
+   return stbi__gif_stream_open_main(gs, x, y);
+}
+
+#ifndef STBI_NO_STDIO
+STBIDEF stbi_gif_stream *stbi_gif_stream_open(char const *filename, int *x, int *y)
+{
+   stbi_gif_stream *gs;
+   FILE *f = stbi__fopen(filename, "rb");
+   if (!f) return (stbi_gif_stream *) stbi__errpuc("can't fopen", "Unable to open file");
+   gs = (stbi_gif_stream *) stbi__malloc(sizeof(*gs));
+   if (!gs) {
+      fclose(f);
+      return (stbi_gif_stream *) stbi__errpuc("outofmem", "Out of memory");
+   }
+   memset(gs, 0, sizeof(*gs));
+   gs->f = f;
+   return stbi__gif_stream_open_main(gs, x, y);
+}
+#endif
+
+STBIDEF stbi_uc *stbi_gif_stream_next(stbi_gif_stream *gs, int *delay_ms)
+{
+   stbi_uc *u, *two_back = 0;
+   int comp, next = 0;
+
+   if (gs->g.out) {
+      next = (gs->cur + 1) % STBI__GIF_STREAM_POOL;
+      if (!gs->pool[next]) {
+         gs->pool[next] = (stbi_uc *) stbi__malloc_mad3(4, gs->g.w, gs->g.h, 0);
+         if (!gs->pool[next]) return stbi__errpuc("outofmem", "Out of memory");
+      }
+      memcpy(gs->pool[next], gs->g.out, 4 * gs->g.w * gs->g.h);
+      gs->g.out = gs->pool[next];
+      if (gs->frames >= 2)
+         two_back = gs->pool[(next + 1) % STBI__GIF_STREAM_POOL];
+   }
+
+   u = stbi__gif_load_next(&gs->s, &gs->g, &comp, 4, two_back);
+   if (gs->frames == 0)
+      gs->pool[0] = gs->g.out; // first frame allocates the initial canvas
+   if (u == (stbi_uc *) &gs->s || u == 0)
+      return 0;
+
+   gs->cur = next;
+   ++gs->frames;
+   if (delay_ms) *delay_ms = gs->g.delay;
+   return u;
+}
+
+STBIDEF int stbi_gif_stream_rewind(stbi_gif_stream *gs)
+{
+   stbi__gif_stream_reset(gs);
+   return stbi__gif_test(&gs->s);
+}
+
+STBIDEF void stbi_gif_stream_close(stbi_gif_stream *gs)
+{
+   int i;
+   if (!gs) return;
+   for (i=0; i < STBI__GIF_STREAM_POOL; ++i)
+      STBI_FREE(gs->pool[i]);
+   STBI_FREE(gs->g.background);
+   STBI_FREE(gs->g.history);
+#ifndef STBI_NO_STDIO
+   if (gs->f) fclose(gs->f);
+#endif
+   STBI_FREE(gs);
+}
 #endif
 
 // *************************************************************************************************
@@ -7202,7 +7900,6 @@ static int      stbi__pnm_test(stbi__context *s)
 static void *stbi__pnm_load(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri)
 {
    stbi_uc *out;
-   STBI_NOTUSED(ri);
 
    if (!stbi__pnm_info(s, (int *)&s->img_x, (int *)&s->img_y, (int *)&s->img_n))
       return 0;
@@ -7218,10 +7915,8 @@ static void *stbi__pnm_load(stbi__context *s, int *x, int *y, int *comp, int req
    if (!out) return stbi__errpuc("outofmem", "Out of memory");
    stbi__getn(s, out, s->img_n * s->img_x * s->img_y);
 
-   if (req_comp && req_comp != s->img_n) {
-      out = stbi__convert_format(out, s->img_n, req_comp, s->img_x, s->img_y);
-      if (out == NULL) return out; // stbi__convert_format frees input on failure
-   }
+   if (req_comp && req_comp != s->img_n)
+      ri->num_channels = s->img_n; // converted in stbi__postprocess
    return out;
 }
 
@@ -7300,6 +7995,366 @@ static int      stbi__pnm_info(stbi__context *s, int *x, int *y, int *comp)
 }
 #endif
 
+#ifndef STBI_NO_SPF
+
+// SPF spill frames (writeSpill in image_writer.h): a 24-byte header -- "SPFR",
+// version 1, channels, bits per channel (8 or 16), 0, then width, height and
+// rows per block as 32-bit little-endian -- followed by the 64-bit
+// little-endian file offset of every block of rows and of the end of the last
+// one, then the blocks. Each block decodes on its own and starts with its
+// method: 0 stores the rows, 1 is an LZ4 block (the format of lz4's
+// LZ4_compress_default) and 2 an LZ4 block of the rows after the row above,
+// within the block, has been subtracted bytewise. 16-bit samples are
+// little-endian, which is all this reads them as.
+
+typedef struct
+{
+   int w, h, n, bits, rows_per_block, blocks, row_bytes;
+} stbi__spf_header;
+
+#define STBI__SPF_HEADER_SIZE 24
+// offset table entries a header may ask for (an 8 MB table); a header with
+// more is corrupt, and the table is read before anything else is checked
+#define STBI__SPF_MAX_BLOCKS (1 << 20)
+
+static stbi__uint32 stbi__spf_get32(stbi_uc const *p)
+{
+   return p[0] | (p[1] << 8) | (p[2] << 16) | ((stbi__uint32) p[3] << 24);
+}
+
+static int stbi__spf_parse_header(stbi_uc const *p, stbi__spf_header *h)
+{
+   stbi__uint32 w, height, rows;
+   if (p[0] != 'S' || p[1] != 'P' || p[2] != 'F' || p[3] != 'R')
+      return 0;
+   w = stbi__spf_get32(p + 8);
+   height = stbi__spf_get32(p + 12);
+   rows = stbi__spf_get32(p + 16);
+   h->n = p[5];
+   h->bits = p[6];
+   if (p[4] != 1 || h->n < 1 || h->n > 4 || (h->bits != 8 && h->bits != 16) || !w || !height || !rows
+       || w > 0x7fffffff || height > 0x7fffffff)
+      return stbi__err("bad header", "Corrupt SPF header");
+   h->w = (int) w;
+   h->h = (int) height;
+   if (!stbi__mad3sizes_valid(h->n * (h->bits / 8), h->w, h->h, 0))
+      return stbi__err("too large", "SPF too large");
+   h->rows_per_block = rows < height ? (int) rows : h->h;
+   h->blocks = (h->h - 1) / h->rows_per_block + 1;
+   if (h->blocks > STBI__SPF_MAX_BLOCKS)
+      return stbi__err("bad header", "Corrupt SPF header");
+   h->row_bytes = h->w * h->n * (h->bits / 8);
+   return 1;
+}
+
+static size_t stbi__spf_table_size(stbi__spf_header const *h)
+{
+   return ((size_t) h->blocks + 1) * 8;
+}
+
+// reads the offset table that follows the header; the blocks must follow it
+// in order, without gaps, so a stream can be read straight through
+static int stbi__spf_check_offsets(stbi_uc const *table, stbi__spf_header const *h, size_t file_len)
+{
+   int i;
+   size_t previous = STBI__SPF_HEADER_SIZE + stbi__spf_table_size(h);
+   for (i = 0; i <= h->blocks; ++i) {
+      size_t offset = stbi__spf_get32(table + i * 8);
+      if (stbi__spf_get32(table + i * 8 + 4))
+         return stbi__err("bad offset", "Corrupt SPF");
+      if (i == 0 ? offset != previous : offset <= previous || offset > file_len)
+         return stbi__err("bad offset", "Corrupt SPF");
+      previous = offset;
+   }
+   return 1;
+}
+
+static int stbi__lz4_length(stbi_uc const **ip, stbi_uc const *iend, int *length)
+{
+   int b;
+   do {
+      if (*ip >= iend || *length > 0x7fffffff - 255)
+         return 0;
+      b = *(*ip)++;
+      *length += b;
+   } while (b == 255);
+   return 1;
+}
+
+// decodes an LZ4 block that must fill dst exactly. Copies go 8 or 16 bytes at
+// a time wherever dst has room past the end of the copy; the excess is always
+// overwritten by what follows.
+static int stbi__lz4_decode(stbi_uc *dst, int dst_len, stbi_uc const *src, int src_len)
+{
+   stbi_uc *op = dst, *oend = dst + dst_len;
+   stbi_uc const *ip = src, *iend = src + src_len;
+   for (;;) {
+      int token, length, offset;
+      stbi_uc *match, *end;
+      if (ip >= iend)
+         return 0;
+      token = *ip++;
+
+      length = token >> 4;
+      if (length == 15 && !stbi__lz4_length(&ip, iend, &length))
+         return 0;
+      if (length > iend - ip || length > oend - op)
+         return 0;
+      if (length <= 16 && iend - ip >= 16 && oend - op >= 16)
+         memcpy(op, ip, 16);
+      else
+         memcpy(op, ip, length);
+      op += length;
+      ip += length;
+      if (ip == iend)
+         return op == oend; // the last sequence is literals only
+
+      if (iend - ip < 2)
+         return 0;
+      offset = ip[0] | (ip[1] << 8);
+      ip += 2;
+      length = token & 15;
+      if (length == 15 && !stbi__lz4_length(&ip, iend, &length))
+         return 0;
+      length += 4;
+      if (offset == 0 || offset > op - dst || length > oend - op)
+         return 0;
+      match = op - offset;
+      end = op + length;
+
+      if (oend - end >= 16) {
+         // with room to spare past the match, copy in chunks that may
+         // overshoot. Offsets under 8 first write 8 bytes singly and step
+         // 'match' back to a multiple of the offset at least 8 behind (the
+         // table trick from lz4), so 8-byte chunks never overlap their source.
+         if (offset < 8) {
+            static const int inc[8] = { 0, 1, 2, 1, 0, 4, 4, 4 }, dec[8] = { 0, 0, 0, -1, -4, 1, 2, 3 };
+            op[0] = match[0];
+            op[1] = match[1];
+            op[2] = match[2];
+            op[3] = match[3];
+            match += inc[offset];
+            memcpy(op + 4, match, 4);
+            match -= dec[offset];
+            op += 8;
+         }
+         if (op - match >= 16) {
+            for (; op < end; op += 16, match += 16)
+               memcpy(op, match, 16);
+         } else {
+            for (; op < end; op += 8, match += 8)
+               memcpy(op, match, 8);
+         }
+      } else {
+         while (op < end)
+            *op++ = *match++;
+      }
+      op = end;
+   }
+}
+
+static void stbi__spf_undo_up(stbi_uc *rows, int len, int row_bytes)
+{
+   int i = row_bytes;
+   #ifdef STBI_SSE2
+   // rows shorter than a register would read bytes this loop has yet to write
+   if (row_bytes >= 16 && stbi__sse2_available()) {
+      for (; i + 16 <= len; i += 16) {
+         __m128i above = _mm_loadu_si128((__m128i const *) (rows + i - row_bytes));
+         __m128i delta = _mm_loadu_si128((__m128i const *) (rows + i));
+         _mm_storeu_si128((__m128i *) (rows + i), _mm_add_epi8(above, delta));
+      }
+   }
+   #endif
+   for (; i < len; ++i)
+      rows[i] = (stbi_uc) (rows[i] + rows[i - row_bytes]);
+}
+
+static int stbi__spf_decode_block(stbi_uc *out, int out_len, int row_bytes, stbi_uc const *in, size_t in_len)
+{
+   if (in_len < 1 || in_len > 0x7fffffff)
+      return stbi__err("bad block", "Corrupt SPF");
+   switch (in[0]) {
+      case 0:
+         if (in_len - 1 != (size_t) out_len)
+            return stbi__err("bad block", "Corrupt SPF");
+         memcpy(out, in + 1, out_len);
+         return 1;
+      case 1:
+      case 2:
+         if (!stbi__lz4_decode(out, out_len, in + 1, (int) in_len - 1))
+            return stbi__err("bad block", "Corrupt SPF");
+         if (in[0] == 2)
+            stbi__spf_undo_up(out, out_len, row_bytes);
+         return 1;
+      default:
+         return stbi__err("bad block", "Corrupt SPF");
+   }
+}
+
+static int stbi__spf_test(stbi__context *s)
+{
+   int r = stbi__get8(s) == 'S' && stbi__get8(s) == 'P' && stbi__get8(s) == 'F' && stbi__get8(s) == 'R';
+   stbi__rewind(s);
+   return r;
+}
+
+static int stbi__spf_read_header(stbi__context *s, stbi__spf_header *h)
+{
+   stbi_uc header[STBI__SPF_HEADER_SIZE];
+   int r = stbi__getn(s, header, STBI__SPF_HEADER_SIZE) && stbi__spf_parse_header(header, h);
+   if (!r)
+      stbi__rewind(s);
+   return r;
+}
+
+static int stbi__spf_info(stbi__context *s, int *x, int *y, int *comp)
+{
+   stbi__spf_header h;
+   if (!stbi__spf_read_header(s, &h))
+      return 0;
+   if (x) *x = h.w;
+   if (y) *y = h.h;
+   if (comp) *comp = h.n;
+   stbi__rewind(s);
+   return 1;
+}
+
+static int stbi__spf_is16(stbi__context *s)
+{
+   stbi__spf_header h;
+   if (!stbi__spf_read_header(s, &h))
+      return 0;
+   stbi__rewind(s);
+   return h.bits == 16;
+}
+
+static void *stbi__spf_load(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri)
+{
+   stbi__spf_header h;
+   stbi_uc *out, *table, *scratch = NULL;
+   size_t table_size;
+   int i, ok = 1;
+   STBI_TRACE_ZONE("stbi__spf_load");
+
+   if (!stbi__spf_read_header(s, &h))
+      return NULL;
+   table_size = stbi__spf_table_size(&h);
+   if (!s->io.read && (size_t) (s->img_buffer_end - s->img_buffer) < table_size)
+      return stbi__errpuc("bad offset", "Corrupt SPF");
+   table = (stbi_uc *) stbi__malloc(table_size);
+   if (!table)
+      return stbi__errpuc("outofmem", "Out of memory");
+   if (!stbi__getn(s, table, (int) table_size) || !stbi__spf_check_offsets(table, &h, (size_t) -1)) {
+      STBI_FREE(table);
+      return stbi__errpuc("bad offset", "Corrupt SPF");
+   }
+   out = (stbi_uc *) stbi__malloc_mad3(h.row_bytes, h.h, 1, 0);
+   if (!out) {
+      STBI_FREE(table);
+      return stbi__errpuc("outofmem", "Out of memory");
+   }
+
+   // blocks are decoded straight from a memory buffer; a stream reads each
+   // into a scratch buffer first
+   if (s->io.read) {
+      size_t largest = 0;
+      for (i = 0; i < h.blocks; ++i) {
+         size_t in_len = stbi__spf_get32(table + (i + 1) * 8) - stbi__spf_get32(table + i * 8);
+         largest = in_len > largest ? in_len : largest;
+      }
+      scratch = largest <= 0x7fffffff ? (stbi_uc *) stbi__malloc(largest) : NULL;
+      if (!scratch) {
+         STBI_FREE(out);
+         STBI_FREE(table);
+         return stbi__errpuc("outofmem", "Out of memory");
+      }
+   }
+   for (i = 0; ok && i < h.blocks; ++i) {
+      size_t in_len = stbi__spf_get32(table + (i + 1) * 8) - stbi__spf_get32(table + i * 8);
+      int first = i * h.rows_per_block, rows = h.h - first < h.rows_per_block ? h.h - first : h.rows_per_block;
+      stbi_uc const *in = s->img_buffer;
+      if (scratch) {
+         ok = stbi__getn(s, scratch, (int) in_len);
+         in = scratch;
+      } else {
+         ok = (size_t) (s->img_buffer_end - s->img_buffer) >= in_len;
+         s->img_buffer += ok ? in_len : 0;
+      }
+      if (!ok)
+         ok = stbi__err("truncated", "Corrupt SPF");
+      else
+         ok = stbi__spf_decode_block(out + (size_t) first * h.row_bytes, rows * h.row_bytes, h.row_bytes, in, in_len);
+   }
+   if (scratch) STBI_FREE(scratch);
+   STBI_FREE(table);
+   if (!ok) {
+      STBI_FREE(out);
+      return NULL;
+   }
+
+   *x = h.w;
+   *y = h.h;
+   if (comp) *comp = h.n;
+   ri->bits_per_channel = h.bits;
+   if (req_comp && req_comp != h.n)
+      ri->num_channels = h.n; // converted in stbi__postprocess
+   return out;
+}
+
+STBIDEF void *stbi_spf_load_rows_from_memory(stbi_uc const *buffer, int len, int first_row, int row_count,
+                                             int *x, int *channels_in_file, int *bits_per_channel)
+{
+   stbi__spf_header h;
+   stbi_uc const *table;
+   stbi_uc *out;
+   int block, last_row;
+   if (len < STBI__SPF_HEADER_SIZE)
+      return stbi__errpuc("not SPF", "Image not of any known type, or corrupt");
+   if (!stbi__spf_parse_header(buffer, &h))
+      return stbi__errpuc("not SPF", "Image not of any known type, or corrupt");
+   if (first_row < 0 || row_count <= 0 || row_count > h.h - first_row)
+      return stbi__errpuc("bad rows", "Rows outside the image");
+   table = buffer + STBI__SPF_HEADER_SIZE;
+   if ((size_t) len < STBI__SPF_HEADER_SIZE + stbi__spf_table_size(&h) || !stbi__spf_check_offsets(table, &h, len))
+      return NULL;
+   out = (stbi_uc *) stbi__malloc_mad3(h.row_bytes, row_count, 1, 0);
+   if (!out)
+      return stbi__errpuc("outofmem", "Out of memory");
+
+   // whole blocks go straight to the output; the partly wanted ones at
+   // either end through a block-sized buffer
+   last_row = first_row + row_count;
+   for (block = first_row / h.rows_per_block; block * h.rows_per_block < last_row; ++block) {
+      int first = block * h.rows_per_block;
+      int rows = h.h - first < h.rows_per_block ? h.h - first : h.rows_per_block;
+      size_t begin = stbi__spf_get32(table + block * 8), end = stbi__spf_get32(table + (block + 1) * 8);
+      int from = first < first_row ? first_row : first, to = first + rows < last_row ? first + rows : last_row;
+      stbi_uc *dest = out + (size_t) (from - first_row) * h.row_bytes;
+      if (from == first && to == first + rows) {
+         if (!stbi__spf_decode_block(dest, rows * h.row_bytes, h.row_bytes, buffer + begin, end - begin)) {
+            STBI_FREE(out);
+            return NULL;
+         }
+      } else {
+         stbi_uc *temp = (stbi_uc *) stbi__malloc_mad3(h.row_bytes, rows, 1, 0);
+         if (!temp || !stbi__spf_decode_block(temp, rows * h.row_bytes, h.row_bytes, buffer + begin, end - begin)) {
+            if (temp) STBI_FREE(temp);
+            STBI_FREE(out);
+            return temp ? NULL : stbi__errpuc("outofmem", "Out of memory");
+         }
+         memcpy(dest, temp + (size_t) (from - first) * h.row_bytes, (size_t) (to - from) * h.row_bytes);
+         STBI_FREE(temp);
+      }
+   }
+
+   if (x) *x = h.w;
+   if (channels_in_file) *channels_in_file = h.n;
+   if (bits_per_channel) *bits_per_channel = h.bits;
+   return out;
+}
+#endif
+
 static int stbi__info_main(stbi__context *s, int *x, int *y, int *comp)
 {
    #ifndef STBI_NO_JPEG
@@ -7330,6 +8385,10 @@ static int stbi__info_main(stbi__context *s, int *x, int *y, int *comp)
    if (stbi__pnm_info(s, x, y, comp))  return 1;
    #endif
 
+   #ifndef STBI_NO_SPF
+   if (stbi__spf_info(s, x, y, comp))  return 1;
+   #endif
+
    #ifndef STBI_NO_HDR
    if (stbi__hdr_info(s, x, y, comp))  return 1;
    #endif
@@ -7352,6 +8411,10 @@ static int stbi__is_16_main(stbi__context *s)
    if (stbi__psd_is16(s))  return 1;
    #endif
 
+   #ifndef STBI_NO_SPF
+   if (stbi__spf_is16(s))  return 1;
+   #endif
+
    return 0;
 }
 
@@ -0,0 +1,427 @@
+#include "job_system.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <thread>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+using namespace std;
+
+struct Job {
+  function<void()> task;
+  atomic<int> unfinished;  // the task itself plus children not yet finished
+  atomic<int> blockers;    // dependencies not yet finished, plus one until submitted
+  JobHandle parent;
+
+  mutex lock;              // orders 'done' against new continuations
+  atomic<bool> done;
+  vector<JobHandle> continuations;
+};
+
+struct JobSystem::Worker {
+  mutex lock;
+  deque<JobHandle> jobs;
+  thread handle;
+
+  atomic<unsigned long long> executed, stolen, failedSteals, idleNs;
+  atomic<unsigned> maxQueueDepth;
+};
+
+namespace {
+
+typedef chrono::steady_clock Clock;
+
+// which scheduler (if any) the calling thread works for, and as which worker
+thread_local JobSystem* t_system = NULL;
+thread_local int t_worker = -1;
+
+void pinToCore(thread& worker, int core)
+{
+#ifdef _WIN32
+  if (core < int(sizeof(DWORD_PTR) * 8))
+    SetThreadAffinityMask(worker.native_handle(), DWORD_PTR(1) << core);
+#elif defined(__linux__)
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(core, &set);
+  pthread_setaffinity_np(worker.native_handle(), sizeof(set), &set);
+#else
+  (void)worker;
+  (void)core;
+#endif
+}
+
+} // namespace
+
+JobSystem::JobSystem()
+  : m_running(false), m_stopping(false), m_queued(0), m_sleeping(0), m_waiting(0), m_nextWorker(0), m_helped(0)
+{
+}
+
+JobSystem::~JobSystem()
+{
+  stop();
+}
+
+bool JobSystem::start(int workers, bool pin)
+{
+  lock_guard<mutex> guard(m_startLock);
+  if (running())
+    return false;
+
+  int cores = max(1, int(thread::hardware_concurrency()));
+  if (workers < 0)
+    workers = max(1, cores - 1);
+  // pinning more threads than cores would stack them up on the same ones
+  pin = pin && workers + 1 <= cores;
+
+  m_stopping = false;
+  m_workers.clear();
+  for (int i = 0; i < workers; ++i) {
+    m_workers.push_back(unique_ptr<Worker>(new Worker));
+    Worker& worker = *m_workers.back();
+    worker.executed = worker.stolen = worker.failedSteals = worker.idleNs = 0;
+    worker.maxQueueDepth = 0;
+  }
+  for (int i = 0; i < workers; ++i) {
+    m_workers[i]->handle = thread(&JobSystem::workerLoop, this, i);
+    if (pin)
+      pinToCore(m_workers[i]->handle, i + 1);
+  }
+  m_running.store(true, memory_order_release);
+  return true;
+}
+
+void JobSystem::stop()
+{
+  lock_guard<mutex> guard(m_startLock);
+  if (!running())
+    return;
+
+  {
+    lock_guard<mutex> sleepGuard(m_sleepLock);
+    m_stopping = true;
+  }
+  m_wake.notify_all();
+  for (size_t i = 0; i < m_workers.size(); ++i)
+    m_workers[i]->handle.join();
+
+  // a continuation released by the last job to finish may still be queued
+  while (JobHandle job = take(-1))
+    execute(job);
+
+  m_running.store(false, memory_order_release);
+  m_workers.clear();
+}
+
+void JobSystem::ensureRunning()
+{
+  if (!running())
+    start();
+}
+
+JobHandle JobSystem::createJob(function<void()> task)
+{
+  JobHandle job = make_shared<Job>();
+  job->task = move(task);
+  job->unfinished = 1;
+  job->blockers = 1;
+  job->done = false;
+  return job;
+}
+
+JobHandle JobSystem::submit(function<void()> task)
+{
+  ensureRunning();
+  JobHandle job = createJob(move(task));
+  release(job);
+  return job;
+}
+
+JobHandle JobSystem::submitAfter(vector<JobHandle> const& dependencies, function<void()> task)
+{
+  ensureRunning();
+  JobHandle job = createJob(move(task));
+  for (size_t i = 0; i < dependencies.size(); ++i) {
+    Job* dependency = dependencies[i].get();
+    if (!dependency)
+      continue;
+    lock_guard<mutex> guard(dependency->lock);
+    if (!dependency->done) {
+      ++job->blockers;
+      dependency->continuations.push_back(job);
+    }
+  }
+  // drops the hold taken in createJob; enqueues now if nothing was pending
+  release(job);
+  return job;
+}
+
+JobHandle JobSystem::then(JobHandle const& job, function<void()> task)
+{
+  return submitAfter(vector<JobHandle>(1, job), move(task));
+}
+
+JobHandle JobSystem::parallelForAsync(int begin, int end, int grain, function<void(int, int)> body)
+{
+  ensureRunning();
+  grain = max(1, grain);
+  int count = max(0, end - begin);
+
+  // a few chunks per thread leave stealing something to balance with
+  int chunks = (count + grain - 1) / grain;
+  chunks = min(chunks, (workerCount() + 1) * 4);
+
+  JobHandle parent = createJob(function<void()>());
+  parent->unfinished += chunks;
+  shared_ptr<function<void(int, int)>> shared = make_shared<function<void(int, int)>>(move(body));
+  for (int c = 0; c < chunks; ++c) {
+    int first = begin + int(static_cast<long long>(count) * c / chunks);
+    int last = begin + int(static_cast<long long>(count) * (c + 1) / chunks);
+    JobHandle chunk = createJob([shared, first, last] { (*shared)(first, last); });
+    chunk->parent = parent;
+    release(chunk);
+  }
+  // the parent has no work of its own; it finishes with its last chunk
+  complete(parent.get());
+  return parent;
+}
+
+void JobSystem::parallelFor(int begin, int end, int grain, function<void(int, int)> const& body)
+{
+  if (end - begin <= max(1, grain)) {
+    if (end > begin)
+      body(begin, end);
+    return;
+  }
+  ensureRunning();
+  if (workerCount() == 0) {
+    body(begin, end);
+    return;
+  }
+  wait(parallelForAsync(begin, end, grain, body));
+}
+
+void JobSystem::wait(JobHandle const& job)
+{
+  if (!job)
+    return;
+  bool isWorker = t_system == this;
+  while (!finished(job)) {
+    JobHandle next = take(isWorker ? t_worker : -1);
+    if (next) {
+      if (!isWorker)
+        ++m_helped;
+      execute(next);
+      continue;
+    }
+    // the job is running elsewhere; the timeout covers a notify that slips
+    // in between the check and the wait
+    unique_lock<mutex> guard(m_waitLock);
+    ++m_waiting;
+    m_jobDone.wait_for(guard, chrono::milliseconds(1), [&] { return finished(job) || m_queued.load() > 0; });
+    --m_waiting;
+  }
+}
+
+bool JobSystem::finished(JobHandle const& job)
+{
+  return !job || job->done.load(memory_order_acquire);
+}
+
+void JobSystem::release(JobHandle const& job)
+{
+  if (--job->blockers == 0)
+    enqueue(job);
+}
+
+void JobSystem::enqueue(JobHandle const& job)
+{
+  if (m_workers.empty()) {
+    execute(job);
+    return;
+  }
+
+  int target = t_system == this ? t_worker : int(m_nextWorker++ % m_workers.size());
+  Worker& worker = *m_workers[target];
+  {
+    lock_guard<mutex> guard(worker.lock);
+    worker.jobs.push_back(job);
+    unsigned depth = unsigned(worker.jobs.size());
+    if (depth > worker.maxQueueDepth.load(memory_order_relaxed))
+      worker.maxQueueDepth.store(depth, memory_order_relaxed);
+  }
+
+  // sleepers re-check m_queued after registering in m_sleeping, so one of
+  // the two always sees the other
+  ++m_queued;
+  if (m_sleeping.load() > 0) {
+    lock_guard<mutex> guard(m_sleepLock);
+    m_wake.notify_one();
+  }
+}
+
+JobHandle JobSystem::take(int self)
+{
+  JobHandle job;
+  int count = int(m_workers.size());
+  if (count == 0)
+    return job;
+
+  if (self >= 0) {
+    Worker& own = *m_workers[self];
+    lock_guard<mutex> guard(own.lock);
+    if (!own.jobs.empty()) {
+      job = own.jobs.back();
+      own.jobs.pop_back();
+    }
+  }
+
+  // steal the oldest job from someone else, starting past ourselves (or at
+  // a rotating victim for outside threads) so thieves spread out
+  int start = self >= 0 ? self : int(m_nextWorker.load() % count);
+  for (int k = self >= 0 ? 1 : 0; !job && k < count; ++k) {
+    Worker& victim = *m_workers[(start + k) % count];
+    lock_guard<mutex> guard(victim.lock);
+    if (!victim.jobs.empty()) {
+      job = victim.jobs.front();
+      victim.jobs.pop_front();
+      if (self >= 0)
+        ++m_workers[self]->stolen;
+    }
+  }
+
+  if (job)
+    --m_queued;
+  else if (self >= 0 && count > 1)
+    ++m_workers[self]->failedSteals;
+  return job;
+}
+
+void JobSystem::execute(JobHandle const& job)
+{
+  if (t_system == this)
+    ++m_workers[t_worker]->executed;
+  if (job->task) {
+    job->task();
+    // drop captures now rather than when the last handle goes
+    job->task = function<void()>();
+  }
+  complete(job.get());
+}
+
+void JobSystem::complete(Job* job)
+{
+  if (--job->unfinished != 0)
+    return;
+
+  vector<JobHandle> continuations;
+  {
+    lock_guard<mutex> guard(job->lock);
+    job->done.store(true, memory_order_release);
+    continuations.swap(job->continuations);
+  }
+  for (size_t i = 0; i < continuations.size(); ++i)
+    release(continuations[i]);
+
+  if (m_waiting.load() > 0) {
+    lock_guard<mutex> guard(m_waitLock);
+    m_jobDone.notify_all();
+  }
+
+  JobHandle parent = job->parent;
+  job->parent.reset();
+  if (parent)
+    complete(parent.get());
+}
+
+void JobSystem::workerLoop(int index)
+{
+  t_system = this;
+  t_worker = index;
+  TRACE_THREAD_NAME("job worker");
+
+  Worker& self = *m_workers[index];
+  for (;;) {
+    JobHandle job = take(index);
+    if (job) {
+      execute(job);
+      continue;
+    }
+
+    unique_lock<mutex> guard(m_sleepLock);
+    if (m_stopping && m_queued.load() == 0)
+      break;
+    ++m_sleeping;
+    Clock::time_point start = Clock::now();
+    m_wake.wait(guard, [&] { return m_stopping || m_queued.load() > 0; });
+    --m_sleeping;
+    self.idleNs += chrono::duration_cast<chrono::nanoseconds>(Clock::now() - start).count();
+  }
+
+  t_system = NULL;
+  t_worker = -1;
+}
+
+vector<JobSystem::WorkerStats> JobSystem::stats() const
+{
+  vector<WorkerStats> result;
+  for (size_t i = 0; i < m_workers.size(); ++i) {
+    Worker& worker = *m_workers[i];
+    WorkerStats stats;
+    stats.executed = worker.executed;
+    stats.stolen = worker.stolen;
+    stats.failedSteals = worker.failedSteals;
+    stats.helped = 0;
+    stats.idleMs = worker.idleNs / 1e6;
+    {
+      lock_guard<mutex> guard(worker.lock);
+      stats.queueDepth = unsigned(worker.jobs.size());
+    }
+    stats.maxQueueDepth = worker.maxQueueDepth;
+    result.push_back(stats);
+  }
+  return result;
+}
+
+JobSystem::WorkerStats JobSystem::totals() const
+{
+  vector<WorkerStats> workers = stats();
+  WorkerStats total = WorkerStats();
+  for (size_t i = 0; i < workers.size(); ++i) {
+    total.executed += workers[i].executed;
+    total.stolen += workers[i].stolen;
+    total.failedSteals += workers[i].failedSteals;
+    total.idleMs += workers[i].idleMs;
+    total.queueDepth += workers[i].queueDepth;
+    total.maxQueueDepth = max(total.maxQueueDepth, workers[i].maxQueueDepth);
+  }
+  total.helped = m_helped;
+  return total;
+}
+
+void JobSystem::resetStats()
+{
+  for (size_t i = 0; i < m_workers.size(); ++i) {
+    Worker& worker = *m_workers[i];
+    worker.executed = worker.stolen = worker.failedSteals = worker.idleNs = 0;
+    worker.maxQueueDepth = 0;
+  }
+  m_helped = 0;
+}
+
+JobSystem& jobSystem()
+{
+  static JobSystem system;
+  return system;
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// One job: a function plus the bookkeeping that lets others depend on it.
+// Only the scheduler looks inside; callers hold JobHandles.
+struct Job;
+typedef std::shared_ptr<Job> JobHandle;
+
+// Work-stealing scheduler shared by every parallel stage (decode, colour
+// conversion, warps, mips, encoders), so they divide the cores between them
+// instead of each spinning up its own threads.
+//
+// Every worker owns a deque: jobs submitted from a worker go to the back of
+// its own deque and it takes work from the back (most recent first, still
+// warm in cache); an idle worker steals from the front of the others (oldest
+// first, usually the biggest pieces). Jobs submitted from other threads are
+// dealt round-robin. Workers with nothing to run or steal sleep until new
+// work arrives.
+//
+// A job is finished once its function has returned and every child added to
+// it (parallelForAsync chunks) has finished; only then do jobs that depend on
+// it become runnable.
+class JobSystem
+{
+public:
+  // A snapshot of one worker's counters. executed includes stolen jobs;
+  // helped counts jobs run by threads blocked in wait() and is only filled
+  // in by totals().
+  struct WorkerStats {
+    unsigned long long executed;
+    unsigned long long stolen;
+    unsigned long long failedSteals;  // full passes over the other deques that found nothing
+    unsigned long long helped;
+    double idleMs;                    // asleep waiting for work
+    unsigned queueDepth;              // jobs waiting in its deque right now
+    unsigned maxQueueDepth;
+  };
+
+  JobSystem();
+  ~JobSystem();
+
+  // Starts the workers; the first submit does this with the defaults if it
+  // hasn't been called. 'workers' < 0 means one per hardware thread minus
+  // one, leaving a core to the thread that owns the GL context. With 'pin',
+  // worker i is bound to core i + 1 (core 0 stays with that thread) as long
+  // as there are enough cores. Returns false if already running.
+  bool start(int workers = -1, bool pin = true);
+
+  // runs whatever is still queued, then joins the workers
+  void stop();
+
+  bool running() const { return m_running.load(std::memory_order_acquire); }
+  int workerCount() const { return int(m_workers.size()); }
+
+  JobHandle submit(std::function<void()> task);
+
+  // runs 'task' once every job in 'dependencies' has finished (empty
+  // handles are ignored)
+  JobHandle submitAfter(std::vector<JobHandle> const& dependencies, std::function<void()> task);
+
+  // continuation: runs 'task' once 'job' has finished
+  JobHandle then(JobHandle const& job, std::function<void()> task);
+
+  // Splits [begin, end) into chunks of at least 'grain' items and runs
+  // body(first, last) on each. The returned job finishes when every chunk
+  // has, so it can be waited on or continued like any other.
+  JobHandle parallelForAsync(int begin, int end, int grain, std::function<void(int, int)> body);
+
+  // as above and waits; small ranges run directly on the calling thread
+  void parallelFor(int begin, int end, int grain, std::function<void(int, int)> const& body);
+
+  // Blocks until 'job' has finished, running queued jobs meanwhile so a
+  // waiting worker (or caller) isn't a lost core.
+  void wait(JobHandle const& job);
+  static bool finished(JobHandle const& job);
+
+  std::vector<WorkerStats> stats() const;
+  WorkerStats totals() const;
+  void resetStats();
+
+private:
+  struct Worker;
+
+  void ensureRunning();
+  void workerLoop(int index);
+  JobHandle createJob(std::function<void()> task);
+  void enqueue(JobHandle const& job);
+  void release(JobHandle const& job);
+  JobHandle take(int self);
+  void execute(JobHandle const& job);
+  void complete(Job* job);
+
+  std::vector<std::unique_ptr<Worker>> m_workers;
+  std::atomic<bool> m_running;
+  bool m_stopping;
+  std::mutex m_startLock;
+
+  // sleeping workers and waiters; m_queued counts jobs sitting in deques
+  std::atomic<int> m_queued;
+  std::atomic<int> m_sleeping, m_waiting;
+  std::atomic<unsigned> m_nextWorker;
+  std::atomic<unsigned long long> m_helped;
+  std::mutex m_sleepLock, m_waitLock;
+  std::condition_variable m_wake, m_jobDone;
+};
+
+// the scheduler shared by the whole process
+JobSystem& jobSystem();
@@ -0,0 +1,411 @@
+#include "image_writer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <iostream>
+
+#include "cpu_features.h"
+#include "job_system.h"
+#include "simd_lane.h"
+#include "trace.h"
+
+namespace scalar {
+typedef LaneScalar Lane;
+#include "jpeg_writer_kernels.inl"
+}
+
+#ifdef SIMD_X86
+SIMD_BEGIN_TARGET_SSE2
+namespace sse2 {
+typedef LaneSSE2 Lane;
+#include "jpeg_writer_kernels.inl"
+}
+SIMD_END_TARGET
+
+SIMD_BEGIN_TARGET_AVX2
+namespace avx2 {
+typedef LaneAVX2 Lane;
+#include "jpeg_writer_kernels.inl"
+}
+SIMD_END_TARGET
+
+SIMD_BEGIN_TARGET_AVX512
+namespace avx512 {
+typedef LaneAVX512 Lane;
+#include "jpeg_writer_kernels.inl"
+}
+SIMD_END_TARGET
+#endif
+
+namespace {
+
+// about this many pixels per job; strips are whole MCU rows
+const int kPixelsPerStrip = 1 << 16;
+
+// position in natural (row-major) order of each zigzag index
+const unsigned char kZigzag[64] = {
+  0, 1, 8, 16, 9, 2, 3, 10, 17, 24, 32, 25, 18, 11, 4, 5, 12, 19, 26, 33, 40, 48,
+  41, 34, 27, 20, 13, 6, 7, 14, 21, 28, 35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23,
+  30, 37, 44, 51, 58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63 };
+
+// ITU T.81 Annex K: quantizers at quality 50 in natural order, and the
+// typical Huffman tables as code counts per length followed by the symbols
+const unsigned char kLumaQuantizers[64] = {
+  16, 11, 10, 16, 24, 40, 51, 61, 12, 12, 14, 19, 26, 58, 60, 55,
+  14, 13, 16, 24, 40, 57, 69, 56, 14, 17, 22, 29, 51, 87, 80, 62,
+  18, 22, 37, 56, 68, 109, 103, 77, 24, 35, 55, 64, 81, 104, 113, 92,
+  49, 64, 78, 87, 103, 121, 120, 101, 72, 92, 95, 98, 112, 100, 103, 99 };
+const unsigned char kChromaQuantizers[64] = {
+  17, 18, 24, 47, 99, 99, 99, 99, 18, 21, 26, 66, 99, 99, 99, 99,
+  24, 26, 56, 99, 99, 99, 99, 99, 47, 66, 99, 99, 99, 99, 99, 99,
+  99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99,
+  99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99 };
+
+const unsigned char kLumaDc[16 + 12] = {
+  0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0,
+  0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
+const unsigned char kChromaDc[16 + 12] = {
+  0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0,
+  0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
+const unsigned char kLumaAc[16 + 162] = {
+  0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7D,
+  0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+  0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xA1, 0x08, 0x23, 0x42, 0xB1, 0xC1, 0x15, 0x52, 0xD1, 0xF0,
+  0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0A, 0x16, 0x17, 0x18, 0x19, 0x1A, 0x25, 0x26, 0x27, 0x28,
+  0x29, 0x2A, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+  0x4A, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5A, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+  0x6A, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7A, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+  0x8A, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9A, 0xA2, 0xA3, 0xA4, 0xA5, 0xA6, 0xA7,
+  0xA8, 0xA9, 0xAA, 0xB2, 0xB3, 0xB4, 0xB5, 0xB6, 0xB7, 0xB8, 0xB9, 0xBA, 0xC2, 0xC3, 0xC4, 0xC5,
+  0xC6, 0xC7, 0xC8, 0xC9, 0xCA, 0xD2, 0xD3, 0xD4, 0xD5, 0xD6, 0xD7, 0xD8, 0xD9, 0xDA, 0xE1, 0xE2,
+  0xE3, 0xE4, 0xE5, 0xE6, 0xE7, 0xE8, 0xE9, 0xEA, 0xF1, 0xF2, 0xF3, 0xF4, 0xF5, 0xF6, 0xF7, 0xF8,
+  0xF9, 0xFA };
+const unsigned char kChromaAc[16 + 162] = {
+  0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77,
+  0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+  0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xA1, 0xB1, 0xC1, 0x09, 0x23, 0x33, 0x52, 0xF0,
+  0x15, 0x62, 0x72, 0xD1, 0x0A, 0x16, 0x24, 0x34, 0xE1, 0x25, 0xF1, 0x17, 0x18, 0x19, 0x1A, 0x26,
+  0x27, 0x28, 0x29, 0x2A, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+  0x49, 0x4A, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5A, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+  0x69, 0x6A, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7A, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+  0x88, 0x89, 0x8A, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9A, 0xA2, 0xA3, 0xA4, 0xA5,
+  0xA6, 0xA7, 0xA8, 0xA9, 0xAA, 0xB2, 0xB3, 0xB4, 0xB5, 0xB6, 0xB7, 0xB8, 0xB9, 0xBA, 0xC2, 0xC3,
+  0xC4, 0xC5, 0xC6, 0xC7, 0xC8, 0xC9, 0xCA, 0xD2, 0xD3, 0xD4, 0xD5, 0xD6, 0xD7, 0xD8, 0xD9, 0xDA,
+  0xE2, 0xE3, 0xE4, 0xE5, 0xE6, 0xE7, 0xE8, 0xE9, 0xEA, 0xF2, 0xF3, 0xF4, 0xF5, 0xF6, 0xF7, 0xF8,
+  0xF9, 0xFA };
+
+struct HuffmanTable {
+  unsigned short codes[256];
+  unsigned char lengths[256];
+
+  // canonical codes from a DHT-style table
+  explicit HuffmanTable(unsigned char const* table)
+  {
+    unsigned code = 0;
+    unsigned char const* symbol = table + 16;
+    for (int length = 1; length <= 16; ++length) {
+      for (int i = 0; i < table[length - 1]; ++i, ++symbol) {
+        codes[*symbol] = (unsigned short)code++;
+        lengths[*symbol] = (unsigned char)length;
+      }
+      code <<= 1;
+    }
+  }
+};
+
+struct Tables {
+  HuffmanTable dc[2], ac[2];
+
+  Tables() : dc{ HuffmanTable(kLumaDc), HuffmanTable(kChromaDc) }, ac{ HuffmanTable(kLumaAc), HuffmanTable(kChromaAc) }
+  {}
+};
+
+// built on first use; C++11 makes the initialisation thread safe
+Tables const& tables()
+{
+  static Tables tables;
+  return tables;
+}
+
+// entropy-coded data, most significant bit first, with a zero stuffed after
+// every 0xFF
+class BitWriter {
+public:
+  explicit BitWriter(std::vector<unsigned char>& out) : m_out(out), m_bits(0), m_count(0) {}
+
+  void put(unsigned bits, int length)
+  {
+    m_bits = m_bits << length | (bits & ((1u << length) - 1));
+    m_count += length;
+    while (m_count >= 8) {
+      m_count -= 8;
+      unsigned char byte = (unsigned char)(m_bits >> m_count);
+      m_out.push_back(byte);
+      if (byte == 0xFF)
+        m_out.push_back(0);
+    }
+  }
+
+  // pads the last byte with 1 bits, as the standard asks before a marker
+  void flush()
+  {
+    if (m_count)
+      put(0x7F, 8 - m_count);
+  }
+
+private:
+  std::vector<unsigned char>& m_out;
+  unsigned long long m_bits;
+  int m_count;
+};
+
+// bits needed for |value|, which is the JPEG magnitude category
+int category(int value)
+{
+  unsigned magnitude = unsigned(value < 0 ? -value : value);
+  int bits = 0;
+  while (magnitude) {
+    ++bits;
+    magnitude >>= 1;
+  }
+  return bits;
+}
+
+void putValue(BitWriter& writer, int value, int bits)
+{
+  // negative values are sent as value - 1 in 'bits' bits, i.e. one's
+  // complement of the magnitude
+  writer.put(unsigned(value < 0 ? value - 1 : value), bits);
+}
+
+void encodeBlock(BitWriter& writer, short const* coefficients, int& previousDc, HuffmanTable const& dc,
+  HuffmanTable const& ac)
+{
+  int difference = coefficients[0] - previousDc;
+  previousDc = coefficients[0];
+  int bits = category(difference);
+  writer.put(dc.codes[bits], dc.lengths[bits]);
+  if (bits)
+    putValue(writer, difference, bits);
+
+  int run = 0;
+  for (int k = 1; k < 64; ++k) {
+    int value = coefficients[kZigzag[k]];
+    if (!value) {
+      ++run;
+      continue;
+    }
+    for (; run >= 16; run -= 16)
+      writer.put(ac.codes[0xF0], ac.lengths[0xF0]);
+    bits = category(value);
+    int symbol = run << 4 | bits;
+    writer.put(ac.codes[symbol], ac.lengths[symbol]);
+    putValue(writer, value, bits);
+    run = 0;
+  }
+  if (run)
+    writer.put(ac.codes[0x00], ac.lengths[0x00]);
+}
+
+void transformPlane(SimdLevel level, float const* plane, int width, int height, float const* scale,
+  short* coefficients)
+{
+  switch (level) {
+#ifdef SIMD_X86
+  case SIMD_AVX512: avx512::transformPlane(plane, width, height, scale, coefficients); break;
+  case SIMD_AVX2: avx2::transformPlane(plane, width, height, scale, coefficients); break;
+  case SIMD_SSE2: sse2::transformPlane(plane, width, height, scale, coefficients); break;
+#endif
+  default: scalar::transformPlane(plane, width, height, scale, coefficients); break;
+  }
+}
+
+void rgbToYcc(SimdLevel level, float* c0, float* c1, float* c2, std::size_t count)
+{
+  switch (level) {
+#ifdef SIMD_X86
+  case SIMD_AVX512: avx512::rgbToYcc(c0, c1, c2, count); break;
+  case SIMD_AVX2: avx2::rgbToYcc(c0, c1, c2, count); break;
+  case SIMD_SSE2: sse2::rgbToYcc(c0, c1, c2, count); break;
+#endif
+  default: scalar::rgbToYcc(c0, c1, c2, count); break;
+  }
+}
+
+void putMarker(std::vector<unsigned char>& out, unsigned char marker, int length)
+{
+  out.push_back(0xFF);
+  out.push_back(marker);
+  if (length) {
+    out.push_back((unsigned char)(length >> 8));
+    out.push_back((unsigned char)length);
+  }
+}
+
+} // namespace
+
+bool writeJpeg(std::vector<unsigned char>& out, unsigned char const* pixels, int width, int height, int channels,
+  int quality, bool subsample)
+{
+  TRACE_ZONE("writeJpeg");
+  if (!pixels || width <= 0 || height <= 0 || width > 65535 || height > 65535 || channels < 1 || channels > 4) {
+    std::cerr << "Error: can't write JPEG: " << width << "x" << height << " image with " << channels
+      << " channels" << std::endl;
+    return false;
+  }
+
+  // quantizers scaled as libjpeg's jpeg_quality_scaling(), and the matching
+  // DCT output multipliers
+  quality = std::min(100, std::max(1, quality));
+  int percent = quality < 50 ? 5000 / quality : 200 - quality * 2;
+  unsigned char quantizers[2][64];
+  float scales[2][64];
+  static const double kAan[8] = { 1.0, 1.387039845, 1.306562965, 1.175875602, 1.0, 0.785694958, 0.541196100,
+    0.275899379 };
+  for (int t = 0; t < 2; ++t) {
+    unsigned char const* base = t ? kChromaQuantizers : kLumaQuantizers;
+    for (int k = 0; k < 64; ++k) {
+      quantizers[t][k] = (unsigned char)std::min(255, std::max(1, (base[k] * percent + 50) / 100));
+      scales[t][k] = float(1.0 / (quantizers[t][k] * kAan[k / 8] * kAan[k % 8] * 8.0));
+    }
+  }
+
+  bool color = channels >= 3;
+  int components = color ? 3 : 1;
+  int lumaFactor = color && subsample ? 2 : 1;  // Y samples per chroma sample, each way
+  int mcuSize = 8 * lumaFactor;
+  int mcusPerRow = (width + mcuSize - 1) / mcuSize, mcuRows = (height + mcuSize - 1) / mcuSize;
+  int planeWidth = mcusPerRow * mcuSize;
+
+  // each strip restarts the entropy coder, so it is one restart interval
+  int stripMcuRows = std::max(1, kPixelsPerStrip / (planeWidth * mcuSize));
+  stripMcuRows = std::min(stripMcuRows, std::max(1, 65535 / mcusPerRow));
+  if (mcusPerRow * stripMcuRows > 65535)
+    stripMcuRows = mcuRows;  // too wide for any interval: one strip
+  int strips = (mcuRows + stripMcuRows - 1) / stripMcuRows;
+
+  std::vector<std::vector<unsigned char> > encoded(strips);
+  SimdLevel level = activeSimdLevel();
+  Tables const& huffman = tables();
+  jobSystem().parallelFor(0, strips, 1, [&](int first, int last) {
+    for (int s = first; s < last; ++s) {
+      TRACE_ZONE("writeJpeg strip");
+      int firstRow = s * stripMcuRows, rows = std::min(mcuRows, firstRow + stripMcuRows) - firstRow;
+      int planeHeight = rows * mcuSize;
+      std::size_t planeSize = std::size_t(planeWidth) * planeHeight;
+
+      // samples as floats, the edge pixels repeated out to whole MCUs
+      std::vector<float> planes(planeSize * components);
+      for (int y = 0; y < planeHeight; ++y) {
+        unsigned char const* row = pixels + std::size_t(std::min(height - 1, firstRow * mcuSize + y)) * width * channels;
+        for (int x = 0; x < planeWidth; ++x) {
+          unsigned char const* pixel = row + std::min(width - 1, x) * channels;
+          for (int c = 0; c < components; ++c)
+            planes[c * planeSize + std::size_t(y) * planeWidth + x] = pixel[c];
+        }
+      }
+      if (color)
+        rgbToYcc(level, planes.data(), planes.data() + planeSize, planes.data() + 2 * planeSize, planeSize);
+      else
+        for (std::size_t i = 0; i < planeSize; ++i)
+          planes[i] -= 128.0f;
+
+      int chromaWidth = planeWidth / lumaFactor, chromaHeight = planeHeight / lumaFactor;
+      if (lumaFactor == 2) {
+        for (int c = 1; c < 3; ++c) {
+          float* plane = planes.data() + c * planeSize;
+          for (int y = 0; y < chromaHeight; ++y)
+            for (int x = 0; x < chromaWidth; ++x) {
+              float const* p = plane + std::size_t(2 * y) * planeWidth + 2 * x;
+              plane[std::size_t(y) * chromaWidth + x] = (p[0] + p[1] + p[planeWidth] + p[planeWidth + 1]) * 0.25f;
+            }
+        }
+      }
+
+      std::vector<short> coefficients(planeSize * components);
+      for (int c = 0; c < components; ++c)
+        transformPlane(level, planes.data() + c * planeSize, c ? chromaWidth : planeWidth,
+          c ? chromaHeight : planeHeight, scales[c ? 1 : 0], coefficients.data() + c * planeSize);
+
+      std::vector<unsigned char>& data = encoded[s];
+      data.reserve(planeSize / 4);
+      BitWriter writer(data);
+      int previousDc[3] = {};
+      int lumaBlocksPerRow = planeWidth / 8, chromaBlocksPerRow = chromaWidth / 8;
+      for (int my = 0; my < rows; ++my)
+        for (int mx = 0; mx < mcusPerRow; ++mx) {
+          for (int by = 0; by < lumaFactor; ++by)
+            for (int bx = 0; bx < lumaFactor; ++bx) {
+              int block = (my * lumaFactor + by) * lumaBlocksPerRow + mx * lumaFactor + bx;
+              encodeBlock(writer, coefficients.data() + std::size_t(block) * 64, previousDc[0], huffman.dc[0],
+                huffman.ac[0]);
+            }
+          for (int c = 1; c < components; ++c) {
+            int block = my * chromaBlocksPerRow + mx;
+            encodeBlock(writer, coefficients.data() + c * planeSize + std::size_t(block) * 64, previousDc[c],
+              huffman.dc[1], huffman.ac[1]);
+          }
+        }
+      writer.flush();
+    }
+  });
+
+  putMarker(out, 0xD8, 0);  // SOI
+  static const unsigned char kJfif[14] = { 'J', 'F', 'I', 'F', 0, 1, 1, 0, 0, 1, 0, 1, 0, 0 };
+  putMarker(out, 0xE0, 2 + 14);
+  out.insert(out.end(), kJfif, kJfif + 14);
+
+  int tableCount = color ? 2 : 1;
+  putMarker(out, 0xDB, 2 + 65 * tableCount);  // DQT
+  for (int t = 0; t < tableCount; ++t) {
+    out.push_back((unsigned char)t);
+    for (int k = 0; k < 64; ++k)
+      out.push_back(quantizers[t][kZigzag[k]]);
+  }
+
+  putMarker(out, 0xC0, 8 + 3 * components);  // SOF0
+  unsigned char frame[6] = { 8, (unsigned char)(height >> 8), (unsigned char)height, (unsigned char)(width >> 8),
+    (unsigned char)width, (unsigned char)components };
+  out.insert(out.end(), frame, frame + 6);
+  for (int c = 0; c < components; ++c) {
+    out.push_back((unsigned char)(c + 1));
+    out.push_back(c ? 0x11 : (unsigned char)(lumaFactor * 0x11));
+    out.push_back(c ? 1 : 0);
+  }
+
+  static unsigned char const* const kHuffman[4] = { kLumaDc, kLumaAc, kChromaDc, kChromaAc };
+  static const int kSymbols[4] = { 12, 162, 12, 162 };
+  int huffmanLength = 2;
+  for (int t = 0; t < 2 * tableCount; ++t)
+    huffmanLength += 17 + kSymbols[t];
+  putMarker(out, 0xC4, huffmanLength);  // DHT
+  for (int t = 0; t < 2 * tableCount; ++t) {
+    out.push_back((unsigned char)((t & 1) << 4 | t >> 1));
+    out.insert(out.end(), kHuffman[t], kHuffman[t] + 16 + kSymbols[t]);
+  }
+
+  if (strips > 1) {
+    putMarker(out, 0xDD, 4);  // DRI
+    int interval = stripMcuRows * mcusPerRow;
+    out.push_back((unsigned char)(interval >> 8));
+    out.push_back((unsigned char)interval);
+  }
+
+  putMarker(out, 0xDA, 6 + 2 * components);  // SOS
+  out.push_back((unsigned char)components);
+  for (int c = 0; c < components; ++c) {
+    out.push_back((unsigned char)(c + 1));
+    out.push_back(c ? 0x11 : 0x00);
+  }
+  out.push_back(0);
+  out.push_back(63);
+  out.push_back(0);
+  for (int s = 0; s < strips; ++s) {
+    if (s)
+      putMarker(out, (unsigned char)(0xD0 + (s - 1) % 8), 0);  // RSTn
+    out.insert(out.end(), encoded[s].begin(), encoded[s].end());
+  }
+  putMarker(out, 0xD9, 0);  // EOI
+  return true;
+}
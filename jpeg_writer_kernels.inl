@@ -0,0 +1,89 @@
+// JPEG colour conversion and forward DCT written against 'Lane'
+// (simd_lane.h); jpeg_writer.cpp includes this once per instruction set.
+
+// RGB planes to level-shifted Y, Cb and Cr in place (JFIF / BT.601 full
+// range); count is a multiple of Lane::kWidth
+static void rgbToYcc(float* c0, float* c1, float* c2, std::size_t count)
+{
+  for (std::size_t i = 0; i < count; i += Lane::kWidth) {
+    Lane::V r = Lane::loadu(c0 + i), g = Lane::loadu(c1 + i), b = Lane::loadu(c2 + i);
+    Lane::V y = Lane::fma(Lane::set1(0.299f), r, Lane::fma(Lane::set1(0.587f), g, Lane::mul(Lane::set1(0.114f), b)));
+    Lane::V cb = Lane::fma(Lane::set1(-0.168736f), r, Lane::fma(Lane::set1(-0.331264f), g, Lane::mul(Lane::set1(0.5f), b)));
+    Lane::V cr = Lane::fma(Lane::set1(0.5f), r, Lane::fma(Lane::set1(-0.418688f), g, Lane::mul(Lane::set1(-0.081312f), b)));
+    Lane::storeu(c0 + i, Lane::sub(y, Lane::set1(128.0f)));
+    Lane::storeu(c1 + i, cb);
+    Lane::storeu(c2 + i, cr);
+  }
+}
+
+// One pass of the AAN float DCT (IJG jfdctflt.c) over the eight values
+// d[0], d[step], ... d[7 * step]; outputs are scaled by the AAN factors,
+// which quantization takes out again.
+static void dct8(Lane::V* d, int step)
+{
+  Lane::V tmp0 = Lane::add(d[0], d[7 * step]), tmp7 = Lane::sub(d[0], d[7 * step]);
+  Lane::V tmp1 = Lane::add(d[step], d[6 * step]), tmp6 = Lane::sub(d[step], d[6 * step]);
+  Lane::V tmp2 = Lane::add(d[2 * step], d[5 * step]), tmp5 = Lane::sub(d[2 * step], d[5 * step]);
+  Lane::V tmp3 = Lane::add(d[3 * step], d[4 * step]), tmp4 = Lane::sub(d[3 * step], d[4 * step]);
+
+  // even part
+  Lane::V tmp10 = Lane::add(tmp0, tmp3), tmp13 = Lane::sub(tmp0, tmp3);
+  Lane::V tmp11 = Lane::add(tmp1, tmp2), tmp12 = Lane::sub(tmp1, tmp2);
+  d[0] = Lane::add(tmp10, tmp11);
+  d[4 * step] = Lane::sub(tmp10, tmp11);
+  Lane::V z1 = Lane::mul(Lane::add(tmp12, tmp13), Lane::set1(0.707106781f));
+  d[2 * step] = Lane::add(tmp13, z1);
+  d[6 * step] = Lane::sub(tmp13, z1);
+
+  // odd part
+  tmp10 = Lane::add(tmp4, tmp5);
+  tmp11 = Lane::add(tmp5, tmp6);
+  tmp12 = Lane::add(tmp6, tmp7);
+  Lane::V z5 = Lane::mul(Lane::sub(tmp10, tmp12), Lane::set1(0.382683433f));
+  Lane::V z2 = Lane::fma(Lane::set1(0.541196100f), tmp10, z5);
+  Lane::V z4 = Lane::fma(Lane::set1(1.306562965f), tmp12, z5);
+  Lane::V z3 = Lane::mul(tmp11, Lane::set1(0.707106781f));
+  Lane::V z11 = Lane::add(tmp7, z3), z13 = Lane::sub(tmp7, z3);
+  d[5 * step] = Lane::add(z13, z2);
+  d[3 * step] = Lane::sub(z13, z2);
+  d[step] = Lane::add(z11, z4);
+  d[7 * step] = Lane::sub(z11, z4);
+}
+
+// Transforms and quantizes every 8x8 block of a plane, whose sides are
+// multiples of 8, into 64 coefficients each in natural order, blocks in
+// raster order. Lane::kWidth blocks go through at once, one per lane;
+// 'scale' is 1 / (quantizer * AAN factors) per coefficient.
+static void transformPlane(float const* plane, int width, int height, float const* scale, short* coefficients)
+{
+  int blocksPerRow = width / 8, blockCount = blocksPerRow * (height / 8);
+  float gathered[64 * Lane::kWidth];
+  float quantized[64 * Lane::kWidth];
+  Lane::V d[64];
+  for (int first = 0; first < blockCount; first += Lane::kWidth) {
+    // transposes kWidth blocks so lane b holds block first + b; a short last
+    // batch repeats its final block
+    for (int b = 0; b < Lane::kWidth; ++b) {
+      int block = std::min(first + b, blockCount - 1);
+      float const* src = plane + std::size_t(block / blocksPerRow) * 8 * width + block % blocksPerRow * 8;
+      for (int y = 0; y < 8; ++y)
+        for (int x = 0; x < 8; ++x)
+          gathered[(y * 8 + x) * Lane::kWidth + b] = src[std::size_t(y) * width + x];
+    }
+    for (int k = 0; k < 64; ++k)
+      d[k] = Lane::loadu(gathered + k * Lane::kWidth);
+    for (int row = 0; row < 8; ++row)
+      dct8(d + row * 8, 1);
+    for (int column = 0; column < 8; ++column)
+      dct8(d + column, 8);
+    for (int k = 0; k < 64; ++k)
+      Lane::storeu(quantized + k * Lane::kWidth, Lane::toFloat(Lane::roundToInt(Lane::mul(d[k], Lane::set1(scale[k])))));
+
+    int count = std::min(blockCount - first, int(Lane::kWidth));
+    for (int b = 0; b < count; ++b) {
+      short* dst = coefficients + std::size_t(first + b) * 64;
+      for (int k = 0; k < 64; ++k)
+        dst[k] = short(quantized[k * Lane::kWidth + b]);
+    }
+  }
+}
@@ -0,0 +1,110 @@
+#include "lz4_block.h"
+
+#include <cstring>
+
+using namespace std;
+
+namespace {
+
+const int kMinMatch = 4;
+const int kHashBits = 13;
+// shorter matches are left as literals: on pixel data they save a byte or
+// two, cost the decoder a whole sequence each and, taken greedily, cut
+// longer matches short, so keeping them made frames both bigger and two to
+// three times slower to decode
+const size_t kUsefulMatch = 8;
+const size_t kMaxOffset = 65535;
+// the format's end conditions: the last 5 bytes are always literals and no
+// match starts in the last 12, which lets decoders copy in wide chunks
+const size_t kLastLiterals = 5;
+const size_t kMatchStartLimit = 12;
+
+unsigned read32(unsigned char const* p)
+{
+  unsigned value;
+  memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+unsigned hashSequence(unsigned sequence)
+{
+  return (sequence * 2654435761u) >> (32 - kHashBits);
+}
+
+void putLength(vector<unsigned char>& out, size_t length)
+{
+  for (; length >= 255; length -= 255)
+    out.push_back(255);
+  out.push_back((unsigned char)length);
+}
+
+void putSequence(vector<unsigned char>& out, unsigned char const* literals, size_t literalCount, size_t offset,
+  size_t matchLength)
+{
+  size_t extra = matchLength - kMinMatch;
+  out.push_back((unsigned char)((literalCount < 15 ? literalCount : 15) << 4 | (extra < 15 ? extra : 15)));
+  if (literalCount >= 15)
+    putLength(out, literalCount - 15);
+  out.insert(out.end(), literals, literals + literalCount);
+  out.push_back((unsigned char)offset);
+  out.push_back((unsigned char)(offset >> 8));
+  if (extra >= 15)
+    putLength(out, extra - 15);
+}
+
+} // namespace
+
+size_t lz4CompressBound(size_t size)
+{
+  return size + size / 255 + 16;
+}
+
+void lz4Compress(unsigned char const* data, size_t size, vector<unsigned char>& out)
+{
+  out.reserve(out.size() + lz4CompressBound(size));
+  size_t anchor = 0;
+  if (size > kMatchStartLimit) {
+    // positions + 1, so 0 is an empty slot
+    unsigned table[1 << kHashBits] = {};
+    size_t matchLimit = size - kLastLiterals, startLimit = size - kMatchStartLimit;
+    size_t i = 0;
+    unsigned misses = 0;
+    while (i < startLimit) {
+      unsigned sequence = read32(data + i);
+      unsigned& slot = table[hashSequence(sequence)];
+      size_t candidate = slot;
+      slot = unsigned(i + 1);
+      if (!candidate-- || i - candidate > kMaxOffset || read32(data + candidate) != sequence) {
+        // skip ahead faster the longer nothing matches, as LZ4 does
+        i += 1 + (misses++ >> 6);
+        continue;
+      }
+      misses = 0;
+
+      size_t start = i, length = kMinMatch;
+      while (start > anchor && candidate > 0 && data[start - 1] == data[candidate - 1]) {
+        --start;
+        --candidate;
+        ++length;
+      }
+      while (start + length < matchLimit && data[start + length] == data[candidate + length])
+        ++length;
+      if (length < kUsefulMatch) {
+        ++i;
+        continue;
+      }
+
+      putSequence(out, data + anchor, start - anchor, start - candidate, length);
+      anchor = i = start + length;
+      if (i - 2 < startLimit)
+        table[hashSequence(read32(data + i - 2))] = unsigned(i - 2 + 1);
+    }
+  }
+
+  // the last sequence is literals only
+  size_t literalCount = size - anchor;
+  out.push_back((unsigned char)((literalCount < 15 ? literalCount : 15) << 4));
+  if (literalCount >= 15)
+    putLength(out, literalCount - 15);
+  out.insert(out.end(), data + anchor, data + size);
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+// LZ4 block format (github.com/lz4/lz4, doc/lz4_Block_format.md): appends
+// data[0, size) compressed as one block to 'out'. Greedy matching over a
+// small hash table, much like LZ4_compress_default but ignoring matches under
+// 8 bytes, so it compresses at a few hundred MB/s and decodes at several
+// GB/s; any LZ4 block decoder reads the result, stb_image's SPF loader among
+// them. At most 2 GB per block.
+void lz4Compress(unsigned char const* data, std::size_t size, std::vector<unsigned char>& out);
+
+// worst-case compressed size, for incompressible data
+std::size_t lz4CompressBound(std::size_t size);
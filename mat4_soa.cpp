@@ -0,0 +1,59 @@
+#include "mat4_soa.h"
+
+#include "cpu_features.h"
+#include "simd_lane.h"
+
+namespace scalar {
+typedef LaneScalar Lane;
+#include "mat4_soa_kernels.inl"
+}
+
+#ifdef SIMD_X86
+SIMD_BEGIN_TARGET_SSE2
+namespace sse2 {
+typedef LaneSSE2 Lane;
+#include "mat4_soa_kernels.inl"
+}
+SIMD_END_TARGET
+
+SIMD_BEGIN_TARGET_AVX2
+namespace avx2 {
+typedef LaneAVX2 Lane;
+#include "mat4_soa_kernels.inl"
+}
+SIMD_END_TARGET
+
+SIMD_BEGIN_TARGET_AVX512
+namespace avx512 {
+typedef LaneAVX512 Lane;
+#include "mat4_soa_kernels.inl"
+}
+SIMD_END_TARGET
+#endif
+
+void soaDeterminant(mat4_soa const& m, float_soa& out)
+{
+  out.resize(m.size());
+  switch (activeSimdLevel()) {
+#ifdef SIMD_X86
+  case SIMD_AVX512: avx512::determinantKernel(m, out); break;
+  case SIMD_AVX2: avx2::determinantKernel(m, out); break;
+  case SIMD_SSE2: sse2::determinantKernel(m, out); break;
+#endif
+  default: scalar::determinantKernel(m, out); break;
+  }
+}
+
+void soaInverse(mat4_soa const& m, mat4_soa& out, glm::qualifier precision)
+{
+  bool lowp = precision == glm::lowp || precision == glm::mediump;
+  out.resize(m.size());
+  switch (activeSimdLevel()) {
+#ifdef SIMD_X86
+  case SIMD_AVX512: avx512::inverseKernel(m, out, lowp); break;
+  case SIMD_AVX2: avx2::inverseKernel(m, out, lowp); break;
+  case SIMD_SSE2: sse2::inverseKernel(m, out, lowp); break;
+#endif
+  default: scalar::inverseKernel(m, out, lowp); break;
+  }
+}
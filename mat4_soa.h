@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstddef>
+
+#include <glm/glm.hpp>
+
+#include "vec_soa.h"
+
+// Array of mat4 stored transposed: one float stream per matrix element, so a
+// SIMD register holds the same element of 4, 8 or 16 matrices and the batch
+// kernels below run the scalar algorithm across lanes with no shuffles.
+// Padding follows vec_soa.
+class mat4_soa
+{
+public:
+  mat4_soa() {}
+  explicit mat4_soa(std::size_t size) { resize(size); }
+
+  void resize(std::size_t size)
+  {
+    for (int c = 0; c < 4; ++c)
+      m_columns[c].resize(size);
+  }
+
+  std::size_t size() const { return m_columns[0].size(); }
+  std::size_t padded_size() const { return m_columns[0].padded_size(); }
+
+  // stream of element [column][row], matching glm::mat4 indexing
+  float* operator()(int column, int row) { return m_columns[column][row]; }
+  float const* operator()(int column, int row) const { return m_columns[column][row]; }
+
+  vec4_soa& column(int c) { return m_columns[c]; }
+  vec4_soa const& column(int c) const { return m_columns[c]; }
+
+  glm::mat4 get(std::size_t i) const
+  {
+    return glm::mat4(m_columns[0].get(i), m_columns[1].get(i), m_columns[2].get(i), m_columns[3].get(i));
+  }
+
+  void set(std::size_t i, glm::mat4 const& m)
+  {
+    for (int c = 0; c < 4; ++c)
+      m_columns[c].set(i, m[c]);
+  }
+
+private:
+  vec4_soa m_columns[4];
+};
+
+// Determinant and inverse of every matrix, dispatched on activeSimdLevel()
+// like the vec_soa kernels. 'out' is resized to match and may alias the
+// input. As with glm_mat4_inverse_lowp, glm::lowp (or mediump) replaces the
+// division by the determinant with the hardware reciprocal estimate, adding
+// up to 2^-12 relative error (2^-14 with AVX-512) for a few percent more
+// throughput. Singular matrices give inf/nan, as glm::inverse does.
+void soaDeterminant(mat4_soa const& m, float_soa& out);
+void soaInverse(mat4_soa const& m, mat4_soa& out, glm::qualifier precision = glm::highp);
@@ -0,0 +1,99 @@
+// Batch mat4 kernels written against 'Lane' (simd_lane.h); mat4_soa.cpp
+// includes this once per instruction set. Lane k of every register belongs to
+// matrix i + k, so each kernel is the scalar 2x2-minor cofactor expansion
+// applied to kWidth matrices at once.
+
+struct Minors
+{
+  // 2x2 minors of the first two and last two columns
+  Lane::V s0, s1, s2, s3, s4, s5;
+  Lane::V c0, c1, c2, c3, c4, c5;
+};
+
+static void loadMatrix(mat4_soa const& m, std::size_t i, Lane::V a[4][4])
+{
+  for (int c = 0; c < 4; ++c)
+    for (int r = 0; r < 4; ++r)
+      a[c][r] = Lane::load(m(c, r) + i);
+}
+
+static void computeMinors(Lane::V const a[4][4], Minors& n)
+{
+  n.s0 = Lane::fms(a[0][0], a[1][1], Lane::mul(a[1][0], a[0][1]));
+  n.s1 = Lane::fms(a[0][0], a[1][2], Lane::mul(a[1][0], a[0][2]));
+  n.s2 = Lane::fms(a[0][0], a[1][3], Lane::mul(a[1][0], a[0][3]));
+  n.s3 = Lane::fms(a[0][1], a[1][2], Lane::mul(a[1][1], a[0][2]));
+  n.s4 = Lane::fms(a[0][1], a[1][3], Lane::mul(a[1][1], a[0][3]));
+  n.s5 = Lane::fms(a[0][2], a[1][3], Lane::mul(a[1][2], a[0][3]));
+  n.c5 = Lane::fms(a[2][2], a[3][3], Lane::mul(a[3][2], a[2][3]));
+  n.c4 = Lane::fms(a[2][1], a[3][3], Lane::mul(a[3][1], a[2][3]));
+  n.c3 = Lane::fms(a[2][1], a[3][2], Lane::mul(a[3][1], a[2][2]));
+  n.c2 = Lane::fms(a[2][0], a[3][3], Lane::mul(a[3][0], a[2][3]));
+  n.c1 = Lane::fms(a[2][0], a[3][2], Lane::mul(a[3][0], a[2][2]));
+  n.c0 = Lane::fms(a[2][0], a[3][1], Lane::mul(a[3][0], a[2][1]));
+}
+
+static Lane::V determinant(Minors const& n)
+{
+  Lane::V d = Lane::mul(n.s0, n.c5);
+  d = Lane::fma(Lane::sub(Lane::set1(0.0f), n.s1), n.c4, d);
+  d = Lane::fma(n.s2, n.c3, d);
+  d = Lane::fma(n.s3, n.c2, d);
+  d = Lane::fma(Lane::sub(Lane::set1(0.0f), n.s4), n.c1, d);
+  return Lane::fma(n.s5, n.c0, d);
+}
+
+// x*p - y*q + z*r
+static Lane::V cofactor(Lane::V x, Lane::V p, Lane::V y, Lane::V q, Lane::V z, Lane::V r)
+{
+  return Lane::fma(z, r, Lane::fms(x, p, Lane::mul(y, q)));
+}
+
+static void determinantKernel(mat4_soa const& m, float_soa& out)
+{
+  for (std::size_t i = 0; i < m.padded_size(); i += Lane::kWidth) {
+    Lane::V a[4][4];
+    Minors n;
+    loadMatrix(m, i, a);
+    computeMinors(a, n);
+    Lane::store(out[0] + i, determinant(n));
+  }
+}
+
+static void inverseKernel(mat4_soa const& m, mat4_soa& out, bool lowp)
+{
+  for (std::size_t i = 0; i < m.padded_size(); i += Lane::kWidth) {
+    Lane::V a[4][4];
+    Minors n;
+    loadMatrix(m, i, a);
+    computeMinors(a, n);
+
+    Lane::V det = determinant(n);
+    Lane::V inv = lowp ? Lane::rcp(det) : Lane::div(Lane::set1(1.0f), det);
+    Lane::V neg = Lane::sub(Lane::set1(0.0f), inv);
+
+    // the inverse is the transposed cofactor matrix over the determinant;
+    // indices here are [column][row] of the glm matrices
+    Lane::V b[4][4];
+    b[0][0] = Lane::mul(cofactor(a[1][1], n.c5, a[1][2], n.c4, a[1][3], n.c3), inv);
+    b[0][1] = Lane::mul(cofactor(a[0][1], n.c5, a[0][2], n.c4, a[0][3], n.c3), neg);
+    b[0][2] = Lane::mul(cofactor(a[3][1], n.s5, a[3][2], n.s4, a[3][3], n.s3), inv);
+    b[0][3] = Lane::mul(cofactor(a[2][1], n.s5, a[2][2], n.s4, a[2][3], n.s3), neg);
+    b[1][0] = Lane::mul(cofactor(a[1][0], n.c5, a[1][2], n.c2, a[1][3], n.c1), neg);
+    b[1][1] = Lane::mul(cofactor(a[0][0], n.c5, a[0][2], n.c2, a[0][3], n.c1), inv);
+    b[1][2] = Lane::mul(cofactor(a[3][0], n.s5, a[3][2], n.s2, a[3][3], n.s1), neg);
+    b[1][3] = Lane::mul(cofactor(a[2][0], n.s5, a[2][2], n.s2, a[2][3], n.s1), inv);
+    b[2][0] = Lane::mul(cofactor(a[1][0], n.c4, a[1][1], n.c2, a[1][3], n.c0), inv);
+    b[2][1] = Lane::mul(cofactor(a[0][0], n.c4, a[0][1], n.c2, a[0][3], n.c0), neg);
+    b[2][2] = Lane::mul(cofactor(a[3][0], n.s4, a[3][1], n.s2, a[3][3], n.s0), inv);
+    b[2][3] = Lane::mul(cofactor(a[2][0], n.s4, a[2][1], n.s2, a[2][3], n.s0), neg);
+    b[3][0] = Lane::mul(cofactor(a[1][0], n.c3, a[1][1], n.c1, a[1][2], n.c0), neg);
+    b[3][1] = Lane::mul(cofactor(a[0][0], n.c3, a[0][1], n.c1, a[0][2], n.c0), inv);
+    b[3][2] = Lane::mul(cofactor(a[3][0], n.s3, a[3][1], n.s1, a[3][2], n.s0), neg);
+    b[3][3] = Lane::mul(cofactor(a[2][0], n.s3, a[2][1], n.s1, a[2][2], n.s0), inv);
+
+    for (int c = 0; c < 4; ++c)
+      for (int r = 0; r < 4; ++r)
+        Lane::store(out(c, r) + i, b[c][r]);
+  }
+}
@@ -0,0 +1,160 @@
+#include "nv12_convert.h"
+
+#include "cpu_features.h"
+#include "job_system.h"
+#include "trace.h"
+
+#include <algorithm>
+
+#ifdef SIMD_X86
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+namespace {
+
+constexpr int fixedPoint(double value, int bits)
+{
+  return value >= 0 ? int(value * (1 << bits) + 0.5) : -int(-value * (1 << bits) + 0.5);
+}
+
+// Y = 16 + 219 * (0.2126 R + 0.7152 G + 0.0722 B) / 255, with 15 fraction
+// bits; the bias carries the rounding
+const int kYR = fixedPoint(0.2126 * 219 / 255, 15);
+const int kYG = fixedPoint(0.7152 * 219 / 255, 15);
+const int kYB = fixedPoint(0.0722 * 219 / 255, 15);
+const int kYBias = (16 << 15) + (1 << 14);
+
+// Cb = 128 + 224 * (B - Y') / (1.8556 * 255), Cr likewise over 1.5748 from R,
+// applied to the sum of a 2x2 block: 16 fraction bits on four times the
+// value make 18 (and keep every coefficient a 16-bit integer for pmaddwd)
+const double kCbScale = 224.0 / 255 / 1.8556, kCrScale = 224.0 / 255 / 1.5748;
+const int kCbR = fixedPoint(-0.2126 * kCbScale, 16);
+const int kCbG = fixedPoint(-0.7152 * kCbScale, 16);
+const int kCbB = fixedPoint((1 - 0.0722) * kCbScale, 16);
+const int kCrR = fixedPoint((1 - 0.2126) * kCrScale, 16);
+const int kCrG = fixedPoint(-0.7152 * kCrScale, 16);
+const int kCrB = fixedPoint(-0.0722 * kCrScale, 16);
+const int kCBias = (128 << 18) + (1 << 17);
+
+inline unsigned char luma(unsigned char const* p)
+{
+  return (unsigned char)((kYR * p[0] + kYG * p[1] + kYB * p[2] + kYBias) >> 15);
+}
+
+// pixels [x, width) of a row pair, x even; 'y1' may be 'y0' for the last row
+// of an odd height, whose pair is the row twice
+void convertPair(unsigned char const* row0, unsigned char const* row1, int channels, int x, int width,
+  unsigned char* y0, unsigned char* y1, unsigned char* uv)
+{
+  for (; x < width; x += 2) {
+    int x1 = min(x + 1, width - 1);
+    unsigned char const* p[4] = { row0 + x * channels, row0 + x1 * channels, row1 + x * channels, row1 + x1 * channels };
+    y0[x] = luma(p[0]);
+    y0[x1] = luma(p[1]);
+    y1[x] = luma(p[2]);
+    y1[x1] = luma(p[3]);
+    int r = p[0][0] + p[1][0] + p[2][0] + p[3][0];
+    int g = p[0][1] + p[1][1] + p[2][1] + p[3][1];
+    int b = p[0][2] + p[1][2] + p[2][2] + p[3][2];
+    uv[x] = (unsigned char)((kCbR * r + kCbG * g + kCbB * b + kCBias) >> 18);
+    uv[x + 1] = (unsigned char)((kCrR * r + kCrG * g + kCrB * b + kCBias) >> 18);
+  }
+}
+
+#ifdef SIMD_X86
+
+// [a0 + a1, a2 + a3, b0 + b1, b2 + b3], SSE2 having no phaddd
+SIMD_TARGET_SSE2 __m128i addPairsSSE2(__m128i a, __m128i b)
+{
+  __m128 fa = _mm_castsi128_ps(a), fb = _mm_castsi128_ps(b);
+  return _mm_add_epi32(_mm_castps_si128(_mm_shuffle_ps(fa, fb, _MM_SHUFFLE(2, 0, 2, 0))),
+    _mm_castps_si128(_mm_shuffle_ps(fa, fb, _MM_SHUFFLE(3, 1, 3, 1))));
+}
+
+// eight pixels, two RGBA per register widened to 16 bits
+SIMD_TARGET_SSE2 void storeLumaSSE2(unsigned char* out, __m128i p01, __m128i p23, __m128i p45, __m128i p67)
+{
+  const __m128i coefficients = _mm_setr_epi16(kYR, kYG, kYB, 0, kYR, kYG, kYB, 0);
+  const __m128i bias = _mm_set1_epi32(kYBias);
+  __m128i low = addPairsSSE2(_mm_madd_epi16(p01, coefficients), _mm_madd_epi16(p23, coefficients));
+  __m128i high = addPairsSSE2(_mm_madd_epi16(p45, coefficients), _mm_madd_epi16(p67, coefficients));
+  low = _mm_srai_epi32(_mm_add_epi32(low, bias), 15);
+  high = _mm_srai_epi32(_mm_add_epi32(high, bias), 15);
+  __m128i words = _mm_packs_epi32(low, high);
+  _mm_storel_epi64(reinterpret_cast<__m128i*>(out), _mm_packus_epi16(words, words));
+}
+
+// the sum of a register's two pixels, in its low half
+SIMD_TARGET_SSE2 __m128i foldSSE2(__m128i v)
+{
+  return _mm_add_epi16(v, _mm_srli_si128(v, 8));
+}
+
+// RGBA only; returns how many pixels it did, a multiple of 8
+SIMD_TARGET_SSE2 int convertPairSSE2(unsigned char const* row0, unsigned char const* row1, int width,
+  unsigned char* y0, unsigned char* y1, unsigned char* uv)
+{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i cbCoefficients = _mm_setr_epi16(kCbR, kCbG, kCbB, 0, kCbR, kCbG, kCbB, 0);
+  const __m128i crCoefficients = _mm_setr_epi16(kCrR, kCrG, kCrB, 0, kCrR, kCrG, kCrB, 0);
+  const __m128i bias = _mm_set1_epi32(kCBias);
+  int x = 0;
+  for (; x + 8 <= width; x += 8) {
+    __m128i a0 = _mm_loadu_si128(reinterpret_cast<__m128i const*>(row0 + 4 * x));
+    __m128i a1 = _mm_loadu_si128(reinterpret_cast<__m128i const*>(row0 + 4 * x + 16));
+    __m128i b0 = _mm_loadu_si128(reinterpret_cast<__m128i const*>(row1 + 4 * x));
+    __m128i b1 = _mm_loadu_si128(reinterpret_cast<__m128i const*>(row1 + 4 * x + 16));
+    __m128i a01 = _mm_unpacklo_epi8(a0, zero), a23 = _mm_unpackhi_epi8(a0, zero);
+    __m128i a45 = _mm_unpacklo_epi8(a1, zero), a67 = _mm_unpackhi_epi8(a1, zero);
+    __m128i b01 = _mm_unpacklo_epi8(b0, zero), b23 = _mm_unpackhi_epi8(b0, zero);
+    __m128i b45 = _mm_unpacklo_epi8(b1, zero), b67 = _mm_unpackhi_epi8(b1, zero);
+    storeLumaSSE2(y0 + x, a01, a23, a45, a67);
+    storeLumaSSE2(y1 + x, b01, b23, b45, b67);
+
+    // the four 2x2 block sums, two per register
+    __m128i blocks01 = _mm_unpacklo_epi64(foldSSE2(_mm_add_epi16(a01, b01)), foldSSE2(_mm_add_epi16(a23, b23)));
+    __m128i blocks23 = _mm_unpacklo_epi64(foldSSE2(_mm_add_epi16(a45, b45)), foldSSE2(_mm_add_epi16(a67, b67)));
+    __m128i cb = addPairsSSE2(_mm_madd_epi16(blocks01, cbCoefficients), _mm_madd_epi16(blocks23, cbCoefficients));
+    __m128i cr = addPairsSSE2(_mm_madd_epi16(blocks01, crCoefficients), _mm_madd_epi16(blocks23, crCoefficients));
+    cb = _mm_srai_epi32(_mm_add_epi32(cb, bias), 18);
+    cr = _mm_srai_epi32(_mm_add_epi32(cr, bias), 18);
+    __m128i words = _mm_packs_epi32(cb, cr);
+    words = _mm_unpacklo_epi16(words, _mm_srli_si128(words, 8));
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(uv + x), _mm_packus_epi16(words, words));
+  }
+  return x;
+}
+
+#endif
+
+} // namespace
+
+void rgbToNv12(unsigned char const* src, ptrdiff_t stride, int width, int height, int channels, unsigned char* dst)
+{
+  TRACE_ZONE("rgbToNv12");
+  int chromaHeight = (height + 1) / 2;
+  unsigned char* chroma = dst + size_t(width) * height;
+  size_t chromaStride = size_t((width + 1) / 2) * 2;
+  SimdLevel level = activeSimdLevel();
+  jobSystem().parallelFor(0, chromaHeight, max(1, int((1 << 16) / (size_t(width) * channels * 2))),
+    [&](int first, int last) {
+      for (int j = first; j < last; ++j) {
+        int top = 2 * j, bottom = min(top + 1, height - 1);
+        unsigned char const* row0 = src + top * stride;
+        unsigned char const* row1 = src + bottom * stride;
+        unsigned char* y0 = dst + size_t(top) * width;
+        unsigned char* y1 = dst + size_t(bottom) * width;
+        unsigned char* uv = chroma + j * chromaStride;
+        int x = 0;
+#ifdef SIMD_X86
+        if (channels == 4 && level >= SIMD_SSE2)
+          x = convertPairSSE2(row0, row1, width, y0, y1, uv);
+#else
+        (void)level;
+#endif
+        convertPair(row0, row1, channels, x, width, y0, y1, uv);
+      }
+    });
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstddef>
+
+// R'G'B' to NV12: a full-resolution Y plane, then Cb and Cr interleaved at
+// half resolution in each direction, BT.709 limited range (the inverse of
+// yuvToRgb in shaders/include/yuv.glsl). Chroma is the average of each 2x2
+// block, sited at its centre; odd edges repeat their last row or column.
+// This is what shaders/nv12.frag writes for Nv12Readback, done on the CPU to
+// check it against and for runs that read RGBA back instead.
+//
+// 'src' rows are 'channels' (3 or 4, alpha ignored) components, 'stride'
+// bytes apart; a negative stride from the last row reads a bottom-up GL
+// image top down. 'dst' takes nv12FrameSize() bytes, top down. Row pairs are
+// split across the shared JobSystem. RGBA runs through SSE2 fixed point
+// (15 fraction bits for luma, 18 for chroma) and comes within one code of
+// the exact result.
+void rgbToNv12(unsigned char const* src, std::ptrdiff_t stride, int width, int height, int channels,
+  unsigned char* dst);
+
+inline std::size_t nv12FrameSize(int width, int height)
+{
+  return std::size_t(width) * height + std::size_t((width + 1) / 2) * ((height + 1) / 2) * 2;
+}
@@ -0,0 +1,278 @@
+#include "nv12_readback.h"
+#include "nv12_convert.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+
+using namespace std;
+
+namespace {
+
+typedef chrono::steady_clock Clock;
+
+GLuint createTarget(GLint internalFormat, GLenum format, int width, int height, GLuint& texture)
+{
+  glGenTextures(1, &texture);
+  glBindTexture(GL_TEXTURE_2D, texture);
+  glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, GL_UNSIGNED_BYTE, NULL);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+  GLuint framebuffer;
+  glGenFramebuffers(1, &framebuffer);
+  glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+  if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+    glDeleteFramebuffers(1, &framebuffer);
+    framebuffer = 0;
+  }
+  return framebuffer;
+}
+
+} // namespace
+
+Nv12Readback::Nv12Readback()
+  : m_program(0), m_planeLocation(-1), m_vertexArray(0), m_sceneFramebuffer(0), m_lumaFramebuffer(0),
+    m_chromaFramebuffer(0), m_sceneTexture(0), m_lumaTexture(0), m_chromaTexture(0), m_width(0), m_height(0),
+    m_conversion(NV12_ON_GPU), m_oldest(0), m_inFlight(0), m_nextFrame(0), m_savedFramebuffer(0), m_stats()
+{
+  for (int i = 0; i < kRingSize; ++i) {
+    m_slots[i].buffer = 0;
+    m_slots[i].fence = NULL;
+    m_slots[i].frame = 0;
+  }
+}
+
+Nv12Readback::~Nv12Readback()
+{
+  release();
+}
+
+bool Nv12Readback::init(string const& shaderDirectory, ShaderCache* cache, int width, int height,
+  Nv12Conversion conversion, Consumer const& consumer)
+{
+  TRACE_ZONE("Nv12Readback::init");
+  release();
+  if (width <= 0 || height <= 0) {
+    cerr << "Error: NV12 output needs a size, not " << width << "x" << height << endl;
+    return false;
+  }
+
+  m_shaders.init(cache, [](GLuint program) { glBindFragDataLocation(program, 0, "outColor"); });
+  if (!m_shaders.load((shaderDirectory + "/nv12.vert").c_str(), (shaderDirectory + "/nv12.frag").c_str()))
+    return false;
+  m_shaders.request(0);
+  if (!m_shaders.compileAll())
+    return false;
+  m_program = m_shaders.program(0);
+  m_planeLocation = glGetUniformLocation(m_program, "uPlane");
+
+  GLint savedFramebuffer, savedTexture, savedProgram;
+  glGetIntegerv(GL_FRAMEBUFFER_BINDING, &savedFramebuffer);
+  glGetIntegerv(GL_TEXTURE_BINDING_2D, &savedTexture);
+  glGetIntegerv(GL_CURRENT_PROGRAM, &savedProgram);
+  m_width = width;
+  m_height = height;
+  m_sceneFramebuffer = createTarget(GL_RGBA8, GL_RGBA, width, height, m_sceneTexture);
+  m_lumaFramebuffer = createTarget(GL_R8, GL_RED, width, height, m_lumaTexture);
+  m_chromaFramebuffer = createTarget(GL_RG8, GL_RG, (width + 1) / 2, (height + 1) / 2, m_chromaTexture);
+  glBindFramebuffer(GL_FRAMEBUFFER, savedFramebuffer);
+  glBindTexture(GL_TEXTURE_2D, savedTexture);
+  glUseProgram(m_program);
+  glUniform1i(glGetUniformLocation(m_program, "uFrame"), 0);
+  glUseProgram(savedProgram);
+  glGenVertexArrays(1, &m_vertexArray);
+
+  if (!m_sceneFramebuffer || !m_lumaFramebuffer || !m_chromaFramebuffer) {
+    cerr << "Error: NV12 output framebuffers are incomplete" << endl;
+    release();
+    return false;
+  }
+
+  // one buffer per slot, holding whatever the conversion reads back
+  m_conversion = conversion;
+  size_t nv12Size = nv12FrameSize(width, height), rgbaSize = size_t(width) * height * 4;
+  size_t slotSize = conversion == NV12_ON_GPU ? nv12Size : conversion == NV12_ON_CPU ? rgbaSize : nv12Size + rgbaSize;
+  for (int i = 0; i < kRingSize; ++i) {
+    glGenBuffers(1, &m_slots[i].buffer);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, m_slots[i].buffer);
+    glBufferData(GL_PIXEL_PACK_BUFFER, slotSize, NULL, GL_STREAM_READ);
+  }
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  if (conversion != NV12_ON_GPU)
+    m_converted.resize(nv12Size);
+
+  m_consumer = consumer;
+  m_oldest = m_inFlight = 0;
+  m_nextFrame = 0;
+  m_stats = Stats();
+  return true;
+}
+
+void Nv12Readback::release()
+{
+  while (m_inFlight)
+    deliverOldest(true);
+  for (int i = 0; i < kRingSize; ++i)
+    if (m_slots[i].buffer) {
+      glDeleteBuffers(1, &m_slots[i].buffer);
+      m_slots[i].buffer = 0;
+    }
+  GLuint framebuffers[3] = { m_sceneFramebuffer, m_lumaFramebuffer, m_chromaFramebuffer };
+  GLuint textures[3] = { m_sceneTexture, m_lumaTexture, m_chromaTexture };
+  for (int i = 0; i < 3; ++i) {
+    if (framebuffers[i])
+      glDeleteFramebuffers(1, &framebuffers[i]);
+    if (textures[i])
+      glDeleteTextures(1, &textures[i]);
+  }
+  m_sceneFramebuffer = m_lumaFramebuffer = m_chromaFramebuffer = 0;
+  m_sceneTexture = m_lumaTexture = m_chromaTexture = 0;
+  if (m_vertexArray) {
+    glDeleteVertexArrays(1, &m_vertexArray);
+    m_vertexArray = 0;
+  }
+  m_shaders.release();
+  m_program = 0;
+  m_converted.clear();
+}
+
+void Nv12Readback::beginFrame()
+{
+  glGetIntegerv(GL_FRAMEBUFFER_BINDING, &m_savedFramebuffer);
+  glGetIntegerv(GL_VIEWPORT, m_savedViewport);
+  glBindFramebuffer(GL_FRAMEBUFFER, m_sceneFramebuffer);
+  glViewport(0, 0, m_width, m_height);
+}
+
+void Nv12Readback::endFrame()
+{
+  TRACE_ZONE("Nv12Readback::endFrame");
+
+  // whatever has arrived, then room for this frame
+  while (m_inFlight && deliverOldest(false)) {
+  }
+  if (m_inFlight == kRingSize) {
+    Clock::time_point start = Clock::now();
+    deliverOldest(true);
+    ++m_stats.stalls;
+    m_stats.stallMs += chrono::duration<double, milli>(Clock::now() - start).count();
+  }
+
+  if (m_conversion != NV12_ON_CPU)
+    pack();
+  Slot& slot = m_slots[(m_oldest + m_inFlight) % kRingSize];
+  readInto(slot);
+  ++m_inFlight;
+
+  glBindFramebuffer(GL_FRAMEBUFFER, m_savedFramebuffer);
+  glViewport(m_savedViewport[0], m_savedViewport[1], m_savedViewport[2], m_savedViewport[3]);
+}
+
+void Nv12Readback::pack()
+{
+  GLint savedTexture, savedProgram, savedVertexArray;
+  glGetIntegerv(GL_TEXTURE_BINDING_2D, &savedTexture);
+  glGetIntegerv(GL_CURRENT_PROGRAM, &savedProgram);
+  glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &savedVertexArray);
+
+  glUseProgram(m_program);
+  glBindVertexArray(m_vertexArray);
+  glBindTexture(GL_TEXTURE_2D, m_sceneTexture);
+
+  glBindFramebuffer(GL_FRAMEBUFFER, m_lumaFramebuffer);
+  glViewport(0, 0, m_width, m_height);
+  glUniform1i(m_planeLocation, 0);
+  glDrawArrays(GL_TRIANGLES, 0, 3);
+
+  glBindFramebuffer(GL_FRAMEBUFFER, m_chromaFramebuffer);
+  glViewport(0, 0, (m_width + 1) / 2, (m_height + 1) / 2);
+  glUniform1i(m_planeLocation, 1);
+  glDrawArrays(GL_TRIANGLES, 0, 3);
+
+  glBindTexture(GL_TEXTURE_2D, savedTexture);
+  glBindVertexArray(savedVertexArray);
+  glUseProgram(savedProgram);
+}
+
+void Nv12Readback::readInto(Slot& slot)
+{
+  // into the buffer, so these return at once and the copies run on the GPU
+  // behind the frame
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+  glPixelStorei(GL_PACK_ALIGNMENT, 1);
+  size_t rgbaOffset = 0;
+  if (m_conversion != NV12_ON_CPU) {
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, m_lumaFramebuffer);
+    glReadPixels(0, 0, m_width, m_height, GL_RED, GL_UNSIGNED_BYTE, 0);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, m_chromaFramebuffer);
+    glReadPixels(0, 0, (m_width + 1) / 2, (m_height + 1) / 2, GL_RG, GL_UNSIGNED_BYTE,
+      reinterpret_cast<void*>(size_t(m_width) * m_height));
+    rgbaOffset = nv12FrameSize(m_width, m_height);
+  }
+  if (m_conversion != NV12_ON_GPU) {
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, m_sceneFramebuffer);
+    glReadPixels(0, 0, m_width, m_height, GL_RGBA, GL_UNSIGNED_BYTE, reinterpret_cast<void*>(rgbaOffset));
+  }
+  glPixelStorei(GL_PACK_ALIGNMENT, 4);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+  // the swap at the end of the frame flushes the fence
+  slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  slot.frame = m_nextFrame++;
+}
+
+// false if 'wait' is false and the oldest frame isn't there yet
+bool Nv12Readback::deliverOldest(bool wait)
+{
+  Slot& slot = m_slots[m_oldest];
+  GLenum status = glClientWaitSync(slot.fence, wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0, wait ? 1000000000ull : 0);
+  if (status == GL_TIMEOUT_EXPIRED && !wait)
+    return false;
+  if (status == GL_WAIT_FAILED || status == GL_TIMEOUT_EXPIRED)
+    cerr << "Error: waiting on an NV12 readback fence failed" << endl;
+  glDeleteSync(slot.fence);
+  slot.fence = NULL;
+
+  TRACE_ZONE("deliverNv12");
+  Clock::time_point start = Clock::now();
+  size_t nv12Size = nv12FrameSize(m_width, m_height), rowSize = size_t(m_width) * 4;
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+  size_t mapSize = m_conversion == NV12_ON_GPU ? nv12Size
+    : m_conversion == NV12_ON_CPU ? rowSize * m_height : nv12Size + rowSize * m_height;
+  unsigned char const* mapped = static_cast<unsigned char const*>(
+    glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, mapSize, GL_MAP_READ_BIT));
+  if (mapped) {
+    unsigned char const* nv12 = mapped;
+    if (m_conversion != NV12_ON_GPU) {
+      // RGBA rows come back bottom up
+      unsigned char const* rgba = mapped + (m_conversion == NV12_ON_CPU ? 0 : nv12Size);
+      rgbToNv12(rgba + (m_height - 1) * rowSize, -ptrdiff_t(rowSize), m_width, m_height, 4, m_converted.data());
+      if (m_conversion == NV12_ON_CPU)
+        nv12 = m_converted.data();
+    }
+    if (m_conversion == NV12_VERIFY)
+      for (size_t i = 0; i < nv12Size; ++i) {
+        int difference = abs(int(mapped[i]) - int(m_converted[i]));
+        m_stats.differing += difference != 0;
+        m_stats.maxDifference = max(m_stats.maxDifference, difference);
+      }
+    if (m_consumer)
+      m_consumer(nv12, m_width, m_height, slot.frame);
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    ++m_stats.frames;
+  } else {
+    cerr << "Error: can't map NV12 readback buffer" << endl;
+  }
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  m_stats.deliverMs += chrono::duration<double, milli>(Clock::now() - start).count();
+
+  m_oldest = (m_oldest + 1) % kRingSize;
+  --m_inFlight;
+  return true;
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "shader_library.h"
+
+class ShaderCache;
+
+enum Nv12Conversion {
+  NV12_ON_GPU,   // the shader packs the planes and they are read back
+  NV12_ON_CPU,   // RGBA is read back and rgbToNv12 packs it
+  NV12_VERIFY    // both, counting samples where they differ
+};
+
+// Hands rendered frames to a video encoder as NV12 without stalling the
+// render loop. The scene is drawn into an offscreen RGBA8 target of the
+// output size between beginFrame() and endFrame(); endFrame() packs it into
+// an R8 luma and an RG8 half-size chroma target with shaders/nv12.frag (one
+// pass each, since GL only draws where all of a framebuffer's attachments
+// overlap) and starts glReadPixels of both planes into the next pixel pack
+// buffer of a ring, followed by a fence. That moves 1.5 bytes a pixel
+// instead of RGBA's 4 and leaves no colour conversion to the CPU.
+//
+// Frames are mapped and handed to the consumer, in order and top down, once
+// their fence has passed, a frame or two later; only when every buffer is
+// still in flight does endFrame() wait for the oldest.
+class Nv12Readback
+{
+public:
+  static const int kRingSize = 3;
+
+  // 'nv12' holds nv12FrameSize() bytes and is only valid during the call
+  typedef std::function<void(unsigned char const* nv12, int width, int height, long long frame)> Consumer;
+
+  struct Stats {
+    unsigned frames;          // delivered
+    unsigned stalls;          // endFrame() calls that waited for the oldest frame
+    double stallMs;
+    double deliverMs;         // mapping, converting and the consumer
+    unsigned long long differing;  // NV12_VERIFY: samples the GPU and CPU disagree on
+    int maxDifference;
+  };
+
+  Nv12Readback();
+  ~Nv12Readback();
+
+  // with the GL context current; 'cache' may be NULL
+  bool init(std::string const& shaderDirectory, ShaderCache* cache, int width, int height, Nv12Conversion conversion,
+    Consumer const& consumer);
+  // waits for and delivers every frame in flight, then deletes everything
+  void release();
+  bool isOpen() const { return m_sceneFramebuffer != 0; }
+
+  // binds the output target and viewport; the caller draws as usual
+  void beginFrame();
+  // restores the framebuffer, program, texture, vertex array and viewport
+  // that were bound when it was called
+  void endFrame();
+
+  int width() const { return m_width; }
+  int height() const { return m_height; }
+  Stats const& stats() const { return m_stats; }
+
+private:
+  struct Slot {
+    GLuint buffer;
+    GLsync fence;
+    long long frame;
+  };
+
+  void pack();
+  void readInto(Slot& slot);
+  bool deliverOldest(bool wait);
+
+  ShaderLibrary m_shaders;
+  GLuint m_program;
+  GLint m_planeLocation;
+  GLuint m_vertexArray;
+  GLuint m_sceneFramebuffer, m_lumaFramebuffer, m_chromaFramebuffer;
+  GLuint m_sceneTexture, m_lumaTexture, m_chromaTexture;
+  int m_width, m_height;
+  Nv12Conversion m_conversion;
+  Consumer m_consumer;
+
+  Slot m_slots[kRingSize];
+  int m_oldest, m_inFlight;
+  long long m_nextFrame;
+  std::vector<unsigned char> m_converted;  // rgbToNv12's output, for NV12_ON_CPU and NV12_VERIFY
+
+  GLint m_savedFramebuffer, m_savedViewport[4];
+  Stats m_stats;
+};
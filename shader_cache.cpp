@@ -0,0 +1,304 @@
+#include "shader_cache.h"
+#include "trace.h"
+
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+using namespace std;
+
+namespace {
+
+typedef chrono::steady_clock Clock;
+
+const char kMagic[4] = { 'G', 'L', 'P', 'B' };
+const unsigned kFormatVersion = 1;
+
+// fixed-size part of an entry; followed by the driver string and the binary
+struct EntryHeader {
+  char magic[4];
+  unsigned version;
+  unsigned long long key;
+  unsigned binaryFormat;
+  unsigned binaryLength;
+  unsigned driverLength;
+};
+
+unsigned long long fnv1a(unsigned long long hash, void const* data, size_t size)
+{
+  unsigned char const* bytes = static_cast<unsigned char const*>(data);
+  for (size_t i = 0; i < size; ++i) {
+    hash ^= bytes[i];
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+bool makeDirectory(string const& path)
+{
+#ifdef _WIN32
+  int result = _mkdir(path.c_str());
+#else
+  int result = mkdir(path.c_str(), 0755);
+#endif
+  return result == 0 || errno == EEXIST;
+}
+
+double millisecondsSince(Clock::time_point start)
+{
+  return chrono::duration<double, milli>(Clock::now() - start).count();
+}
+
+GLuint compileShader(GLenum type, char const* source)
+{
+  GLuint shader = glCreateShader(type);
+  glShaderSource(shader, 1, &source, NULL);
+  glCompileShader(shader);
+
+  GLint result;
+  glGetShaderiv(shader, GL_COMPILE_STATUS, &result);
+  if (!result) {
+    GLchar errorLog[512];
+    glGetShaderInfoLog(shader, sizeof(errorLog), NULL, errorLog);
+    cerr << "ERROR: " << (type == GL_VERTEX_SHADER ? "vertex" : "fragment") << " shader result error\n"
+      << errorLog << endl;
+    glDeleteShader(shader);
+    return 0;
+  }
+  return shader;
+}
+
+} // namespace
+
+GLuint compileProgram(char const* vertexSource, char const* fragmentSource,
+  function<void(GLuint)> const& bindLocations, bool retrievable)
+{
+  GLuint vertexShader = compileShader(GL_VERTEX_SHADER, vertexSource);
+  if (!vertexShader)
+    return 0;
+  GLuint fragmentShader = compileShader(GL_FRAGMENT_SHADER, fragmentSource);
+  if (!fragmentShader) {
+    glDeleteShader(vertexShader);
+    return 0;
+  }
+
+  GLuint program = glCreateProgram();
+  glAttachShader(program, vertexShader);
+  glAttachShader(program, fragmentShader);
+  if (bindLocations)
+    bindLocations(program);
+  // must be set before linking for glGetProgramBinary to return anything
+  if (retrievable)
+    glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+  glLinkProgram(program);
+
+  glDetachShader(program, vertexShader);
+  glDetachShader(program, fragmentShader);
+  glDeleteShader(vertexShader);
+  glDeleteShader(fragmentShader);
+
+  GLint result;
+  glGetProgramiv(program, GL_LINK_STATUS, &result);
+  if (!result) {
+    GLchar errorLog[512];
+    glGetProgramInfoLog(program, sizeof(errorLog), NULL, errorLog);
+    cerr << "ERROR: shader program result error\n" << errorLog << endl;
+    glDeleteProgram(program);
+    return 0;
+  }
+  return program;
+}
+
+ShaderCache::ShaderCache()
+  : m_enabled(false)
+{
+  memset(&m_stats, 0, sizeof(m_stats));
+}
+
+bool ShaderCache::init(char const* directory)
+{
+  m_enabled = false;
+  if (!directory)
+    return true;
+
+  // glProgramBinary is core in 4.1; on 3.3 contexts it comes from the extension
+  GLint formats = 0;
+  if (GLEW_VERSION_4_1 || GLEW_ARB_get_program_binary)
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+  if (formats <= 0) {
+    cerr << "Warning: driver has no program binary formats, shaders are compiled every run" << endl;
+    return true;
+  }
+
+  m_directory = directory;
+  if (!makeDirectory(m_directory)) {
+    cerr << "Error: can't create shader cache directory " << m_directory << endl;
+    return false;
+  }
+
+  m_driver = string(reinterpret_cast<char const*>(glGetString(GL_VENDOR))) + "\n" +
+    reinterpret_cast<char const*>(glGetString(GL_RENDERER)) + "\n" +
+    reinterpret_cast<char const*>(glGetString(GL_VERSION));
+  m_enabled = true;
+  return true;
+}
+
+GLuint ShaderCache::buildProgram(char const* vertexSource, char const* fragmentSource,
+  function<void(GLuint)> const& bindLocations)
+{
+  TRACE_ZONE("ShaderCache::buildProgram");
+
+  GLuint program = find(vertexSource, fragmentSource);
+  if (program)
+    return program;
+
+  Clock::time_point start = Clock::now();
+  program = compileProgram(vertexSource, fragmentSource, bindLocations, m_enabled);
+  if (program) {
+    ++m_stats.compiled;
+    insert(vertexSource, fragmentSource, program);
+  }
+  m_stats.compileMs += millisecondsSince(start);
+  return program;
+}
+
+GLuint ShaderCache::find(char const* vertexSource, char const* fragmentSource)
+{
+  if (!m_enabled)
+    return 0;
+
+  Clock::time_point start = Clock::now();
+  GLuint program = load(key(vertexSource, fragmentSource));
+  if (program) {
+    ++m_stats.hits;
+    m_stats.loadMs += millisecondsSince(start);
+  }
+  return program;
+}
+
+void ShaderCache::insert(char const* vertexSource, char const* fragmentSource, GLuint program)
+{
+  if (m_enabled)
+    store(key(vertexSource, fragmentSource), program);
+}
+
+void ShaderCache::erase(char const* vertexSource, char const* fragmentSource)
+{
+  if (m_enabled)
+    remove(entryPath(key(vertexSource, fragmentSource)).c_str());
+}
+
+unsigned long long ShaderCache::key(char const* vertexSource, char const* fragmentSource) const
+{
+  // the terminating NULs keep "ab"+"c" and "a"+"bc" apart
+  unsigned long long hash = 14695981039346656037ull;
+  hash = fnv1a(hash, vertexSource, strlen(vertexSource) + 1);
+  hash = fnv1a(hash, fragmentSource, strlen(fragmentSource) + 1);
+  return fnv1a(hash, m_driver.data(), m_driver.size());
+}
+
+string ShaderCache::entryPath(unsigned long long key) const
+{
+  char name[32];
+  snprintf(name, sizeof(name), "/%016llx.bin", key);
+  return m_directory + name;
+}
+
+GLuint ShaderCache::load(unsigned long long key)
+{
+  string path = entryPath(key);
+  FILE* file = fopen(path.c_str(), "rb");
+  if (!file)
+    return 0;
+
+  // the driver string is stored in full, so a hash collision can't hand a
+  // binary to the wrong driver; the lengths are checked against what the
+  // file holds before anything is allocated for them
+  long fileSize = -1;
+  if (fseek(file, 0, SEEK_END) == 0) {
+    fileSize = ftell(file);
+    rewind(file);
+  }
+  EntryHeader header;
+  vector<char> driver, binary;
+  bool valid = fileSize >= long(sizeof(header)) && fread(&header, sizeof(header), 1, file) == 1 &&
+    memcmp(header.magic, kMagic, sizeof(kMagic)) == 0 && header.version == kFormatVersion &&
+    header.key == key && header.driverLength == m_driver.size() &&
+    (unsigned long long)header.driverLength + header.binaryLength <= (unsigned long long)fileSize - sizeof(header);
+  if (valid) {
+    driver.resize(header.driverLength);
+    binary.resize(header.binaryLength);
+    valid = fread(driver.data(), 1, driver.size(), file) == driver.size() &&
+      fread(binary.data(), 1, binary.size(), file) == binary.size() &&
+      memcmp(driver.data(), m_driver.data(), driver.size()) == 0;
+  }
+  fclose(file);
+
+  GLuint program = 0;
+  if (valid) {
+    program = glCreateProgram();
+    glProgramBinary(program, header.binaryFormat, binary.data(), GLsizei(binary.size()));
+    GLint result;
+    glGetProgramiv(program, GL_LINK_STATUS, &result);
+    if (!result) {
+      glDeleteProgram(program);
+      program = 0;
+    }
+  }
+
+  if (!program) {
+    ++m_stats.rejected;
+    remove(path.c_str());
+  }
+  return program;
+}
+
+void ShaderCache::store(unsigned long long key, GLuint program)
+{
+  GLint length = 0;
+  glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+  if (length <= 0)
+    return;
+
+  vector<char> binary(length);
+  GLenum binaryFormat = 0;
+  glGetProgramBinary(program, length, &length, &binaryFormat, binary.data());
+
+  EntryHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kFormatVersion;
+  header.key = key;
+  header.binaryFormat = binaryFormat;
+  header.binaryLength = unsigned(length);
+  header.driverLength = unsigned(m_driver.size());
+
+  // write to a temporary and rename, so a crash or a second instance never
+  // leaves a truncated entry behind
+  string path = entryPath(key), temporary = path + ".tmp";
+  FILE* file = fopen(temporary.c_str(), "wb");
+  if (!file) {
+    cerr << "Warning: can't write shader cache entry " << temporary << endl;
+    return;
+  }
+  bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+    fwrite(m_driver.data(), 1, m_driver.size(), file) == m_driver.size() &&
+    fwrite(binary.data(), 1, size_t(length), file) == size_t(length);
+  written = fclose(file) == 0 && written;
+
+  // rename() doesn't replace an existing file on Windows
+  remove(path.c_str());
+  if (!written || rename(temporary.c_str(), path.c_str()) != 0) {
+    cerr << "Warning: can't write shader cache entry " << path << endl;
+    remove(temporary.c_str());
+  }
+}
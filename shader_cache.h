@@ -0,0 +1,64 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <functional>
+#include <string>
+
+// On-disk cache of linked program binaries (glGetProgramBinary). Each entry
+// is keyed by a hash of the shader sources and the driver's vendor, renderer
+// and version strings, so a driver update or an edited shader simply misses.
+// A binary the driver refuses at load time is dropped and the program is
+// compiled from source again, so callers never see the difference.
+//
+// Pre-link state set by 'bindLocations' (attribute and fragment output
+// locations) is baked into the binary but not part of the key: it must be a
+// function of the sources, as it is for every program in this app.
+class ShaderCache
+{
+public:
+  struct Stats {
+    unsigned hits;      // loaded from disk
+    unsigned compiled;  // built from source by buildProgram
+    unsigned rejected;  // entry present but unreadable or refused by the driver
+    double loadMs;      // spent in hits
+    double compileMs;   // spent in buildProgram compiling, linking and storing
+  };
+
+  ShaderCache();
+
+  // Call with the GL context current. 'directory' is created if missing;
+  // NULL, or a driver without program binary formats, disables caching and
+  // buildProgram just compiles.
+  bool init(char const* directory);
+  bool enabled() const { return m_enabled; }
+
+  // Returns a linked program, or 0 after printing the compile/link log.
+  GLuint buildProgram(char const* vertexSource, char const* fragmentSource,
+    std::function<void(GLuint)> const& bindLocations = std::function<void(GLuint)>());
+
+  // The two halves of buildProgram, for callers that compile several
+  // programs at once (ShaderLibrary): find returns 0 on a miss, insert stores
+  // a program linked with compileProgram(..., retrievable = enabled()).
+  GLuint find(char const* vertexSource, char const* fragmentSource);
+  void insert(char const* vertexSource, char const* fragmentSource, GLuint program);
+
+  // Drops the entry for these sources, if any (benchmarks, tools).
+  void erase(char const* vertexSource, char const* fragmentSource);
+
+  Stats const& stats() const { return m_stats; }
+
+private:
+  unsigned long long key(char const* vertexSource, char const* fragmentSource) const;
+  std::string entryPath(unsigned long long key) const;
+  GLuint load(unsigned long long key);
+  void store(unsigned long long key, GLuint program);
+
+  bool m_enabled;
+  std::string m_directory, m_driver;
+  Stats m_stats;
+};
+
+// compiles and links without touching any cache
+GLuint compileProgram(char const* vertexSource, char const* fragmentSource,
+  std::function<void(GLuint)> const& bindLocations, bool retrievable);
@@ -0,0 +1,374 @@
+#include "shader_library.h"
+#include "shader_cache.h"
+#include "trace.h"
+
+#include <cctype>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+using namespace std;
+
+namespace {
+
+typedef chrono::steady_clock Clock;
+
+char const* const kFeatureNames[FEATURE_COUNT] = { "homography", "yuv_input", "input_16bit", "lut_warp" };
+
+double millisecondsSince(Clock::time_point start)
+{
+  return chrono::duration<double, milli>(Clock::now() - start).count();
+}
+
+// joins 'name' onto the directory of 'from' and folds "." and ".." segments,
+// so the same file reached two ways is recognised as one
+string resolvePath(string const& from, string const& name)
+{
+  string path = name;
+  size_t slash = from.find_last_of("/\\");
+  if (slash != string::npos && !(name.size() > 0 && (name[0] == '/' || name[0] == '\\')))
+    path = from.substr(0, slash + 1) + name;
+  for (size_t i = 0; i < path.size(); ++i)
+    if (path[i] == '\\')
+      path[i] = '/';
+
+  vector<string> parts;
+  stringstream stream(path);
+  string part;
+  while (getline(stream, part, '/')) {
+    if (part == "." || (part.empty() && !parts.empty()))
+      continue;
+    if (part == ".." && !parts.empty() && parts.back() != "..") {
+      parts.pop_back();
+      continue;
+    }
+    parts.push_back(part);
+  }
+
+  string resolved;
+  for (size_t i = 0; i < parts.size(); ++i)
+    resolved += (i ? "/" : "") + parts[i];
+  return resolved;
+}
+
+// matches '#<directive>' with optional whitespace around the '#'
+bool isDirective(string const& line, char const* directive, size_t& end)
+{
+  size_t i = line.find_first_not_of(" \t");
+  if (i == string::npos || line[i] != '#')
+    return false;
+  i = line.find_first_not_of(" \t", i + 1);
+  size_t length = strlen(directive);
+  if (i == string::npos || line.compare(i, length, directive) != 0)
+    return false;
+  end = i + length;
+  return true;
+}
+
+void printShaderLog(GLuint shader, char const* stage, unsigned features)
+{
+  GLint result;
+  glGetShaderiv(shader, GL_COMPILE_STATUS, &result);
+  if (result)
+    return;
+  GLchar errorLog[1024];
+  glGetShaderInfoLog(shader, sizeof(errorLog), NULL, errorLog);
+  cerr << "ERROR: " << stage << " shader (" << shaderFeatureName(features) << ") result error\n"
+    << errorLog << endl;
+}
+
+} // namespace
+
+bool ShaderPreprocessor::expand(string const& path, string& out)
+{
+  m_error.clear();
+  out.clear();
+  set<string> included;
+  return expandFile(resolvePath("", path), out, included);
+}
+
+bool ShaderPreprocessor::read(string const& path, string const*& contents)
+{
+  map<string, string>::const_iterator it = m_contents.find(path);
+  if (it == m_contents.end()) {
+    ifstream file(path.c_str(), ios::binary);
+    if (!file)
+      return false;
+    stringstream buffer;
+    buffer << file.rdbuf();
+    it = m_contents.insert(make_pair(path, buffer.str())).first;
+    m_files.push_back(path);
+  }
+  contents = &it->second;
+  return true;
+}
+
+bool ShaderPreprocessor::expandFile(string const& path, string& out, set<string>& included)
+{
+  string const* contents;
+  if (!read(path, contents)) {
+    m_error = "can't read " + path;
+    return false;
+  }
+  included.insert(path);
+
+  size_t index = 0;
+  while (m_files[index] != path)
+    ++index;
+  bool topLevel = included.size() == 1;
+  // the top-level file's #version has to stay the first line, so it gets its
+  // #line directive after that instead
+  if (!topLevel)
+    out += "#line 1 " + to_string(index) + "\n";
+
+  istringstream lines(*contents);
+  string line;
+  for (int number = 1; getline(lines, line); ++number) {
+    if (!line.empty() && line[line.size() - 1] == '\r')
+      line.erase(line.size() - 1);
+
+    size_t end;
+    if (isDirective(line, "version", end)) {
+      if (!topLevel) {
+        m_error = path + ":" + to_string(number) + ": #version in an included file";
+        return false;
+      }
+      out += line + "\n#line " + to_string(number + 1) + " " + to_string(index) + "\n";
+      continue;
+    }
+    if (!isDirective(line, "include", end)) {
+      out += line + "\n";
+      continue;
+    }
+
+    size_t open = line.find('"', end), close = open == string::npos ? open : line.find('"', open + 1);
+    if (close == string::npos) {
+      m_error = path + ":" + to_string(number) + ": expected #include \"file\"";
+      return false;
+    }
+    string child = resolvePath(path, line.substr(open + 1, close - open - 1));
+    if (!included.count(child)) {
+      if (!expandFile(child, out, included)) {
+        m_error += "\n  included from " + path + ":" + to_string(number);
+        return false;
+      }
+      out += "#line " + to_string(number + 1) + " " + to_string(index) + "\n";
+    }
+  }
+  return true;
+}
+
+string applyShaderFeatures(string const& source, unsigned features)
+{
+  string defines;
+  for (int i = 0; i < FEATURE_COUNT; ++i)
+    if (features & (1u << i)) {
+      string name = kFeatureNames[i];
+      for (size_t c = 0; c < name.size(); ++c)
+        name[c] = char(toupper(name[c]));
+      defines += "#define FEATURE_" + name + " 1\n";
+    }
+
+  // after the #version line, which the preprocessor left as the first line
+  size_t end;
+  size_t lineEnd = source.find('\n');
+  if (lineEnd != string::npos && isDirective(source.substr(0, lineEnd), "version", end))
+    return source.substr(0, lineEnd + 1) + defines + source.substr(lineEnd + 1);
+  return defines + source;
+}
+
+string shaderFeatureName(unsigned features)
+{
+  string name;
+  for (int i = 0; i < FEATURE_COUNT; ++i)
+    if (features & (1u << i))
+      name += (name.empty() ? "" : "+") + string(kFeatureNames[i]);
+  return name.empty() ? "base" : name;
+}
+
+ShaderLibrary::ShaderLibrary()
+  : m_cache(NULL), m_parallel(false)
+{
+  memset(&m_stats, 0, sizeof(m_stats));
+}
+
+ShaderLibrary::~ShaderLibrary()
+{
+  // programs belong to the GL context, which is usually gone by now; owners
+  // call release() while it is still current
+}
+
+void ShaderLibrary::init(ShaderCache* cache, function<void(GLuint)> const& bindLocations)
+{
+  m_cache = cache;
+  m_bindLocations = bindLocations;
+
+  // 0xFFFFFFFF asks for as many compiler threads as the implementation likes
+  m_parallel = false;
+  if (GLEW_KHR_parallel_shader_compile) {
+    glMaxShaderCompilerThreadsKHR(0xFFFFFFFFu);
+    m_parallel = true;
+  } else if (GLEW_ARB_parallel_shader_compile) {
+    glMaxShaderCompilerThreadsARB(0xFFFFFFFFu);
+    m_parallel = true;
+  }
+}
+
+bool ShaderLibrary::load(char const* vertexPath, char const* fragmentPath)
+{
+  TRACE_ZONE("ShaderLibrary::load");
+
+  ShaderPreprocessor preprocessor;
+  if (!preprocessor.expand(vertexPath, m_vertexSource) || !preprocessor.expand(fragmentPath, m_fragmentSource)) {
+    cerr << "Error: " << preprocessor.error() << endl;
+    return false;
+  }
+  m_files = preprocessor.files();
+  return true;
+}
+
+void ShaderLibrary::request(unsigned features)
+{
+  for (size_t i = 0; i < m_permutations.size(); ++i)
+    if (m_permutations[i].features == features)
+      return;
+
+  Permutation permutation;
+  permutation.features = features;
+  permutation.program = 0;
+  permutation.vertexShader = permutation.fragmentShader = 0;
+  permutation.fragmentSource = applyShaderFeatures(m_fragmentSource, features);
+  m_permutations.push_back(permutation);
+}
+
+bool ShaderLibrary::compileAll()
+{
+  TRACE_ZONE("ShaderLibrary::compileAll");
+
+  Clock::time_point start = Clock::now();
+  vector<Permutation*> pending;
+  for (size_t i = 0; i < m_permutations.size(); ++i) {
+    Permutation& permutation = m_permutations[i];
+    if (permutation.program)
+      continue;
+    if (m_cache)
+      permutation.program = m_cache->find(m_vertexSource.c_str(), permutation.fragmentSource.c_str());
+    if (permutation.program)
+      ++m_stats.cached;
+    else
+      pending.push_back(&permutation);
+  }
+  m_stats.cachedMs += millisecondsSince(start);
+  if (pending.empty())
+    return true;
+
+  start = Clock::now();
+
+  // issue everything before asking for any result: a status query is what
+  // makes the driver block. Permutations share one vertex shader.
+  char const* vertexSource = m_vertexSource.c_str();
+  GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
+  glShaderSource(vertexShader, 1, &vertexSource, NULL);
+  glCompileShader(vertexShader);
+  for (size_t i = 0; i < pending.size(); ++i) {
+    Permutation& permutation = *pending[i];
+    permutation.vertexShader = vertexShader;
+
+    char const* source = permutation.fragmentSource.c_str();
+    permutation.fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
+    glShaderSource(permutation.fragmentShader, 1, &source, NULL);
+    glCompileShader(permutation.fragmentShader);
+  }
+
+  bool retrievable = m_cache && m_cache->enabled();
+  for (size_t i = 0; i < pending.size(); ++i) {
+    Permutation& permutation = *pending[i];
+    permutation.program = glCreateProgram();
+    glAttachShader(permutation.program, permutation.vertexShader);
+    glAttachShader(permutation.program, permutation.fragmentShader);
+    if (m_bindLocations)
+      m_bindLocations(permutation.program);
+    if (retrievable)
+      glProgramParameteri(permutation.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    glLinkProgram(permutation.program);
+  }
+
+  // with parallel compile, finish (and store) programs as they complete
+  // rather than stalling on the first one
+  bool ok = true;
+  size_t remaining = pending.size();
+  vector<bool> finished(pending.size(), false);
+  while (remaining) {
+    size_t before = remaining;
+    for (size_t i = 0; i < pending.size(); ++i) {
+      if (finished[i])
+        continue;
+      if (m_parallel) {
+        GLint complete = GL_FALSE;
+        glGetProgramiv(pending[i]->program, GL_COMPLETION_STATUS_KHR, &complete);
+        if (!complete)
+          continue;
+      }
+      ok = finish(*pending[i]) && ok;
+      finished[i] = true;
+      --remaining;
+    }
+    if (remaining == before)
+      this_thread::sleep_for(chrono::microseconds(100));
+  }
+
+  for (size_t i = 0; i < pending.size(); ++i) {
+    glDeleteShader(pending[i]->fragmentShader);
+    pending[i]->vertexShader = pending[i]->fragmentShader = 0;
+  }
+  glDeleteShader(vertexShader);
+
+  m_stats.compileMs += millisecondsSince(start);
+  return ok;
+}
+
+bool ShaderLibrary::finish(Permutation& permutation)
+{
+  GLint result;
+  glGetProgramiv(permutation.program, GL_LINK_STATUS, &result);
+  glDetachShader(permutation.program, permutation.vertexShader);
+  glDetachShader(permutation.program, permutation.fragmentShader);
+
+  if (!result) {
+    printShaderLog(permutation.vertexShader, "vertex", permutation.features);
+    printShaderLog(permutation.fragmentShader, "fragment", permutation.features);
+    GLchar errorLog[1024];
+    glGetProgramInfoLog(permutation.program, sizeof(errorLog), NULL, errorLog);
+    cerr << "ERROR: shader program (" << shaderFeatureName(permutation.features) << ") result error\n"
+      << errorLog << endl;
+    // messages are "<source string>:<line>" or "<source string>(<line>)" depending on the driver
+    for (size_t i = 0; i < m_files.size(); ++i)
+      cerr << "  source string " << i << " is " << m_files[i] << endl;
+    glDeleteProgram(permutation.program);
+    permutation.program = 0;
+    return false;
+  }
+
+  ++m_stats.compiled;
+  if (m_cache)
+    m_cache->insert(m_vertexSource.c_str(), permutation.fragmentSource.c_str(), permutation.program);
+  return true;
+}
+
+GLuint ShaderLibrary::program(unsigned features) const
+{
+  for (size_t i = 0; i < m_permutations.size(); ++i)
+    if (m_permutations[i].features == features)
+      return m_permutations[i].program;
+  return 0;
+}
+
+void ShaderLibrary::release()
+{
+  for (size_t i = 0; i < m_permutations.size(); ++i)
+    glDeleteProgram(m_permutations[i].program);
+  m_permutations.clear();
+}
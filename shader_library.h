@@ -0,0 +1,99 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <functional>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+class ShaderCache;
+
+// Feature bits selecting a permutation of a shader pair; each set bit adds
+// "#define FEATURE_<NAME> 1" right after the fragment shader's #version line.
+// The vertex stage is the same for every permutation.
+enum ShaderFeature {
+  FEATURE_HOMOGRAPHY = 1 << 0,
+  FEATURE_YUV_INPUT = 1 << 1,
+  FEATURE_INPUT_16BIT = 1 << 2,
+  FEATURE_LUT_WARP = 1 << 3,
+  FEATURE_COUNT = 4
+};
+
+// Loads GLSL files and expands #include "path" (relative to the including
+// file). Every file is inserted at most once per expansion, so headers need
+// no guards and cycles are harmless. "#line" directives keep compiler
+// messages pointing at the original file and line: the second number is the
+// index into files().
+class ShaderPreprocessor
+{
+public:
+  bool expand(std::string const& path, std::string& out);
+
+  std::vector<std::string> const& files() const { return m_files; }
+  std::string const& error() const { return m_error; }
+
+private:
+  bool expandFile(std::string const& path, std::string& out, std::set<std::string>& included);
+  bool read(std::string const& path, std::string const*& contents);
+
+  std::map<std::string, std::string> m_contents;
+  std::vector<std::string> m_files;
+  std::string m_error;
+};
+
+// returns 'source' with a #define for every feature bit inserted after #version
+std::string applyShaderFeatures(std::string const& source, unsigned features);
+
+// A vertex/fragment pair and the permutations requested from it. compileAll
+// takes whatever it can from the ShaderCache, then issues every remaining
+// compile and link before waiting on any of them, so the driver can work on
+// all of them at once; with GL_KHR/ARB_parallel_shader_compile it is also
+// told to use all its compiler threads and programs are finished in the
+// order they complete.
+class ShaderLibrary
+{
+public:
+  struct Stats {
+    unsigned cached, compiled;
+    double cachedMs, compileMs;
+  };
+
+  ShaderLibrary();
+  ~ShaderLibrary();
+
+  // call with the GL context current; 'cache' may be NULL
+  void init(ShaderCache* cache, std::function<void(GLuint)> const& bindLocations);
+
+  bool load(char const* vertexPath, char const* fragmentPath);
+  void request(unsigned features);
+  bool compileAll();
+
+  // 0 unless the permutation was requested and compiled
+  GLuint program(unsigned features) const;
+
+  Stats const& stats() const { return m_stats; }
+  void release();
+
+private:
+  struct Permutation {
+    unsigned features;
+    GLuint program;
+    GLuint vertexShader, fragmentShader;
+    std::string fragmentSource;
+  };
+
+  bool finish(Permutation& permutation);
+
+  ShaderCache* m_cache;
+  std::function<void(GLuint)> m_bindLocations;
+  bool m_parallel;
+  std::string m_vertexSource, m_fragmentSource;
+  std::vector<std::string> m_files;
+  std::vector<Permutation> m_permutations;
+  Stats m_stats;
+};
+
+// human-readable "homography+lut_warp" style name of a permutation
+std::string shaderFeatureName(unsigned features);
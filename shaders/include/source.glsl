@@ -0,0 +1,37 @@
+// Fetches the source colour as linear-range RGB in [0, 1].
+
+#if defined(FEATURE_YUV_INPUT)
+
+#include "yuv.glsl"
+
+uniform sampler2D uLuma;    // R8, full resolution
+uniform sampler2D uChroma;  // RG8, half resolution, Cb in R and Cr in G
+
+vec3 sampleSource(vec2 uv)
+{
+  return yuvToRgb(texture(uLuma, uv).r, texture(uChroma, uv).rg);
+}
+
+#elif defined(FEATURE_INPUT_16BIT)
+
+// GL_RGB16, normalised like any other texture, read unfiltered: the nearest
+// texel's exact 16-bit value rather than a blend of its neighbours
+uniform sampler2D ourTexture;
+
+vec3 sampleSource(vec2 uv)
+{
+  ivec2 size = textureSize(ourTexture, 0);
+  ivec2 texel = clamp(ivec2(uv * vec2(size)), ivec2(0), size - 1);
+  return texelFetch(ourTexture, texel, 0).rgb;
+}
+
+#else
+
+uniform sampler2D ourTexture;
+
+vec3 sampleSource(vec2 uv)
+{
+  return texture(ourTexture, uv).rgb;
+}
+
+#endif
@@ -0,0 +1,23 @@
+// Texture coordinate remapping: homography first, then the lookup table, so
+// a LUT measured on the rectified image can correct residual distortion.
+
+#ifdef FEATURE_HOMOGRAPHY
+uniform mat3 uHomography;
+#endif
+
+#ifdef FEATURE_LUT_WARP
+// RG32F, one source coordinate per output texel
+uniform sampler2D uWarpLut;
+#endif
+
+vec2 warpCoord(vec2 uv)
+{
+#ifdef FEATURE_HOMOGRAPHY
+  vec3 projected = uHomography * vec3(uv, 1.0);
+  uv = projected.xy / projected.z;
+#endif
+#ifdef FEATURE_LUT_WARP
+  uv = texture(uWarpLut, uv).rg;
+#endif
+  return uv;
+}
@@ -0,0 +1,18 @@
+// BT.709 limited-range Y'CbCr to R'G'B'.
+
+vec3 yuvToRgb(float y, vec2 cbcr)
+{
+  y = (y - 16.0 / 255.0) * (255.0 / 219.0);
+  cbcr = (cbcr - 128.0 / 255.0) * (255.0 / 224.0);
+  return clamp(vec3(y + 1.5748 * cbcr.y,
+                    y - 0.1873 * cbcr.x - 0.4681 * cbcr.y,
+                    y + 1.8556 * cbcr.x), 0.0, 1.0);
+}
+
+// and back, as Y, Cb, Cr
+vec3 rgbToYuv(vec3 rgb)
+{
+  float y = dot(rgb, vec3(0.2126, 0.7152, 0.0722));
+  vec2 cbcr = vec2((rgb.b - y) / 1.8556, (rgb.r - y) / 1.5748);
+  return vec3(y * (219.0 / 255.0) + 16.0 / 255.0, cbcr * (224.0 / 255.0) + 128.0 / 255.0);
+}
@@ -0,0 +1,27 @@
+#version 330 core
+
+// Packs a rendered frame into the NV12 planes Nv12Readback reads back. Drawn
+// once per plane over a target of that plane's size: uPlane 0 writes luma at
+// full resolution to an R8 target, 1 writes Cb and Cr at half resolution to
+// an RG8 one. Rows are flipped on the way, so glReadPixels returns the image
+// top down as encoders expect.
+
+#include "include/yuv.glsl"
+
+uniform sampler2D uFrame;
+uniform int uPlane;
+out vec4 outColor;
+
+void main()
+{
+  vec2 size = vec2(textureSize(uFrame, 0));
+  if (uPlane == 0) {
+    vec2 texel = vec2(gl_FragCoord.x, size.y - gl_FragCoord.y);
+    outColor = vec4(rgbToYuv(texture(uFrame, texel / size).rgb).x, 0.0, 0.0, 1.0);
+  } else {
+    // the centre of this sample's 2x2 block, where linear filtering averages
+    // all four pixels; past an odd edge it clamps to the last one
+    vec2 texel = vec2(gl_FragCoord.x * 2.0, size.y - gl_FragCoord.y * 2.0);
+    outColor = vec4(rgbToYuv(texture(uFrame, texel / size).rgb).yz, 0.0, 1.0);
+  }
+}
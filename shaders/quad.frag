@@ -0,0 +1,21 @@
+#version 330 core
+
+// Samples the source image through an optional geometric warp and colour
+// decode. Permutations are selected by FEATURE_* defines injected after the
+// #version line (see shader_library.h):
+//   FEATURE_HOMOGRAPHY   projective remap of the texture coordinates
+//   FEATURE_LUT_WARP     per-pixel remap from a coordinate lookup texture
+//   FEATURE_YUV_INPUT    NV12 luma + interleaved chroma planes, BT.709
+//   FEATURE_INPUT_16BIT  GL_RGB16 texture read at the nearest texel, unfiltered
+
+#include "include/warp.glsl"
+#include "include/source.glsl"
+
+in vec3 Color;
+in vec2 TexCoord;
+out vec4 outColor;
+
+void main()
+{
+  outColor = vec4(sampleSource(warpCoord(TexCoord)) * Color, 1.0);
+}
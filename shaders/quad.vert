@@ -0,0 +1,16 @@
+#version 330 core
+
+// Textured quad; attribute locations are bound by the application so every
+// permutation shares one vertex array layout.
+in vec3 aPos;
+in vec3 aColor;
+in vec2 aTexCoord;
+out vec3 Color;
+out vec2 TexCoord;
+
+void main()
+{
+  gl_Position = vec4(aPos, 1.0F);
+  Color = aColor;
+  TexCoord = aTexCoord;
+}
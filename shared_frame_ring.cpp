@@ -0,0 +1,390 @@
+#include "shared_frame_ring.h"
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <string>
+#include <thread>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#endif
+
+using namespace std;
+
+namespace {
+
+typedef chrono::steady_clock Clock;
+
+const uint32_t kMagic = 0x474E5253;  // "SRNG" little endian
+const uint32_t kVersion = 1;
+const size_t kPageSize = 4096;
+const uint32_t kMaxDimension = 1 << 16;
+
+size_t roundUp(size_t size, size_t alignment)
+{
+  return (size + alignment - 1) / alignment * alignment;
+}
+
+size_t frameBytes(uint32_t width, uint32_t height, uint32_t format)
+{
+  return format == SHARED_FRAME_NV12
+    ? size_t(width) * height + size_t((width + 1) / 2) * ((height + 1) / 2) * 2
+    : size_t(width) * height * 4;
+}
+
+// Sleeps while 'word' still holds 'expected', for at most timeoutMs (< 0
+// forever); may return early. The futex isn't FUTEX_PRIVATE, the other side
+// is another process.
+void sleepOn(atomic<uint32_t>& word, uint32_t expected, int timeoutMs, void* event)
+{
+#if defined(__linux__)
+  (void)event;
+  timespec timeout;
+  timeout.tv_sec = timeoutMs / 1000;
+  timeout.tv_nsec = long(timeoutMs % 1000) * 1000000;
+  syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT, expected, timeoutMs < 0 ? NULL : &timeout,
+    NULL, 0);
+#elif defined(_WIN32)
+  WaitForSingleObject(event, timeoutMs < 0 ? INFINITE : DWORD(timeoutMs));
+#else
+  (void)word, (void)expected, (void)timeoutMs, (void)event;
+  this_thread::sleep_for(chrono::microseconds(100));
+#endif
+}
+
+void wake(atomic<uint32_t>& word, void* event)
+{
+#if defined(__linux__)
+  (void)event;
+  syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE, 1, NULL, NULL, 0);
+#elif defined(_WIN32)
+  SetEvent(event);
+#else
+  (void)word, (void)event;
+#endif
+}
+
+// Waits until ready(word) for at most timeoutMs (0 only checks, < 0
+// forever). The waiter raises its flag before it rereads the counter and the
+// other side moves the counter before it looks at the flag, with a full
+// fence on both sides, so one of them always sees the other.
+template <class Ready>
+bool waitFor(atomic<uint32_t>& word, atomic<uint32_t>& waiting, int timeoutMs, void* event, Ready ready,
+  unsigned long long& waits)
+{
+  if (ready(word.load(memory_order_acquire)))
+    return true;
+  if (timeoutMs == 0)
+    return false;
+
+  Clock::time_point deadline = Clock::now() + chrono::milliseconds(timeoutMs);
+  bool done = false;
+  for (;;) {
+    waiting.store(1);
+    uint32_t observed = word.load();
+    if (ready(observed)) {
+      done = true;
+      break;
+    }
+    int remaining = -1;
+    if (timeoutMs > 0) {
+      Clock::time_point now = Clock::now();
+      if (now >= deadline)
+        break;
+      remaining = int(chrono::duration_cast<chrono::milliseconds>(deadline - now).count()) + 1;
+    }
+    ++waits;
+    sleepOn(word, observed, remaining, event);
+  }
+  // one waiter per flag, so it can lower its own
+  waiting.store(0, memory_order_relaxed);
+  return done;
+}
+
+void notify(atomic<uint32_t>& word, atomic<uint32_t>& waiting, void* event)
+{
+  atomic_thread_fence(memory_order_seq_cst);
+  if (waiting.load(memory_order_relaxed) && waiting.exchange(0))
+    wake(word, event);
+}
+
+} // namespace
+
+// At the start of the mapping. Each counter has a cache line of its own so
+// the two sides don't keep stealing one line from each other.
+struct SharedFrameRing::Header {
+  atomic<uint32_t> magic;  // kMagic once create() has filled in the rest
+  uint32_t version;
+  uint32_t width, height, format, slotCount;
+  uint64_t frameSize, slotSize, dataOffset, mappingSize;
+
+  alignas(64) atomic<uint32_t> head;  // slots published
+  atomic<uint32_t> consumerWaiting;
+  alignas(64) atomic<uint32_t> tail;  // slots given back
+  atomic<uint32_t> producerWaiting;
+
+  // written before the slot is published
+  struct SlotInfo {
+    uint64_t sequence;
+    int64_t timestampNs;
+  };
+  alignas(64) SlotInfo slots[kMaxSlots];
+};
+
+SharedFrameRing::SharedFrameRing()
+  : m_header(NULL), m_mapping(NULL), m_mappingSize(0), m_producer(false), m_position(0), m_sequence(0), m_stats()
+{
+  m_events[0] = m_events[1] = NULL;
+#ifdef _WIN32
+  m_file = NULL;
+#else
+  m_name[0] = 0;
+#endif
+}
+
+SharedFrameRing::~SharedFrameRing()
+{
+  close();
+}
+
+bool SharedFrameRing::create(char const* name, int width, int height, SharedFrameFormat format, int slotCount)
+{
+  close();
+  if (width <= 0 || height <= 0 || slotCount < 1 || slotCount > kMaxSlots || (slotCount & (slotCount - 1))) {
+    cerr << "Error: can't create a " << slotCount << " slot ring of " << width << "x" << height << " frames" << endl;
+    return false;
+  }
+
+  size_t frameSize = frameBytes(width, height, format);
+  // page-aligned slots can back a pinned GL buffer
+  size_t slotSize = roundUp(frameSize, kPageSize), dataOffset = roundUp(sizeof(Header), kPageSize);
+  size_t size = dataOffset + slotSize * slotCount;
+  if (!map(name, size, true))
+    return false;
+
+  m_header = new (m_mapping) Header();
+  m_header->version = kVersion;
+  m_header->width = width;
+  m_header->height = height;
+  m_header->format = format;
+  m_header->slotCount = slotCount;
+  m_header->frameSize = frameSize;
+  m_header->slotSize = slotSize;
+  m_header->dataOffset = dataOffset;
+  m_header->mappingSize = size;
+  m_header->magic.store(kMagic, memory_order_release);
+
+  m_producer = true;
+  m_position = 0;
+  m_sequence = 0;
+  m_stats = Stats();
+  return true;
+}
+
+bool SharedFrameRing::open(char const* name)
+{
+  close();
+  if (!map(name, 0, false))
+    return false;
+
+  Header* header = reinterpret_cast<Header*>(m_mapping);
+  if (m_mappingSize < sizeof(Header) || header->magic.load(memory_order_acquire) != kMagic
+    || header->version != kVersion || header->mappingSize > m_mappingSize) {
+    cerr << "Error: shared frame ring " << name << " isn't ready" << endl;
+    close();
+    return false;
+  }
+
+  // everything slot() and the uploads rely on comes from the other process
+  uint32_t slotCount = header->slotCount;
+  bool valid = header->width > 0 && header->width <= kMaxDimension && header->height > 0
+    && header->height <= kMaxDimension && (header->format == SHARED_FRAME_RGBA8 || header->format == SHARED_FRAME_NV12)
+    && slotCount >= 1 && slotCount <= uint32_t(kMaxSlots) && (slotCount & (slotCount - 1)) == 0
+    && header->frameSize == frameBytes(header->width, header->height, header->format)
+    && header->frameSize <= header->slotSize && header->dataOffset >= sizeof(Header)
+    && header->dataOffset <= m_mappingSize && header->slotSize <= (m_mappingSize - header->dataOffset) / slotCount;
+  if (!valid) {
+    cerr << "Error: shared frame ring " << name << " has a corrupt header" << endl;
+    close();
+    return false;
+  }
+
+  m_header = header;
+  m_producer = false;
+  m_position = m_header->tail.load(memory_order_acquire);
+  m_stats = Stats();
+  return true;
+}
+
+void SharedFrameRing::close()
+{
+  // a consumer left waiting has its timeout to fall back on
+#ifdef _WIN32
+  for (int i = 0; i < 2; ++i)
+    if (m_events[i]) {
+      CloseHandle(m_events[i]);
+      m_events[i] = NULL;
+    }
+  if (m_mapping)
+    UnmapViewOfFile(m_mapping);
+  if (m_file)
+    CloseHandle(m_file);
+  m_file = NULL;
+#else
+  if (m_mapping)
+    munmap(m_mapping, m_mappingSize);
+  if (m_producer && m_name[0])
+    shm_unlink(m_name);
+  m_name[0] = 0;
+#endif
+  m_header = NULL;
+  m_mapping = NULL;
+  m_mappingSize = 0;
+  m_producer = false;
+}
+
+unsigned char* SharedFrameRing::beginWrite(int timeoutMs)
+{
+  Header* header = m_header;
+  unsigned position = m_position;
+  bool room = waitFor(header->tail, header->producerWaiting, timeoutMs, m_events[1],
+    [&](uint32_t tail) { return position - tail < header->slotCount; }, m_stats.waits);
+  return room ? slot(position) : NULL;
+}
+
+void SharedFrameRing::publish()
+{
+  Header::SlotInfo& info = m_header->slots[m_position & (m_header->slotCount - 1)];
+  info.sequence = m_sequence++;
+  info.timestampNs = chrono::duration_cast<chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+  m_header->head.store(++m_position, memory_order_release);
+  ++m_stats.frames;
+  notify(m_header->head, m_header->consumerWaiting, m_events[0]);
+}
+
+bool SharedFrameRing::acquire(Frame& frame, int timeoutMs)
+{
+  Header* header = m_header;
+  unsigned position = m_position;
+  if (!waitFor(header->head, header->consumerWaiting, timeoutMs, m_events[0],
+      [&](uint32_t head) { return head != position; }, m_stats.waits))
+    return false;
+
+  Header::SlotInfo const& info = header->slots[position & (header->slotCount - 1)];
+  frame.data = slot(position);
+  frame.sequence = info.sequence;
+  frame.timestampNs = info.timestampNs;
+  ++m_position;
+  ++m_stats.frames;
+  return true;
+}
+
+bool SharedFrameRing::hasFrame() const
+{
+  return m_header->head.load(memory_order_acquire) != m_position;
+}
+
+void SharedFrameRing::release()
+{
+  m_header->tail.store(m_header->tail.load(memory_order_relaxed) + 1, memory_order_release);
+  notify(m_header->tail, m_header->producerWaiting, m_events[1]);
+}
+
+int SharedFrameRing::width() const { return int(m_header->width); }
+int SharedFrameRing::height() const { return int(m_header->height); }
+SharedFrameFormat SharedFrameRing::format() const { return SharedFrameFormat(m_header->format); }
+int SharedFrameRing::slotCount() const { return int(m_header->slotCount); }
+size_t SharedFrameRing::frameSize() const { return size_t(m_header->frameSize); }
+
+unsigned char* SharedFrameRing::slot(unsigned position) const
+{
+  return m_mapping + m_header->dataOffset + size_t(position & (m_header->slotCount - 1)) * m_header->slotSize;
+}
+
+// maps the named shared memory, creating it 'size' bytes long or opening it
+// at whatever size it has
+bool SharedFrameRing::map(char const* name, size_t size, bool create)
+{
+#ifdef _WIN32
+  // a named mapping lives as long as a handle to it does, so one that
+  // already exists belongs to a live producer
+  string object = string("Local\\") + name;
+  if (create) {
+    m_file = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, DWORD(uint64_t(size) >> 32), DWORD(size),
+      object.c_str());
+    if (m_file && GetLastError() == ERROR_ALREADY_EXISTS) {
+      CloseHandle(m_file);
+      m_file = NULL;
+    }
+  } else {
+    m_file = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, object.c_str());
+  }
+  if (m_file)
+    m_mapping = static_cast<unsigned char*>(MapViewOfFile(m_file, FILE_MAP_ALL_ACCESS, 0, 0, 0));
+  MEMORY_BASIC_INFORMATION region;
+  if (m_mapping && VirtualQuery(m_mapping, &region, sizeof(region)))
+    m_mappingSize = region.RegionSize;
+  // auto-reset events, one per counter; whichever side comes first creates them
+  m_events[0] = CreateEventA(NULL, FALSE, FALSE, (object + ".head").c_str());
+  m_events[1] = CreateEventA(NULL, FALSE, FALSE, (object + ".tail").c_str());
+  if (!m_mapping || !m_mappingSize || !m_events[0] || !m_events[1]) {
+    cerr << "Error: can't " << (create ? "create" : "open") << " shared memory " << name << endl;
+    close();
+    return false;
+  }
+  return true;
+#else
+  snprintf(m_name, sizeof(m_name), "/%s", name);
+  int file;
+  if (create) {
+    shm_unlink(m_name);
+    file = shm_open(m_name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (file >= 0 && ftruncate(file, off_t(size)) != 0) {
+      ::close(file);
+      file = -1;
+    }
+  } else {
+    file = shm_open(m_name, O_RDWR, 0);
+    struct stat status;
+    if (file >= 0 && fstat(file, &status) == 0)
+      size = size_t(status.st_size);
+  }
+  if (file >= 0 && size) {
+    void* mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+    if (mapping != MAP_FAILED) {
+      m_mapping = static_cast<unsigned char*>(mapping);
+      m_mappingSize = size;
+    }
+  }
+  if (file >= 0)
+    ::close(file);
+  // only the producer removes the name again
+  m_producer = create;
+  if (!m_mapping) {
+    cerr << "Error: can't " << (create ? "create" : "open") << " shared memory " << name << ": " << strerror(errno)
+      << endl;
+    close();
+    return false;
+  }
+  return true;
+#endif
+}
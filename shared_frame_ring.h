@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstddef>
+
+enum SharedFrameFormat {
+  SHARED_FRAME_RGBA8,
+  SHARED_FRAME_NV12  // Y plane, then Cb and Cr interleaved at half resolution
+};
+
+// Hands frames from a capture process to the renderer through shared memory
+// (shm_open on POSIX, a named file mapping on Windows) without copying them
+// on the way. The mapping holds a header and a ring of frame slots with one
+// producer and one consumer: the producer fills the slot at 'head' and
+// publishes it by advancing head, the consumer reads slots from 'tail' on and
+// gives each back by advancing tail. Both counters only ever grow and each is
+// written by one side, so neither side takes a lock.
+//
+// A side that has to wait (ring full, or empty) raises a flag and sleeps on
+// the other side's counter: a futex on Linux, a named event on Windows, short
+// sleeps elsewhere. The other side only makes the wake up system call when
+// the flag is up, so a ring that never runs full or empty costs no system
+// calls at all.
+class SharedFrameRing
+{
+public:
+  static const int kMaxSlots = 64;
+
+  struct Frame {
+    unsigned char* data;          // frameSize() bytes, valid until released
+    unsigned long long sequence;  // 0, 1, 2 ... in publishing order
+    long long timestampNs;        // the producer's steady_clock at publish()
+  };
+
+  struct Stats {
+    unsigned long long frames;  // published or acquired, by this side
+    unsigned long long waits;   // times this side had to sleep
+  };
+
+  SharedFrameRing();
+  ~SharedFrameRing();
+
+  // Producer: creates the named ring, replacing any left behind by a
+  // producer that died. slotCount is a power of two up to kMaxSlots, so
+  // slot indices survive the counters wrapping around.
+  bool create(char const* name, int width, int height, SharedFrameFormat format, int slotCount);
+
+  // consumer: attaches to a ring its producer has finished creating
+  bool open(char const* name);
+
+  void close();
+  bool isOpen() const { return m_header != NULL; }
+
+  // Producer: the next slot to fill, waiting up to timeoutMs (< 0 forever)
+  // while the ring is full; NULL if it stayed full.
+  unsigned char* beginWrite(int timeoutMs);
+  void publish();
+
+  // Consumer: the oldest frame not yet acquired, waiting up to timeoutMs
+  // (0 only polls, < 0 waits forever) while there is none.
+  bool acquire(Frame& frame, int timeoutMs);
+
+  // consumer: whether acquire() would return a frame without waiting
+  bool hasFrame() const;
+
+  // consumer: gives back the oldest acquired frame's slot
+  void release();
+
+  int width() const;
+  int height() const;
+  SharedFrameFormat format() const;
+  int slotCount() const;
+  std::size_t frameSize() const;
+
+  // the whole mapping, with every slot inside it at a page-aligned offset
+  unsigned char* mapping() const { return m_mapping; }
+  std::size_t mappingSize() const { return m_mappingSize; }
+
+  Stats const& stats() const { return m_stats; }
+
+private:
+  struct Header;
+
+  bool map(char const* name, std::size_t size, bool create);
+  unsigned char* slot(unsigned position) const;
+
+  Header* m_header;
+  unsigned char* m_mapping;
+  std::size_t m_mappingSize;
+  bool m_producer;
+  unsigned m_position;  // head or tail position of the next slot to fill or acquire
+  unsigned long long m_sequence;
+  Stats m_stats;
+
+  void* m_events[2];  // Windows: named events for head and tail moving
+#ifdef _WIN32
+  void* m_file;
+#else
+  char m_name[256];   // shm_unlink()ed again by the producer
+#endif
+};
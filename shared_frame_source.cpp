@@ -0,0 +1,202 @@
+#include "shared_frame_source.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+using namespace std;
+
+namespace {
+
+typedef chrono::steady_clock Clock;
+
+GLuint createTexture(GLint internalFormat, GLenum format, int width, int height)
+{
+  GLuint texture;
+  glGenTextures(1, &texture);
+  glBindTexture(GL_TEXTURE_2D, texture);
+  glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, GL_UNSIGNED_BYTE, NULL);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  return texture;
+}
+
+} // namespace
+
+SharedFrameSource::SharedFrameSource()
+  : m_buffer(0), m_current(-1), m_stats()
+{
+  for (int i = 0; i < kTextureRing; ++i)
+    m_textures[i][0] = m_textures[i][1] = 0;
+}
+
+SharedFrameSource::~SharedFrameSource()
+{
+  close();
+}
+
+bool SharedFrameSource::open(char const* name)
+{
+  close();
+  if (!m_ring.open(name))
+    return false;
+
+  // the mapping is page aligned and stays put until close(), which is all
+  // AMD_pinned_memory asks
+  if (GLEW_AMD_pinned_memory) {
+    // earlier errors would look like this one failing
+    while (glGetError() != GL_NO_ERROR) {
+    }
+    glGenBuffers(1, &m_buffer);
+    glBindBuffer(GL_EXTERNAL_VIRTUAL_MEMORY_BUFFER_AMD, m_buffer);
+    glBufferData(GL_EXTERNAL_VIRTUAL_MEMORY_BUFFER_AMD, m_ring.mappingSize(), m_ring.mapping(), GL_STREAM_READ);
+    glBindBuffer(GL_EXTERNAL_VIRTUAL_MEMORY_BUFFER_AMD, 0);
+    if (glGetError() != GL_NO_ERROR) {
+      glDeleteBuffers(1, &m_buffer);
+      m_buffer = 0;
+    }
+  }
+
+  int width = m_ring.width(), height = m_ring.height();
+  for (int i = 0; i < kTextureRing; ++i) {
+    if (yuv()) {
+      m_textures[i][0] = createTexture(GL_R8, GL_RED, width, height);
+      m_textures[i][1] = createTexture(GL_RG8, GL_RG, (width + 1) / 2, (height + 1) / 2);
+    } else {
+      m_textures[i][0] = createTexture(GL_RGBA8, GL_RGBA, width, height);
+    }
+  }
+
+  m_current = -1;
+  m_stats = Stats();
+  return true;
+}
+
+void SharedFrameSource::close()
+{
+  // hands every slot back, once the GPU is done with them, so the producer
+  // carries on for whoever attaches next
+  if (!m_pending.empty() && m_buffer)
+    glFinish();
+  for (size_t i = 0; i < m_pending.size(); ++i) {
+    if (m_pending[i])
+      glDeleteSync(m_pending[i]);
+    m_ring.release();
+  }
+  m_pending.clear();
+  for (int i = 0; i < kTextureRing; ++i)
+    for (int plane = 0; plane < 2; ++plane)
+      if (m_textures[i][plane]) {
+        glDeleteTextures(1, &m_textures[i][plane]);
+        m_textures[i][plane] = 0;
+      }
+  // before the memory behind it is unmapped
+  if (m_buffer) {
+    glDeleteBuffers(1, &m_buffer);
+    m_buffer = 0;
+  }
+  m_ring.close();
+  m_current = -1;
+}
+
+bool SharedFrameSource::update()
+{
+  TRACE_ZONE("SharedFrameSource::update");
+  if (!isOpen())
+    return false;
+  retire();
+
+  // everything published since the last call; only the newest is shown
+  SharedFrameRing::Frame frame, next;
+  bool got = false;
+  while (m_ring.acquire(next, 0)) {
+    if (got) {
+      m_pending.push_back(NULL);
+      ++m_stats.dropped;
+    }
+    frame = next;
+    got = true;
+  }
+  if (got)
+    upload(frame);
+  retire();
+  return m_current >= 0;
+}
+
+bool SharedFrameSource::frameWaiting()
+{
+  if (!isOpen())
+    return false;
+  retire();
+  return m_ring.hasFrame();
+}
+
+void SharedFrameSource::bind() const
+{
+  if (m_current < 0)
+    return;
+  if (yuv()) {
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, m_textures[m_current][1]);
+    glActiveTexture(GL_TEXTURE0);
+  }
+  glBindTexture(GL_TEXTURE_2D, m_textures[m_current][0]);
+}
+
+void SharedFrameSource::upload(SharedFrameRing::Frame const& frame)
+{
+  TRACE_ZONE("uploadSharedFrame");
+  Clock::time_point start = Clock::now();
+  int width = m_ring.width(), height = m_ring.height();
+
+  // with the pinned buffer bound the data pointers are offsets into the mapping
+  unsigned char const* source = m_buffer
+    ? reinterpret_cast<unsigned char const*>(frame.data - m_ring.mapping()) : frame.data;
+  int next = (m_current + 1) % kTextureRing;
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_buffer);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glBindTexture(GL_TEXTURE_2D, m_textures[next][0]);
+  if (yuv()) {
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RED, GL_UNSIGNED_BYTE, source);
+    glBindTexture(GL_TEXTURE_2D, m_textures[next][1]);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, (width + 1) / 2, (height + 1) / 2, GL_RG, GL_UNSIGNED_BYTE,
+      source + size_t(width) * height);
+  } else {
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, source);
+  }
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  m_current = next;
+
+  // the swap at the end of the frame flushes the fence
+  m_pending.push_back(m_buffer ? glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0) : NULL);
+
+  ++m_stats.shown;
+  m_stats.uploadMs += chrono::duration<double, milli>(Clock::now() - start).count();
+  long long nowNs = chrono::duration_cast<chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+  double latencyMs = (nowNs - frame.timestampNs) / 1e6;
+  m_stats.latencyMs += latencyMs;
+  m_stats.maxLatencyMs = max(m_stats.maxLatencyMs, latencyMs);
+}
+
+// gives slots back in the order they were acquired, as far as their uploads
+// have finished
+void SharedFrameSource::retire()
+{
+  while (!m_pending.empty()) {
+    GLsync fence = m_pending.front();
+    if (fence) {
+      GLenum status = glClientWaitSync(fence, 0, 0);
+      if (status == GL_TIMEOUT_EXPIRED)
+        break;
+      if (status == GL_WAIT_FAILED)
+        cerr << "Error: waiting on a shared frame upload fence failed" << endl;
+      glDeleteSync(fence);
+    }
+    m_ring.release();
+    m_pending.pop_front();
+  }
+}
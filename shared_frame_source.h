@@ -0,0 +1,61 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <deque>
+
+#include "shared_frame_ring.h"
+
+// Shows frames from a capture process's SharedFrameRing, the newest one
+// published each time update() is called; frames overtaken in between are
+// given straight back unseen. Uploads read the producer's slots where they
+// are: with GL_AMD_pinned_memory the whole mapping becomes a pixel unpack
+// buffer the GPU copies from, and a slot goes back to the producer once the
+// fence after its upload has passed; otherwise glTexSubImage2D reads the
+// mapping and the driver has its copy when the call returns. RGBA frames go
+// to texture unit 0, NV12 to units 0 and 1 as FEATURE_YUV_INPUT samples them.
+class SharedFrameSource
+{
+public:
+  static const int kTextureRing = 3;
+
+  struct Stats {
+    unsigned shown, dropped;
+    double uploadMs;
+    double latencyMs, maxLatencyMs;  // publish to upload, summed over 'shown'
+  };
+
+  SharedFrameSource();
+  ~SharedFrameSource();
+
+  // with the GL context current
+  bool open(char const* name);
+  void close();
+  bool isOpen() const { return m_ring.isOpen(); }
+  bool yuv() const { return m_ring.format() == SHARED_FRAME_NV12; }
+
+  // render thread, once per frame, never blocks; false until the first frame
+  bool update();
+  void bind() const;
+
+  // Render thread, never blocks: gives back slots whose uploads have
+  // finished and says whether update() has a new frame to show.
+  bool frameWaiting();
+
+  int width() const { return m_ring.width(); }
+  int height() const { return m_ring.height(); }
+  Stats const& stats() const { return m_stats; }
+
+private:
+  void upload(SharedFrameRing::Frame const& frame);
+  void retire();
+
+  SharedFrameRing m_ring;
+  GLuint m_buffer;  // the pinned mapping, or 0
+  GLuint m_textures[kTextureRing][2];  // RGBA or luma, chroma
+  int m_current;
+  // acquired frames in order, each with the fence of its upload if the GPU
+  // still has to read the slot
+  std::deque<GLsync> m_pending;
+  Stats m_stats;
+};
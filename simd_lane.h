@@ -0,0 +1,236 @@
+#pragma once
+
+#include <cmath>
+#include <cstring>
+
+#include "cpu_features.h"
+
+#ifdef SIMD_X86
+#include <immintrin.h>
+#endif
+
+// One SIMD register of floats per instruction set, behind the same small
+// interface, so a batch kernel can be written once against 'Lane' and built
+// for every level:
+//
+//   SIMD_BEGIN_TARGET_AVX2
+//   namespace avx2 {
+//   typedef LaneAVX2 Lane;
+//   #include "my_kernels.inl"
+//   }
+//   SIMD_END_TARGET
+//
+// load/store are aligned, loadu/storeu not; kWidth floats per register. I is
+// the matching vector of 32-bit ints and M the result of a comparison, which
+// select() consumes. storeBytes writes the low byte of each int lane, for
+// values already in [0, 255].
+
+struct LaneScalar
+{
+  typedef float V;
+  typedef int I;
+  static const int kWidth = 1;
+
+  static V load(float const* p) { return *p; }
+  static void store(float* p, V v) { *p = v; }
+  static V set1(float f) { return f; }
+  static V add(V a, V b) { return a + b; }
+  static V sub(V a, V b) { return a - b; }
+  static V mul(V a, V b) { return a * b; }
+  static V div(V a, V b) { return a / b; }
+  static V fma(V a, V b, V c) { return a * b + c; }
+  static V fms(V a, V b, V c) { return a * b - c; }
+  static V rcp(V a) { return 1.0f / a; }
+  static V sqrt(V a) { return std::sqrt(a); }
+  static V min(V a, V b) { return a < b ? a : b; }
+  static V max(V a, V b) { return a > b ? a : b; }
+
+  static V loadu(float const* p) { return *p; }
+  static void storeu(float* p, V v) { *p = v; }
+
+  typedef bool M;
+  static M lt(V a, V b) { return a < b; }
+  static M le(V a, V b) { return a <= b; }
+  static M eq(V a, V b) { return a == b; }
+  static M eqInt(I a, I b) { return a == b; }
+  static M orMask(M a, M b) { return a || b; }
+  static V select(M m, V a, V b) { return m ? a : b; }
+
+  static V bitXor(V a, V b) { return asFloat(asInt(a) ^ asInt(b)); }
+  static V bitAnd(V a, V b) { return asFloat(asInt(a) & asInt(b)); }
+
+  static I roundToInt(V a) { return I(std::lrint(a)); }
+  static V toFloat(I a) { return V(a); }
+  static I asInt(V a) { I i; std::memcpy(&i, &a, sizeof(i)); return i; }
+  static V asFloat(I a) { V f; std::memcpy(&f, &a, sizeof(f)); return f; }
+  static void storeBytes(unsigned char* p, I a) { *p = (unsigned char)a; }
+  static I set1Int(int i) { return i; }
+  static I addInt(I a, I b) { return a + b; }
+  static I subInt(I a, I b) { return a - b; }
+  static I andInt(I a, I b) { return a & b; }
+  template<int n> static I shl(I a) { return I(unsigned(a) << n); }
+  template<int n> static I shr(I a) { return I(unsigned(a) >> n); }
+  template<int n> static I sar(I a) { return a >> n; }
+};
+
+#ifdef SIMD_X86
+SIMD_BEGIN_TARGET_SSE2
+struct LaneSSE2
+{
+  typedef __m128 V;
+  typedef __m128i I;
+  static const int kWidth = 4;
+
+  static V load(float const* p) { return _mm_load_ps(p); }
+  static void store(float* p, V v) { _mm_store_ps(p, v); }
+  static V set1(float f) { return _mm_set1_ps(f); }
+  static V add(V a, V b) { return _mm_add_ps(a, b); }
+  static V sub(V a, V b) { return _mm_sub_ps(a, b); }
+  static V mul(V a, V b) { return _mm_mul_ps(a, b); }
+  static V div(V a, V b) { return _mm_div_ps(a, b); }
+  static V fma(V a, V b, V c) { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+  static V fms(V a, V b, V c) { return _mm_sub_ps(_mm_mul_ps(a, b), c); }
+  static V rcp(V a) { return _mm_rcp_ps(a); } // 12 bits
+  static V sqrt(V a) { return _mm_sqrt_ps(a); }
+  static V min(V a, V b) { return _mm_min_ps(a, b); }
+  static V max(V a, V b) { return _mm_max_ps(a, b); }
+
+  static V loadu(float const* p) { return _mm_loadu_ps(p); }
+  static void storeu(float* p, V v) { _mm_storeu_ps(p, v); }
+
+  typedef __m128 M;
+  static M lt(V a, V b) { return _mm_cmplt_ps(a, b); }
+  static M le(V a, V b) { return _mm_cmple_ps(a, b); }
+  static M eq(V a, V b) { return _mm_cmpeq_ps(a, b); }
+  static M eqInt(I a, I b) { return _mm_castsi128_ps(_mm_cmpeq_epi32(a, b)); }
+  static M orMask(M a, M b) { return _mm_or_ps(a, b); }
+  static V select(M m, V a, V b) { return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b)); }
+
+  static V bitXor(V a, V b) { return _mm_xor_ps(a, b); }
+  static V bitAnd(V a, V b) { return _mm_and_ps(a, b); }
+
+  static I roundToInt(V a) { return _mm_cvtps_epi32(a); } // nearest, under the default MXCSR
+  static V toFloat(I a) { return _mm_cvtepi32_ps(a); }
+  static I asInt(V a) { return _mm_castps_si128(a); }
+  static V asFloat(I a) { return _mm_castsi128_ps(a); }
+  static void storeBytes(unsigned char* p, I a)
+  {
+    __m128i w = _mm_packs_epi32(a, a);
+    int four = _mm_cvtsi128_si32(_mm_packus_epi16(w, w));
+    std::memcpy(p, &four, sizeof(four));
+  }
+  static I set1Int(int i) { return _mm_set1_epi32(i); }
+  static I addInt(I a, I b) { return _mm_add_epi32(a, b); }
+  static I subInt(I a, I b) { return _mm_sub_epi32(a, b); }
+  static I andInt(I a, I b) { return _mm_and_si128(a, b); }
+  template<int n> static I shl(I a) { return _mm_slli_epi32(a, n); }
+  template<int n> static I shr(I a) { return _mm_srli_epi32(a, n); }
+  template<int n> static I sar(I a) { return _mm_srai_epi32(a, n); }
+};
+SIMD_END_TARGET
+
+SIMD_BEGIN_TARGET_AVX2
+struct LaneAVX2
+{
+  typedef __m256 V;
+  typedef __m256i I;
+  static const int kWidth = 8;
+
+  static V load(float const* p) { return _mm256_load_ps(p); }
+  static void store(float* p, V v) { _mm256_store_ps(p, v); }
+  static V set1(float f) { return _mm256_set1_ps(f); }
+  static V add(V a, V b) { return _mm256_add_ps(a, b); }
+  static V sub(V a, V b) { return _mm256_sub_ps(a, b); }
+  static V mul(V a, V b) { return _mm256_mul_ps(a, b); }
+  static V div(V a, V b) { return _mm256_div_ps(a, b); }
+  static V fma(V a, V b, V c) { return _mm256_fmadd_ps(a, b, c); }
+  static V fms(V a, V b, V c) { return _mm256_fmsub_ps(a, b, c); }
+  static V rcp(V a) { return _mm256_rcp_ps(a); } // 12 bits
+  static V sqrt(V a) { return _mm256_sqrt_ps(a); }
+  static V min(V a, V b) { return _mm256_min_ps(a, b); }
+  static V max(V a, V b) { return _mm256_max_ps(a, b); }
+
+  static V loadu(float const* p) { return _mm256_loadu_ps(p); }
+  static void storeu(float* p, V v) { _mm256_storeu_ps(p, v); }
+
+  typedef __m256 M;
+  static M lt(V a, V b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+  static M le(V a, V b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+  static M eq(V a, V b) { return _mm256_cmp_ps(a, b, _CMP_EQ_OQ); }
+  static M eqInt(I a, I b) { return _mm256_castsi256_ps(_mm256_cmpeq_epi32(a, b)); }
+  static M orMask(M a, M b) { return _mm256_or_ps(a, b); }
+  static V select(M m, V a, V b) { return _mm256_blendv_ps(b, a, m); }
+
+  static V bitXor(V a, V b) { return _mm256_xor_ps(a, b); }
+  static V bitAnd(V a, V b) { return _mm256_and_ps(a, b); }
+
+  static I roundToInt(V a) { return _mm256_cvtps_epi32(a); }
+  static V toFloat(I a) { return _mm256_cvtepi32_ps(a); }
+  static I asInt(V a) { return _mm256_castps_si256(a); }
+  static V asFloat(I a) { return _mm256_castsi256_ps(a); }
+  static void storeBytes(unsigned char* p, I a)
+  {
+    __m128i w = _mm_packs_epi32(_mm256_castsi256_si128(a), _mm256_extracti128_si256(a, 1));
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(p), _mm_packus_epi16(w, w));
+  }
+  static I set1Int(int i) { return _mm256_set1_epi32(i); }
+  static I addInt(I a, I b) { return _mm256_add_epi32(a, b); }
+  static I subInt(I a, I b) { return _mm256_sub_epi32(a, b); }
+  static I andInt(I a, I b) { return _mm256_and_si256(a, b); }
+  template<int n> static I shl(I a) { return _mm256_slli_epi32(a, n); }
+  template<int n> static I shr(I a) { return _mm256_srli_epi32(a, n); }
+  template<int n> static I sar(I a) { return _mm256_srai_epi32(a, n); }
+};
+SIMD_END_TARGET
+
+SIMD_BEGIN_TARGET_AVX512
+struct LaneAVX512
+{
+  typedef __m512 V;
+  typedef __m512i I;
+  static const int kWidth = 16;
+
+  static V load(float const* p) { return _mm512_load_ps(p); }
+  static void store(float* p, V v) { _mm512_store_ps(p, v); }
+  static V set1(float f) { return _mm512_set1_ps(f); }
+  static V add(V a, V b) { return _mm512_add_ps(a, b); }
+  static V sub(V a, V b) { return _mm512_sub_ps(a, b); }
+  static V mul(V a, V b) { return _mm512_mul_ps(a, b); }
+  static V div(V a, V b) { return _mm512_div_ps(a, b); }
+  static V fma(V a, V b, V c) { return _mm512_fmadd_ps(a, b, c); }
+  static V fms(V a, V b, V c) { return _mm512_fmsub_ps(a, b, c); }
+  static V rcp(V a) { return _mm512_rcp14_ps(a); } // 14 bits
+  static V sqrt(V a) { return _mm512_sqrt_ps(a); }
+  static V min(V a, V b) { return _mm512_min_ps(a, b); }
+  static V max(V a, V b) { return _mm512_max_ps(a, b); }
+
+  static V loadu(float const* p) { return _mm512_loadu_ps(p); }
+  static void storeu(float* p, V v) { _mm512_storeu_ps(p, v); }
+
+  typedef __mmask16 M;
+  static M lt(V a, V b) { return _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ); }
+  static M le(V a, V b) { return _mm512_cmp_ps_mask(a, b, _CMP_LE_OQ); }
+  static M eq(V a, V b) { return _mm512_cmp_ps_mask(a, b, _CMP_EQ_OQ); }
+  static M eqInt(I a, I b) { return _mm512_cmpeq_epi32_mask(a, b); }
+  static M orMask(M a, M b) { return M(a | b); }
+  static V select(M m, V a, V b) { return _mm512_mask_blend_ps(m, b, a); }
+
+  // the float bitwise ops are AVX512DQ, so go through the integer ones
+  static V bitXor(V a, V b) { return asFloat(_mm512_xor_si512(asInt(a), asInt(b))); }
+  static V bitAnd(V a, V b) { return asFloat(_mm512_and_si512(asInt(a), asInt(b))); }
+
+  static I roundToInt(V a) { return _mm512_cvtps_epi32(a); }
+  static V toFloat(I a) { return _mm512_cvtepi32_ps(a); }
+  static I asInt(V a) { return _mm512_castps_si512(a); }
+  static V asFloat(I a) { return _mm512_castsi512_ps(a); }
+  static void storeBytes(unsigned char* p, I a) { _mm_storeu_si128(reinterpret_cast<__m128i*>(p), _mm512_cvtepi32_epi8(a)); }
+  static I set1Int(int i) { return _mm512_set1_epi32(i); }
+  static I addInt(I a, I b) { return _mm512_add_epi32(a, b); }
+  static I subInt(I a, I b) { return _mm512_sub_epi32(a, b); }
+  static I andInt(I a, I b) { return _mm512_and_si512(a, b); }
+  template<int n> static I shl(I a) { return _mm512_slli_epi32(a, n); }
+  template<int n> static I shr(I a) { return _mm512_srli_epi32(a, n); }
+  template<int n> static I sar(I a) { return _mm512_srai_epi32(a, n); }
+};
+SIMD_END_TARGET
+#endif
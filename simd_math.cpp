@@ -0,0 +1,117 @@
+#include "simd_math.h"
+
+#include <cmath>
+#include <cstring>
+
+#include "cpu_features.h"
+#include "simd_lane.h"
+
+namespace scalar {
+typedef LaneScalar Lane;
+#include "simd_math_kernels.inl"
+}
+
+#ifdef SIMD_X86
+SIMD_BEGIN_TARGET_SSE2
+namespace sse2 {
+typedef LaneSSE2 Lane;
+#include "simd_math_kernels.inl"
+}
+SIMD_END_TARGET
+
+SIMD_BEGIN_TARGET_AVX2
+namespace avx2 {
+typedef LaneAVX2 Lane;
+#include "simd_math_kernels.inl"
+}
+SIMD_END_TARGET
+
+SIMD_BEGIN_TARGET_AVX512
+namespace avx512 {
+typedef LaneAVX512 Lane;
+#include "simd_math_kernels.inl"
+}
+SIMD_END_TARGET
+
+// a vec4 is exactly one SSE register
+#define SIMD_MATH_VEC4 sse2
+#else
+#define SIMD_MATH_VEC4 scalar
+#endif
+
+glm::vec4 approxSin(glm::vec4 const& x)
+{
+  glm::vec4 r;
+  SIMD_MATH_VEC4::sinArray(&x[0], &r[0], 4);
+  return r;
+}
+
+glm::vec4 approxCos(glm::vec4 const& x)
+{
+  glm::vec4 r;
+  SIMD_MATH_VEC4::cosArray(&x[0], &r[0], 4);
+  return r;
+}
+
+glm::vec4 approxExp(glm::vec4 const& x)
+{
+  glm::vec4 r;
+  SIMD_MATH_VEC4::expArray(&x[0], &r[0], 4);
+  return r;
+}
+
+glm::vec4 approxLog(glm::vec4 const& x)
+{
+  glm::vec4 r;
+  SIMD_MATH_VEC4::logArray(&x[0], &r[0], 4);
+  return r;
+}
+
+glm::vec4 approxPow(glm::vec4 const& x, glm::vec4 const& y)
+{
+  glm::vec4 r;
+  SIMD_MATH_VEC4::powArray(&x[0], &y[0], 0.0f, &r[0], 4);
+  return r;
+}
+
+#ifdef SIMD_X86
+#define SIMD_MATH_DISPATCH(call) \
+  switch (activeSimdLevel()) { \
+  case SIMD_AVX512: avx512::call; break; \
+  case SIMD_AVX2: avx2::call; break; \
+  case SIMD_SSE2: sse2::call; break; \
+  default: scalar::call; break; \
+  }
+#else
+#define SIMD_MATH_DISPATCH(call) scalar::call;
+#endif
+
+void approxSin(float const* x, float* out, std::size_t count)
+{
+  SIMD_MATH_DISPATCH(sinArray(x, out, count))
+}
+
+void approxCos(float const* x, float* out, std::size_t count)
+{
+  SIMD_MATH_DISPATCH(cosArray(x, out, count))
+}
+
+void approxExp(float const* x, float* out, std::size_t count)
+{
+  SIMD_MATH_DISPATCH(expArray(x, out, count))
+}
+
+void approxLog(float const* x, float* out, std::size_t count)
+{
+  SIMD_MATH_DISPATCH(logArray(x, out, count))
+}
+
+void approxPow(float const* x, float const* y, float* out, std::size_t count)
+{
+  SIMD_MATH_DISPATCH(powArray(x, y, 0.0f, out, count))
+}
+
+void approxPow(float const* x, float y, float* out, std::size_t count)
+{
+  SIMD_MATH_DISPATCH(powArray(x, NULL, y, out, count))
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+
+#include <glm/glm.hpp>
+
+// Polynomial sin, cos, exp, log and pow, vectorised like the batch kernels
+// (SSE2 for a single vec4, up to AVX-512 for arrays). glm's own sin/exp and
+// the gtx fast_* helpers go through libm or stay scalar per lane.
+//
+// Worst error against double precision, in ulp of the float result, as
+// measured by bench/math_bench:
+//
+//   approxSin, approxCos   |x| <= 8192                       2.3 ulp (1e-7 absolute)
+//   approxExp              every float                       1.3 ulp, denormal results included
+//   approxLog              x > 0, denormals included         0.8 ulp
+//   approxPow              x in [1e-4, 1e4], |y| <= 4        2 ulp while |y log x| < 1, then about
+//                                                            1.5 ulp per unit of |y log x| (60 at 37)
+//
+// Special values: log(0) = -inf, log(x < 0) = NaN, exp overflows to inf and
+// underflows through denormals to 0, NaN propagates. pow is exp(y log x), so
+// x < 0 gives NaN and pow(0, 0) is NaN rather than 1.
+glm::vec4 approxSin(glm::vec4 const& x);
+glm::vec4 approxCos(glm::vec4 const& x);
+glm::vec4 approxExp(glm::vec4 const& x);
+glm::vec4 approxLog(glm::vec4 const& x);
+glm::vec4 approxPow(glm::vec4 const& x, glm::vec4 const& y);
+
+// Same functions over arrays; 'out' may alias the inputs.
+void approxSin(float const* x, float* out, std::size_t count);
+void approxCos(float const* x, float* out, std::size_t count);
+void approxExp(float const* x, float* out, std::size_t count);
+void approxLog(float const* x, float* out, std::size_t count);
+void approxPow(float const* x, float const* y, float* out, std::size_t count);
+void approxPow(float const* x, float y, float* out, std::size_t count);
@@ -0,0 +1,167 @@
+// Polynomial sin/cos/exp/log written against 'Lane' (simd_lane.h);
+// simd_math.cpp includes this once per instruction set. The reductions and
+// coefficients follow Cephes (sinf, cosf, expf, logf). Everything is inline
+// so a file that includes this for one function (srgb_convert.cpp) does not
+// warn about the others.
+
+static inline Lane::V polynomial(Lane::V x, float const* c, int degree)
+{
+  Lane::V p = Lane::set1(c[0]);
+  for (int i = 1; i <= degree; ++i)
+    p = Lane::fma(p, x, Lane::set1(c[i]));
+  return p;
+}
+
+// sin(x) for quadrant offset 0, cos(x) for offset 1
+static inline Lane::V sinCos(Lane::V x, int quadrantOffset)
+{
+  static const float kSin[] = { -1.9515295891e-4f, 8.3321608736e-3f, -1.6666654611e-1f };
+  static const float kCos[] = { 2.443315711809948e-5f, -1.388731625493765e-3f, 4.166664568298827e-2f };
+
+  // x = j * pi/2 + r with |r| <= pi/4; pi/2 is split in four, the first three
+  // with at most 11 significant bits so j * part is exact for |x| <= 8192
+  // with or without FMA
+  Lane::I j = Lane::roundToInt(Lane::mul(x, Lane::set1(0.63661977236758134f)));
+  Lane::V jf = Lane::toFloat(j);
+  Lane::V r = Lane::fma(jf, Lane::set1(-1.5703125f), x);
+  r = Lane::fma(jf, Lane::set1(-4.837512969970703125e-4f), r);
+  r = Lane::fma(jf, Lane::set1(-7.549533620476723e-8f), r);
+  r = Lane::fma(jf, Lane::set1(-2.5633440682570896e-12f), r);
+
+  Lane::V z = Lane::mul(r, r);
+  Lane::V s = Lane::fma(Lane::mul(polynomial(z, kSin, 2), z), r, r);
+  Lane::V c = Lane::fma(Lane::mul(polynomial(z, kCos, 2), z), z, Lane::fma(z, Lane::set1(-0.5f), Lane::set1(1.0f)));
+
+  // odd quadrants swap to the other polynomial, quadrants 2 and 3 flip sign
+  Lane::I q = Lane::addInt(j, Lane::set1Int(quadrantOffset));
+  Lane::V result = Lane::select(Lane::eqInt(Lane::andInt(q, Lane::set1Int(1)), Lane::set1Int(1)), c, s);
+  return Lane::bitXor(result, Lane::asFloat(Lane::shl<30>(Lane::andInt(q, Lane::set1Int(2)))));
+}
+
+static inline Lane::V sinLane(Lane::V x) { return sinCos(x, 0); }
+static inline Lane::V cosLane(Lane::V x) { return sinCos(x, 1); }
+
+// e^x = 2^n * p, with the reduction split off for callers that know their range
+static inline Lane::V expReduced(Lane::V x, Lane::I& n)
+{
+  static const float kExp[] = { 1.9875691500e-4f, 1.3981999507e-3f, 8.3334519073e-3f, 4.1665795894e-2f,
+    1.6666665459e-1f, 5.0000001201e-1f };
+
+  // x = n ln2 + r, ln2 split so n * 0.693359375 is exact
+  n = Lane::roundToInt(Lane::mul(x, Lane::set1(1.44269504088896341f)));
+  Lane::V nf = Lane::toFloat(n);
+  Lane::V r = Lane::fma(nf, Lane::set1(-0.693359375f), x);
+  r = Lane::fma(nf, Lane::set1(2.12194440e-4f), r);
+
+  return Lane::fma(Lane::mul(polynomial(r, kExp, 5), r), r, Lane::add(r, Lane::set1(1.0f)));
+}
+
+// e^x where the result is a normal float (x in about [-87.3, 88.7]), no checks
+static inline Lane::V expNormal(Lane::V x)
+{
+  Lane::I n;
+  Lane::V p = expReduced(x, n);
+  return Lane::mul(p, Lane::asFloat(Lane::shl<23>(Lane::addInt(n, Lane::set1Int(127)))));
+}
+
+static inline Lane::V expLane(Lane::V x)
+{
+  const float kMax = 88.72283905f;  // log(FLT_MAX)
+  const float kMin = -103.97208f;   // log of the smallest denormal
+
+  Lane::I n;
+  Lane::V p = expReduced(Lane::min(Lane::max(x, Lane::set1(kMin)), Lane::set1(kMax)), n);
+
+  // scale by 2^n in two halves so results near the top overflow correctly and
+  // those at the bottom round into denormals instead of breaking the exponent
+  Lane::I n1 = Lane::sar<1>(n);
+  Lane::I n2 = Lane::subInt(n, n1);
+  p = Lane::mul(p, Lane::asFloat(Lane::shl<23>(Lane::addInt(n1, Lane::set1Int(127)))));
+  p = Lane::mul(p, Lane::asFloat(Lane::shl<23>(Lane::addInt(n2, Lane::set1Int(127)))));
+
+  p = Lane::select(Lane::lt(Lane::set1(kMax), x), Lane::set1(INFINITY), p);
+  p = Lane::select(Lane::lt(x, Lane::set1(kMin)), Lane::set1(0.0f), p);
+  return Lane::select(Lane::eq(x, x), p, x); // NaN stays NaN
+}
+
+// log of a positive normal float whose exponent field is 'bias' + 1 too large
+// for x in [0.5, 1); the plain case is 126
+static inline Lane::V logBiased(Lane::V x, Lane::V bias)
+{
+  static const float kLog[] = { 7.0376836292e-2f, -1.1514610310e-1f, 1.1676998740e-1f, -1.2420140846e-1f,
+    1.4249322787e-1f, -1.6668057665e-1f, 2.0000714765e-1f, -2.4999993993e-1f, 3.3333331174e-1f };
+
+  Lane::V e = Lane::sub(Lane::toFloat(Lane::shr<23>(Lane::asInt(x))), bias);
+
+  // mantissa in [0.5, 1), then folded to [sqrt(0.5), sqrt(2)) - 1
+  Lane::V m = Lane::asFloat(Lane::addInt(Lane::andInt(Lane::asInt(x), Lane::set1Int(0x007fffff)),
+    Lane::set1Int(0x3f000000)));
+  Lane::M small = Lane::lt(m, Lane::set1(0.707106781186547524f));
+  e = Lane::sub(e, Lane::select(small, Lane::set1(1.0f), Lane::set1(0.0f)));
+  m = Lane::add(Lane::sub(m, Lane::set1(1.0f)), Lane::select(small, m, Lane::set1(0.0f)));
+
+  Lane::V z = Lane::mul(m, m);
+  Lane::V y = Lane::mul(Lane::mul(polynomial(m, kLog, 8), m), z);
+  y = Lane::fma(e, Lane::set1(-2.12194440e-4f), y);
+  y = Lane::fma(z, Lane::set1(-0.5f), y);
+  return Lane::fma(e, Lane::set1(0.693359375f), Lane::add(m, y));
+}
+
+// log of a positive normal float, no checks
+static inline Lane::V logNormal(Lane::V x)
+{
+  return logBiased(x, Lane::set1(126.0f));
+}
+
+static inline Lane::V logLane(Lane::V x)
+{
+  // bring denormals into the normal range first
+  Lane::M denormal = Lane::lt(x, Lane::set1(1.17549435e-38f));
+  Lane::V result = logBiased(Lane::select(denormal, Lane::mul(x, Lane::set1(8388608.0f)), x),
+    Lane::select(denormal, Lane::set1(126.0f + 23.0f), Lane::set1(126.0f)));
+
+  result = Lane::select(Lane::lt(x, Lane::set1(0.0f)), Lane::set1(NAN), result);
+  result = Lane::select(Lane::eq(x, Lane::set1(0.0f)), Lane::set1(-INFINITY), result);
+  result = Lane::select(Lane::eq(x, Lane::set1(INFINITY)), x, result);
+  return Lane::select(Lane::eq(x, x), result, x);
+}
+
+static inline Lane::V powLane(Lane::V x, Lane::V y)
+{
+  return expLane(Lane::mul(y, logLane(x)));
+}
+
+// whole registers with unaligned loads, then the tail through a padded copy
+template<Lane::V (*F)(Lane::V)>
+static inline void mapArray(float const* x, float* out, std::size_t count)
+{
+  std::size_t i = 0;
+  for (; i + Lane::kWidth <= count; i += Lane::kWidth)
+    Lane::storeu(out + i, F(Lane::loadu(x + i)));
+  if (i < count) {
+    float tail[Lane::kWidth] = {};
+    std::memcpy(tail, x + i, (count - i) * sizeof(float));
+    Lane::storeu(tail, F(Lane::loadu(tail)));
+    std::memcpy(out + i, tail, (count - i) * sizeof(float));
+  }
+}
+
+static inline void powArray(float const* x, float const* y, float yScalar, float* out, std::size_t count)
+{
+  std::size_t i = 0;
+  for (; i + Lane::kWidth <= count; i += Lane::kWidth)
+    Lane::storeu(out + i, powLane(Lane::loadu(x + i), y ? Lane::loadu(y + i) : Lane::set1(yScalar)));
+  if (i < count) {
+    float tailX[Lane::kWidth] = {}, tailY[Lane::kWidth] = {};
+    std::memcpy(tailX, x + i, (count - i) * sizeof(float));
+    if (y)
+      std::memcpy(tailY, y + i, (count - i) * sizeof(float));
+    Lane::storeu(tailX, powLane(Lane::loadu(tailX), y ? Lane::loadu(tailY) : Lane::set1(yScalar)));
+    std::memcpy(out + i, tailX, (count - i) * sizeof(float));
+  }
+}
+
+static inline void sinArray(float const* x, float* out, std::size_t count) { mapArray<sinLane>(x, out, count); }
+static inline void cosArray(float const* x, float* out, std::size_t count) { mapArray<cosLane>(x, out, count); }
+static inline void expArray(float const* x, float* out, std::size_t count) { mapArray<expLane>(x, out, count); }
+static inline void logArray(float const* x, float* out, std::size_t count) { mapArray<logLane>(x, out, count); }
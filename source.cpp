@@ -3,27 +3,56 @@
 #include <GL/freeglut.h>
 
 #include "stb-master/stb_image.h"
-#include "glsl/core/shader_loader.h"
-
+#include "animated_texture.h"
+#include "half_float.h"
+#include "frame_profiler.h"
+#include "image_writer.h"
+#include "job_system.h"
+#include "nv12_convert.h"
+#include "nv12_readback.h"
+#include "shader_cache.h"
+#include "shader_library.h"
+#include "shared_frame_source.h"
+#include "texture_uploader.h"
+#include "trace.h"
+#include "video_source.h"
+
+#include <atomic>
 #include <string>
+#include <vector>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
 #include <fstream>
 #include <sstream>
 #include <iostream>
 
 using namespace std;
 
-GLuint CreateTexture(char const* filename);
-bool initShaderProgram();
+bool DecodeImage(char const* filename, DecodedImage& image);
+bool DecodeImageHDR(char const* filename, DecodedImage& image);
+bool DecodeImage16(char const* filename, DecodedImage& image);
+bool initShaderProgram(string const& shaderDirectory);
+bool useVideoProgram();
 bool defineTextureObject();
 
 void framebufferSizeCallback(GLFWwindow* window, int width, int height);
+void refreshCallback(GLFWwindow* window);
 void errorCallback(int errorCode, const char* errorDescription);
 void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods);
+void drawScene();
 void renderScene(GLFWwindow* window);
+bool saveFrame(GLFWwindow* window, char const* path);
 
 int framebufferWidth, framebufferHeight;
+bool g_frameDirty = true;  // something on screen changed since the last frame drawn
 GLuint g_VAO, g_VBO, g_EBO;
 GLuint g_shaderProgramID;
+FrameProfiler g_frameProfiler;
+ShaderCache g_shaderCache;
+ShaderLibrary g_shaderLibrary;
+TextureUploader g_textureUploader;
+Nv12Readback g_nv12Output;
 
 typedef struct {
   float x, y;
@@ -49,8 +78,84 @@ unsigned int indices[] = {
   2, 3, 4,
 };
 
-int main()
+int main(int argc, char** argv)
 {
+  char const* imageFile = "C:/data/test.jpg";
+  char const* tracePath = NULL;
+  char const* chromeTracePath = NULL;
+  char const* shaderCacheDir = "shader_cache";
+  char const* shaderDir = "shaders";
+  char const* savePath = NULL;
+  char const* videoPath = NULL;
+  char const* sharedName = NULL;
+  char const* nv12Path = NULL;
+  int nv12Width = 0, nv12Height = 0;
+  Nv12Conversion nv12Conversion = NV12_ON_GPU;
+  VideoOptions videoOptions;
+  bool videoFormatGiven = false;
+  bool headless = false;
+  bool continuous = false;
+  long maxFrames = -1;
+  int workers = -1;
+
+  for (int i = 1; i < argc; ++i) {
+    string arg = argv[i];
+    if (arg == "--headless")
+      headless = true;
+    else if (arg == "--continuous")
+      continuous = true;
+    else if (arg == "--frames" && i + 1 < argc)
+      maxFrames = atol(argv[++i]);
+    else if (arg == "--trace" && i + 1 < argc)
+      tracePath = argv[++i];
+    else if (arg == "--chrome-trace" && i + 1 < argc)
+      chromeTracePath = argv[++i];
+    else if (arg == "--shader-cache" && i + 1 < argc)
+      shaderCacheDir = argv[++i];
+    else if (arg == "--no-shader-cache")
+      shaderCacheDir = NULL;
+    else if (arg == "--shaders" && i + 1 < argc)
+      shaderDir = argv[++i];
+    else if (arg == "--workers" && i + 1 < argc)
+      workers = atoi(argv[++i]);
+    else if (arg == "--save" && i + 1 < argc)
+      savePath = argv[++i];
+    else if (arg == "--video" && i + 1 < argc)
+      videoPath = argv[++i];
+    else if (arg == "--video-format" && i + 1 < argc) {
+      string format = argv[++i];
+      videoOptions.format = format == "nv12" ? VIDEO_NV12 : format == "i420" ? VIDEO_I420 : VIDEO_Y4M;
+      videoFormatGiven = true;
+    } else if (arg == "--video-size" && i + 1 < argc) {
+      if (sscanf(argv[++i], "%dx%d", &videoOptions.width, &videoOptions.height) != 2)
+        cerr << "Warning: --video-size takes WIDTHxHEIGHT" << endl;
+    } else if (arg == "--video-rate" && i + 1 < argc)
+      videoOptions.frameRate = atof(argv[++i]);
+    else if (arg == "--video-once")
+      videoOptions.loop = false;
+    else if (arg == "--shm" && i + 1 < argc)
+      sharedName = argv[++i];
+    else if (arg == "--nv12-out" && i + 1 < argc)
+      nv12Path = argv[++i];
+    else if (arg == "--nv12-size" && i + 1 < argc) {
+      if (sscanf(argv[++i], "%dx%d", &nv12Width, &nv12Height) != 2)
+        cerr << "Warning: --nv12-size takes WIDTHxHEIGHT" << endl;
+    } else if (arg == "--nv12-convert" && i + 1 < argc) {
+      string conversion = argv[++i];
+      nv12Conversion = conversion == "cpu" ? NV12_ON_CPU : conversion == "verify" ? NV12_VERIFY : NV12_ON_GPU;
+    } else
+      imageFile = argv[i];
+  }
+
+#ifndef ENABLE_TRACE
+  if (chromeTracePath)
+    cerr << "Warning: built without ENABLE_TRACE (msbuild /p:EnableTrace=true), --chrome-trace is ignored" << endl;
+#endif
+  TRACE_THREAD_NAME("main");
+
+  // this thread owns the GL context; the workers get the other cores
+  jobSystem().start(workers);
+
   glfwSetErrorCallback(errorCallback);
 
   if (!glfwInit()) {
@@ -65,6 +170,8 @@ int main()
   glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
   //glfwWindowHint(GLFW_RESIZABLE, GL_FALSE);
   glfwWindowHint(GLFW_SAMPLES, 4);
+  if (headless)
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
 
   GLFWwindow* window = glfwCreateWindow(
     1280,
@@ -81,6 +188,7 @@ int main()
 
   glfwSetKeyCallback(window, keyCallback);
   glfwSetFramebufferSizeCallback(window, framebufferSizeCallback);
+  glfwSetWindowRefreshCallback(window, refreshCallback);
 
   glewExperimental = GL_TRUE;
   GLenum errorCode = glewInit();
@@ -113,7 +221,49 @@ int main()
     std::exit(EXIT_FAILURE);
   }
 
-  if (!initShaderProgram()) {
+  // frames from a capture process, video and animated GIFs are streamed frame
+  // by frame, everything else is a still texture, decoded on a job and
+  // uploaded by the upload thread; the render loop draws without it until it
+  // is ready
+  SharedFrameSource shared;
+  VideoSource video;
+  AnimatedTexture animation;
+  JobHandle decode;
+  atomic<bool> decodeFailed(false);
+  if (sharedName) {
+    if (!shared.open(sharedName)) {
+
+      glfwTerminate();
+      std::exit(EXIT_FAILURE);
+    }
+    cout << "Shared frames: " << shared.width() << "x" << shared.height() << (shared.yuv() ? " NV12" : " RGBA")
+      << " from " << sharedName << endl;
+  } else if (videoPath) {
+    if (!videoFormatGiven && strcmp(videoPath, "-") != 0)
+      videoOptions.format = videoFormatFromPath(videoPath);
+    if (!video.open(videoPath, videoOptions)) {
+
+      glfwTerminate();
+      std::exit(EXIT_FAILURE);
+    }
+    cout << "Video: " << video.width() << "x" << video.height() << " at " << video.frameRate() << " fps" << endl;
+  } else if (!animation.open(imageFile))
+    decode = jobSystem().submit([imageFile, &decodeFailed] {
+      DecodedImage image = DecodedImage();
+      if (DecodeImage(imageFile, image))
+        g_textureUploader.submit(image);
+      else
+        decodeFailed = true;
+    });
+
+  if (!g_shaderCache.init(shaderCacheDir)) {
+
+    glfwTerminate();
+    std::exit(EXIT_FAILURE);
+  }
+
+  chrono::steady_clock::time_point shaderStart = chrono::steady_clock::now();
+  if (!initShaderProgram(shaderDir)) {
 
     cerr << "Error: Shader Program init error" << endl;
 
@@ -121,170 +271,346 @@ int main()
     std::exit(EXIT_FAILURE);
   }
 
-  glfwSwapInterval(1);
+  if ((video.isOpen() || (shared.isOpen() && shared.yuv())) && !useVideoProgram()) {
+
+    glfwTerminate();
+    std::exit(EXIT_FAILURE);
+  }
+
+  // cold (compiled) vs warm (cached binary) startup cost of the shaders
+  ShaderLibrary::Stats const& shaderStats = g_shaderLibrary.stats();
+  cout << "Shaders ready in " << chrono::duration<double, milli>(chrono::steady_clock::now() - shaderStart).count()
+    << " ms: " << shaderStats.cached << " cached (" << shaderStats.cachedMs << " ms), "
+    << shaderStats.compiled << " compiled (" << shaderStats.compileMs << " ms)";
+  if (g_shaderCache.stats().rejected)
+    cout << ", " << g_shaderCache.stats().rejected << " stale cache entries replaced";
+  cout << endl;
+
+  // raw NV12 frames for an encoder, e.g. ffmpeg -f rawvideo -pix_fmt nv12;
+  // the output is the window's size unless --nv12-size says otherwise
+  FILE* nv12File = NULL;
+  if (nv12Path) {
+    nv12File = fopen(nv12Path, "wb");
+    if (!nv12File) {
+      cerr << "Error: can't write " << nv12Path << endl;
+
+      glfwTerminate();
+      std::exit(EXIT_FAILURE);
+    }
+    if (nv12Width <= 0 || nv12Height <= 0)
+      glfwGetFramebufferSize(window, &nv12Width, &nv12Height);
+    bool initialized = g_nv12Output.init(shaderDir, &g_shaderCache, nv12Width, nv12Height, nv12Conversion,
+      [nv12File](unsigned char const* nv12, int width, int height, long long) {
+        fwrite(nv12, 1, nv12FrameSize(width, height), nv12File);
+      });
+    if (!initialized) {
+
+      glfwTerminate();
+      std::exit(EXIT_FAILURE);
+    }
+    cout << "NV12 output: " << nv12Width << "x" << nv12Height << " to " << nv12Path << endl;
+  }
+
+  // a hidden window has no display to sync to, so run unthrottled
+  glfwSwapInterval(headless ? 0 : 1);
 
-  GLuint texureId = CreateTexture("C:/data/test.jpg");
-  
-  while (!glfwWindowShouldClose(window)) {
+  if (!g_frameProfiler.init(GLEW_ARB_timer_query || GLEW_VERSION_3_3, tracePath)) {
+
+    glfwTerminate();
+    std::exit(EXIT_FAILURE);
+  }
+
+  // started this late so the early exits above have no thread to stop;
+  // anything decoded meanwhile waits in its queue
+  g_textureUploader.init(window);
+  GLuint texureId = 0;
+  unsigned uploadTicket;
+
+  // Frames are only drawn when something on screen changed: a new texture or
+  // video frame, a resize, or the window system asking for a repaint. In
+  // between the loop sleeps in glfwWaitEvents, which input wakes at once, or
+  // until a source has its next frame due; streams from a reader thread or
+  // another process are looked at every kStreamPollSeconds. Those checks come
+  // before the frame is begun, so an idle pass issues no timer queries and
+  // records nothing. A hidden window gets no events, so headless runs draw
+  // every frame, as do runs of a set number of --frames, --continuous (for
+  // profiling) and NV12 output, which an encoder expects at a steady rate.
+  const double kStreamPollSeconds = 0.002;
+  continuous = continuous || headless || maxFrames >= 0 || g_nv12Output.isOpen();
+  long frame = 0;
+  while (!glfwWindowShouldClose(window) && frame != maxFrames) {
+    double now = glfwGetTime();
+    double wakeTime = -1.0;  // when to look at the sources again; < 0 only for events
+    bool draw = g_frameDirty || continuous;
+    if (shared.isOpen()) {
+      draw = shared.frameWaiting() || draw;
+      wakeTime = now + kStreamPollSeconds;
+    } else if (video.isOpen()) {
+      draw = video.frameDue(now) || draw;
+      wakeTime = now + kStreamPollSeconds;
+    } else if (animation.isOpen()) {
+      // no frame time before the first draw, which g_frameDirty brings, nor
+      // ever for a still GIF
+      wakeTime = animation.nextFrameTime();
+      draw = draw || (wakeTime >= 0.0 && wakeTime <= now);
+    } else if (g_textureUploader.ready()) {
+      draw = true;
+    } else if (!texureId && !decodeFailed) {
+      // still decoding or uploading
+      wakeTime = now + kStreamPollSeconds;
+    }
+
+    if (!draw) {
+      TRACE_ZONE("idle");
+      if (wakeTime < 0.0)
+        glfwWaitEvents();
+      else if (wakeTime > now)
+        glfwWaitEventsTimeout(wakeTime - now);
+      else
+        glfwPollEvents();
+      continue;
+    }
+
+    TRACE_ZONE("frame");
+    g_frameProfiler.beginFrame();
+
+    g_frameProfiler.beginStage(STAGE_UPLOAD);
+    if (shared.isOpen()) {
+      if (shared.update())
+        shared.bind();
+    } else if (video.isOpen()) {
+      if (video.update(now))
+        video.bind();
+    } else if (animation.isOpen())
+      glBindTexture(GL_TEXTURE_2D, animation.update(now));
+    else if (g_textureUploader.poll(uploadTicket, texureId))
+      glBindTexture(GL_TEXTURE_2D, texureId);
+    g_frameProfiler.endStage(STAGE_UPLOAD);
+
+    g_frameDirty = false;
     renderScene(window);
+    ++frame;
+
+    g_frameProfiler.endFrame();
+    g_frameProfiler.reportEvery(2.0);
   }
 
+  g_frameProfiler.shutdown();
+  g_frameProfiler.report();
+
+  if (savePath)
+    saveFrame(window, savePath);
+
+  if (video.isOpen()) {
+    VideoSource::Stats frames = video.stats();
+    cout << "Video frames: " << frames.shown << " shown of " << frames.read << " read, " << frames.dropped
+      << " dropped, " << frames.late << " late; uploads took " << frames.uploadMs << " ms, reader waited "
+      << frames.readerWaitMs << " ms for free slots" << endl;
+  }
+  if (shared.isOpen()) {
+    SharedFrameSource::Stats const& frames = shared.stats();
+    cout << "Shared frames: " << frames.shown << " shown, " << frames.dropped << " dropped; uploads took "
+      << frames.uploadMs << " ms, publish to upload " << (frames.shown ? frames.latencyMs / frames.shown : 0.0)
+      << " ms on average, " << frames.maxLatencyMs << " ms at most" << endl;
+  }
+  if (g_nv12Output.isOpen()) {
+    g_nv12Output.release();
+    fclose(nv12File);
+    Nv12Readback::Stats const& frames = g_nv12Output.stats();
+    cout << "NV12 frames: " << frames.frames << " written, " << frames.stalls << " waited for ("
+      << frames.stallMs << " ms), delivering took " << frames.deliverMs << " ms";
+    if (nv12Conversion == NV12_VERIFY)
+      cout << "; " << frames.differing << " samples differ from the CPU conversion, by up to "
+        << frames.maxDifference;
+    cout << endl;
+  }
+  shared.close();
+  video.close();
+  animation.close();
+
+  // the decode may still be running if the loop ended early
+  jobSystem().wait(decode);
+  g_textureUploader.shutdown();
+  TextureUploader::Stats uploads = g_textureUploader.stats();
+  cout << "Texture uploads: " << uploads.uploads << " (" << uploads.bytes / 1048576.0 << " MB) in "
+    << uploads.uploadMs << " ms on the " << (g_textureUploader.threaded() ? "upload" : "render")
+    << " thread, longest wait " << uploads.maxLatencyMs << " ms" << endl;
+
   glUseProgram(0);
   glBindVertexArray(0);
 
   glDeleteTextures(1, &texureId);
-  glDeleteProgram(g_shaderProgramID);
+  g_shaderLibrary.release();
   glDeleteBuffers(1, &g_EBO);
   glDeleteBuffers(1, &g_VBO);
   glDeleteVertexArrays(1, &g_VAO);
   glfwTerminate();
 
+  JobSystem::WorkerStats jobs = jobSystem().totals();
+  cout << "Jobs: " << jobs.executed + jobs.helped << " run on " << jobSystem().workerCount() << " workers ("
+    << jobs.stolen << " stolen, " << jobs.helped << " by waiting threads), idle " << jobs.idleMs
+    << " ms, deepest queue " << jobs.maxQueueDepth << endl;
+  jobSystem().stop();
+
+  if (chromeTracePath)
+    traceWriteChromeJson(chromeTracePath);
+
   std::exit(EXIT_SUCCESS);
 }
 
-GLuint CreateTexture(char const* filename)
+// runs on a job: stb_image and the half-float packing need no GL context
+bool DecodeImage(char const* filename, DecodedImage& image)
 {
-  // load image
-  int width, height, channel;
+  TRACE_ZONE("DecodeImage");
+
+  // float images go to a half-float texture instead of being tone mapped to 8 bits
+  if (stbi_is_hdr(filename))
+    return DecodeImageHDR(filename, image);
+
+  // likewise keep 16-bit images at full precision instead of truncating to 8 bits
+  if (stbi_is_16_bit(filename))
+    return DecodeImage16(filename, image);
 
   //stbi_set_flip_vertically_on_load(true);
 
-  GLubyte* textureData = stbi_load(filename, &width, &height, &channel, STBI_rgb);
+  int channel;
+  image.pixels = stbi_load(filename, &image.width, &image.height, &channel, STBI_rgb);
+  if (!image.pixels) {
+    cerr << "Error: can't load " << filename << ": " << stbi_failure_reason() << endl;
+    return false;
+  }
 
-  // Generate a texture ID and bind to it
-  GLuint tempTextureID;
-  glGenTextures(1, &tempTextureID);
-  glBindTexture(GL_TEXTURE_2D, tempTextureID);
+  // rows of 3 bytes are only byte aligned
+  image.internalFormat = GL_RGB;
+  image.type = GL_UNSIGNED_BYTE;
+  image.rowAlignment = 1;
+  return true;
+}
 
-  // Construct the texture.
-  // Note: The 'Data format' is the format of the image data as provided by the image library. FreeImage decodes images into
-  // BGR/BGRA format, but we want to work with it in the more common RGBA format, so we specify the 'Internal format' as such.
-  glTexImage2D(GL_TEXTURE_2D,    // Type of texture
-    0,                // Mipmap level (0 being the top level i.e. full size)
-    GL_RGB,          // Internal format
-    width,       // Width of the texture
-    height,      // Height of the texture,
-    0,                // Border in pixels
-    GL_RGB,          // Data format
-    GL_UNSIGNED_BYTE, // Type of texture data
-    textureData);     // The image data to use for this texture
+bool DecodeImageHDR(char const* filename, DecodedImage& image)
+{
+  TRACE_ZONE("DecodeImageHDR");
+  int channel;
 
-              // Specify our minification and magnification filters
+  float* textureData = stbi_loadf(filename, &image.width, &image.height, &channel, STBI_rgb);
+  if (!textureData) {
+    cerr << "Error: can't load " << filename << ": " << stbi_failure_reason() << endl;
+    return false;
+  }
 
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  // narrow to half floats in place; GL_RGB16F needs half the memory and
+  // upload bandwidth of GL_RGB32F and is plenty for display
+  glm::uint16* halfData = reinterpret_cast<glm::uint16*>(textureData);
+  packHalfArray(textureData, halfData, size_t(image.width) * image.height * 3);
 
-  stbi_image_free(textureData);
+  // rows of 3 halves are only 2-byte aligned
+  image.pixels = halfData;
+  image.internalFormat = GL_RGB16F;
+  image.type = GL_HALF_FLOAT;
+  image.rowAlignment = 2;
+  return true;
+}
 
-  return tempTextureID;
+bool DecodeImage16(char const* filename, DecodedImage& image)
+{
+  TRACE_ZONE("DecodeImage16");
+  int channel;
+
+  // 16-bit sources (e.g. metrology PNGs) stay 16-bit all the way to the GPU;
+  // dropping an alpha channel for STBI_rgb happens in place inside stb_image
+  image.pixels = stbi_load_16(filename, &image.width, &image.height, &channel, STBI_rgb);
+  if (!image.pixels) {
+    cerr << "Error: can't load " << filename << ": " << stbi_failure_reason() << endl;
+    return false;
+  }
+
+  image.internalFormat = GL_RGB16;
+  image.type = GL_UNSIGNED_SHORT;
+  image.rowAlignment = 2;
+  return true;
 }
 
-void renderScene(GLFWwindow* window)
+void drawScene()
 {
   glClearColor(0.0F, 0.0F, 0.0F, 1.0F);
   glClear(GL_COLOR_BUFFER_BIT);
-
   glDrawElements(GL_TRIANGLES, sizeof(indices) / sizeof(float), GL_UNSIGNED_INT, 0);
+}
+
+void renderScene(GLFWwindow* window)
+{
+  TRACE_ZONE("renderScene");
+
+  g_frameProfiler.beginStage(STAGE_DRAW);
+  drawScene();
 
+  // the same frame again for the NV12 output, which reads it back a frame or
+  // two later
+  if (g_nv12Output.isOpen()) {
+    g_nv12Output.beginFrame();
+    drawScene();
+    g_nv12Output.endFrame();
+  }
+  g_frameProfiler.endStage(STAGE_DRAW);
+
+  g_frameProfiler.beginStage(STAGE_SWAP);
   glfwSwapBuffers(window);
+  g_frameProfiler.endStage(STAGE_SWAP);
+
+  g_frameProfiler.beginStage(STAGE_POLL);
   glfwPollEvents();
+  g_frameProfiler.endStage(STAGE_POLL);
 }
 
-bool initShaderProgram() {
-
-  //load and compile shaders
-
-  //char* vertex_shader = (char*)"Shaders\\vertex_shader.glsl";
-  //char* fragment_shader = (char*)"Shaders\\fragment_shader.glsl";
-  //Core::Shader_Loader shaderLoader;
-  //g_shaderProgramID = shaderLoader.CreateProgram(vertex_shader, fragment_shader);
-
-  const GLchar* vertexShaderSource = R"glsl(
-    #version 330 core
-    in vec3 aPos;
-    in vec3 aColor;
-    in vec2 aTexCoord;
-    out vec3 Color;
-    out vec2 TexCoord;
-    void main()
-    {
-      gl_Position = vec4(aPos, 1.0F);
-      Color = aColor;
-      TexCoord = aTexCoord;
-    }
-)glsl";
-
-  //"#version 330 core\n"
-  //"in vec3 aPos;"
-  //"in vec3 aColor;"
-  //"in vec2 aTexCoord;"
-  //"out vec3 Color;"
-  //"out vec2 TexCoord;"
-  //"void main()"
-  //"{"
-  //"gl_Position = vec4(aPos, 1.0F);"
-  //"Color = aColor;"
-  //"TexCoord = aTexCoord;"
-  //"}";
-
-  const GLchar* fragmentShaderSource = R"glsl(
-    #version 330 core
-    in vec3 Color;
-    in vec2 TexCoord;
-    out vec4 outColor;
-    uniform sampler2D ourTexture;
-    void main()
-    {
-      outColor = texture(ourTexture, TexCoord) * vec4(Color, 1.0);
-    }
-)glsl";
-
-  //"#version 330 core\n"
-  //"in vec3 Color;"
-  //"in vec2 TexCoord;"
-  //"out vec4 outColor;"
-  //"uniform sampler2D ourTexture;"
-  //"void main()"
-  //"{"
-  //"outColor = texture(ourTexture, TexCoord) * vec4(Color, 1.0);"
-  //"}";
-
-  GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
-  glShaderSource(vertexShader, 1, &vertexShaderSource, NULL);
-  glCompileShader(vertexShader);
-
-  GLint result;
-  GLchar errorLog[512];
-  glGetShaderiv(vertexShader, GL_COMPILE_STATUS, &result);
-  if (!result)
-  {
-    glGetShaderInfoLog(vertexShader, 512, NULL, errorLog);
-    cerr << "ERROR: vertex shader result error\n" << errorLog << endl;
-    glDeleteShader(vertexShader);
+// draws the last frame once more and writes it to 'path' (.png, .jpg or
+// .qoi); the back buffer is undefined after a swap, so it can't be reused
+bool saveFrame(GLFWwindow* window, char const* path)
+{
+  TRACE_ZONE("saveFrame");
+  int width, height;
+  glfwGetFramebufferSize(window, &width, &height);
+  drawScene();
+
+  // GL rows run bottom up, the writers' top down
+  size_t rowSize = size_t(width) * 3;
+  vector<unsigned char> pixels(rowSize * height), flipped(pixels.size());
+  glReadBuffer(GL_BACK);
+  glPixelStorei(GL_PACK_ALIGNMENT, 1);
+  glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, pixels.data());
+  for (int y = 0; y < height; ++y)
+    copy(pixels.begin() + y * rowSize, pixels.begin() + (y + 1) * rowSize, flipped.begin() + (height - 1 - y) * rowSize);
+
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  if (!writeImage(path, flipped.data(), width, height, 3))
     return false;
-  }
+  cout << "Saved " << width << "x" << height << " frame to " << path << " in "
+    << chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() << " ms" << endl;
+  return true;
+}
 
-  GLuint fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-  glShaderSource(fragmentShader, 1, &fragmentShaderSource, NULL);
-  glCompileShader(fragmentShader);
+bool initShaderProgram(string const& shaderDirectory) {
 
-  glGetShaderiv(fragmentShader, GL_COMPILE_STATUS, &result);
-  if (!result)
-  {
-    glGetShaderInfoLog(fragmentShader, 512, NULL, errorLog);
-    cerr << "ERROR: fragment shader result error\n" << errorLog << endl;
+  TRACE_ZONE("initShaderProgram");
 
+  // fixed attribute locations let every permutation use the one vertex array
+  g_shaderLibrary.init(&g_shaderCache, [](GLuint program) {
+    glBindAttribLocation(program, 0, "aPos");
+    glBindAttribLocation(program, 1, "aColor");
+    glBindAttribLocation(program, 2, "aTexCoord");
+    glBindFragDataLocation(program, 0, "outColor");
+  });
+  if (!g_shaderLibrary.load((shaderDirectory + "/quad.vert").c_str(), (shaderDirectory + "/quad.frag").c_str()))
     return false;
-  }
 
-  // Link the vertex and fragment shader into a shader program
-  g_shaderProgramID = glCreateProgram();
-  glAttachShader(g_shaderProgramID, vertexShader);
-  glAttachShader(g_shaderProgramID, fragmentShader);
-  glBindFragDataLocation(g_shaderProgramID, 0, "outColor");
-  glLinkProgram(g_shaderProgramID);
+  // every permutation the viewer can switch to; YUV and 16-bit input are
+  // alternative sources, so never both
+  for (unsigned features = 0; features < (1u << FEATURE_COUNT); ++features)
+    if ((features & (FEATURE_YUV_INPUT | FEATURE_INPUT_16BIT)) != (FEATURE_YUV_INPUT | FEATURE_INPUT_16BIT))
+      g_shaderLibrary.request(features);
+  if (!g_shaderLibrary.compileAll())
+    return false;
+
+  g_shaderProgramID = g_shaderLibrary.program(0);
   glUseProgram(g_shaderProgramID);
 
   // specify the layout of the vertex data
@@ -312,21 +638,30 @@ bool initShaderProgram() {
     return false;
   }
 
-  glDeleteShader(vertexShader);
-  glDeleteShader(fragmentShader);
+  return true;
+}
 
-  glGetProgramiv(g_shaderProgramID, GL_LINK_STATUS, &result);
-  if (!result) {
-    glGetProgramInfoLog(g_shaderProgramID, 512, NULL, errorLog);
-    cerr << "ERROR: shader program result error\n" << errorLog << endl;
+// switches to the YUV permutation, sampling luma from texture unit 0 and
+// chroma from unit 1 (see VideoSource::bind and SharedFrameSource::bind)
+bool useVideoProgram()
+{
+  GLuint program = g_shaderLibrary.program(FEATURE_YUV_INPUT);
+  if (!program) {
+    cerr << "Error: no YUV shader for video input" << endl;
     return false;
   }
 
+  g_shaderProgramID = program;
+  glUseProgram(g_shaderProgramID);
+  glUniform1i(glGetUniformLocation(g_shaderProgramID, "uLuma"), 0);
+  glUniform1i(glGetUniformLocation(g_shaderProgramID, "uChroma"), 1);
   return true;
 }
 
 bool defineTextureObject() {
 
+  TRACE_ZONE("defineTextureObject");
+
   glGenVertexArrays(1, &g_VAO);
   glGenBuffers(1, &g_VBO);
   glGenBuffers(1, &g_EBO);
@@ -348,6 +683,13 @@ void framebufferSizeCallback(GLFWwindow* window, int width, int height)
 
   framebufferWidth = width;
   framebufferHeight = height;
+  g_frameDirty = true;
+}
+
+// the window was uncovered or otherwise lost its contents
+void refreshCallback(GLFWwindow* window)
+{
+  g_frameDirty = true;
 }
 
 void errorCallback(int errorCode, const char* errorDescription)
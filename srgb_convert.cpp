@@ -0,0 +1,142 @@
+#include "srgb_convert.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <vector>
+
+#include "cpu_features.h"
+#include "half_float.h"
+#include "job_system.h"
+#include "simd_lane.h"
+
+namespace scalar {
+typedef LaneScalar Lane;
+#include "simd_math_kernels.inl"
+#include "srgb_convert_kernels.inl"
+}
+
+#ifdef SIMD_X86
+SIMD_BEGIN_TARGET_SSE2
+namespace sse2 {
+typedef LaneSSE2 Lane;
+#include "simd_math_kernels.inl"
+#include "srgb_convert_kernels.inl"
+}
+SIMD_END_TARGET
+
+SIMD_BEGIN_TARGET_AVX2
+namespace avx2 {
+typedef LaneAVX2 Lane;
+#include "simd_math_kernels.inl"
+#include "srgb_convert_kernels.inl"
+}
+SIMD_END_TARGET
+
+SIMD_BEGIN_TARGET_AVX512
+namespace avx512 {
+typedef LaneAVX512 Lane;
+#include "simd_math_kernels.inl"
+#include "srgb_convert_kernels.inl"
+}
+SIMD_END_TARGET
+#endif
+
+// below this many components per band, a job costs more than it saves
+static const long kMinComponentsPerBand = 1 << 16;
+
+// splits rows [0, height) into at most 'threads' bands (0: as many as the job
+// system wants) and runs body(first, end) on each through the shared
+// JobSystem, the calling thread included
+static void forEachRowBand(int height, int rowSize, int threads, std::function<void(int, int)> const& body)
+{
+  int grain = int(std::max(1L, kMinComponentsPerBand / std::max(1, rowSize)));
+  if (threads > 0)
+    grain = std::max(grain, (height + threads - 1) / threads);
+  jobSystem().parallelFor(0, height, grain, body);
+}
+
+static bool hasAlpha(int channels)
+{
+  return channels == 2 || channels == 4;
+}
+
+struct DecodeTables
+{
+  float color[256], alpha[256];
+  glm::uint16 colorHalf[256], alphaHalf[256];
+
+  DecodeTables()
+  {
+    for (int i = 0; i < 256; ++i) {
+      double c = i / 255.0;
+      color[i] = float(c <= 0.04045 ? c / 12.92 : std::pow((c + 0.055) / 1.055, 2.4));
+      alpha[i] = float(c);
+    }
+    packHalfArray(color, colorHalf, 256);
+    packHalfArray(alpha, alphaHalf, 256);
+  }
+};
+
+// built on first use; C++11 makes the initialisation thread safe
+static DecodeTables const& decodeTables()
+{
+  static DecodeTables tables;
+  return tables;
+}
+
+template<typename T>
+static void decodeImage(unsigned char const* src, T* dst, int width, int height, int channels, int threads,
+  T const* color, T const* alpha)
+{
+  int rowSize = width * channels;
+  forEachRowBand(height, rowSize, threads, [=](int first, int end) {
+    std::size_t begin = std::size_t(first) * rowSize, stop = std::size_t(end) * rowSize;
+    if (hasAlpha(channels)) {
+      for (std::size_t i = begin; i < stop; i += channels) {
+        for (int k = 0; k < channels - 1; ++k)
+          dst[i + k] = color[src[i + k]];
+        dst[i + channels - 1] = alpha[src[i + channels - 1]];
+      }
+    } else {
+      for (std::size_t i = begin; i < stop; ++i)
+        dst[i] = color[src[i]];
+    }
+  });
+}
+
+void srgbToLinear(unsigned char const* src, float* dst, int width, int height, int channels, int threads)
+{
+  DecodeTables const& tables = decodeTables();
+  decodeImage(src, dst, width, height, channels, threads, tables.color, tables.alpha);
+}
+
+void srgbToLinearHalf(unsigned char const* src, glm::uint16* dst, int width, int height, int channels, int threads)
+{
+  DecodeTables const& tables = decodeTables();
+  decodeImage(src, dst, width, height, channels, threads, tables.colorHalf, tables.alphaHalf);
+}
+
+void linearToSrgb(float const* src, unsigned char* dst, int width, int height, int channels, int threads)
+{
+  // 1 at the alpha component, long enough to start at any phase of a pixel
+  float alphaPattern[4 + 16] = {};
+  if (hasAlpha(channels))
+    for (int k = channels - 1; k < 4 + 16; k += channels)
+      alphaPattern[k] = 1.0f;
+
+  SimdLevel level = activeSimdLevel();
+  int rowSize = width * channels;
+  forEachRowBand(height, rowSize, threads, [&](int first, int end) {
+    std::size_t begin = std::size_t(first) * rowSize, count = std::size_t(end - first) * rowSize;
+    switch (level) {
+#ifdef SIMD_X86
+    case SIMD_AVX512: avx512::encodeRange(src + begin, dst + begin, count, channels, alphaPattern); break;
+    case SIMD_AVX2: avx2::encodeRange(src + begin, dst + begin, count, channels, alphaPattern); break;
+    case SIMD_SSE2: sse2::encodeRange(src + begin, dst + begin, count, channels, alphaPattern); break;
+#endif
+    default: scalar::encodeRange(src + begin, dst + begin, count, channels, alphaPattern); break;
+    }
+  });
+}
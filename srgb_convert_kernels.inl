@@ -0,0 +1,47 @@
+// Linear float to 8-bit sRGB written against 'Lane' (simd_lane.h);
+// srgb_convert.cpp includes this after simd_math_kernels.inl once per
+// instruction set.
+
+static Lane::V saturate(Lane::V x)
+{
+  // max() returns its second operand for NaN, so NaN clamps to 0
+  return Lane::min(Lane::max(x, Lane::set1(0.0f)), Lane::set1(1.0f));
+}
+
+// x in [0, 1]; the curve only matters above 0.0031308, so x^(1/2.4) can skip
+// the special cases powLane handles
+static Lane::V encodeSrgb(Lane::V x)
+{
+  Lane::V safe = Lane::max(x, Lane::set1(0.0031308f));
+  Lane::V power = expNormal(Lane::mul(logNormal(safe), Lane::set1(1.0f / 2.4f)));
+  Lane::V curve = Lane::fms(Lane::set1(1.055f), power, Lane::set1(0.055f));
+  Lane::V linear = Lane::mul(x, Lane::set1(12.92f));
+  return Lane::select(Lane::le(x, Lane::set1(0.0031308f)), linear, curve);
+}
+
+static Lane::I encodeBlock(float const* src, float const* alphaPattern)
+{
+  Lane::V x = saturate(Lane::loadu(src));
+  Lane::M alpha = Lane::lt(Lane::set1(0.5f), Lane::loadu(alphaPattern));
+  return Lane::roundToInt(Lane::mul(Lane::select(alpha, x, encodeSrgb(x)), Lane::set1(255.0f)));
+}
+
+// 'count' components starting on a pixel boundary; alphaPattern[k] is 1 where
+// component k of a row is alpha and is read at offsets up to channels - 1
+static void encodeRange(float const* src, unsigned char* dst, std::size_t count, int channels,
+  float const* alphaPattern)
+{
+  std::size_t i = 0;
+  int phase = 0;
+  for (; i + Lane::kWidth <= count; i += Lane::kWidth) {
+    Lane::storeBytes(dst + i, encodeBlock(src + i, alphaPattern + phase));
+    phase = (phase + Lane::kWidth) % channels;
+  }
+  if (i < count) {
+    float tail[Lane::kWidth] = {};
+    unsigned char bytes[Lane::kWidth];
+    std::memcpy(tail, src + i, (count - i) * sizeof(float));
+    Lane::storeBytes(bytes, encodeBlock(tail, alphaPattern + phase));
+    std::memcpy(dst + i, bytes, count - i);
+  }
+}
@@ -0,0 +1,7 @@
+// Single translation unit that holds the stb_image implementation so the
+// other sources can include the header for declarations only.
+#include "trace.h"
+
+#define STBI_TRACE_ZONE(name) TRACE_ZONE(name)
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb-master/stb_image.h"
@@ -0,0 +1,238 @@
+#include "texture_uploader.h"
+#include "stb-master/stb_image.h"
+#include "trace.h"
+
+#include <GLFW/glfw3.h>
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+using namespace std;
+
+namespace {
+
+size_t componentSize(GLenum type)
+{
+  switch (type) {
+  case GL_UNSIGNED_BYTE:
+    return 1;
+  case GL_FLOAT:
+    return 4;
+  default:
+    return 2;  // GL_HALF_FLOAT, GL_UNSIGNED_SHORT
+  }
+}
+
+} // namespace
+
+TextureUploader::TextureUploader()
+  : m_context(NULL), m_buffer(0), m_stopping(false), m_nextTicket(1), m_stats()
+{
+}
+
+TextureUploader::~TextureUploader()
+{
+  shutdown();
+}
+
+bool TextureUploader::init(GLFWwindow* window)
+{
+  // same version and profile hints as the main window, so GLEW's function
+  // pointers are valid in this context too
+  glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+  m_context = glfwCreateWindow(1, 1, "texture upload", NULL, window);
+  if (!m_context) {
+    cerr << "Warning: no shared GL context, textures are uploaded on the render thread" << endl;
+    return false;
+  }
+
+  m_stopping = false;
+  m_thread = thread(&TextureUploader::threadLoop, this);
+  return true;
+}
+
+void TextureUploader::shutdown()
+{
+  if (m_thread.joinable()) {
+    {
+      lock_guard<mutex> guard(m_lock);
+      m_stopping = true;
+    }
+    m_wake.notify_all();
+    m_thread.join();
+  }
+  if (m_context) {
+    glfwDestroyWindow(m_context);
+    m_context = NULL;
+  }
+
+  // the rest is shared between the contexts, so the main one can clean up
+  if (m_buffer) {
+    glDeleteBuffers(1, &m_buffer);
+    m_buffer = 0;
+  }
+  for (size_t i = 0; i < m_requests.size(); ++i)
+    stbi_image_free(m_requests[i].image.pixels);
+  m_requests.clear();
+  for (size_t i = 0; i < m_uploads.size(); ++i) {
+    glDeleteSync(m_uploads[i].fence);
+    glDeleteTextures(1, &m_uploads[i].texture);
+  }
+  m_uploads.clear();
+}
+
+unsigned TextureUploader::submit(DecodedImage const& image)
+{
+  Request request;
+  request.image = image;
+  request.submitted = Clock::now();
+  {
+    lock_guard<mutex> guard(m_lock);
+    request.ticket = m_nextTicket++;
+    m_requests.push_back(request);
+  }
+  m_wake.notify_one();
+  return request.ticket;
+}
+
+bool TextureUploader::poll(unsigned& ticket, GLuint& texture)
+{
+  if (!threaded()) {
+    Request request;
+    bool pending = false;
+    {
+      lock_guard<mutex> guard(m_lock);
+      if (!m_requests.empty()) {
+        request = m_requests.front();
+        m_requests.pop_front();
+        pending = true;
+      }
+    }
+    if (pending) {
+      Upload issued = upload(request);
+      lock_guard<mutex> guard(m_lock);
+      m_uploads.push_back(issued);
+    }
+  }
+
+  lock_guard<mutex> guard(m_lock);
+  for (size_t i = 0; i < m_uploads.size(); ++i) {
+    // a zero timeout only asks; the uploader flushed after the fence, so it
+    // signals without any help from this context
+    GLenum status = glClientWaitSync(m_uploads[i].fence, 0, 0);
+    if (status == GL_TIMEOUT_EXPIRED)
+      continue;
+    if (status == GL_WAIT_FAILED)
+      cerr << "Error: waiting on a texture upload fence failed" << endl;
+
+    ticket = m_uploads[i].ticket;
+    texture = m_uploads[i].texture;
+    glDeleteSync(m_uploads[i].fence);
+    double latency = chrono::duration<double, milli>(Clock::now() - m_uploads[i].submitted).count();
+    m_stats.maxLatencyMs = max(m_stats.maxLatencyMs, latency);
+    m_uploads.erase(m_uploads.begin() + i);
+    return true;
+  }
+  return false;
+}
+
+bool TextureUploader::ready() const
+{
+  lock_guard<mutex> guard(m_lock);
+  if (!threaded() && !m_requests.empty())
+    return true;
+  for (size_t i = 0; i < m_uploads.size(); ++i)
+    if (glClientWaitSync(m_uploads[i].fence, 0, 0) != GL_TIMEOUT_EXPIRED)
+      return true;
+  return false;
+}
+
+TextureUploader::Stats TextureUploader::stats() const
+{
+  lock_guard<mutex> guard(m_lock);
+  return m_stats;
+}
+
+void TextureUploader::threadLoop()
+{
+  TRACE_THREAD_NAME("texture upload");
+  glfwMakeContextCurrent(m_context);
+
+  for (;;) {
+    Request request;
+    {
+      unique_lock<mutex> guard(m_lock);
+      m_wake.wait(guard, [&] { return m_stopping || !m_requests.empty(); });
+      // whatever is still queued is freed by shutdown()
+      if (m_stopping)
+        break;
+      request = m_requests.front();
+      m_requests.pop_front();
+    }
+
+    Upload issued = upload(request);
+    lock_guard<mutex> guard(m_lock);
+    m_uploads.push_back(issued);
+  }
+
+  glDeleteBuffers(1, &m_buffer);
+  m_buffer = 0;
+  glfwMakeContextCurrent(NULL);
+}
+
+// runs with the uploading context current; frees the request's pixels
+TextureUploader::Upload TextureUploader::upload(Request& request)
+{
+  TRACE_ZONE("uploadTexture");
+  Clock::time_point start = Clock::now();
+
+  DecodedImage& image = request.image;
+  size_t size = size_t(image.width) * image.height * 3 * componentSize(image.type);
+
+  // orphaning the buffer gives it fresh storage, so the copy never waits for
+  // the GPU to finish reading the previous image out of it
+  if (!m_buffer)
+    glGenBuffers(1, &m_buffer);
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_buffer);
+  glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+  void* mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+  if (mapped)
+    memcpy(mapped, image.pixels, size);
+  // an unmap can fail if the storage was lost meanwhile; then upload from
+  // client memory instead
+  bool staged = mapped && glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+  if (!staged)
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+  Upload issued;
+  issued.ticket = request.ticket;
+  issued.submitted = request.submitted;
+  glGenTextures(1, &issued.texture);
+  glBindTexture(GL_TEXTURE_2D, issued.texture);
+
+  glPixelStorei(GL_UNPACK_ALIGNMENT, image.rowAlignment);
+  // with the buffer bound the data pointer is an offset into it
+  glTexImage2D(GL_TEXTURE_2D, 0, image.internalFormat, image.width, image.height, 0, GL_RGB, image.type,
+    staged ? NULL : image.pixels);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+  // a fence only signals once it reaches the GPU, hence the flush
+  issued.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  glFlush();
+
+  stbi_image_free(image.pixels);
+  image.pixels = NULL;
+
+  lock_guard<mutex> guard(m_lock);
+  ++m_stats.uploads;
+  m_stats.bytes += size;
+  m_stats.uploadMs += chrono::duration<double, milli>(Clock::now() - start).count();
+  return issued;
+}
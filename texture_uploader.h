@@ -0,0 +1,96 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct GLFWwindow;
+
+// pixels decoded off the GL thread, waiting for the uploader
+struct DecodedImage {
+  void* pixels;       // from stb_image; freed once uploaded
+  int width, height;
+  GLint internalFormat;
+  GLenum type;        // of each component; rows are always GL_RGB and tightly packed
+  int rowAlignment;
+};
+
+// Uploads textures from a thread of its own through a second GL context that
+// shares objects with the main window, so the render loop never waits on a
+// glTexImage2D. Queued images are copied into a pixel unpack buffer and the
+// texture is filled from there; a fence follows every upload, and poll() only
+// hands a texture to the render thread once its fence has signalled, so
+// binding it on the main context from then on sees the finished contents.
+//
+// Without a shared context (init failed or wasn't called) poll() does the
+// uploads itself on the calling thread, one per call.
+class TextureUploader
+{
+public:
+  struct Stats {
+    unsigned uploads;
+    unsigned long long bytes;
+    double uploadMs;      // copying and issuing, on whichever thread uploads
+    double maxLatencyMs;  // longest time from submit() to poll() handing the texture over
+  };
+
+  TextureUploader();
+  ~TextureUploader();
+
+  // Main thread, with 'window' current: creates the hidden shared context
+  // (GLFW only creates windows there) and starts the upload thread.
+  bool init(GLFWwindow* window);
+
+  // main thread, before glfwTerminate; textures never handed over are deleted
+  void shutdown();
+
+  // Any thread. Takes ownership of image.pixels and returns the ticket
+  // poll() reports the texture under.
+  unsigned submit(DecodedImage const& image);
+
+  // Render thread, never blocks: true with the next texture whose upload has
+  // completed. The caller owns the texture from then on.
+  bool poll(unsigned& ticket, GLuint& texture);
+
+  // render thread, never blocks: whether poll() would hand a texture over
+  bool ready() const;
+
+  bool threaded() const { return m_context != NULL; }
+  Stats stats() const;
+
+private:
+  typedef std::chrono::steady_clock Clock;
+
+  struct Request {
+    unsigned ticket;
+    DecodedImage image;
+    Clock::time_point submitted;
+  };
+
+  struct Upload {
+    unsigned ticket;
+    GLuint texture;
+    GLsync fence;
+    Clock::time_point submitted;
+  };
+
+  void threadLoop();
+  Upload upload(Request& request);
+
+  GLFWwindow* m_context;
+  std::thread m_thread;
+  GLuint m_buffer;  // the unpack buffer; belongs to whichever thread uploads
+
+  mutable std::mutex m_lock;
+  std::condition_variable m_wake;
+  bool m_stopping;
+  unsigned m_nextTicket;
+  std::deque<Request> m_requests;
+  std::vector<Upload> m_uploads;  // issued, fence not yet seen signalled
+  Stats m_stats;
+};
@@ -0,0 +1,160 @@
+#include "trace.h"
+
+#ifdef ENABLE_TRACE
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+namespace {
+
+struct TraceEvent
+{
+  char const* name;
+  unsigned long long begin, end;
+};
+
+// Events go into fixed-size chunks that are never moved or freed, so the
+// writer can read a chunk while its owner keeps appending: 'count' is only
+// published after the event itself has been stored.
+struct TraceChunk
+{
+  static const size_t kCapacity = 16384;
+
+  TraceEvent events[kCapacity];
+  atomic<size_t> count;
+  atomic<TraceChunk*> next;
+
+  TraceChunk() : count(0), next(NULL) {}
+};
+
+struct TraceThread
+{
+  TraceChunk* first;
+  TraceChunk* last;
+  unsigned id;
+  char const* name;
+  TraceThread* next;
+};
+
+typedef chrono::steady_clock Clock;
+
+// all thread buffers ever created, pushed lock-free on first use
+atomic<TraceThread*> s_threads(NULL);
+atomic<unsigned> s_nextThreadId(1);
+
+// reference point to convert timestamps to microseconds since startup
+unsigned long long const s_startTicks = traceTimestamp();
+Clock::time_point const s_startTime = Clock::now();
+
+thread_local TraceThread* t_thread = NULL;
+
+TraceThread* registerThread()
+{
+  TraceThread* thread = new TraceThread;
+  thread->first = thread->last = new TraceChunk;
+  thread->id = s_nextThreadId.fetch_add(1);
+  thread->name = NULL;
+  thread->next = s_threads.load(memory_order_relaxed);
+  while (!s_threads.compare_exchange_weak(thread->next, thread, memory_order_release, memory_order_relaxed)) {
+  }
+  return thread;
+}
+
+double ticksPerMicrosecond()
+{
+#ifdef TRACE_HAS_TSC
+  // calibrate the TSC against the steady clock over the whole session
+  double elapsedUs = chrono::duration<double, micro>(Clock::now() - s_startTime).count();
+  double elapsedTicks = double(traceTimestamp() - s_startTicks);
+  return elapsedUs > 0.0 ? elapsedTicks / elapsedUs : 1.0;
+#else
+  return 1000.0;
+#endif
+}
+
+void writeJsonString(FILE* file, char const* text)
+{
+  fputc('"', file);
+  for (; *text; ++text) {
+    if (*text == '"' || *text == '\\')
+      fputc('\\', file);
+    fputc(*text, file);
+  }
+  fputc('"', file);
+}
+
+}
+
+void traceRecord(char const* name, unsigned long long begin, unsigned long long end)
+{
+  TraceThread* thread = t_thread;
+  if (!thread)
+    thread = t_thread = registerThread();
+
+  TraceChunk* chunk = thread->last;
+  size_t index = chunk->count.load(memory_order_relaxed);
+  if (index == TraceChunk::kCapacity) {
+    TraceChunk* fresh = new TraceChunk;
+    chunk->next.store(fresh, memory_order_release);
+    thread->last = chunk = fresh;
+    index = 0;
+  }
+
+  TraceEvent& event = chunk->events[index];
+  event.name = name;
+  event.begin = begin;
+  event.end = end;
+  chunk->count.store(index + 1, memory_order_release);
+}
+
+void traceSetThreadName(char const* name)
+{
+  if (!t_thread)
+    t_thread = registerThread();
+  t_thread->name = name;
+}
+
+bool traceWriteChromeJson(char const* path)
+{
+  FILE* file = fopen(path, "w");
+  if (!file) {
+    cerr << "Error: can't open trace file " << path << endl;
+    return false;
+  }
+
+  double ticksPerUs = ticksPerMicrosecond();
+  bool first = true;
+
+  fputs("{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n", file);
+  for (TraceThread* thread = s_threads.load(memory_order_acquire); thread; thread = thread->next) {
+    if (thread->name) {
+      fprintf(file, "%s{\"ph\": \"M\", \"name\": \"thread_name\", \"pid\": 1, \"tid\": %u, \"args\": {\"name\": ", first ? "" : ",\n", thread->id);
+      writeJsonString(file, thread->name);
+      fputs("}}", file);
+      first = false;
+    }
+
+    for (TraceChunk* chunk = thread->first; chunk; chunk = chunk->next.load(memory_order_acquire)) {
+      size_t count = chunk->count.load(memory_order_acquire);
+      for (size_t i = 0; i < count; ++i) {
+        TraceEvent const& event = chunk->events[i];
+        fprintf(file, "%s{\"ph\": \"X\", \"name\": ", first ? "" : ",\n");
+        writeJsonString(file, event.name);
+        fprintf(file, ", \"pid\": 1, \"tid\": %u, \"ts\": %.3f, \"dur\": %.3f}", thread->id,
+          (event.begin - s_startTicks) / ticksPerUs, (event.end - event.begin) / ticksPerUs);
+        first = false;
+      }
+    }
+  }
+  fputs("\n]}\n", file);
+
+  fclose(file);
+  return true;
+}
+
+#endif
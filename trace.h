@@ -0,0 +1,77 @@
+#pragma once
+
+// Scoped trace zones exported as Chrome trace-event JSON (chrome://tracing,
+// ui.perfetto.dev). Build with ENABLE_TRACE to record (opengl_test.vcxproj
+// defines it for msbuild /p:EnableTrace=true, in any configuration, and the
+// app then writes --chrome-trace FILE at exit); without it the macros expand
+// to nothing and cost nothing.
+//
+//   void decode() {
+//     TRACE_ZONE("decode");
+//     ...
+//   }
+//
+// Every thread appends to its own buffer, so recording takes no locks: a zone
+// costs two timestamp reads and one store into thread-local memory. That is
+// about 60 ns back to back in a VM where a TSC read takes 20 ns and each
+// event lands in memory not touched before, more than the 50 ns aimed for;
+// the store alone is 3 ns while the buffer is in cache.
+
+#ifdef ENABLE_TRACE
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define TRACE_HAS_TSC
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#define TRACE_HAS_TSC
+#else
+#include <chrono>
+#endif
+
+inline unsigned long long traceTimestamp()
+{
+#ifdef TRACE_HAS_TSC
+  return __rdtsc();
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+// appends a complete event to the calling thread's buffer
+void traceRecord(char const* name, unsigned long long begin, unsigned long long end);
+
+// names the calling thread in the exported trace
+void traceSetThreadName(char const* name);
+
+// writes every thread's events recorded so far; call once threads are idle
+bool traceWriteChromeJson(char const* path);
+
+class TraceZone
+{
+public:
+  explicit TraceZone(char const* name) : m_name(name), m_begin(traceTimestamp()) {}
+  ~TraceZone() { traceRecord(m_name, m_begin, traceTimestamp()); }
+
+private:
+  TraceZone(TraceZone const&);
+  TraceZone& operator=(TraceZone const&);
+
+  char const* m_name;
+  unsigned long long m_begin;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_ZONE(name) TraceZone TRACE_CONCAT(traceZone_, __LINE__)(name)
+#define TRACE_THREAD_NAME(name) traceSetThreadName(name)
+
+#else
+
+#define TRACE_ZONE(name) ((void)0)
+#define TRACE_THREAD_NAME(name) ((void)0)
+
+inline bool traceWriteChromeJson(char const*) { return false; }
+
+#endif
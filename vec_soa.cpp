@@ -0,0 +1,364 @@
+#include "vec_soa.h"
+
+#include <cmath>
+
+#include "cpu_features.h"
+
+#ifdef SIMD_X86
+#include <immintrin.h>
+#endif
+
+// All kernels run over padded_size() elements, a multiple of 16, so no kernel
+// needs a tail loop. The scalar versions are the reference for the others.
+
+template<glm::length_t L>
+static void dotScalar(vec_soa<L> const& a, vec_soa<L> const& b, float_soa& out)
+{
+  for (std::size_t i = 0; i < a.padded_size(); ++i) {
+    float sum = 0.0f;
+    for (glm::length_t c = 0; c < L; ++c)
+      sum += a[c][i] * b[c][i];
+    out[0][i] = sum;
+  }
+}
+
+static void crossScalar(vec3_soa const& a, vec3_soa const& b, vec3_soa& out)
+{
+  for (std::size_t i = 0; i < a.padded_size(); ++i) {
+    float x = a[1][i] * b[2][i] - b[1][i] * a[2][i];
+    float y = a[2][i] * b[0][i] - b[2][i] * a[0][i];
+    float z = a[0][i] * b[1][i] - b[0][i] * a[1][i];
+    out[0][i] = x;
+    out[1][i] = y;
+    out[2][i] = z;
+  }
+}
+
+template<glm::length_t L>
+static void normalizeScalar(vec_soa<L> const& v, vec_soa<L>& out)
+{
+  for (std::size_t i = 0; i < v.padded_size(); ++i) {
+    float sum = 0.0f;
+    for (glm::length_t c = 0; c < L; ++c)
+      sum += v[c][i] * v[c][i];
+    float scale = 1.0f / std::sqrt(sum);
+    for (glm::length_t c = 0; c < L; ++c)
+      out[c][i] = v[c][i] * scale;
+  }
+}
+
+template<glm::length_t L>
+static void mixScalar(vec_soa<L> const& a, vec_soa<L> const& b, float t, vec_soa<L>& out)
+{
+  for (glm::length_t c = 0; c < L; ++c)
+    for (std::size_t i = 0; i < a.padded_size(); ++i)
+      out[c][i] = a[c][i] * (1.0f - t) + b[c][i] * t;
+}
+
+template<glm::length_t L>
+static void clampScalar(vec_soa<L> const& v, float minVal, float maxVal, vec_soa<L>& out)
+{
+  for (glm::length_t c = 0; c < L; ++c)
+    for (std::size_t i = 0; i < v.padded_size(); ++i)
+      out[c][i] = glm::clamp(v[c][i], minVal, maxVal);
+}
+
+template<glm::length_t L>
+static void fmaScalar(vec_soa<L> const& a, vec_soa<L> const& b, vec_soa<L> const& d, vec_soa<L>& out)
+{
+  for (glm::length_t c = 0; c < L; ++c)
+    for (std::size_t i = 0; i < a.padded_size(); ++i)
+      out[c][i] = a[c][i] * b[c][i] + d[c][i];
+}
+
+#ifdef SIMD_X86
+template<glm::length_t L>
+SIMD_TARGET_SSE2 static void dotSSE(vec_soa<L> const& a, vec_soa<L> const& b, float_soa& out)
+{
+  for (std::size_t i = 0; i < a.padded_size(); i += 4) {
+    __m128 sum = _mm_mul_ps(_mm_load_ps(a[0] + i), _mm_load_ps(b[0] + i));
+    for (glm::length_t c = 1; c < L; ++c)
+      sum = _mm_add_ps(_mm_mul_ps(_mm_load_ps(a[c] + i), _mm_load_ps(b[c] + i)), sum);
+    _mm_store_ps(out[0] + i, sum);
+  }
+}
+
+SIMD_TARGET_SSE2 static void crossSSE(vec3_soa const& a, vec3_soa const& b, vec3_soa& out)
+{
+  for (std::size_t i = 0; i < a.padded_size(); i += 4) {
+    __m128 ax = _mm_load_ps(a[0] + i), ay = _mm_load_ps(a[1] + i), az = _mm_load_ps(a[2] + i);
+    __m128 bx = _mm_load_ps(b[0] + i), by = _mm_load_ps(b[1] + i), bz = _mm_load_ps(b[2] + i);
+    _mm_store_ps(out[0] + i, _mm_sub_ps(_mm_mul_ps(ay, bz), _mm_mul_ps(by, az)));
+    _mm_store_ps(out[1] + i, _mm_sub_ps(_mm_mul_ps(az, bx), _mm_mul_ps(bz, ax)));
+    _mm_store_ps(out[2] + i, _mm_sub_ps(_mm_mul_ps(ax, by), _mm_mul_ps(bx, ay)));
+  }
+}
+
+template<glm::length_t L>
+SIMD_TARGET_SSE2 static void normalizeSSE(vec_soa<L> const& v, vec_soa<L>& out)
+{
+  for (std::size_t i = 0; i < v.padded_size(); i += 4) {
+    __m128 comp[L];
+    __m128 sum = _mm_setzero_ps();
+    for (glm::length_t c = 0; c < L; ++c) {
+      comp[c] = _mm_load_ps(v[c] + i);
+      sum = _mm_add_ps(_mm_mul_ps(comp[c], comp[c]), sum);
+    }
+    __m128 scale = _mm_div_ps(_mm_set1_ps(1.0f), _mm_sqrt_ps(sum));
+    for (glm::length_t c = 0; c < L; ++c)
+      _mm_store_ps(out[c] + i, _mm_mul_ps(comp[c], scale));
+  }
+}
+
+template<glm::length_t L>
+SIMD_TARGET_SSE2 static void mixSSE(vec_soa<L> const& a, vec_soa<L> const& b, float t, vec_soa<L>& out)
+{
+  __m128 tv = _mm_set1_ps(t), sv = _mm_set1_ps(1.0f - t);
+  for (glm::length_t c = 0; c < L; ++c)
+    for (std::size_t i = 0; i < a.padded_size(); i += 4)
+      _mm_store_ps(out[c] + i, _mm_add_ps(_mm_mul_ps(_mm_load_ps(a[c] + i), sv), _mm_mul_ps(_mm_load_ps(b[c] + i), tv)));
+}
+
+template<glm::length_t L>
+SIMD_TARGET_SSE2 static void clampSSE(vec_soa<L> const& v, float minVal, float maxVal, vec_soa<L>& out)
+{
+  __m128 lo = _mm_set1_ps(minVal), hi = _mm_set1_ps(maxVal);
+  for (glm::length_t c = 0; c < L; ++c)
+    for (std::size_t i = 0; i < v.padded_size(); i += 4)
+      _mm_store_ps(out[c] + i, _mm_max_ps(_mm_min_ps(_mm_load_ps(v[c] + i), hi), lo));
+}
+
+template<glm::length_t L>
+SIMD_TARGET_SSE2 static void fmaSSE(vec_soa<L> const& a, vec_soa<L> const& b, vec_soa<L> const& d, vec_soa<L>& out)
+{
+  for (glm::length_t c = 0; c < L; ++c)
+    for (std::size_t i = 0; i < a.padded_size(); i += 4)
+      _mm_store_ps(out[c] + i, _mm_add_ps(_mm_mul_ps(_mm_load_ps(a[c] + i), _mm_load_ps(b[c] + i)), _mm_load_ps(d[c] + i)));
+}
+
+template<glm::length_t L>
+SIMD_TARGET_AVX2 static void dotAVX2(vec_soa<L> const& a, vec_soa<L> const& b, float_soa& out)
+{
+  for (std::size_t i = 0; i < a.padded_size(); i += 8) {
+    __m256 sum = _mm256_mul_ps(_mm256_load_ps(a[0] + i), _mm256_load_ps(b[0] + i));
+    for (glm::length_t c = 1; c < L; ++c)
+      sum = _mm256_fmadd_ps(_mm256_load_ps(a[c] + i), _mm256_load_ps(b[c] + i), sum);
+    _mm256_store_ps(out[0] + i, sum);
+  }
+}
+
+SIMD_TARGET_AVX2 static void crossAVX2(vec3_soa const& a, vec3_soa const& b, vec3_soa& out)
+{
+  for (std::size_t i = 0; i < a.padded_size(); i += 8) {
+    __m256 ax = _mm256_load_ps(a[0] + i), ay = _mm256_load_ps(a[1] + i), az = _mm256_load_ps(a[2] + i);
+    __m256 bx = _mm256_load_ps(b[0] + i), by = _mm256_load_ps(b[1] + i), bz = _mm256_load_ps(b[2] + i);
+    _mm256_store_ps(out[0] + i, _mm256_fmsub_ps(ay, bz, _mm256_mul_ps(by, az)));
+    _mm256_store_ps(out[1] + i, _mm256_fmsub_ps(az, bx, _mm256_mul_ps(bz, ax)));
+    _mm256_store_ps(out[2] + i, _mm256_fmsub_ps(ax, by, _mm256_mul_ps(bx, ay)));
+  }
+}
+
+template<glm::length_t L>
+SIMD_TARGET_AVX2 static void normalizeAVX2(vec_soa<L> const& v, vec_soa<L>& out)
+{
+  for (std::size_t i = 0; i < v.padded_size(); i += 8) {
+    __m256 comp[L];
+    __m256 sum = _mm256_setzero_ps();
+    for (glm::length_t c = 0; c < L; ++c) {
+      comp[c] = _mm256_load_ps(v[c] + i);
+      sum = _mm256_fmadd_ps(comp[c], comp[c], sum);
+    }
+    __m256 scale = _mm256_div_ps(_mm256_set1_ps(1.0f), _mm256_sqrt_ps(sum));
+    for (glm::length_t c = 0; c < L; ++c)
+      _mm256_store_ps(out[c] + i, _mm256_mul_ps(comp[c], scale));
+  }
+}
+
+template<glm::length_t L>
+SIMD_TARGET_AVX2 static void mixAVX2(vec_soa<L> const& a, vec_soa<L> const& b, float t, vec_soa<L>& out)
+{
+  __m256 tv = _mm256_set1_ps(t), sv = _mm256_set1_ps(1.0f - t);
+  for (glm::length_t c = 0; c < L; ++c)
+    for (std::size_t i = 0; i < a.padded_size(); i += 8)
+      _mm256_store_ps(out[c] + i, _mm256_fmadd_ps(_mm256_load_ps(b[c] + i), tv, _mm256_mul_ps(_mm256_load_ps(a[c] + i), sv)));
+}
+
+template<glm::length_t L>
+SIMD_TARGET_AVX2 static void clampAVX2(vec_soa<L> const& v, float minVal, float maxVal, vec_soa<L>& out)
+{
+  __m256 lo = _mm256_set1_ps(minVal), hi = _mm256_set1_ps(maxVal);
+  for (glm::length_t c = 0; c < L; ++c)
+    for (std::size_t i = 0; i < v.padded_size(); i += 8)
+      _mm256_store_ps(out[c] + i, _mm256_max_ps(_mm256_min_ps(_mm256_load_ps(v[c] + i), hi), lo));
+}
+
+template<glm::length_t L>
+SIMD_TARGET_AVX2 static void fmaAVX2(vec_soa<L> const& a, vec_soa<L> const& b, vec_soa<L> const& d, vec_soa<L>& out)
+{
+  for (glm::length_t c = 0; c < L; ++c)
+    for (std::size_t i = 0; i < a.padded_size(); i += 8)
+      _mm256_store_ps(out[c] + i, _mm256_fmadd_ps(_mm256_load_ps(a[c] + i), _mm256_load_ps(b[c] + i), _mm256_load_ps(d[c] + i)));
+}
+
+// GCC's AVX-512 headers pass _mm512_undefined_ps() through unmasked
+// builtins, which trips -Wmaybe-uninitialized once they're inlined
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+template<glm::length_t L>
+SIMD_TARGET_AVX512 static void dotAVX512(vec_soa<L> const& a, vec_soa<L> const& b, float_soa& out)
+{
+  for (std::size_t i = 0; i < a.padded_size(); i += 16) {
+    __m512 sum = _mm512_mul_ps(_mm512_load_ps(a[0] + i), _mm512_load_ps(b[0] + i));
+    for (glm::length_t c = 1; c < L; ++c)
+      sum = _mm512_fmadd_ps(_mm512_load_ps(a[c] + i), _mm512_load_ps(b[c] + i), sum);
+    _mm512_store_ps(out[0] + i, sum);
+  }
+}
+
+SIMD_TARGET_AVX512 static void crossAVX512(vec3_soa const& a, vec3_soa const& b, vec3_soa& out)
+{
+  for (std::size_t i = 0; i < a.padded_size(); i += 16) {
+    __m512 ax = _mm512_load_ps(a[0] + i), ay = _mm512_load_ps(a[1] + i), az = _mm512_load_ps(a[2] + i);
+    __m512 bx = _mm512_load_ps(b[0] + i), by = _mm512_load_ps(b[1] + i), bz = _mm512_load_ps(b[2] + i);
+    _mm512_store_ps(out[0] + i, _mm512_fmsub_ps(ay, bz, _mm512_mul_ps(by, az)));
+    _mm512_store_ps(out[1] + i, _mm512_fmsub_ps(az, bx, _mm512_mul_ps(bz, ax)));
+    _mm512_store_ps(out[2] + i, _mm512_fmsub_ps(ax, by, _mm512_mul_ps(bx, ay)));
+  }
+}
+
+template<glm::length_t L>
+SIMD_TARGET_AVX512 static void normalizeAVX512(vec_soa<L> const& v, vec_soa<L>& out)
+{
+  for (std::size_t i = 0; i < v.padded_size(); i += 16) {
+    __m512 comp[L];
+    __m512 sum = _mm512_setzero_ps();
+    for (glm::length_t c = 0; c < L; ++c) {
+      comp[c] = _mm512_load_ps(v[c] + i);
+      sum = _mm512_fmadd_ps(comp[c], comp[c], sum);
+    }
+    __m512 scale = _mm512_div_ps(_mm512_set1_ps(1.0f), _mm512_sqrt_ps(sum));
+    for (glm::length_t c = 0; c < L; ++c)
+      _mm512_store_ps(out[c] + i, _mm512_mul_ps(comp[c], scale));
+  }
+}
+
+template<glm::length_t L>
+SIMD_TARGET_AVX512 static void mixAVX512(vec_soa<L> const& a, vec_soa<L> const& b, float t, vec_soa<L>& out)
+{
+  __m512 tv = _mm512_set1_ps(t), sv = _mm512_set1_ps(1.0f - t);
+  for (glm::length_t c = 0; c < L; ++c)
+    for (std::size_t i = 0; i < a.padded_size(); i += 16)
+      _mm512_store_ps(out[c] + i, _mm512_fmadd_ps(_mm512_load_ps(b[c] + i), tv, _mm512_mul_ps(_mm512_load_ps(a[c] + i), sv)));
+}
+
+template<glm::length_t L>
+SIMD_TARGET_AVX512 static void clampAVX512(vec_soa<L> const& v, float minVal, float maxVal, vec_soa<L>& out)
+{
+  __m512 lo = _mm512_set1_ps(minVal), hi = _mm512_set1_ps(maxVal);
+  for (glm::length_t c = 0; c < L; ++c)
+    for (std::size_t i = 0; i < v.padded_size(); i += 16)
+      _mm512_store_ps(out[c] + i, _mm512_max_ps(_mm512_min_ps(_mm512_load_ps(v[c] + i), hi), lo));
+}
+
+template<glm::length_t L>
+SIMD_TARGET_AVX512 static void fmaAVX512(vec_soa<L> const& a, vec_soa<L> const& b, vec_soa<L> const& d, vec_soa<L>& out)
+{
+  for (glm::length_t c = 0; c < L; ++c)
+    for (std::size_t i = 0; i < a.padded_size(); i += 16)
+      _mm512_store_ps(out[c] + i, _mm512_fmadd_ps(_mm512_load_ps(a[c] + i), _mm512_load_ps(b[c] + i), _mm512_load_ps(d[c] + i)));
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#endif
+
+// picks the kernel for the active level; every branch is spelled out so each
+// call only instantiates what it uses
+#ifdef SIMD_X86
+#define VEC_SOA_DISPATCH(name, args) \
+  switch (activeSimdLevel()) { \
+  case SIMD_AVX512: name##AVX512 args; break; \
+  case SIMD_AVX2: name##AVX2 args; break; \
+  case SIMD_SSE2: name##SSE args; break; \
+  default: name##Scalar args; break; \
+  }
+#else
+#define VEC_SOA_DISPATCH(name, args) name##Scalar args;
+#endif
+
+void soaDot(vec3_soa const& a, vec3_soa const& b, float_soa& out)
+{
+  assert(a.size() == b.size());
+  out.resize(a.size());
+  VEC_SOA_DISPATCH(dot, (a, b, out))
+}
+
+void soaDot(vec4_soa const& a, vec4_soa const& b, float_soa& out)
+{
+  assert(a.size() == b.size());
+  out.resize(a.size());
+  VEC_SOA_DISPATCH(dot, (a, b, out))
+}
+
+void soaCross(vec3_soa const& a, vec3_soa const& b, vec3_soa& out)
+{
+  assert(a.size() == b.size());
+  out.resize(a.size());
+  VEC_SOA_DISPATCH(cross, (a, b, out))
+}
+
+void soaNormalize(vec3_soa const& v, vec3_soa& out)
+{
+  out.resize(v.size());
+  VEC_SOA_DISPATCH(normalize, (v, out))
+}
+
+void soaNormalize(vec4_soa const& v, vec4_soa& out)
+{
+  out.resize(v.size());
+  VEC_SOA_DISPATCH(normalize, (v, out))
+}
+
+void soaMix(vec3_soa const& a, vec3_soa const& b, float t, vec3_soa& out)
+{
+  assert(a.size() == b.size());
+  out.resize(a.size());
+  VEC_SOA_DISPATCH(mix, (a, b, t, out))
+}
+
+void soaMix(vec4_soa const& a, vec4_soa const& b, float t, vec4_soa& out)
+{
+  assert(a.size() == b.size());
+  out.resize(a.size());
+  VEC_SOA_DISPATCH(mix, (a, b, t, out))
+}
+
+void soaClamp(vec3_soa const& v, float minVal, float maxVal, vec3_soa& out)
+{
+  out.resize(v.size());
+  VEC_SOA_DISPATCH(clamp, (v, minVal, maxVal, out))
+}
+
+void soaClamp(vec4_soa const& v, float minVal, float maxVal, vec4_soa& out)
+{
+  out.resize(v.size());
+  VEC_SOA_DISPATCH(clamp, (v, minVal, maxVal, out))
+}
+
+void soaFma(vec3_soa const& a, vec3_soa const& b, vec3_soa const& c, vec3_soa& out)
+{
+  assert(a.size() == b.size() && a.size() == c.size());
+  out.resize(a.size());
+  VEC_SOA_DISPATCH(fma, (a, b, c, out))
+}
+
+void soaFma(vec4_soa const& a, vec4_soa const& b, vec4_soa const& c, vec4_soa& out)
+{
+  assert(a.size() == b.size() && a.size() == c.size());
+  out.resize(a.size());
+  VEC_SOA_DISPATCH(fma, (a, b, c, out))
+}
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+
+#include <glm/glm.hpp>
+#include <glm/ext/vector_float1.hpp>
+
+#include "batch_transform.h"
+
+// Array of glm vectors stored structure-of-arrays: one float stream per
+// component, so SIMD kernels fill every lane instead of leaving the fourth
+// lane of an AoS vec3 idle. Each stream is 64-byte aligned and padded to a
+// multiple of 16 floats, so kernels run whole AVX-512 vectors with no tail;
+// padding lanes are zero after resize() and unspecified after a kernel.
+template<glm::length_t L>
+class vec_soa
+{
+public:
+  static const std::size_t kAlignment = 64;
+  static const std::size_t kLanes = kAlignment / sizeof(float);
+
+  vec_soa() : m_data(NULL), m_size(0), m_stride(0) {}
+  explicit vec_soa(std::size_t size) : m_data(NULL), m_size(0), m_stride(0) { resize(size); }
+  vec_soa(vec_soa const& other) : m_data(NULL), m_size(0), m_stride(0) { *this = other; }
+  ~vec_soa() { release(); }
+
+  vec_soa& operator=(vec_soa const& other)
+  {
+    if (this != &other) {
+      resize(other.m_size);
+      if (m_stride)
+        std::memcpy(m_data, other.m_data, L * m_stride * sizeof(float));
+    }
+    return *this;
+  }
+
+  // keeps the first min(size, new size) elements and zeroes the rest; if
+  // allocation fails the array is left empty
+  void resize(std::size_t size)
+  {
+    std::size_t stride = (size + kLanes - 1) / kLanes * kLanes;
+    if (stride != m_stride) {
+      float* data = stride ? allocate(L * stride) : NULL;
+      if (data) {
+        std::memset(data, 0, L * stride * sizeof(float));
+        for (glm::length_t c = 0; c < L; ++c)
+          std::memcpy(data + c * stride, m_data + c * m_stride, (size < m_size ? size : m_size) * sizeof(float));
+      }
+      release();
+      m_data = data;
+      m_stride = data ? stride : 0;
+      if (!data)
+        size = 0;
+    } else if (size < m_size) {
+      for (glm::length_t c = 0; c < L; ++c)
+        std::memset(m_data + c * m_stride + size, 0, (m_size - size) * sizeof(float));
+    }
+    m_size = size;
+  }
+
+  std::size_t size() const { return m_size; }
+
+  // elements including padding; every kernel may touch this many
+  std::size_t padded_size() const { return m_stride; }
+
+  float* operator[](glm::length_t component) { return m_data + component * m_stride; }
+  float const* operator[](glm::length_t component) const { return m_data + component * m_stride; }
+
+  glm::vec<L, float> get(std::size_t i) const
+  {
+    glm::vec<L, float> v;
+    for (glm::length_t c = 0; c < L; ++c)
+      v[c] = m_data[c * m_stride + i];
+    return v;
+  }
+
+  void set(std::size_t i, glm::vec<L, float> const& v)
+  {
+    for (glm::length_t c = 0; c < L; ++c)
+      m_data[c * m_stride + i] = v[c];
+  }
+
+private:
+  static float* allocate(std::size_t count)
+  {
+#ifdef _MSC_VER
+    return static_cast<float*>(_aligned_malloc(count * sizeof(float), kAlignment));
+#else
+    void* p = NULL;
+    return posix_memalign(&p, kAlignment, count * sizeof(float)) == 0 ? static_cast<float*>(p) : NULL;
+#endif
+  }
+
+  void release()
+  {
+#ifdef _MSC_VER
+    _aligned_free(m_data);
+#else
+    std::free(m_data);
+#endif
+    m_data = NULL;
+  }
+
+  float* m_data;
+  std::size_t m_size, m_stride;
+};
+
+typedef vec_soa<1> float_soa;
+typedef vec_soa<3> vec3_soa;
+typedef vec_soa<4> vec4_soa;
+
+// views for the batch transforms
+inline ConstVec3Streams streams(vec3_soa const& v) { ConstVec3Streams s = { v[0], v[1], v[2] }; return s; }
+inline Vec3Streams streams(vec3_soa& v) { Vec3Streams s = { v[0], v[1], v[2] }; return s; }
+inline ConstVec4Streams streams(vec4_soa const& v) { ConstVec4Streams s = { v[0], v[1], v[2], v[3] }; return s; }
+inline Vec4Streams streams(vec4_soa& v) { Vec4Streams s = { v[0], v[1], v[2], v[3] }; return s; }
+
+// Element-wise kernels, the SoA counterparts of the glm functions of the same
+// name. 'out' is resized to match the inputs, which must all be the same
+// size, and may be one of them. They dispatch on activeSimdLevel(): 4 lanes
+// with SSE2, 8 with AVX2, 16 with AVX-512.
+void soaDot(vec3_soa const& a, vec3_soa const& b, float_soa& out);
+void soaDot(vec4_soa const& a, vec4_soa const& b, float_soa& out);
+void soaCross(vec3_soa const& a, vec3_soa const& b, vec3_soa& out);
+void soaNormalize(vec3_soa const& v, vec3_soa& out);
+void soaNormalize(vec4_soa const& v, vec4_soa& out);
+void soaMix(vec3_soa const& a, vec3_soa const& b, float t, vec3_soa& out);
+void soaMix(vec4_soa const& a, vec4_soa const& b, float t, vec4_soa& out);
+void soaClamp(vec3_soa const& v, float minVal, float maxVal, vec3_soa& out);
+void soaClamp(vec4_soa const& v, float minVal, float maxVal, vec4_soa& out);
+void soaFma(vec3_soa const& a, vec3_soa const& b, vec3_soa const& c, vec3_soa& out);
+void soaFma(vec4_soa const& a, vec4_soa const& b, vec4_soa const& c, vec4_soa& out);
@@ -0,0 +1,488 @@
+#include "video_source.h"
+#include "cpu_features.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#ifdef SIMD_X86
+#include <immintrin.h>
+#endif
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+using namespace std;
+
+namespace {
+
+#ifdef SIMD_X86
+SIMD_TARGET_SSE2 size_t interleaveSSE2(unsigned char const* cb, unsigned char const* cr, unsigned char* out,
+  size_t count)
+{
+  size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    __m128i u = _mm_loadu_si128((__m128i const*)(cb + i)), v = _mm_loadu_si128((__m128i const*)(cr + i));
+    _mm_storeu_si128((__m128i*)(out + 2 * i), _mm_unpacklo_epi8(u, v));
+    _mm_storeu_si128((__m128i*)(out + 2 * i + 16), _mm_unpackhi_epi8(u, v));
+  }
+  return i;
+}
+#endif
+
+// I420's separate chroma planes to NV12's interleaved one
+void interleaveChroma(unsigned char const* cb, unsigned char const* cr, unsigned char* out, size_t count)
+{
+  size_t i = 0;
+#ifdef SIMD_X86
+  if (activeSimdLevel() >= SIMD_SSE2)
+    i = interleaveSSE2(cb, cr, out, count);
+#endif
+  for (; i < count; ++i) {
+    out[2 * i] = cb[i];
+    out[2 * i + 1] = cr[i];
+  }
+}
+
+// one header line without its '\n'; false at the end of the input
+bool readLine(FILE* file, string& line)
+{
+  line.clear();
+  for (int c; (c = fgetc(file)) != EOF;) {
+    if (c == '\n')
+      return true;
+    // real headers are a few dozen bytes
+    if (line.size() >= 1024)
+      return false;
+    line += char(c);
+  }
+  return false;
+}
+
+GLuint createPlaneTexture(GLint internalFormat, GLenum format, int width, int height)
+{
+  GLuint texture;
+  glGenTextures(1, &texture);
+  glBindTexture(GL_TEXTURE_2D, texture);
+  glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, GL_UNSIGNED_BYTE, NULL);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  return texture;
+}
+
+} // namespace
+
+VideoFormat videoFormatFromPath(char const* path)
+{
+  string name = path;
+  size_t dot = name.find_last_of('.');
+  string extension = dot == string::npos ? string() : name.substr(dot + 1);
+  for (size_t i = 0; i < extension.size(); ++i)
+    extension[i] = char(tolower((unsigned char)extension[i]));
+  if (extension == "y4m")
+    return VIDEO_Y4M;
+  if (extension == "nv12")
+    return VIDEO_NV12;
+  return VIDEO_I420;
+}
+
+VideoSource::VideoSource()
+  : m_file(NULL), m_ownsFile(false), m_width(0), m_height(0), m_lumaSize(0), m_chromaSize(0), m_slotSize(0),
+    m_frameRate(0.0), m_buffer(0), m_current(-1), m_startTime(-1.0), m_stopping(false),
+    m_nextFrame(0), m_stats()
+{
+  for (int i = 0; i < kRingSize; ++i) {
+    Slot empty = Slot();
+    m_slots[i] = empty;
+  }
+}
+
+VideoSource::~VideoSource()
+{
+  close();
+}
+
+bool VideoSource::open(char const* path, VideoOptions const& options)
+{
+  close();
+
+  m_options = options;
+  if (strcmp(path, "-") == 0) {
+#ifdef _WIN32
+    // stdin is a text stream on Windows, which would mangle the frames
+    _setmode(_fileno(stdin), _O_BINARY);
+#endif
+    m_file = stdin;
+    m_ownsFile = false;
+  } else {
+    m_file = fopen(path, "rb");
+    m_ownsFile = true;
+    if (!m_file) {
+      cerr << "Error: can't open video " << path << endl;
+      return false;
+    }
+  }
+
+  m_frameRate = 30.0;
+  if (m_options.format == VIDEO_Y4M) {
+    if (!readHeader(m_width, m_height, m_frameRate)) {
+      cerr << "Error: " << path << " isn't 8-bit 4:2:0 Y4M" << endl;
+      close();
+      return false;
+    }
+  } else {
+    m_width = m_options.width;
+    m_height = m_options.height;
+    if (m_width <= 0 || m_height <= 0) {
+      cerr << "Error: raw video " << path << " needs a frame size" << endl;
+      close();
+      return false;
+    }
+  }
+  if (m_options.frameRate > 0.0)
+    m_frameRate = m_options.frameRate;
+
+  // 4:2:0 rounds odd sizes up
+  int chromaWidth = (m_width + 1) / 2, chromaHeight = (m_height + 1) / 2;
+  m_lumaSize = size_t(m_width) * m_height;
+  m_chromaSize = size_t(chromaWidth) * chromaHeight * 2;
+  m_slotSize = (m_lumaSize + m_chromaSize + 255) & ~size_t(255);
+  if (m_options.format != VIDEO_NV12)
+    m_planes.resize(m_chromaSize);
+
+  // the reader writes into the mapping while the GPU reads other slots of
+  // the same buffer; coherent, so nothing needs flushing
+  unsigned char* slots = NULL;
+  if (GLEW_ARB_buffer_storage) {
+    GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glGenBuffers(1, &m_buffer);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_buffer);
+    glBufferStorage(GL_PIXEL_UNPACK_BUFFER, m_slotSize * kRingSize, NULL, flags);
+    slots = (unsigned char*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, m_slotSize * kRingSize, flags);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    if (!slots) {
+      glDeleteBuffers(1, &m_buffer);
+      m_buffer = 0;
+    }
+  }
+  if (!slots) {
+    cerr << "Warning: no persistently mapped buffers, video frames are uploaded from client memory" << endl;
+    m_staging.resize(m_slotSize * kRingSize);
+    slots = m_staging.data();
+  }
+
+  for (int i = 0; i < kRingSize; ++i) {
+    Slot& slot = m_slots[i];
+    slot.offset = m_slotSize * i;
+    slot.data = slots + slot.offset;
+    slot.luma = createPlaneTexture(GL_R8, GL_RED, m_width, m_height);
+    slot.chroma = createPlaneTexture(GL_RG8, GL_RG, chromaWidth, chromaHeight);
+    slot.fence = NULL;
+    m_free.push_back(i);
+  }
+
+  m_current = -1;
+  m_startTime = -1.0;
+  m_stopping = false;
+  m_nextFrame = 0;
+  m_stats = Stats();
+  m_reader = thread(&VideoSource::readerLoop, this);
+  return true;
+}
+
+// A reader blocked on a pipe only sees the request to stop once its fread
+// returns, so closing waits for the writer's next frame or end of stream.
+void VideoSource::close()
+{
+  if (m_reader.joinable()) {
+    {
+      lock_guard<mutex> guard(m_lock);
+      m_stopping = true;
+    }
+    m_wake.notify_all();
+    m_reader.join();
+  }
+  if (m_file && m_ownsFile)
+    fclose(m_file);
+  m_file = NULL;
+
+  for (int i = 0; i < kRingSize; ++i) {
+    Slot& slot = m_slots[i];
+    if (slot.fence)
+      glDeleteSync(slot.fence);
+    if (slot.luma) {
+      glDeleteTextures(1, &slot.luma);
+      glDeleteTextures(1, &slot.chroma);
+    }
+    Slot empty = Slot();
+    slot = empty;
+  }
+  if (m_buffer) {
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_buffer);
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    glDeleteBuffers(1, &m_buffer);
+    m_buffer = 0;
+  }
+  m_staging.clear();
+  m_free.clear();
+  m_ready.clear();
+  m_current = -1;
+}
+
+bool VideoSource::update(double time)
+{
+  TRACE_ZONE("VideoSource::update");
+  if (!m_file)
+    return false;
+  retireUploads();
+
+  // the newest frame that is due; older ones it overtook go back unseen
+  int pick = -1;
+  unsigned dropped = 0;
+  {
+    lock_guard<mutex> guard(m_lock);
+    while (!m_ready.empty()) {
+      Slot const& slot = m_slots[m_ready.front()];
+      // the first frame starts the clock
+      if (m_startTime < 0.0)
+        m_startTime = time - slot.frame / m_frameRate;
+      if (m_startTime + slot.frame / m_frameRate > time)
+        break;
+      if (pick >= 0) {
+        m_free.push_back(pick);
+        ++dropped;
+      }
+      pick = m_ready.front();
+      m_ready.pop_front();
+    }
+    m_stats.dropped += dropped;
+  }
+  if (dropped)
+    m_wake.notify_one();
+  if (pick < 0)
+    return m_current >= 0;
+
+  double lateness = time - (m_startTime + m_slots[pick].frame / m_frameRate);
+  if (lateness > 1.0 / m_frameRate) {
+    ++m_stats.late;
+    // the input stalled; play on from here rather than dropping everything
+    // that queued up behind the stall
+    if (lateness > double(kRingSize) / m_frameRate)
+      m_startTime += lateness;
+  }
+
+  upload(pick);
+  return true;
+}
+
+bool VideoSource::frameDue(double time)
+{
+  if (!m_file)
+    return false;
+  retireUploads();
+  lock_guard<mutex> guard(m_lock);
+  if (m_ready.empty())
+    return false;
+  return m_startTime < 0.0 || m_startTime + m_slots[m_ready.front()].frame / m_frameRate <= time;
+}
+
+void VideoSource::bind() const
+{
+  if (m_current < 0)
+    return;
+  glActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_2D, m_slots[m_current].chroma);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, m_slots[m_current].luma);
+}
+
+VideoSource::Stats VideoSource::stats() const
+{
+  lock_guard<mutex> guard(m_lock);
+  return m_stats;
+}
+
+void VideoSource::upload(int index)
+{
+  TRACE_ZONE("uploadVideoFrame");
+  Clock::time_point start = Clock::now();
+  Slot& slot = m_slots[index];
+
+  // with the buffer bound the data pointers are offsets into it
+  unsigned char const* source = m_buffer ? reinterpret_cast<unsigned char const*>(slot.offset) : slot.data;
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_buffer);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glBindTexture(GL_TEXTURE_2D, slot.luma);
+  glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_width, m_height, GL_RED, GL_UNSIGNED_BYTE, source);
+  glBindTexture(GL_TEXTURE_2D, slot.chroma);
+  glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, (m_width + 1) / 2, (m_height + 1) / 2, GL_RG, GL_UNSIGNED_BYTE,
+    source + m_lumaSize);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  m_current = index;
+
+  // from client memory the driver has copied the frame before returning;
+  // from the buffer, the slot is the reader's again once the fence passes
+  // (the swap at the end of the frame flushes it)
+  if (m_buffer)
+    slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+  {
+    lock_guard<mutex> guard(m_lock);
+    if (!m_buffer)
+      m_free.push_back(index);
+    ++m_stats.shown;
+    m_stats.uploadMs += chrono::duration<double, milli>(Clock::now() - start).count();
+  }
+  if (!m_buffer)
+    m_wake.notify_one();
+}
+
+void VideoSource::retireUploads()
+{
+  bool retired = false;
+  for (int i = 0; i < kRingSize; ++i) {
+    Slot& slot = m_slots[i];
+    if (!slot.fence)
+      continue;
+    GLenum status = glClientWaitSync(slot.fence, 0, 0);
+    if (status == GL_TIMEOUT_EXPIRED)
+      continue;
+    if (status == GL_WAIT_FAILED)
+      cerr << "Error: waiting on a video upload fence failed" << endl;
+    glDeleteSync(slot.fence);
+    slot.fence = NULL;
+
+    lock_guard<mutex> guard(m_lock);
+    m_free.push_back(i);
+    retired = true;
+  }
+  if (retired)
+    m_wake.notify_one();
+}
+
+void VideoSource::readerLoop()
+{
+  TRACE_THREAD_NAME("video reader");
+
+  for (;;) {
+    int index;
+    {
+      unique_lock<mutex> guard(m_lock);
+      Clock::time_point start = Clock::now();
+      m_wake.wait(guard, [&] { return m_stopping || !m_free.empty(); });
+      m_stats.readerWaitMs += chrono::duration<double, milli>(Clock::now() - start).count();
+      if (m_stopping)
+        break;
+      index = m_free.front();
+      m_free.pop_front();
+    }
+
+    Slot& slot = m_slots[index];
+    bool read = readFrame(slot.data);
+    if (!read && m_options.loop && rewind())
+      read = readFrame(slot.data);
+
+    lock_guard<mutex> guard(m_lock);
+    if (!read) {
+      // the last frame stays up
+      m_free.push_back(index);
+      break;
+    }
+    slot.frame = m_nextFrame++;
+    m_ready.push_back(index);
+    ++m_stats.read;
+  }
+}
+
+// "YUV4MPEG2 W<width> H<height> F<num>:<den> C<chroma> ..." up to a '\n';
+// the frame rate is left alone unless the header has one
+bool VideoSource::readHeader(int& width, int& height, double& frameRate)
+{
+  string line;
+  if (!readLine(m_file, line) || line.compare(0, 10, "YUV4MPEG2 ") != 0)
+    return false;
+
+  width = height = 0;
+  string chroma = "420jpeg";
+  size_t position = 10;
+  while (position < line.size()) {
+    size_t end = line.find(' ', position);
+    if (end == string::npos)
+      end = line.size();
+    string token = line.substr(position, end - position);
+    position = end + 1;
+    if (token.empty())
+      continue;
+    char const* value = token.c_str() + 1;
+    switch (token[0]) {
+    case 'W':
+      width = atoi(value);
+      break;
+    case 'H':
+      height = atoi(value);
+      break;
+    case 'F': {
+      int numerator = atoi(value), denominator = 0;
+      char const* colon = strchr(value, ':');
+      if (colon)
+        denominator = atoi(colon + 1);
+      if (numerator > 0 && denominator > 0)
+        frameRate = double(numerator) / denominator;
+      break;
+    }
+    case 'C':
+      chroma = value;
+      break;
+    default:
+      // interlacing, aspect ratio and extensions don't change the layout
+      break;
+    }
+  }
+
+  // the 4:2:0 variants only differ in where chroma is sited
+  bool planar420 = chroma == "420jpeg" || chroma == "420paldv" || chroma == "420mpeg2" || chroma == "420";
+  return planar420 && width > 0 && height > 0;
+}
+
+// one frame as NV12 into 'out'; false at the end of the input
+bool VideoSource::readFrame(unsigned char* out)
+{
+  TRACE_ZONE("readVideoFrame");
+  if (m_options.format == VIDEO_Y4M) {
+    // "FRAME", maybe with parameters, then the I420 planes
+    string line;
+    if (!readLine(m_file, line) || line.compare(0, 5, "FRAME") != 0)
+      return false;
+  }
+
+  if (m_options.format == VIDEO_NV12)
+    return fread(out, 1, m_lumaSize + m_chromaSize, m_file) == m_lumaSize + m_chromaSize;
+
+  if (fread(out, 1, m_lumaSize, m_file) != m_lumaSize || fread(m_planes.data(), 1, m_chromaSize, m_file) != m_chromaSize)
+    return false;
+  size_t count = m_chromaSize / 2;
+  interleaveChroma(m_planes.data(), m_planes.data() + count, out + m_lumaSize, count);
+  return true;
+}
+
+// back to the first frame; pipes can't. Runs on the reader thread, so the
+// header is only checked, not taken in again.
+bool VideoSource::rewind()
+{
+  if (!m_ownsFile || fseek(m_file, 0, SEEK_SET) != 0)
+    return false;
+  if (m_options.format != VIDEO_Y4M)
+    return true;
+  int width, height;
+  double frameRate = 0.0;
+  return readHeader(width, height, frameRate) && width == m_width && height == m_height;
+}
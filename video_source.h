@@ -0,0 +1,119 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// layouts of 8-bit YUV 4:2:0 input; Y4M files carry their size and rate,
+// raw sequences need them from VideoOptions
+enum VideoFormat {
+  VIDEO_Y4M,
+  VIDEO_NV12,  // Y plane, then Cb and Cr interleaved at half resolution
+  VIDEO_I420   // Y plane, then a Cb and a Cr plane at half resolution
+};
+
+struct VideoOptions {
+  VideoFormat format;
+  int width, height;  // raw input only
+  double frameRate;   // frames per second; overrides a Y4M header when > 0
+  bool loop;          // rewind files at the end; pipes just stop
+
+  VideoOptions(): format(VIDEO_Y4M), width(0), height(0), frameRate(0.0), loop(true) {}
+};
+
+// .y4m and .nv12 by extension, anything else I420
+VideoFormat videoFormatFromPath(char const* path);
+
+// Plays a YUV 4:2:0 sequence from a file or a pipe ("-" is stdin) at its own
+// frame rate. A reader thread parses frames straight into a ring of slots in
+// one pixel unpack buffer, persistently mapped where GL_ARB_buffer_storage is
+// available (otherwise plain memory the driver copies from). update() copies
+// the frame that is due from its slot into the slot's textures, R8 luma and
+// RG8 interleaved chroma as FEATURE_YUV_INPUT samples them, and a fence hands
+// the slot back to the reader once the GPU has read it. If rendering falls
+// behind, frames that were overtaken are dropped unseen; if the input falls
+// behind, frames are shown late. Both are counted.
+class VideoSource
+{
+public:
+  static const int kRingSize = 4;
+
+  struct Stats {
+    unsigned read, shown;
+    unsigned dropped;     // a later frame was due before they were shown
+    unsigned late;        // shown more than a frame interval after they were due
+    double readerWaitMs;  // reader blocked on a full ring, i.e. rendering was slower
+    double uploadMs;
+  };
+
+  VideoSource();
+  ~VideoSource();
+
+  // with the GL context current
+  bool open(char const* path, VideoOptions const& options);
+  void close();
+  bool isOpen() const { return m_file != NULL; }
+
+  // Render thread, once per frame: moves to the frame due at 'time'
+  // (seconds) if it has arrived. False until the first frame is up.
+  bool update(double time);
+
+  // Render thread, never blocks: gives back slots whose uploads have
+  // finished, so the reader can go on, and says whether update(time) would
+  // move to another frame.
+  bool frameDue(double time);
+
+  // luma on texture unit 0, chroma on unit 1 (uLuma and uChroma)
+  void bind() const;
+
+  int width() const { return m_width; }
+  int height() const { return m_height; }
+  double frameRate() const { return m_frameRate; }
+  Stats stats() const;
+
+private:
+  typedef std::chrono::steady_clock Clock;
+
+  struct Slot {
+    unsigned char* data;     // mapped buffer or m_staging
+    std::size_t offset;      // of 'data' in the buffer
+    GLuint luma, chroma;
+    GLsync fence;            // upload from this slot not yet finished
+    unsigned long long frame;
+  };
+
+  bool readHeader(int& width, int& height, double& frameRate);
+  bool readFrame(unsigned char* out);
+  bool rewind();
+  void readerLoop();
+  void upload(int slot);
+  void retireUploads();
+
+  FILE* m_file;
+  bool m_ownsFile;  // false for stdin
+  VideoOptions m_options;
+  int m_width, m_height;
+  std::size_t m_lumaSize, m_chromaSize, m_slotSize;
+  double m_frameRate;
+
+  GLuint m_buffer;  // 0 when slots live in m_staging
+  std::vector<unsigned char> m_staging;
+  std::vector<unsigned char> m_planes;  // I420 chroma on its way to interleaving
+  Slot m_slots[kRingSize];
+  int m_current;
+  double m_startTime;  // when frame 0 is (or would have been) due
+
+  std::thread m_reader;
+  mutable std::mutex m_lock;
+  std::condition_variable m_wake;
+  bool m_stopping;
+  unsigned long long m_nextFrame;
+  std::deque<int> m_free, m_ready;
+  Stats m_stats;
+};